@@ -45,6 +45,7 @@ public:
     double         reg1;         // Final reg
     std::string    layout;       // layout (Topology)
     unsigned       annSteps;     // Deterministic Annealing steps
+    int            numThreads;   // Number of threads
 public:
     // Define parameters
     void defineParams()
@@ -90,6 +91,7 @@ public:
         addParamsLine(" [--eps <epsilon=1e-7>]       : Stopping criteria");
         addParamsLine(" [--iter <N=200>]             : Number of iterations");
         addParamsLine(" [--norm]                     : Normalize input data");
+        addParamsLine(" [--thr <N=1>]                : Number of threads");
         addExampleLine("xmipp_image_vectorize -i images.stk -o vectors.xmd");
         addExampleLine("xmipp_classify_kerdensom -i vectors.xmd -o kerdensom.xmd");
     }
@@ -109,6 +111,7 @@ public:
         eps = getDoubleParam("--eps");
         iter = getIntParam("--iter");
         norm = checkParam("--norm");
+        numThreads = getIntParam("--thr");
 
         // Some checks
         if (iter < 1)
@@ -126,6 +129,8 @@ public:
             REPORT_ERROR(ERR_ARG_INCORRECT,"xdim must be >= 1");
         if (ydim < 1)
             REPORT_ERROR(ERR_ARG_INCORRECT,"ydim must be >= 1");
+        if (numThreads < 1)
+            REPORT_ERROR(ERR_ARG_INCORRECT,"the number of threads must be >= 1");
     }
 
     void show()
@@ -147,6 +152,7 @@ public:
             std::cout << "Normalize input data" << std::endl;
         else
             std::cout << "Do not normalize input data " << std::endl;
+        std::cout << "Number of threads = " << numThreads << std::endl;
     }
 
     // Run
@@ -175,6 +181,7 @@ public:
         TextualListener myListener;       // Define the listener class
         myListener.setVerbosity() = verbose;       // Set verbosity level
         thisSOM->setListener(&myListener);         // Set Listener
+        thisSOM->setThreads(numThreads);           // Threads of the training loops
         thisSOM->train(*myMap, ts, fnClasses); // Train algorithm
 
         // Test algorithm
@@ -0,0 +1,157 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <chrono>
+#include <core/xmipp_program.h>
+#include <dimred/dimred_tools.h>
+#include <dimred/nearestNeighbours.h>
+
+/* PROGRAM ----------------------------------------------------------------- */
+class ProgDimRedKNNBenchmark: public XmippProgram
+{
+protected:
+    int D, K, Nmin, Nmax, maxAllPairs, maxBrute, threads;
+    double approximation;
+
+    void defineParams()
+    {
+        addUsageLine("Measure the time of the k-nearest neighbour search used by the dimensionality reduction methods.");
+        addUsageLine("Gaussian random data of increasing size (x10 each step) is searched with the original");
+        addUsageLine("all-pairs search, the KD-tree, the blocked brute force and the approximate KD-tree.");
+        addUsageLine("The all-pairs search and the brute force are O(N^2), so they are only run up to");
+        addUsageLine("--max_all_pairs and --max_brute observations respectively.");
+        addUsageLine("The exact engines are checked against it, and the recall of the approximate search");
+        addUsageLine("is measured against the exact KD-tree.");
+        addParamsLine("  [--dim <D=3>]               : Dimensionality of the observations");
+        addParamsLine("  [-k <K=12>]                 : Number of neighbours");
+        addParamsLine("  [--Nmin <N=1000>]           : Smallest number of observations");
+        addParamsLine("  [--Nmax <N=1000000>]        : Largest number of observations");
+        addParamsLine("  [--max_all_pairs <N=20000>] : Largest number of observations for the all-pairs search");
+        addParamsLine("  [--max_brute <N=100000>]    : Largest number of observations for the brute force");
+        addParamsLine("  [--thr <T=-1>]              : Number of threads (-1 for all cores)");
+        addParamsLine("  [--approximation <e=0.5>]   : Approximation factor of the approximate search");
+        addExampleLine("xmipp_dimred_knn_benchmark --dim 3 --Nmax 1000000");
+        addExampleLine("xmipp_dimred_knn_benchmark --dim 100 --Nmax 100000 --max_all_pairs 10000");
+        addKeywords("dimred knn nearest neighbours kdtree benchmark");
+    }
+
+    void readParams()
+    {
+        D = getIntParam("--dim");
+        K = getIntParam("-k");
+        Nmin = std::max(2, getIntParam("--Nmin"));
+        Nmax = getIntParam("--Nmax");
+        maxAllPairs = getIntParam("--max_all_pairs");
+        maxBrute = getIntParam("--max_brute");
+        threads = getIntParam("--thr");
+        approximation = getDoubleParam("--approximation");
+    }
+
+    void show()
+    {
+        if (verbose==0)
+            return;
+        std::cout
+        << "Dimension:       " << D             << std::endl
+        << "Neighbours:      " << K             << std::endl
+        << "Observations:    " << Nmin << " to " << Nmax << std::endl
+        << "Max all-pairs:   " << maxAllPairs   << std::endl
+        << "Max brute force: " << maxBrute      << std::endl
+        << "Threads:         " << threads       << std::endl
+        << "Approximation:   " << approximation << std::endl;
+    }
+
+    // Time in seconds of a search
+    double timeSearch(NearestNeighbourSearch &knn, const Matrix2D<double> &X,
+                      Matrix2D<int> &idx, Matrix2D<double> &distance)
+    {
+        auto t0=std::chrono::steady_clock::now();
+        knn.search(X,K,idx,distance);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    }
+
+    // Fraction of the exact neighbours found by the approximate search
+    double recall(const Matrix2D<int> &exact, const Matrix2D<int> &approx)
+    {
+        size_t found=0;
+        for (size_t i=0; i<MAT_YSIZE(exact); ++i)
+            for (size_t k=0; k<MAT_XSIZE(exact); ++k)
+                for (size_t kp=0; kp<MAT_XSIZE(approx); ++kp)
+                    if (MAT_ELEM(approx,i,kp)==MAT_ELEM(exact,i,k))
+                    {
+                        ++found;
+                        break;
+                    }
+        return (double)found/(MAT_YSIZE(exact)*MAT_XSIZE(exact));
+    }
+
+    void run()
+    {
+        show();
+        std::cout << "       N  all-pairs     kdtree      brute     approx  recall  check" << std::endl;
+        init_random_generator(1);
+        for (int N=Nmin; N<=Nmax; N*=10)
+        {
+            Matrix2D<double> X;
+            X.resizeNoCopy(N,D);
+            FOR_ALL_ELEMENTS_IN_MATRIX2D(X)
+            MAT_ELEM(X,i,j)=rnd_gaus(0,1);
+
+            Matrix2D<int> idxTree, idxBrute, idxApprox, idxAllPairs;
+            Matrix2D<double> distance, distanceAllPairs;
+            NearestNeighbourSearch knn;
+            if (threads>0)
+                knn.threads=threads;
+
+            knn.method=NearestNeighbourSearch::KDTREE;
+            double tTree=timeSearch(knn,X,idxTree,distance);
+            knn.approximation=approximation;
+            double tApprox=timeSearch(knn,X,idxApprox,distance);
+            knn.approximation=0;
+
+            String allPairs="         -", brute="         -";
+            bool same=true;
+            if (N<=maxBrute)
+            {
+                knn.method=NearestNeighbourSearch::BRUTE_FORCE;
+                brute=formatString("%10.3f",timeSearch(knn,X,idxBrute,distance));
+                same=idxTree.equal(idxBrute);
+            }
+            if (N<=maxAllPairs)
+            {
+                auto t0=std::chrono::steady_clock::now();
+                kNearestNeighboursAllPairs(X,K,idxAllPairs,distanceAllPairs,NULL,false);
+                double tAllPairs=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+                allPairs=formatString("%10.3f",tAllPairs);
+                same=same && idxTree.equal(idxAllPairs);
+            }
+            std::cout << formatString("%8d %s %10.3f %s %10.3f %7.4f  %s",
+                                      N,allPairs.c_str(),tTree,brute.c_str(),tApprox,
+                                      recall(idxTree,idxApprox),same ? "ok" : "DIFF") << std::endl;
+        }
+    }
+};
+
+RUN_XMIPP_PROGRAM(ProgDimRedKNNBenchmark)
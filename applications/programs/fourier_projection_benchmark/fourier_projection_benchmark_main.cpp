@@ -0,0 +1,143 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <chrono>
+#include <core/xmipp_program.h>
+#include <core/xmipp_image.h>
+#include <data/fourier_projection.h>
+
+/* PROGRAM ----------------------------------------------------------------- */
+class ProgFourierProjectionBenchmark: public XmippProgram
+{
+protected:
+    FileName fnVol;
+    double paddFactor, maxFreq;
+    int BSplineDeg, Nprojections, batchSize;
+
+    void defineParams()
+    {
+        addUsageLine("Measure the speed of the Fourier projector in double and single precision.");
+        addUsageLine("Projections are taken along a spiral of directions covering the sphere, and the");
+        addUsageLine("difference between the projections of both precisions is reported.");
+        addParamsLine("   -i <volume>              : Volume to project");
+        addParamsLine("  [--padding <p=2>]         : Padding factor");
+        addParamsLine("  [--maxfreq <w=0.5>]       : Maximum digital frequency of the projections");
+        addParamsLine("  [--interp <degree=3>]     : Interpolation: 0 nearest, 1 linear, 3 cubic B-spline");
+        addParamsLine("  [-n <N=500>]              : Number of projections");
+        addParamsLine("  [--batch <b=32>]          : Projections computed per call");
+        addExampleLine("xmipp_fourier_projection_benchmark -i volume.vol -n 1000");
+        addKeywords("fourier projection benchmark");
+    }
+
+    void readParams()
+    {
+        fnVol = getParam("-i");
+        paddFactor = getDoubleParam("--padding");
+        maxFreq = getDoubleParam("--maxfreq");
+        BSplineDeg = getIntParam("--interp");
+        Nprojections = getIntParam("-n");
+        batchSize = std::max(1, getIntParam("--batch"));
+    }
+
+    void show()
+    {
+        if (verbose==0)
+            return;
+        std::cout
+        << "Volume:        " << fnVol        << std::endl
+        << "Padding:       " << paddFactor   << std::endl
+        << "Max. freq.:    " << maxFreq      << std::endl
+        << "Interpolation: " << BSplineDeg   << std::endl
+        << "Projections:   " << Nprojections << std::endl
+        << "Batch size:    " << batchSize    << std::endl;
+    }
+
+    // Project all directions, returns the projections per second
+    double benchmark(bool singlePrecision, const std::vector< Matrix2D<double> > &Es,
+                     std::vector< MultidimArray<double> > &projections)
+    {
+        Image<double> V;
+        V.read(fnVol);
+        V().setXmippOrigin();
+
+        auto t0=std::chrono::steady_clock::now();
+        FourierProjector projector(V(),paddFactor,maxFreq,BSplineDeg,singlePrecision);
+        auto t1=std::chrono::steady_clock::now();
+
+        projections.clear();
+        std::vector< Matrix2D<double> > batchEs;
+        std::vector< MultidimArray<double> > batchProjections;
+        for (size_t n0=0; n0<Es.size(); n0+=batchSize)
+        {
+            size_t n1=std::min(Es.size(),n0+batchSize);
+            batchEs.assign(Es.begin()+n0,Es.begin()+n1);
+            projector.projectBatch(batchEs,batchProjections);
+            projections.insert(projections.end(),batchProjections.begin(),batchProjections.end());
+        }
+        auto t2=std::chrono::steady_clock::now();
+
+        double tPrepare=std::chrono::duration<double>(t1-t0).count();
+        double tProject=std::chrono::duration<double>(t2-t1).count();
+        double speed=Es.size()/tProject;
+        std::cout << (singlePrecision ? "float:  " : "double: ")
+                  << "preparation " << tPrepare << "s, "
+                  << speed << " projections/s" << std::endl;
+        return speed;
+    }
+
+    void run()
+    {
+        show();
+
+        // Directions along a spiral on the sphere
+        std::vector< Matrix2D<double> > Es(Nprojections);
+        for (int n=0; n<Nprojections; ++n)
+        {
+            double tilt=RAD2DEG(acos(1-2*(n+0.5)/Nprojections));
+            double rot=fmod(n*137.508,360.0);
+            double psi=fmod(n*29.0,360.0);
+            Euler_angles2matrix(rot,tilt,psi,Es[n]);
+        }
+
+        std::vector< MultidimArray<double> > projectionsDouble, projectionsFloat;
+        double speedDouble=benchmark(false,Es,projectionsDouble);
+        double speedFloat=benchmark(true,Es,projectionsFloat);
+
+        double maxDiff=0, maxStddev=0;
+        for (size_t k=0; k<projectionsDouble.size(); ++k)
+        {
+            const MultidimArray<double> &Pd=projectionsDouble[k];
+            const MultidimArray<double> &Pf=projectionsFloat[k];
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Pd)
+            maxDiff=std::max(maxDiff,fabs(DIRECT_MULTIDIM_ELEM(Pd,n)-DIRECT_MULTIDIM_ELEM(Pf,n)));
+            maxStddev=std::max(maxStddev,Pd.computeStddev());
+        }
+        std::cout << "Speed-up of float: " << speedFloat/speedDouble << std::endl
+                  << "Max. difference:   " << maxDiff
+                  << " (projection stddev " << maxStddev << ")" << std::endl;
+    }
+};
+
+RUN_XMIPP_PROGRAM(ProgFourierProjectionBenchmark)
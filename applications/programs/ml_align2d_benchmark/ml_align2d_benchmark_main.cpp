@@ -0,0 +1,159 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <core/xmipp_program.h>
+#include <core/xmipp_image.h>
+#include <core/metadata.h>
+#include <data/benchmark.h>
+#include <reconstruction/ml_align2d.h>
+
+/* PROGRAM ----------------------------------------------------------------- */
+class ProgML2DBenchmark: public XmippProgram
+{
+protected:
+    FileName fnRoot;
+    int Xdim, Nimages, Nref, maxThreads, repeats;
+    bool fast;
+
+    void defineParams()
+    {
+        addUsageLine("Measure the throughput (images/s) of the expectation step of xmipp_ml_align2d.");
+        addUsageLine("A synthetic dataset of noisy, rotated and shifted copies of a few Gaussian blobs");
+        addUsageLine("is aligned with 1, 2, 4, ... threads. Small boxes make the cost of waking up the");
+        addUsageLine("threads for every image visible. Both engines are measured: \"barrier\" wakes the");
+        addUsageLine("workers with two barriers per task while the master waits, and \"pool\" keeps the");
+        addUsageLine("workers waiting on a condition variable and the master works as one of them.");
+        addParamsLine("  [--oroot <root=\"ml_align2d_benchmark\">] : Rootname for the synthetic dataset");
+        addParamsLine("  [--size <Xdim=32>]         : Size of the images");
+        addParamsLine("  [-n <N=500>]               : Number of images");
+        addParamsLine("  [--nref <K=4>]             : Number of references");
+        addParamsLine("  [--max_threads <T=16>]     : Maximum number of threads");
+        addParamsLine("  [--repeat <R=3>]           : Number of timed expectation steps");
+        addParamsLine("  [--fast]                   : Use the fast mode of ml_align2d");
+        addExampleLine("xmipp_ml_align2d_benchmark --size 32 -n 1000 --max_threads 8");
+        addKeywords("ml2d maximum likelihood benchmark threads");
+    }
+
+    void readParams()
+    {
+        fnRoot = getParam("--oroot");
+        Xdim = getIntParam("--size");
+        Nimages = getIntParam("-n");
+        Nref = getIntParam("--nref");
+        maxThreads = std::max(1, getIntParam("--max_threads"));
+        repeats = std::max(1, getIntParam("--repeat"));
+        fast = checkParam("--fast");
+    }
+
+    void show()
+    {
+        if (verbose==0)
+            return;
+        std::cout
+        << "Root:        " << fnRoot     << std::endl
+        << "Size:        " << Xdim       << std::endl
+        << "Images:      " << Nimages    << std::endl
+        << "References:  " << Nref       << std::endl
+        << "Max threads: " << maxThreads << std::endl
+        << "Repeats:     " << repeats    << std::endl
+        << "Fast mode:   " << fast       << std::endl;
+    }
+
+    // Noisy copies of Nref different blobs at random rotations and shifts
+    void createDataset(const FileName &fnMd)
+    {
+        std::vector< MultidimArray<double> > classes(Nref);
+        for (int k=0; k<Nref; ++k)
+        {
+            MultidimArray<double> &I=classes[k];
+            I.initZeros(Xdim,Xdim);
+            I.setXmippOrigin();
+            double sx2=2*std::pow(0.08*Xdim*(1+k%3),2.0), sy2=2*std::pow(0.05*Xdim*(1+k%2),2.0);
+            double x0=0.1*Xdim*(k%2), y0=-0.1*Xdim*(k%3-1);
+            FOR_ALL_ELEMENTS_IN_ARRAY2D(I)
+            A2D_ELEM(I,i,j)=exp(-(j-x0)*(j-x0)/sx2-(i-y0)*(i-y0)/sy2);
+        }
+
+        init_random_generator(1);
+        FileName fnStack=fnRoot+"_images.stk", fnImg;
+        MetaData MD;
+        Image<double> I;
+        for (int n=0; n<Nimages; ++n)
+        {
+            double psi=rnd_unif(0,360);
+            double shiftX=rnd_gaus(0,1.5), shiftY=rnd_gaus(0,1.5);
+            Matrix2D<double> A;
+            rotation2DMatrix(psi,A,true);
+            MAT_ELEM(A,0,2)=shiftX;
+            MAT_ELEM(A,1,2)=shiftY;
+            applyGeometry(LINEAR,I(),classes[n%Nref],A,IS_NOT_INV,WRAP);
+            I().addNoise(0,0.5,"gaussian");
+            I.write(fnStack,n+1,true,WRITE_REPLACE);
+            fnImg.compose(n+1,fnStack);
+            MD.setValue(MDL_IMAGE,fnImg,MD.addObject());
+        }
+        MD.write(fnMd);
+    }
+
+    // Images per second of the expectation step
+    double expectationSpeed(const FileName &fnMd, int threads, bool barrierWakeup)
+    {
+        ProgML2D program;
+        program.read(formatString("-i %s --nref %d --oroot %s_ml2d_ --thr %d --mirror %s -v 0",
+                                  fnMd.c_str(), Nref, fnRoot.c_str(), threads, fast ? "--fast" : ""));
+        program.barrierWakeup=barrierWakeup;
+        program.produceSideInfo();
+        program.produceSideInfo2();
+        program.createThreads();
+        program.iter=program.istart;
+
+        // The first step reads the images and plans the transforms
+        program.expectation();
+        double t=wallTime([&]()
+                          {
+                              for (int r=0; r<repeats; ++r)
+                                  program.expectation();
+                          });
+        program.destroyThreads();
+        return program.nr_images_local*repeats/t;
+    }
+
+    void run()
+    {
+        show();
+        FileName fnMd=fnRoot+"_images.xmd";
+        createDataset(fnMd);
+
+        reportThreadScalingHeader("images/s");
+        for (bool barrierWakeup : {true, false})
+            reportThreadScaling(barrierWakeup ? "barrier" : "pool", maxThreads,
+                                [&](int threads)
+                                {
+                                    return expectationSpeed(fnMd,threads,barrierWakeup);
+                                });
+    }
+};
+
+RUN_XMIPP_PROGRAM(ProgML2DBenchmark)
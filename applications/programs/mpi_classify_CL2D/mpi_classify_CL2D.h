@@ -32,6 +32,7 @@
 #include <core/xmipp_fftw.h>
 #include <core/histogram.h>
 #include <data/numerical_tools.h>
+#include <data/particle_cache.h>
 #include <core/xmipp_program.h>
 #include <vector>
 
@@ -131,11 +132,19 @@ public:
 
     /** Compute the fit of the input image with this node.
         The input image is rotationally and traslationally aligned
-        (2 iterations), to make it fit with the node. */
-    void fitBasic(MultidimArray<double> &I, CL2DAssignment &result,  bool reverse=false);
-
-    /** Compute the fit of the input image with this node (check mirrors). */
-    void fit(MultidimArray<double> &I, CL2DAssignment &result);
+        (2 iterations), to make it fit with the node.
+        If given, polarFourierI0 is the polar Fourier transform of the
+        (reversed) input image, so that it is not recomputed. */
+    void fitBasic(MultidimArray<double> &I, CL2DAssignment &result,  bool reverse=false,
+                  const Polar<std::complex <double> > *polarFourierI0=NULL);
+
+    /** Compute the fit of the input image with this node (check mirrors).
+        The polar Fourier transforms of the image and its mirror may be given
+        if they are shared by several nodes.
+        Different nodes can fit images in different threads at the same time. */
+    void fit(MultidimArray<double> &I, CL2DAssignment &result,
+             const Polar<std::complex <double> > *polarFourierI=NULL,
+             const Polar<std::complex <double> > *polarFourierMirror=NULL);
 
     /// Look for K-nearest neighbours
     void lookForNeighbours(const std::vector<CL2DClass *> listP, int K);
@@ -160,8 +169,23 @@ public:
 
     /// List of nodes
     std::vector<CL2DClass *> P;
-    
+
+    /// Plans for the polar Fourier transform of the images
+    Polar_fftw_plans *plans;
+
+    /// Polar Fourier transform of the image being looked for and its mirror
+    Polar<std::complex <double> > polarFourierI, polarFourierMirror;
+
+    /// Aligned image for each node tried in lookNode
+    std::vector< MultidimArray<double> > candidateImg;
+
+    /// Time spent in the communications of shareAssignments (seconds)
+    double communicationTime;
+
 public:
+    /** Empty constructor */
+    CL2D();
+
     /** Destructor */
     ~CL2D();
 
@@ -172,8 +196,11 @@ public:
     void initialize(MetaData &_SF,
     		        std::vector< MultidimArray<double> > &_codes0);
     
-    /// Share assignments
-    void shareAssignments(bool shareAssignment, bool shareUpdates, bool shareNonCorr);
+    /** Share assignments.
+        The class updates, assignments and corrSum (if given) are summed
+        with a single collective, while the image lists are exchanged. */
+    void shareAssignments(bool shareAssignment, bool shareUpdates, bool shareNonCorr,
+                          double *corrSum=NULL);
 
     /// Share split assignment
     void shareSplitAssignments(Matrix1D<int> &assignment, CL2DClass *node1, CL2DClass *node2) const;
@@ -183,7 +210,7 @@ public:
 
     /** Look for a node suitable for this image.
         The image is rotationally and translationally aligned with
-        the best node. */
+        the best node. The nodes are tried in parallel with prm->Nthreads. */
     void lookNode(MultidimArray<double> &I, int oldnode,
     			  int &newnode, CL2DAssignment &bestAssignment);
     
@@ -269,6 +296,15 @@ public:
     /// Don't align images
     bool alignImages;
 
+    /// Number of threads to look for the node of an image
+    int Nthreads;
+
+    /// Keep the preprocessed images in memory between iterations
+    bool cacheImages;
+
+    /// Memory for the image cache (in MB), beyond it the cache is memory mapped
+    double cacheMB;
+
     /// MPI constructor
     ProgClassifyCL2D(int argc, char** argv);
 
@@ -311,6 +347,9 @@ public:
     // Image dimensions
     size_t Ydim, Xdim;
 
+    // Preprocessed images of this node
+    ParticleCache particles;
+
     /// Mask for the background
 	MultidimArray<int> mask;
 
@@ -23,6 +23,10 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
 #include "mpi_classify_CL2D.h"
 #include <data/filters.h>
 #include <data/mask.h>
@@ -209,7 +213,7 @@ void CL2DClass::transferUpdate(bool centerReference)
 //#define DEBUG
 //#define DEBUG_MORE
 void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
-                         bool reverse)
+                         bool reverse, const Polar<std::complex<double> > *polarFourierI0)
 {
     if (reverse)
     {
@@ -273,10 +277,15 @@ void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
 			// Rotate then shift
 			if (bestRotRS > ROTATE_THRESHOLD)
 			{
-				normalizedPolarFourierTransform(IauxRS, polarFourierI, true,
-												XSIZE(P) / 5, XSIZE(P) / 2-2, plans, 1);
-
-				bestRotRS = best_rotation(polarFourierP, polarFourierI, rotAux);
+				// In the first round IauxRS is still the input image
+				if (i == 0 && polarFourierI0 != NULL)
+					bestRotRS = best_rotation(polarFourierP, *polarFourierI0, rotAux);
+				else
+				{
+					normalizedPolarFourierTransform(IauxRS, polarFourierI, true,
+													XSIZE(P) / 5, XSIZE(P) / 2-2, plans, 1);
+					bestRotRS = best_rotation(polarFourierP, polarFourierI, rotAux);
+				}
 				rotation2DMatrix(bestRotRS, R);
 				M3x3_BY_M3x3(ARS,R,ARS);
 				applyGeometry(LINEAR, IauxRS, I, ARS, IS_NOT_INV, WRAP);
@@ -311,17 +320,19 @@ void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
 
     // Compute the correntropy
     double corrRS=0.0, corrSR=0.0;
-    MultidimArray<int> &imask = prm->mask;
+    // The threshold mask is local, several nodes may be fitting at the same time
+    MultidimArray<int> thresholdMask;
     if (prm->useThresholdMask)
     {
-    	imask.initZeros(IauxRS);
+    	thresholdMask.initZeros(IauxRS);
     	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(IauxRS)
     	if (DIRECT_MULTIDIM_ELEM(IauxRS,n)>prm->threshold)
-    		DIRECT_MULTIDIM_ELEM(imask,n)=1;
+    		DIRECT_MULTIDIM_ELEM(thresholdMask,n)=1;
     	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(IauxSR)
     	if (DIRECT_MULTIDIM_ELEM(IauxSR,n)>prm->threshold)
-    		DIRECT_MULTIDIM_ELEM(imask,n)=1;
+    		DIRECT_MULTIDIM_ELEM(thresholdMask,n)=1;
     }
+    const MultidimArray<int> &imask = prm->useThresholdMask ? thresholdMask : prm->mask;
     if (prm->useCorrelation)
     {
         corrRS = corrSR = 0;
@@ -412,7 +423,9 @@ void CL2DClass::fitBasic(MultidimArray<double> &I, CL2DAssignment &result,
 #undef DEBUG
 #undef DEBUG_MORE
 
-void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result)
+void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result,
+                    const Polar<std::complex<double> > *polarFourierI,
+                    const Polar<std::complex<double> > *polarFourierMirror)
 {
     if (currentListImg.size() == 0)
         return;
@@ -420,7 +433,7 @@ void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result)
     // Try this image
     MultidimArray<double> Idirect = I;
     CL2DAssignment resultDirect;
-    fitBasic(Idirect, resultDirect);
+    fitBasic(Idirect, resultDirect, false, polarFourierI);
 
     // Try its mirror
 	CL2DAssignment resultMirror;
@@ -428,7 +441,7 @@ void CL2DClass::fit(MultidimArray<double> &I, CL2DAssignment &result)
     if (prm->mirrorImages)
     {
     	Imirror=I;
-		fitBasic(Imirror, resultMirror, true);
+		fitBasic(Imirror, resultMirror, true, polarFourierMirror);
     }
     else
     	resultMirror.corr=-1e38;
@@ -518,19 +531,124 @@ void CL2DClass::lookForNeighbours(const std::vector<CL2DClass *> listP, int K)
 
 /* Share assignments and classes -------------------------------------- */
 void CL2D::shareAssignments(bool shareAssignment, bool shareUpdates,
-                            bool shareNonCorr)
+                            bool shareNonCorr, double *corrSum)
 {
+    // All the numbers that are summed among nodes go into a single buffer:
+    // class updates, image assignments and the correlation sum.
+    // The assignments are summed as ref+1, because each image is only
+    // assigned by one node and the rest of nodes keep it to -1.
+    int Q = P.size();
+    size_t updateSize = (Q > 0) ? MULTIDIM_SIZE(P[0]->Pupdate) : 0;
+    std::vector<int> nodeRef;
     if (shareAssignment)
     {
-        // Put assignment in common
-        std::vector<int> nodeRef;
         if (SF->containsLabel(MDL_REF))
             SF->getColumnValues(MDL_REF, nodeRef);
         else
             nodeRef.resize(SF->size(), -1);
+    }
+    size_t updatesOffset = 0;
+    size_t refOffset = updatesOffset + (shareUpdates ? Q * updateSize : 0);
+    size_t corrOffset = refOffset + nodeRef.size();
+    std::vector<double> sumBuffer(corrOffset + (corrSum != NULL ? 1 : 0));
+    if (shareUpdates)
+        for (int q = 0; q < Q; q++)
+            memcpy(&sumBuffer[updatesOffset + q * updateSize], MULTIDIM_ARRAY(P[q]->Pupdate),
+                   updateSize * sizeof(double));
+    for (size_t n = 0; n < nodeRef.size(); n++)
+        sumBuffer[refOffset + n] = nodeRef[n] + 1;
+    if (corrSum != NULL)
+        sumBuffer[corrOffset] = *corrSum;
+
+    // Start the reduction and exchange the image lists meanwhile
+    auto t0 = std::chrono::steady_clock::now();
+    const size_t maxBlock = 1 << 28;
+    std::vector<MPI_Request> requests;
+    for (size_t first = 0; first < sumBuffer.size(); first += maxBlock)
+    {
+        MPI_Request request;
+        MPI_Iallreduce(MPI_IN_PLACE, &sumBuffer[first], (int)XMIPP_MIN(maxBlock, sumBuffer.size() - first),
+                       MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &request);
+        requests.push_back(request);
+    }
 
-        MPI_Allreduce(MPI_IN_PLACE, &(nodeRef[0]), nodeRef.size(), MPI_INT,
-                      MPI_MAX, MPI_COMM_WORLD);
+    if (shareUpdates)
+    {
+        // Pack the lists of this node: number of elements per class and then the elements
+        std::vector<char> myLists(2 * Q * sizeof(int));
+        int *counts = (int *)&myLists[0];
+        for (int q = 0; q < Q; q++)
+        {
+            counts[2 * q] = P[q]->nextListImg.size();
+            counts[2 * q + 1] = shareNonCorr ? P[q]->nextNonClassCorr.size() : 0;
+        }
+        for (int q = 0; q < Q; q++)
+        {
+            const char *ptrList = (const char *)P[q]->nextListImg.data();
+            myLists.insert(myLists.end(), ptrList, ptrList + P[q]->nextListImg.size() * sizeof(CL2DAssignment));
+            if (shareNonCorr)
+            {
+                const char *ptrCorr = (const char *)P[q]->nextNonClassCorr.data();
+                myLists.insert(myLists.end(), ptrCorr, ptrCorr + P[q]->nextNonClassCorr.size() * sizeof(double));
+            }
+        }
+
+        int Nnodes = prm->node->size;
+        int mySize = myLists.size();
+        std::vector<int> listSizes(Nnodes), listOffsets(Nnodes);
+        MPI_Allgather(&mySize, 1, MPI_INT, &listSizes[0], 1, MPI_INT, MPI_COMM_WORLD);
+        int totalSize = 0;
+        for (int rank = 0; rank < Nnodes; rank++)
+        {
+            listOffsets[rank] = totalSize;
+            totalSize += listSizes[rank];
+        }
+        std::vector<char> allLists(totalSize);
+        MPI_Allgatherv(&myLists[0], mySize, MPI_CHAR, &allLists[0], &listSizes[0], &listOffsets[0],
+                       MPI_CHAR, MPI_COMM_WORLD);
+
+        // Unpack the lists of all nodes
+        for (int q = 0; q < Q; q++)
+        {
+            P[q]->nextListImg.clear();
+            if (shareNonCorr)
+                P[q]->nextNonClassCorr.clear();
+        }
+        for (int rank = 0; rank < Nnodes; rank++)
+        {
+            const char *ptr = &allLists[listOffsets[rank]];
+            const int *rankCounts = (const int *)ptr;
+            ptr += 2 * Q * sizeof(int);
+            for (int q = 0; q < Q; q++)
+            {
+                const CL2DAssignment *ptrList = (const CL2DAssignment *)ptr;
+                P[q]->nextListImg.insert(P[q]->nextListImg.end(), ptrList, ptrList + rankCounts[2 * q]);
+                ptr += rankCounts[2 * q] * sizeof(CL2DAssignment);
+                const double *ptrCorr = (const double *)ptr;
+                P[q]->nextNonClassCorr.insert(P[q]->nextNonClassCorr.end(), ptrCorr, ptrCorr + rankCounts[2 * q + 1]);
+                ptr += rankCounts[2 * q + 1] * sizeof(double);
+            }
+        }
+        // This is important to ensure that all nodes have all images in the same order
+        for (int q = 0; q < Q; q++)
+            std::sort(P[q]->nextListImg.begin(), P[q]->nextListImg.end(), CL2DAssignmentComparator);
+    }
+
+    if (!requests.empty())
+        MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+    communicationTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    if (shareUpdates)
+        for (int q = 0; q < Q; q++)
+            memcpy(MULTIDIM_ARRAY(P[q]->Pupdate), &sumBuffer[updatesOffset + q * updateSize],
+                   updateSize * sizeof(double));
+    if (corrSum != NULL)
+        *corrSum = sumBuffer[corrOffset];
+
+    if (shareAssignment)
+    {
+        for (size_t n = 0; n < nodeRef.size(); n++)
+            nodeRef[n] = (int)sumBuffer[refOffset + n] - 1;
         SF->setColumnValues(MDL_REF, nodeRef);
 #ifdef DEBUG_WITH_LOG
     	FileName fnImg;
@@ -544,80 +662,8 @@ void CL2D::shareAssignments(bool shareAssignment, bool shareUpdates,
 #endif
     }
 
-    // Share code updates
     if (shareUpdates)
-    {
-        std::vector<CL2DAssignment> auxList;
-        std::vector<double> auxList2;
-        int Q = P.size();
-        for (int q = 0; q < Q; q++)
-        {
-            MPI_Allreduce(MPI_IN_PLACE, MULTIDIM_ARRAY(P[q]->Pupdate),
-                          MULTIDIM_SIZE(P[q]->Pupdate), MPI_DOUBLE, MPI_SUM,
-                          MPI_COMM_WORLD);
-
-            // Share nextClassCorr and nextNonClassCorr
-            std::vector<double> receivedNonClassCorr;
-            std::vector<CL2DAssignment> receivedNextListImage;
-            int listSize;
-            for (size_t rank = 0; rank < prm->node->size; rank++)
-            {
-                if (rank == prm->node->rank)
-                {
-                    listSize = P[q]->nextListImg.size();
-                    MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                    MPI_Bcast(&(P[q]->nextListImg[0]),
-                              P[q]->nextListImg.size() * sizeof(CL2DAssignment),
-                              MPI_CHAR, rank, MPI_COMM_WORLD);
-                    if (shareNonCorr)
-                    {
-                        listSize = P[q]->nextNonClassCorr.size();
-                        MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                        MPI_Bcast(&(P[q]->nextNonClassCorr[0]),
-                                  P[q]->nextNonClassCorr.size(), MPI_DOUBLE,
-                                  rank, MPI_COMM_WORLD);
-                    }
-                }
-                else
-                {
-                    MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                    auxList.resize(listSize);
-                    MPI_Bcast(&(auxList[0]), listSize * sizeof(CL2DAssignment),
-                              MPI_CHAR, rank, MPI_COMM_WORLD);
-                    receivedNextListImage.reserve(
-                        receivedNextListImage.size() + listSize);
-                    for (int j = 0; j < listSize; j++)
-                        receivedNextListImage.push_back(auxList[j]);
-                    if (shareNonCorr)
-                    {
-                        MPI_Bcast(&listSize, 1, MPI_INT, rank, MPI_COMM_WORLD);
-                        auxList2.resize(listSize);
-                        MPI_Bcast(&(auxList2[0]), listSize, MPI_DOUBLE, rank,
-                                  MPI_COMM_WORLD);
-                        receivedNonClassCorr.reserve(
-                            receivedNonClassCorr.size() + listSize);
-                        for (int j = 0; j < listSize; j++)
-                            receivedNonClassCorr.push_back(auxList2[j]);
-                    }
-                }
-            }
-            // This is important to ensure that all nodes have all images in the same order
-            std::sort(receivedNextListImage.begin(),receivedNextListImage.end(),CL2DAssignmentComparator);
-
-            // Copy the received elements
-            listSize = receivedNextListImage.size();
-            P[q]->nextListImg.reserve(P[q]->nextListImg.size() + listSize);
-            for (int j = 0; j < listSize; j++)
-                P[q]->nextListImg.push_back(receivedNextListImage[j]);
-            listSize = receivedNonClassCorr.size();
-            P[q]->nextNonClassCorr.reserve(
-                P[q]->nextNonClassCorr.size() + listSize);
-            for (int j = 0; j < listSize; j++)
-                P[q]->nextNonClassCorr.push_back(receivedNonClassCorr[j]);
-        }
-
         transferUpdates();
-    }
 }
 
 void CL2D::shareSplitAssignments(Matrix1D<int> &assignment, CL2DClass *node1,
@@ -703,17 +749,28 @@ void CL2D::shareSplitAssignments(Matrix1D<int> &assignment, CL2DClass *node1,
     node2->transferUpdate();
 }
 
+/* Constructor -------------------------------------------------------- */
+CL2D::CL2D()
+{
+	plans = NULL;
+	communicationTime = 0;
+}
+
 /* Destructor --------------------------------------------------------- */
 CL2D::~CL2D()
 {
 	int qmax=P.size();
 	for (int q=0; q<qmax; q++)
 		delete P[q];
+	delete plans;
 }
 
 /* Read image --------------------------------------------------------- */
 void CL2D::readImage(Image<double> &I, size_t objId, bool applyGeo) const
 {
+    // Only the images without geometry are read along the iterations
+    if (!applyGeo && prm->particles.get(objId, I()))
+        return;
     if (applyGeo)
         I.readApplyGeo(*SF, objId);
     else
@@ -725,6 +782,8 @@ void CL2D::readImage(Image<double> &I, size_t objId, bool applyGeo) const
     I().setXmippOrigin();
     if (prm->normalizeImages)
     	I().statisticsAdjust(0, 1);
+    if (!applyGeo)
+        prm->particles.put(objId, I());
 }
 
 /* CL2D initialization ------------------------------------------------ */
@@ -933,12 +992,15 @@ void CL2D::lookNode(MultidimArray<double> &I, int oldnode, int &newnode,
 #endif
 	int Q = P.size();
     int bestq = -1;
-    MultidimArray<double> bestImg, Iaux;
+    MultidimArray<double> bestImg;
     Matrix1D<double> corrList;
     corrList.resizeNoCopy(Q);
-    CL2DAssignment assignment;
     bestAssignment.likelihood = bestAssignment.corr = 0;
     size_t objId = bestAssignment.objId;
+
+    // Choose the nodes to try. This is done sequentially because
+    // of the random number generator
+    std::vector<int> candidates;
     for (int q = 0; q < Q; q++)
     {
         // Check if q is neighbour of the oldnode
@@ -972,24 +1034,70 @@ void CL2D::lookNode(MultidimArray<double> &I, int oldnode, int &newnode,
         }
         else
             proceed = true;
+        if (proceed)
+            candidates.push_back(q);
+    }
 
-		if (proceed) {
-			// Try this image
-			Iaux = I;
-			P[q]->fit(Iaux, assignment);
-			VEC_ELEM(corrList,q) = assignment.corr;
+    // The first rotational search of every node starts from the input
+    // image, so its polar Fourier transform is shared by all of them
+    const Polar<std::complex<double> > *ptrPolarI = NULL, *ptrPolarMirror = NULL;
+    if (prm->alignImages)
+    {
+        normalizedPolarFourierTransform(I, polarFourierI, true,
+                                        XSIZE(I) / 5, XSIZE(I) / 2-2, plans, 1);
+        ptrPolarI = &polarFourierI;
+        if (prm->mirrorImages)
+        {
+            MultidimArray<double> Imirror = I;
+            Imirror.selfReverseX();
+            Imirror.setXmippOrigin();
+            normalizedPolarFourierTransform(Imirror, polarFourierMirror, true,
+                                            XSIZE(I) / 5, XSIZE(I) / 2-2, plans, 1);
+            ptrPolarMirror = &polarFourierMirror;
+        }
+    }
+
+    // Fit the image to all candidates. Each node is fitted by a single
+    // thread, so the node alignment auxiliaries are not shared
+    int Ncandidates = candidates.size();
+    if ((int)candidateImg.size() < Ncandidates)
+        candidateImg.resize(Ncandidates);
+    std::vector<CL2DAssignment> candidateAssignment(Ncandidates);
+    std::atomic<int> nextCandidate(0);
+    auto fitCandidates = [&]()
+    {
+        int c;
+        while ((c = nextCandidate++) < Ncandidates)
+        {
+            candidateImg[c] = I;
+            P[candidates[c]]->fit(candidateImg[c], candidateAssignment[c], ptrPolarI, ptrPolarMirror);
+        }
+    };
+    int Nthreads = XMIPP_MIN(prm->Nthreads, Ncandidates);
+    std::vector<std::thread> threads;
+    for (int th = 1; th < Nthreads; th++)
+        threads.push_back(std::thread(fitCandidates));
+    fitCandidates();
+    for (size_t th = 0; th < threads.size(); th++)
+        threads[th].join();
+
+    // Keep the best in the same order as the sequential search
+    for (int c = 0; c < Ncandidates; c++)
+    {
+        int q = candidates[c];
+        const CL2DAssignment &assignment = candidateAssignment[c];
+        VEC_ELEM(corrList,q) = assignment.corr;
 #ifdef DEBUG
-	std::cout << "   Proceeding with node " << q << " corr=" << assignment.corr << std::endl;
+        std::cout << "   Proceeding with node " << q << " corr=" << assignment.corr << std::endl;
 #endif
-			if ((!prm->classicalMultiref && assignment.likelihood > bestAssignment.likelihood) ||
-				(prm->classicalMultiref && assignment.corr > bestAssignment.corr) ||
-				 prm->classifyAllImages && bestAssignment.corr==0) {
-				bestq = q;
-				bestImg = Iaux;
-				bestAssignment = assignment;
-			}
-		}
-	}
+        if ((!prm->classicalMultiref && assignment.likelihood > bestAssignment.likelihood) ||
+            (prm->classicalMultiref && assignment.corr > bestAssignment.corr) ||
+             prm->classifyAllImages && bestAssignment.corr==0) {
+            bestq = q;
+            bestImg = candidateImg[c];
+            bestAssignment = assignment;
+        }
+    }
 
     I = bestImg;
     newnode = bestq;
@@ -1069,6 +1177,7 @@ void CL2D::run(const FileName &fnODir, const FileName &fnOut, int level)
             *ptrOld -= 1;
         SF->fillConstant(MDL_REF, "-1");
         size_t idx=0;
+        auto tStart = std::chrono::steady_clock::now();
         FOR_ALL_OBJECTS_IN_METADATA(prm->SF)
         {
             if ((idx+1)%prm->node->size==prm->node->rank)
@@ -1086,12 +1195,14 @@ void CL2D::run(const FileName &fnODir, const FileName &fnOut, int level)
             }
             idx++;
         }
+        auto tComputed = std::chrono::steady_clock::now();
         prm->node->barrierWait();
+        auto tSynchronized = std::chrono::steady_clock::now();
 
         // Gather all pieces computed by nodes
-        MPI_Allreduce(MPI_IN_PLACE, &corrSum, 1, MPI_DOUBLE, MPI_SUM,
-                      MPI_COMM_WORLD);
-        shareAssignments(true, true, true);
+        communicationTime = 0;
+        shareAssignments(true, true, true, &corrSum);
+        auto tShared = std::chrono::steady_clock::now();
 
         // Some report
         size_t idMdChanges=0;
@@ -1108,6 +1219,11 @@ void CL2D::run(const FileName &fnODir, const FileName &fnOut, int level)
                 finish=1;
             }
             std::cout << "\nAverage correlation with input vectors=" << avgSimilarity << std::endl;
+            double tCompute = std::chrono::duration<double>(tComputed - tStart).count();
+            double tWait = std::chrono::duration<double>(tSynchronized - tComputed).count();
+            double tShare = std::chrono::duration<double>(tShared - tSynchronized).count();
+            std::cout << formatString("Times (s): compute=%.2f wait for nodes=%.2f communication=%.2f class update=%.2f",
+                                      tCompute, tWait, communicationTime, tShare - communicationTime) << std::endl;
             idMdChanges = MDChanges.addObject();
             MDChanges.setValue(MDL_ITER, iter, idMdChanges);
             MDChanges.setValue(MDL_CL2D_SIMILARITY, avgSimilarity, idMdChanges);
@@ -1667,6 +1783,10 @@ void ProgClassifyCL2D::readParams()
 	if (useThresholdMask)
 		threshold=getDoubleParam("--useThresholdMask");
 	alignImages = !checkParam("--dontAlign");
+	Nthreads = getIntParam("--thr");
+	cacheImages = checkParam("--cacheImages");
+	if (cacheImages)
+		cacheMB = getDoubleParam("--cacheImages");
 }
 
 void ProgClassifyCL2D::show() const {
@@ -1690,9 +1810,12 @@ void ProgClassifyCL2D::show() const {
 			<< "Normalize images:        " << normalizeImages << std::endl
 			<< "Mirror images:           " << mirrorImages << std::endl
 			<< "Align images:            " << alignImages << std::endl
+			<< "Threads:                 " << Nthreads << std::endl
 	;
 	if (useThresholdMask)
 		std::cout << "Threshold mask:          " << threshold << std::endl;
+	if (cacheImages)
+		std::cout << "Image cache (MB):        " << cacheMB << std::endl;
 }
 
 void ProgClassifyCL2D::defineParams()
@@ -1735,7 +1858,12 @@ void ProgClassifyCL2D::defineParams()
 	addParamsLine("   [--dontMirrorImages]      : By default, input images are studied unmirrored and mirrored");
 	addParamsLine("   [--useThresholdMask <t>]  : Use a mask to compare images. Remove pixels whose value is smaller or equal t");
 	addParamsLine("   [--dontAlign]             : Do not center the class representatives");
+	addParamsLine("   [--thr <N=1>]             : Number of threads per MPI process to compare each image with the classes");
+	addParamsLine("   [--cacheImages <MB=2048>] : Read the images only once and keep them in memory between iterations");
+	addParamsLine("                             : Each MPI process keeps its share of the images. If they take more than MB, ");
+	addParamsLine("                             : they are kept in a memory mapped file");
     addExampleLine("mpirun -np 3 `which xmipp_mpi_classify_CL2D` -i images.stk --nref 256 --oroot class --odir CL2Dresults --iter 10");
+    addExampleLine("mpirun -np 2 `which xmipp_mpi_classify_CL2D` -i images.stk --nref 256 --oroot class --odir CL2Dresults --thr 8");
 }
 
 void ProgClassifyCL2D::produceSideInfo()
@@ -1758,6 +1886,15 @@ void ProgClassifyCL2D::produceSideInfo()
     SF.findObjects(objId);
     // size_t Nimgs = objId.size();
 
+    // Room for the share of images of this node
+    if (cacheImages)
+    {
+        size_t Nimgs = objId.size();
+        particles.initialize((Nimgs + node->size - 1) / node->size, Ydim, Xdim, cacheMB);
+        if (node->rank == 1 && particles.isMapped())
+            std::cout << "The image cache does not fit in " << cacheMB << " MB, it is memory mapped" << std::endl;
+    }
+
     // Prepare mask for evaluating the noise outside
     mask.resize(prm->Ydim, prm->Xdim);
     mask.setXmippOrigin();
@@ -0,0 +1,156 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <core/xmipp_program.h>
+#include <core/xmipp_image.h>
+#include <core/metadata.h>
+#include <data/benchmark.h>
+#include <data/fourier_projection.h>
+#include <reconstruction/reconstruct_fourier.h>
+
+/* PROGRAM ----------------------------------------------------------------- */
+class ProgReconstructFourierBenchmark: public XmippProgram
+{
+protected:
+    FileName fnRoot;
+    int Xdim, Nprojections, maxThreads;
+    String symmetry;
+
+    void defineParams()
+    {
+        addUsageLine("Measure how xmipp_reconstruct_fourier scales with the number of threads.");
+        addUsageLine("A synthetic volume made of Gaussian balls is projected along a spiral of directions");
+        addUsageLine("and reconstructed with 1, 2, 4, ... threads sharing the rows of each image and");
+        addUsageLine("inserting whole images in partial volumes.");
+        addParamsLine("  [--oroot <root=\"reconstruct_fourier_benchmark\">] : Rootname for the synthetic dataset");
+        addParamsLine("  [--size <Xdim=128>]        : Size of the synthetic volume");
+        addParamsLine("  [-n <N=2000>]              : Number of projections");
+        addParamsLine("  [--max_threads <T=64>]     : Maximum number of threads");
+        addParamsLine("  [--sym <symfile=c1>]       : Symmetry used in the reconstruction");
+        addExampleLine("xmipp_reconstruct_fourier_benchmark --size 128 -n 5000 --max_threads 32");
+        addKeywords("fourier reconstruction benchmark threads");
+    }
+
+    void readParams()
+    {
+        fnRoot = getParam("--oroot");
+        Xdim = getIntParam("--size");
+        Nprojections = getIntParam("-n");
+        maxThreads = std::max(1, getIntParam("--max_threads"));
+        symmetry = getParam("--sym");
+    }
+
+    void show()
+    {
+        if (verbose==0)
+            return;
+        std::cout
+        << "Root:        " << fnRoot       << std::endl
+        << "Size:        " << Xdim         << std::endl
+        << "Projections: " << Nprojections << std::endl
+        << "Max threads: " << maxThreads   << std::endl
+        << "Symmetry:    " << symmetry     << std::endl;
+    }
+
+    // Project a volume of Gaussian balls along a spiral of directions
+    void createDataset(const FileName &fnMd)
+    {
+        Image<double> V;
+        V().initZeros(Xdim,Xdim,Xdim);
+        V().setXmippOrigin();
+        const int Nballs=12;
+        double R=0.3*Xdim;
+        for (int n=0; n<Nballs; ++n)
+        {
+            double z0=R*cos(n*2.399), y0=R*sin(n*1.7), x0=R*cos(n*0.9)*0.8;
+            double sigma2=2*std::pow(0.04*Xdim*(1+n%3),2.0);
+            FOR_ALL_ELEMENTS_IN_ARRAY3D(V())
+            {
+                double r2=(k-z0)*(k-z0)+(i-y0)*(i-y0)+(j-x0)*(j-x0);
+                A3D_ELEM(V(),k,i,j)+=exp(-r2/sigma2);
+            }
+        }
+
+        FourierProjector projector(V(),2,0.5,1);
+        FileName fnStack=fnRoot+"_projections.stk", fnImg;
+        MetaData MD;
+        for (int n=0; n<Nprojections; ++n)
+        {
+            double tilt=RAD2DEG(acos(1-2*(n+0.5)/Nprojections));
+            double rot=fmod(n*137.508,360.0);
+            double psi=fmod(n*29.0,360.0);
+            projector.project(rot,tilt,psi);
+            projector.projection.write(fnStack,n+1,true,WRITE_REPLACE);
+            fnImg.compose(n+1,fnStack);
+            size_t id=MD.addObject();
+            MD.setValue(MDL_IMAGE,fnImg,id);
+            MD.setValue(MDL_ANGLE_ROT,rot,id);
+            MD.setValue(MDL_ANGLE_TILT,tilt,id);
+            MD.setValue(MDL_ANGLE_PSI,psi,id);
+        }
+        MD.write(fnMd);
+    }
+
+    // Reconstruct and return the projections inserted per second
+    double reconstruct(const FileName &fnMd, const FileName &fnVol, const String &insertion, int threads)
+    {
+        ProgRecFourier program;
+        program.read(formatString("-i %s -o %s --sym %s --thr %d --insertion %s -v 0",
+                                  fnMd.c_str(), fnVol.c_str(), symmetry.c_str(), threads, insertion.c_str()));
+        return Nprojections/wallTime([&]() { program.run(); });
+    }
+
+    void run()
+    {
+        show();
+        FileName fnMd=fnRoot+"_projections.xmd";
+        createDataset(fnMd);
+
+        const char *insertions[]={"rows","images"};
+        FileName fnVol[2];
+        reportThreadScalingHeader("images/s");
+        for (int m=0; m<2; ++m)
+        {
+            fnVol[m]=fnRoot+"_"+insertions[m]+".vol";
+            reportThreadScaling(insertions[m], maxThreads,
+                                [&](int threads)
+                                {
+                                    return reconstruct(fnMd,fnVol[m],insertions[m],threads);
+                                });
+        }
+
+        // Both insertions must give the same reconstruction up to the summation order
+        Image<double> Vrows, Vimages;
+        Vrows.read(fnVol[0]);
+        Vimages.read(fnVol[1]);
+        double maxDiff=0;
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Vrows())
+        maxDiff=std::max(maxDiff,fabs(DIRECT_MULTIDIM_ELEM(Vrows(),n)-DIRECT_MULTIDIM_ELEM(Vimages(),n)));
+        std::cout << "Max. difference between insertions: " << maxDiff
+                  << " (volume stddev " << Vrows().computeStddev() << ")" << std::endl;
+    }
+};
+
+RUN_XMIPP_PROGRAM(ProgReconstructFourierBenchmark)
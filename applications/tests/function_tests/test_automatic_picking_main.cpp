@@ -0,0 +1,208 @@
+#include <reconstruction/micrograph_automatic_picking2.h>
+#include <iostream>
+#include <random>
+#include <gtest/gtest.h>
+
+class AutomaticPickingTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        picker.classifier.setParameters(8.0, 0.125);
+        picker.classifier2.setParameters(1.0, 0.25);
+        picker.num_features = 8;
+    }
+
+    // Random candidates. Costs take few values so that there are ties, and
+    // some candidates are placed exactly particle_radius away from another
+    // one, in x, in y and in both.
+    void randomCandidates(std::mt19937 &generator, size_t n, int radius,
+                          std::vector<Particle2> &candidates)
+    {
+        std::uniform_int_distribution<int> position(0, 20 * radius);
+        std::uniform_int_distribution<int> cost(0, 4);
+        std::uniform_int_distribution<int> shift(0, 4);
+        candidates.clear();
+        Particle2 p;
+        p.status = 1;
+        for (size_t k = 0; k < n; k++)
+        {
+            if (k > 0 && shift(generator) == 0)
+            {
+                p = candidates[k / 2];
+                switch (shift(generator))
+                {
+                case 0: p.x += radius; break;
+                case 1: p.y -= radius; break;
+                case 2: p.x -= radius; p.y += radius; break;
+                case 3: p.x += radius - 1; break;
+                default: break; // same position
+                }
+            }
+            else
+            {
+                p.x = position(generator);
+                p.y = position(generator);
+            }
+            p.cost = 0.5 + 0.1 * cost(generator);
+            p.status = 1;
+            candidates.push_back(p);
+        }
+    }
+
+    AutoParticlePicking2 picker;
+};
+
+// Bubble sort and greedy suppression used before removeOccludedParticles
+static void oldRemoveOccludedParticles(std::vector<Particle2> &auto_candidates, int particle_radius)
+{
+    Particle2 p;
+    for (size_t i=0;i<auto_candidates.size();++i)
+        for (size_t j=0;j<auto_candidates.size()-i-1;j++)
+            if (auto_candidates[j].cost<auto_candidates[j+1].cost)
+            {
+                p=auto_candidates[j+1];
+                auto_candidates[j+1]=auto_candidates[j];
+                auto_candidates[j]=p;
+            }
+    for (size_t i=0;i<auto_candidates.size()-1;++i)
+    {
+        if (auto_candidates[i].status==-1)
+            continue;
+        p=auto_candidates[i];
+        for (size_t j=i+1;j<auto_candidates.size();j++)
+        {
+            if (auto_candidates[j].x>p.x-particle_radius
+                && auto_candidates[j].x<p.x+particle_radius
+                && auto_candidates[j].y>p.y-particle_radius
+                && auto_candidates[j].y<p.y+particle_radius)
+            {
+                if (p.cost<auto_candidates[j].cost)
+                {
+                    auto_candidates[i].status=-1;
+                    p=auto_candidates[j];
+                }
+                else
+                    auto_candidates[j].status=-1;
+            }
+        }
+    }
+}
+
+TEST_F( AutomaticPickingTest, removeOccludedParticles)
+{
+    std::mt19937 generator(25);
+    for (int radius : {1, 2, 7, 20})
+        for (size_t n : {1, 2, 50, 400})
+        {
+            std::vector<Particle2> expected;
+            randomCandidates(generator, n, radius, expected);
+            picker.particle_radius = radius;
+            picker.auto_candidates = expected;
+            oldRemoveOccludedParticles(expected, radius);
+            picker.removeOccludedParticles();
+
+            const std::vector<Particle2> &result = picker.auto_candidates;
+            ASSERT_EQ(result.size(), expected.size());
+            for (size_t k = 0; k < n; k++)
+            {
+                EXPECT_EQ(result[k].x, expected[k].x) << "radius " << radius << " candidate " << k;
+                EXPECT_EQ(result[k].y, expected[k].y) << "radius " << radius << " candidate " << k;
+                EXPECT_EQ(result[k].cost, expected[k].cost) << "radius " << radius << " candidate " << k;
+                EXPECT_EQ(result[k].status, expected[k].status) << "radius " << radius << " candidate " << k;
+            }
+        }
+}
+
+TEST_F( AutomaticPickingTest, classifyCandidates)
+{
+    // Two classes of feature vectors, particles (label 1) have a ramp
+    std::mt19937 generator(25);
+    std::normal_distribution<double> noise(0., 0.3);
+    int nf = picker.num_features;
+    size_t ntrain = 200, n = 300;
+    MultidimArray<double> trainSet(ntrain, nf), labels(ntrain);
+    MultidimArray<double> featVecs(n, nf), featVec;
+    std::vector<Particle2> positionArray(n);
+    for (size_t k = 0; k < ntrain + n; k++)
+    {
+        bool particle = (k % 2 == 0);
+        for (int i = 0; i < nf; i++)
+        {
+            double v = (particle ? i : nf - i) + noise(generator);
+            if (k < ntrain)
+                DIRECT_A2D_ELEM(trainSet, k, i) = v;
+            else
+                DIRECT_A2D_ELEM(featVecs, k - ntrain, i) = v;
+        }
+        if (k < ntrain)
+            DIRECT_A1D_ELEM(labels, k) = particle ? 1 : 2;
+        else
+        {
+            positionArray[k - ntrain].x = (int)k;
+            positionArray[k - ntrain].y = (int)(2 * k);
+        }
+    }
+    // The classifier is trained with the same normalization as the candidates
+    for (size_t k = 0; k < ntrain; k++)
+    {
+        trainSet.getRow(k, featVec);
+        double max = featVec.computeMax();
+        double min = featVec.computeMin();
+        for (int i = 0; i < nf; i++)
+            DIRECT_A2D_ELEM(trainSet, k, i) = (DIRECT_A1D_ELEM(featVec, i) - min) / (max - min);
+    }
+    srand(25);
+    picker.classifier.SVMTrain(trainSet, labels);
+
+    // Candidates classified one by one as before
+    int num = 250;
+    std::vector<Particle2> expected;
+    Particle2 p;
+    featVec.resize(nf);
+    for (int k = 0; k < num; k++)
+    {
+        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
+        DIRECT_A1D_ELEM(featVec,i)=DIRECT_A2D_ELEM(featVecs,k,i);
+        MultidimArray<double> featVecNN = featVec;
+        double max=featVec.computeMax();
+        double min=featVec.computeMin();
+        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
+        DIRECT_A1D_ELEM(featVec,i)=0+((1)*((DIRECT_A1D_ELEM(featVec,i)-min)/(max-min)));
+        double score;
+        double label = picker.classifier.predict(featVec, score);
+        if (label == 1)
+        {
+            p.x = positionArray[k].x;
+            p.y = positionArray[k].y;
+            p.status = 1;
+            p.cost = score;
+            p.vec = featVecNN;
+            expected.push_back(p);
+        }
+    }
+    ASSERT_GT(expected.size(), (size_t)0);
+
+    for (int threads : {1, 4})
+    {
+        picker.setThreads(threads);
+        picker.auto_candidates.clear();
+        picker.classifyCandidates(featVecs, positionArray, num);
+        const std::vector<Particle2> &result = picker.auto_candidates;
+        ASSERT_EQ(result.size(), expected.size());
+        for (size_t k = 0; k < result.size(); k++)
+        {
+            EXPECT_EQ(result[k].x, expected[k].x);
+            EXPECT_EQ(result[k].y, expected[k].y);
+            EXPECT_EQ(result[k].status, expected[k].status);
+            EXPECT_DOUBLE_EQ(result[k].cost, expected[k].cost);
+            EXPECT_TRUE(result[k].vec.equal(expected[k].vec));
+        }
+    }
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
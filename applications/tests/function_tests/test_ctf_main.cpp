@@ -1,10 +1,12 @@
 
 #include <iostream>
+#include <cfloat>
 
 #include <core/xmipp_image.h>
 #include <data/transform_downsample.h>
 #include <gtest/gtest.h>
 #include <data/ctf.h>
+#include <data/ctf_image_cache.h>
 
 // MORE INFO HERE: http://code.google.com/p/googletest/wiki/AdvancedGuide
 // This test is named "Size", and belongs to the "MetadataTest"
@@ -143,6 +145,81 @@ TEST_F( CtfTest, errorMaxFreqCTFs2D)
     XMIPP_CATCH
 }
 
+// The float path rounds the phase of the CTF, so its error grows with the
+// largest phase of the image, the one at the corner of Fourier space
+static double floatCTFTolerance(const CTFDescription &ctf)
+{
+    double u2=2/(4*ctf.Tm*ctf.Tm);
+    double deltaf=std::max(fabs(ctf.DeltafU),fabs(ctf.DeltafV));
+    double phase=fabs(ctf.K1)*deltaf*u2+fabs(ctf.K2)*u2*u2;
+    return 16*FLT_EPSILON*std::max(1.0,phase);
+}
+
+TEST_F( CtfTest, generateCTFFast)
+{
+    XMIPP_TRY
+    MetaData metadata1;
+    long objectId = metadata1.addObject();
+    metadata1.setValue(MDL_CTF_SAMPLING_RATE, 1.3, objectId);
+    metadata1.setValue(MDL_CTF_VOLTAGE, 300., objectId);
+    metadata1.setValue(MDL_CTF_DEFOCUSU, 18000., objectId);
+    metadata1.setValue(MDL_CTF_DEFOCUSV, 15000., objectId);
+    metadata1.setValue(MDL_CTF_DEFOCUS_ANGLE, 30., objectId);
+    metadata1.setValue(MDL_CTF_CS, 2., objectId);
+    metadata1.setValue(MDL_CTF_Q0, 0.1, objectId);
+
+    CTFDescription ctf;
+    ctf.enable_CTF=true;
+    ctf.enable_CTFnoise=false;
+    ctf.readFromMetadataRow(metadata1,metadata1.firstObject());
+    ctf.produceSideInfo();
+    EXPECT_LT(checkCTFFastAccuracy(ctf,128,128),1e-12);
+    EXPECT_LT(checkCTFFastAccuracy(ctf,127,130),1e-12);
+    EXPECT_LT(checkCTFFastAccuracy(ctf,128,128,true),floatCTFTolerance(ctf));
+
+    // No astigmatism goes through the radial path
+    ctf.DeltafV=ctf.DeltafU;
+    ctf.produceSideInfo();
+    EXPECT_LT(checkCTFFastAccuracy(ctf,128,128),1e-12);
+    EXPECT_LT(checkCTFFastAccuracy(ctf,129,129,true),floatCTFTolerance(ctf));
+    XMIPP_CATCH
+}
+
+TEST_F( CtfTest, ctfImageCache)
+{
+    XMIPP_TRY
+    MetaData metadata1;
+    long objectId = metadata1.addObject();
+    metadata1.setValue(MDL_CTF_SAMPLING_RATE, 1.3, objectId);
+    metadata1.setValue(MDL_CTF_VOLTAGE, 300., objectId);
+    metadata1.setValue(MDL_CTF_DEFOCUSU, 18000., objectId);
+    metadata1.setValue(MDL_CTF_DEFOCUSV, 15000., objectId);
+    metadata1.setValue(MDL_CTF_DEFOCUS_ANGLE, 30., objectId);
+    metadata1.setValue(MDL_CTF_CS, 2., objectId);
+    metadata1.setValue(MDL_CTF_Q0, 0.1, objectId);
+
+    CTFDescription ctf;
+    ctf.enable_CTF=true;
+    ctf.enable_CTFnoise=false;
+    ctf.readFromMetadataRow(metadata1,metadata1.firstObject());
+    ctf.produceSideInfo();
+
+    // Room for a single 64x64 image
+    CTFImageCache cache(64*64*sizeof(double)/(1024.0*1024.0), 10);
+    CTFImageCache::ImagePtr I1=cache.getImage(ctf,64,64);
+    ctf.DeltafU+=2; // Same bin
+    CTFImageCache::ImagePtr I2=cache.getImage(ctf,64,64);
+    EXPECT_EQ(I1.get(),I2.get());
+    ctf.DeltafU+=20; // New bin, evicts the first one
+    CTFImageCache::ImagePtr I3=cache.getImage(ctf,64,64);
+    ctf.DeltafU-=22;
+    CTFImageCache::ImagePtr I4=cache.getImage(ctf,64,64);
+    EXPECT_NE(I1.get(),I4.get());
+    EXPECT_EQ(cache.hits(),(size_t)1);
+    EXPECT_EQ(cache.misses(),(size_t)3);
+    XMIPP_CATCH
+}
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
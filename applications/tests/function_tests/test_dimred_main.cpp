@@ -10,6 +10,9 @@
 #include <dimred/diffusionMaps.h>
 #include <dimred/probabilisticPCA.h>
 #include <dimred/laplacianEigenmaps.h>
+#include <dimred/nearestNeighbours.h>
+#include <dimred/lanczos.h>
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>     /* getenv */
 #include <gtest/gtest.h>
@@ -161,6 +164,190 @@ TEST_F( DimRedTest, nca)
 	ASSERT_TRUE(expectedY.equal(Y,1e-4));
 }
 
+TEST_F( DimRedTest, nearest_neighbours)
+{
+	GenerateData generator;
+	generator.generateNewDataset("swiss",2000,0.05);
+	Matrix2D<int> expectedIdx, idx;
+	Matrix2D<double> expectedD, D;
+	kNearestNeighboursAllPairs(generator.X,12,expectedIdx,expectedD);
+
+	NearestNeighbourSearch knn;
+	knn.threads=3;
+	knn.method=NearestNeighbourSearch::KDTREE;
+	knn.search(generator.X,12,idx,D);
+	FOR_ALL_ELEMENTS_IN_MATRIX2D(D)
+		MAT_ELEM(D,i,j)=sqrt(MAT_ELEM(D,i,j));
+	ASSERT_TRUE(expectedIdx.equal(idx));
+	ASSERT_TRUE(expectedD.equal(D,1e-12));
+
+	knn.method=NearestNeighbourSearch::BRUTE_FORCE;
+	knn.search(generator.X,12,idx,D);
+	FOR_ALL_ELEMENTS_IN_MATRIX2D(D)
+		MAT_ELEM(D,i,j)=sqrt(MAT_ELEM(D,i,j));
+	ASSERT_TRUE(expectedIdx.equal(idx));
+	ASSERT_TRUE(expectedD.equal(D,1e-12));
+}
+
+// Distance that depends on the order of its arguments, as the correlation
+// of transform_dimred does, and counts how many times it is called
+static size_t distanceCalls=0;
+static double asymmetricDistance(const Matrix2D<double> &X, size_t i1, size_t i2)
+{
+	++distanceCalls;
+	double d=0;
+	for (size_t j=0; j<MAT_XSIZE(X); ++j)
+		d+=fabs(MAT_ELEM(X,i1,j)-MAT_ELEM(X,i2,j));
+	return d+1e-3*MAT_ELEM(X,i1,0);
+}
+
+TEST_F( DimRedTest, nearest_neighbours_distance)
+{
+	GenerateData generator;
+	generator.generateNewDataset("swiss",300,0.05);
+	size_t N=MAT_YSIZE(generator.X);
+	Matrix2D<int> expectedIdx, idx;
+	Matrix2D<double> expectedD, D;
+	distanceCalls=0;
+	kNearestNeighboursAllPairs(generator.X,12,expectedIdx,expectedD,asymmetricDistance,false);
+	ASSERT_EQ(distanceCalls,N*(N-1)/2);
+
+	NearestNeighbourSearch knn;
+	knn.threads=3;
+	distanceCalls=0;
+	knn.search(generator.X,12,idx,D,asymmetricDistance);
+	ASSERT_EQ(distanceCalls,N*(N-1)/2);
+	ASSERT_TRUE(expectedIdx.equal(idx));
+	ASSERT_TRUE(expectedD.equal(D,0));
+}
+
+TEST_F( DimRedTest, sparse_matrix)
+{
+	// Rows 0, 3 and 4 are empty, (1,2) is given twice and zeros are dropped
+	std::vector<SparseElement> elements;
+	int I[]={2, 1, 1, 2, 1, 3};
+	int J[]={4, 2, 0, 1, 2, 3};
+	double V[]={5, 1, 2, -1, 3, 0};
+	for (int n=0; n<6; ++n)
+	{
+		SparseElement e;
+		e.i=I[n];
+		e.j=J[n];
+		e.value=V[n];
+		elements.push_back(e);
+	}
+	const SparseMatrix2D A(elements,5);
+	EXPECT_EQ(XSIZE(A.values),(size_t)4);
+
+	double expected[5][5]={{0,0,0,0,0},{2,0,4,0,0},{0,-1,0,0,5},{0,0,0,0,0},{0,0,0,0,0}};
+	for (int i=0; i<5; ++i)
+		for (int j=0; j<5; ++j)
+			EXPECT_DOUBLE_EQ(A.getElemIJ(i,j),expected[i][j]);
+
+	const double x[5]={1, 2, 3, 4, 5};
+	double y[5];
+	A.multMv(x,y);
+	for (int i=0; i<5; ++i)
+	{
+		double yi=0;
+		for (int j=0; j<5; ++j)
+			yi+=expected[i][j]*x[j];
+		EXPECT_DOUBLE_EQ(y[i],yi);
+	}
+}
+
+TEST_F( DimRedTest, lanczos)
+{
+	// Symmetric positive definite matrix A=M^t M+I
+	const int N=60, k=4;
+	Matrix2D<double> M, A;
+	M.resizeNoCopy(N,N);
+	FOR_ALL_ELEMENTS_IN_MATRIX2D(M)
+		MAT_ELEM(M,i,j)=sin(0.7*i*j+0.3*j*j+i);
+	A=M.transpose()*M;
+	for (int i=0; i<N; ++i)
+		MAT_ELEM(A,i,i)+=1;
+
+	Matrix1D<double> expectedLambda;
+	Matrix2D<double> expectedV;
+	firstEigs(A,k,expectedLambda,expectedV);
+
+	LanczosEigensolver solver;
+	Matrix1D<double> lambda;
+	Matrix2D<double> V;
+	solver.largest([&](const double *x, double *y)
+	{
+		for (int i=0; i<N; ++i)
+		{
+			y[i]=0;
+			for (int j=0; j<N; ++j)
+				y[i]+=MAT_ELEM(A,i,j)*x[j];
+		}
+	}, N, k, lambda, V);
+	ASSERT_TRUE(solver.converged);
+
+	// Do not rely on the order of the eigenvalues returned by firstEigs
+	std::vector<int> order(k);
+	for (int n=0; n<k; ++n)
+		order[n]=n;
+	std::sort(order.begin(),order.end(),[&](int a, int b)
+	{
+		return VEC_ELEM(expectedLambda,a)>VEC_ELEM(expectedLambda,b);
+	});
+	for (int n=0; n<k; ++n)
+	{
+		int m=order[n];
+		EXPECT_NEAR(VEC_ELEM(lambda,n),VEC_ELEM(expectedLambda,m),1e-8*VEC_ELEM(lambda,0));
+		double dot=0;
+		for (int i=0; i<N; ++i)
+			dot+=MAT_ELEM(V,i,n)*MAT_ELEM(expectedV,i,m);
+		EXPECT_NEAR(fabs(dot),1,1e-6);
+	}
+}
+
+// Columns of Y1 and Y2, normalized, are equal up to their sign
+static void expectEqualUpToSign(const Matrix2D<double> &Y1, const Matrix2D<double> &Y2, double tolerance)
+{
+	ASSERT_EQ(MAT_YSIZE(Y1),MAT_YSIZE(Y2));
+	ASSERT_EQ(MAT_XSIZE(Y1),MAT_XSIZE(Y2));
+	for (size_t j=0; j<MAT_XSIZE(Y1); ++j)
+	{
+		double norm1=0, norm2=0, dot=0;
+		for (size_t i=0; i<MAT_YSIZE(Y1); ++i)
+		{
+			norm1+=MAT_ELEM(Y1,i,j)*MAT_ELEM(Y1,i,j);
+			norm2+=MAT_ELEM(Y2,i,j)*MAT_ELEM(Y2,i,j);
+			dot+=MAT_ELEM(Y1,i,j)*MAT_ELEM(Y2,i,j);
+		}
+		double sign=dot<0 ? -1 : 1;
+		double maxDiff=0;
+		for (size_t i=0; i<MAT_YSIZE(Y1); ++i)
+			maxDiff=std::max(maxDiff,fabs(MAT_ELEM(Y1,i,j)/sqrt(norm1)-sign*MAT_ELEM(Y2,i,j)/sqrt(norm2)));
+		EXPECT_LT(maxDiff,tolerance) << "column " << j;
+	}
+}
+
+#define SPARSE_TEST(method,DimredClass) \
+	TEST_F( DimRedTest, method) \
+{ \
+	GenerateData generator; \
+	generator.generateNewDataset("swiss",1000,0); \
+	DimredClass dense, sparse; \
+	dense.setInputData(generator.X); \
+	dense.setOutputDimensionality(2); \
+	dense.setSpecificParameters(); \
+	dense.reduceDimensionality(); \
+	sparse.setInputData(generator.X); \
+	sparse.setOutputDimensionality(2); \
+	sparse.setSpecificParameters(); \
+	sparse.sparse=true; \
+	sparse.reduceDimensionality(); \
+	expectEqualUpToSign(dense.getReducedData(),sparse.getReducedData(),1e-4); \
+}
+
+SPARSE_TEST(laplacianEigenmapSparse, LaplacianEigenmap)
+SPARSE_TEST(ltsaSparse,              LTSA)
+
 GTEST_API_ int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
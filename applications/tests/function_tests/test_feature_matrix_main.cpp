@@ -0,0 +1,204 @@
+#include <classification/feature_matrix.h>
+#include <classification/fcmeans.h>
+#include <classification/gaussian_kerdensom.h>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <stdint.h>
+#include <gtest/gtest.h>
+
+// Size of the vectors, not a multiple of the lanes
+static const size_t dim = 13;
+
+class FeatureMatrixTest : public ::testing::Test
+{
+protected:
+    FeatureMatrixTest(): ts(0, false)
+    {}
+
+    // Three gaussian clusters
+    virtual void SetUp()
+    {
+        std::mt19937 generator(13);
+        std::normal_distribution<float> noise(0.f, 0.3f);
+        for (size_t i = 0; i < 150; i++)
+        {
+            FeatureVector v(dim);
+            for (size_t j = 0; j < dim; j++)
+                v[j] = (float)((i % 3) * (j % 2 == 0 ? 1 : -1)) + noise(generator);
+            ts.add(v);
+        }
+        listener.setVerbosity() = 0;
+    }
+
+    ClassicTrainingVectors ts;
+    TextualListener listener;
+};
+
+TEST_F( FeatureMatrixTest, padding)
+{
+    FeatureMatrix X;
+    X.resize(3, dim);
+    EXPECT_EQ(X.rows(), (size_t)3);
+    EXPECT_EQ(X.dim(), dim);
+    EXPECT_EQ(X.stride(), (size_t)16);
+    EXPECT_EQ((uintptr_t)X.row(0) % 64, (uintptr_t)0);
+    EXPECT_EQ(X.row(1) - X.row(0), (ptrdiff_t)X.stride());
+    for (size_t i = 0; i < X.rows(); i++)
+        for (size_t j = 0; j < X.stride(); j++)
+            EXPECT_EQ(X.row(i)[j], 0.f);
+
+    // Exact multiple of the lanes, no padding
+    X.resize(2, 2 * FeatureMatrix::lanes);
+    EXPECT_EQ(X.stride(), 2 * FeatureMatrix::lanes);
+}
+
+TEST_F( FeatureMatrixTest, items)
+{
+    FeatureMatrix X(ts.theItems);
+    ASSERT_EQ(X.rows(), ts.size());
+    ASSERT_EQ(X.dim(), dim);
+    for (size_t i = 0; i < X.rows(); i++)
+    {
+        for (size_t j = 0; j < dim; j++)
+            EXPECT_EQ(X.row(i)[j], ts.theItems[i][j]);
+        for (size_t j = dim; j < X.stride(); j++)
+            EXPECT_EQ(X.row(i)[j], 0.f);
+    }
+
+    std::vector<FeatureVector> items;
+    X.toItems(items);
+    EXPECT_TRUE(items == ts.theItems);
+
+    // Smaller set in the same matrix
+    std::vector<FeatureVector> few(ts.theItems.begin(), ts.theItems.begin() + 5);
+    X.fromItems(few);
+    X.toItems(items);
+    EXPECT_TRUE(items == few);
+
+    few[2].push_back(1.f);
+    EXPECT_THROW(X.fromItems(few), std::runtime_error);
+}
+
+TEST_F( FeatureMatrixTest, distances)
+{
+    FeatureMatrix X(ts.theItems);
+    std::vector<FeatureVector> centers(ts.theItems.begin(), ts.theItems.begin() + 4);
+    FeatureMatrix C(centers);
+    std::vector<double> D(10 * C.rows());
+    squaredDistances(X, 20, 30, C, &D[0]);
+    for (size_t i = 20; i < 30; i++)
+        for (size_t c = 0; c < C.rows(); c++)
+        {
+            double expected = 0;
+            for (size_t j = 0; j < dim; j++)
+            {
+                double diff = (double)ts.theItems[i][j] - (double)centers[c][j];
+                expected += diff * diff;
+            }
+            EXPECT_NEAR(D[(i - 20) * C.rows() + c], expected, 1e-12 * (1 + expected));
+        }
+
+    std::vector<double> acc(X.stride(), 1.);
+    addScaledRow(&acc[0], 2., X.row(7), X.stride());
+    for (size_t j = 0; j < dim; j++)
+        EXPECT_DOUBLE_EQ(acc[j], 1. + 2. * ts.theItems[7][j]);
+    for (size_t j = dim; j < X.stride(); j++)
+        EXPECT_EQ(acc[j], 1.);
+}
+
+TEST_F( FeatureMatrixTest, parallelRows)
+{
+    for (size_t N : {0, 3, 1000})
+        for (int threads : {1, 4, 8})
+        {
+            std::vector<int> visits(N, 0), owner(N, -1);
+            size_t calls = 0;
+            std::mutex mutex;
+            parallelRows(N, threads, [&](int thread, size_t begin, size_t end)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                calls++;
+                for (size_t i = begin; i < end; i++)
+                {
+                    visits[i]++;
+                    owner[i] = thread;
+                }
+            });
+            EXPECT_LE(calls, (size_t)std::max(threads, 1));
+            for (size_t i = 0; i < N; i++)
+                EXPECT_EQ(visits[i], 1);
+            // Consecutive chunks in thread order
+            for (size_t i = 1; i < N; i++)
+                EXPECT_LE(owner[i - 1], owner[i]);
+
+            // The partition does not change from one call to the next
+            std::vector<int> owner2(N, -1);
+            parallelRows(N, threads, [&](int thread, size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                    owner2[i] = thread;
+            });
+            EXPECT_TRUE(owner == owner2);
+        }
+}
+
+// Threads only change the order of the sums, so the results agree up to
+// float rounding
+static void expectSameItems(const std::vector<FeatureVector> &A, const std::vector<FeatureVector> &B)
+{
+    ASSERT_EQ(A.size(), B.size());
+    for (size_t i = 0; i < A.size(); i++)
+    {
+        ASSERT_EQ(A[i].size(), B[i].size());
+        for (size_t j = 0; j < A[i].size(); j++)
+            EXPECT_NEAR(A[i][j], B[i][j], 1e-3 * (1 + fabs(A[i][j])));
+    }
+}
+
+TEST_F( FeatureMatrixTest, fcmeansThreads)
+{
+    // Both start from the same (random) code vectors
+    FuzzyCodeBook cb1(3, ts), cb3(3, ts);
+    cb3.theItems = cb1.theItems;
+
+    FuzzyCMeans fcm(2., 1e-6, 50);
+    fcm.setListener(&listener);
+    fcm.train(cb1, ts);
+    fcm.setThreads(3);
+    fcm.train(cb3, ts);
+
+    expectSameItems(cb1.theItems, cb3.theItems);
+    ASSERT_EQ(cb1.memb.size(), cb3.memb.size());
+    for (size_t i = 0; i < cb1.memb.size(); i++)
+        for (size_t c = 0; c < cb1.memb[i].size(); c++)
+            EXPECT_NEAR(cb1.memb[i][c], cb3.memb[i][c], 1e-4);
+}
+
+TEST_F( FeatureMatrixTest, kerdensomThreads)
+{
+    FileName fnTemp;
+    fnTemp.initUniqueName("/tmp/kerdensom_XXXXXX");
+    FileName fnOut = fnTemp + ".xmd";
+
+    // Both start from the same (random) code vectors
+    FuzzyMap map1("rect", 3, 2, ts), map3("rect", 3, 2, ts);
+    map3.theItems = map1.theItems;
+
+    GaussianKerDenSOM som(1000, 100, 3, 1e-7, 50);
+    som.setListener(&listener);
+    som.train(map1, ts, fnOut);
+    som.setThreads(3);
+    som.train(map3, ts, fnOut);
+
+    expectSameItems(map1.theItems, map3.theItems);
+    fnOut.deleteFile();
+    fnTemp.deleteFile();
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
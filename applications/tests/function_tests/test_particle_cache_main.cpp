@@ -0,0 +1,103 @@
+#include <data/particle_cache.h>
+#include <gtest/gtest.h>
+
+static void fillImage(MultidimArray<double> &I, double value)
+{
+    I.initZeros(8,8);
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(I)
+    DIRECT_A2D_ELEM(I,i,j)=value+i*8+j;
+}
+
+TEST( ParticleCacheTest, disabled)
+{
+    XMIPP_TRY
+    ParticleCache cache;
+    MultidimArray<double> I, Iout;
+    fillImage(I,0);
+    EXPECT_FALSE(cache.put(1,I));
+    EXPECT_FALSE(cache.get(1,Iout));
+    EXPECT_EQ(cache.size(),(size_t)0);
+    cache.initialize(0,8,8);
+    EXPECT_FALSE(cache.put(1,I));
+    XMIPP_CATCH
+}
+
+TEST( ParticleCacheTest, putGet)
+{
+    XMIPP_TRY
+    ParticleCache cache;
+    cache.initialize(2,8,8);
+    EXPECT_FALSE(cache.isMapped());
+    MultidimArray<double> I, Iout;
+    fillImage(I,0.5);
+    EXPECT_TRUE(cache.put(10,I));
+    EXPECT_FALSE(cache.get(11,Iout));
+    EXPECT_TRUE(cache.get(10,Iout));
+    EXPECT_EQ(Iout.yinit,-4);
+    EXPECT_EQ(Iout.xinit,-4);
+    FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(I)
+    EXPECT_DOUBLE_EQ(DIRECT_A2D_ELEM(Iout,i,j),DIRECT_A2D_ELEM(I,i,j));
+
+    // Overwriting does not take a new slot
+    fillImage(I,100);
+    EXPECT_TRUE(cache.put(10,I));
+    EXPECT_TRUE(cache.get(10,Iout));
+    EXPECT_DOUBLE_EQ(DIRECT_A2D_ELEM(Iout,0,0),100);
+    EXPECT_EQ(cache.size(),(size_t)1);
+
+    // Wrong size
+    MultidimArray<double> Ismall(4,4);
+    EXPECT_THROW(cache.put(12,Ismall),XmippError);
+    XMIPP_CATCH
+}
+
+TEST( ParticleCacheTest, full)
+{
+    XMIPP_TRY
+    // Nothing is evicted: once full, new images are not stored
+    ParticleCache cache;
+    cache.initialize(2,8,8);
+    MultidimArray<double> I, Iout;
+    fillImage(I,1);
+    EXPECT_TRUE(cache.put(1,I));
+    EXPECT_TRUE(cache.put(2,I));
+    EXPECT_FALSE(cache.put(3,I));
+    EXPECT_FALSE(cache.get(3,Iout));
+    EXPECT_TRUE(cache.get(1,Iout));
+    EXPECT_TRUE(cache.put(2,I));
+    EXPECT_EQ(cache.size(),(size_t)2);
+    EXPECT_EQ(cache.capacity(),(size_t)2);
+    cache.clear();
+    EXPECT_EQ(cache.size(),(size_t)0);
+    EXPECT_FALSE(cache.get(1,Iout));
+    XMIPP_CATCH
+}
+
+TEST( ParticleCacheTest, mmap)
+{
+    XMIPP_TRY
+    // With maxMB=0 any non empty stack is memory mapped
+    ParticleCache cache;
+    cache.initialize(3,8,8,0);
+    EXPECT_TRUE(cache.isMapped());
+    MultidimArray<double> I, Iout;
+    for (size_t n=0; n<3; ++n)
+    {
+        fillImage(I,n*1000);
+        EXPECT_TRUE(cache.put(n,I));
+    }
+    for (size_t n=0; n<3; ++n)
+    {
+        fillImage(I,n*1000);
+        EXPECT_TRUE(cache.get(n,Iout));
+        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(I)
+        EXPECT_DOUBLE_EQ(DIRECT_A2D_ELEM(Iout,i,j),DIRECT_A2D_ELEM(I,i,j));
+    }
+    XMIPP_CATCH
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,120 @@
+#include <classification/svm_classifier.h>
+#include <core/multidim_array.h>
+#include <iostream>
+#include <random>
+#include <gtest/gtest.h>
+
+class SVMTest : public ::testing::Test
+{
+protected:
+    // Two overlapping gaussian classes, with some exact zeros so that the
+    // sparse and dense representations differ. There are enough samples for
+    // the kernel columns to be split among threads
+    virtual void SetUp()
+    {
+        std::mt19937 generator(24);
+        std::normal_distribution<double> noise(0., 1.);
+        std::uniform_int_distribution<int> sparse(0, 6);
+        size_t n = 1500, dim = 10;
+        trainSet.initZeros(n, dim);
+        labels.initZeros(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            double label = (i % 3 == 0) ? 1 : 2;
+            DIRECT_A1D_ELEM(labels, i) = label;
+            for (size_t j = 0; j < dim; j++)
+                if (sparse(generator) != 0)
+                    DIRECT_A2D_ELEM(trainSet, i, j) = noise(generator) + (label == 1 ? 0.8 * (j % 2) : 0.);
+        }
+    }
+
+    // The probability model is estimated by cross validation on a random
+    // permutation, so all models are trained with the same seed
+    void train(SVMClassifier &classifier)
+    {
+        srand(24);
+        classifier.SVMTrain(trainSet, labels);
+    }
+
+    MultidimArray<double> trainSet, labels;
+};
+
+static void expectSameModel(const svm_model *A, const svm_model *B)
+{
+    ASSERT_EQ(A->nr_class, B->nr_class);
+    ASSERT_EQ(A->l, B->l);
+    for (int k = 0; k < A->nr_class; k++)
+    {
+        EXPECT_EQ(A->label[k], B->label[k]);
+        EXPECT_EQ(A->nSV[k], B->nSV[k]);
+    }
+    for (int i = 0; i < A->l; i++)
+    {
+        const svm_node *a = A->SV[i], *b = B->SV[i];
+        for (; a->index != -1 && b->index != -1; a++, b++)
+        {
+            EXPECT_EQ(a->index, b->index);
+            EXPECT_EQ(a->value, b->value);
+        }
+        EXPECT_EQ(a->index, b->index);
+        for (int k = 0; k < A->nr_class - 1; k++)
+            EXPECT_DOUBLE_EQ(A->sv_coef[k][i], B->sv_coef[k][i]);
+    }
+    int npairs = A->nr_class * (A->nr_class - 1) / 2;
+    for (int k = 0; k < npairs; k++)
+    {
+        EXPECT_DOUBLE_EQ(A->rho[k], B->rho[k]);
+        EXPECT_DOUBLE_EQ(A->probA[k], B->probA[k]);
+        EXPECT_DOUBLE_EQ(A->probB[k], B->probB[k]);
+    }
+}
+
+TEST_F( SVMTest, batchPredict)
+{
+    SVMClassifier classifier;
+    classifier.setParameters(1., 0.1);
+    train(classifier);
+
+    for (int threads : {1, 4})
+    {
+        classifier.setThreads(threads);
+        MultidimArray<double> batchLabels, batchScores, featVec;
+        classifier.predict(trainSet, batchLabels, batchScores);
+        ASSERT_EQ(XSIZE(batchLabels), YSIZE(trainSet));
+        ASSERT_EQ(XSIZE(batchScores), YSIZE(trainSet));
+        for (size_t i = 0; i < YSIZE(trainSet); i++)
+        {
+            trainSet.getRow(i, featVec);
+            double score;
+            double label = classifier.predict(featVec, score);
+            EXPECT_EQ(DIRECT_A1D_ELEM(batchLabels, i), label) << "row " << i;
+            EXPECT_DOUBLE_EQ(DIRECT_A1D_ELEM(batchScores, i), score) << "row " << i;
+        }
+    }
+}
+
+TEST_F( SVMTest, threadsAndPrecomputedKernel)
+{
+    SVMClassifier reference;
+    reference.setParameters(1., 0.1);
+    train(reference);
+
+    SVMClassifier threaded;
+    threaded.setParameters(1., 0.1);
+    threaded.setThreads(4);
+    train(threaded);
+    expectSameModel(reference.model, threaded.model);
+
+    SVMClassifier precomputed;
+    precomputed.setParameters(1., 0.1);
+    precomputed.setThreads(4);
+    precomputed.setKernelCache(100, true);
+    train(precomputed);
+    expectSameModel(reference.model, precomputed.model);
+}
+
+GTEST_API_ int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
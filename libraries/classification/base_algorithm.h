@@ -62,7 +62,7 @@ public:
      * Constructor.
      * Parameter: _ID an ID string unique for each algorithm class
      */
-    ClassificationAlgorithm(const std::string& _ID = ""): ID(_ID)
+    ClassificationAlgorithm(const std::string& _ID = ""): ID(_ID), threads(1)
     {};
 
     /**
@@ -131,9 +131,18 @@ public:
         listener = _listener;
     };
 
+    /** Number of threads used by the training loops of the algorithms that
+        support it (KerDenSOM, FuzzyCMeans)
+    */
+    void setThreads(int _threads)
+    {
+        threads = _threads;
+    };
+
 protected:
     std::string ID;// algorithm ID, an unique name to recognize the algorithm
     BaseListener* listener;   // Listener class
+    int threads;              // Number of threads
 
 };
 
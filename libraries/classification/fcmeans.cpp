@@ -27,7 +27,10 @@
 // Fuzzy c-means clustering algorithm
 //-----------------------------------------------------------------------------
 
+#include <algorithm>
+
 #include "fcmeans.h"
+#include "feature_matrix.h"
 
 /**  Ctor from stream
  * Parameter: _is Must have the parameters in the same order than the previous ctor.
@@ -67,13 +70,18 @@ void FuzzyCMeans::train(FuzzyCodeBook& _xmippDS, TS& _examples) const
 
     unsigned numClusters = _xmippDS.size();
     unsigned numVectors = _examples.size();
-    unsigned i, j, k;
+    unsigned i;
     double stopError = 0, auxError = 0;
-    double auxDist, auxProd, tmp, auxExp, auxSum;
+    double auxExp;
     unsigned t = 0;  // Iteration index
-    FeatureVector zero(_xmippDS.theItems[0].size()) ;
-    fill(zero.begin(), zero.end(), 0.0);
 
+    // Contiguous copies of the examples and the cluster centers
+    FeatureMatrix X(_examples.theItems);
+    FeatureMatrix V;
+    size_t dim = X.dim();
+    size_t stride = X.stride();
+    size_t nThreads = std::max(1, threads);
+    std::vector<double> sumMap, sumU;
 
     // Initialize auxiliary Codebook
 
@@ -90,54 +98,78 @@ void FuzzyCMeans::train(FuzzyCodeBook& _xmippDS, TS& _examples) const
 
     while ((stopError > epsilon) && (t < epochs))
     {
+        V.fromItems(_xmippDS.theItems);
+        sumMap.assign(nThreads * numClusters * stride, 0.);
+        sumU.assign(nThreads * numClusters, 0.);
 
-        // Update Membership matrix
-
-        for (k = 0; k < numVectors; k++)
+        // Update Membership matrix and accumulate the new code vectors.
+        // Each thread processes a chunk of the examples.
+        parallelRows(numVectors, threads, [&](int thread, size_t k0, size_t k1)
         {
-
-            auxProd = 1;
-            for (j = 0; j < numClusters; j++)
-                auxProd *= euclideanDistance(_xmippDS.theItems[j], _examples.theItems[k]);
-
-            if (auxProd == 0.)
-            { // Apply k-means criterion (Data-CB) must be > 0
-                for (j = 0; j < numClusters; j ++)
-                    if (euclideanDistance(_xmippDS.theItems[j], _examples.theItems[k]) == 0.)
-                        _xmippDS.memb[k][j] = 1.0;
-                    else
-                        _xmippDS.memb[k][j] =  0.0;
-            }
-            else
+            double auxDist, auxProd, tmp;
+            std::vector<double> dist(numClusters);
+            double *ptrSumMap = &sumMap[thread * numClusters * stride];
+            double *ptrSumU = &sumU[thread * numClusters];
+            for (size_t k = k0; k < k1; k++)
             {
-                for (i = 0; i < numClusters; i ++)
+                squaredDistances(X, k, k + 1, V, &dist[0]);
+                auxProd = 1;
+                for (size_t j = 0; j < numClusters; j++)
                 {
-                    auxDist = 0;
-                    for (j = 0; j < numClusters; j ++)
+                    dist[j] = sqrt(dist[j]);
+                    auxProd *= dist[j];
+                }
+
+                floatFeature *ptrMemb = &(_xmippDS.memb[k][0]);
+                if (auxProd == 0.)
+                { // Apply k-means criterion (Data-CB) must be > 0
+                    for (size_t j = 0; j < numClusters; j ++)
+                        if (dist[j] == 0.)
+                            ptrMemb[j] = 1.0;
+                        else
+                            ptrMemb[j] =  0.0;
+                }
+                else
+                {
+                    for (size_t i = 0; i < numClusters; i ++)
                     {
-                        tmp = euclideanDistance(_xmippDS.theItems[i], _examples.theItems[k]) /
-                              euclideanDistance(_xmippDS.theItems[j], _examples.theItems[k]);
-                        auxDist += pow(tmp, auxExp);
-                    } // for j
-                    _xmippDS.memb[k][i] = (floatFeature) 1.0 / auxDist;
-                } // for i
-            } // if auxProd
-        } // for k
+                        auxDist = 0;
+                        for (size_t j = 0; j < numClusters; j ++)
+                        {
+                            tmp = dist[i] / dist[j];
+                            auxDist += pow(tmp, auxExp);
+                        } // for j
+                        ptrMemb[i] = (floatFeature) 1.0 / auxDist;
+                    } // for i
+                } // if auxProd
+
+                const floatFeature *ptrExample = X.row(k);
+                for (size_t i = 0; i < numClusters; i++)
+                {
+                    double um = pow((double)(ptrMemb[i]), m);
+                    ptrSumU[i] += um;
+                    addScaledRow(ptrSumMap + i * stride, um, ptrExample, stride);
+                }
+            } // for k
+        });
 
 
         // Update code vectors (Cluster Centers)
 
         for (i = 0; i < numClusters; i++)
         {
-            _xmippDS.theItems[i] = zero;
-            auxSum = 0;
-            for (k = 0; k < numVectors; k++)
+            double auxSum = 0;
+            for (size_t th = 0; th < nThreads; th++)
+                auxSum += sumU[th * numClusters + i];
+            FeatureVector &codeVector = _xmippDS.theItems[i];
+            for (size_t j = 0; j < dim; j++)
             {
-                _xmippDS.theItems[i] += (floatFeature) pow((double)(_xmippDS.memb[k][i]), m) * _examples.theItems[k];
-                auxSum += pow((double)(_xmippDS.memb[k][i]), m);
-            } // for i
-            _xmippDS.theItems[i] /= (floatFeature) auxSum;
-        } // for k
+                double sum = 0;
+                for (size_t th = 0; th < nThreads; th++)
+                    sum += sumMap[(th * numClusters + i) * stride + j];
+                codeVector[j] = (floatFeature) (sum / auxSum);
+            }
+        } // for i
 
         // Compute stopping criterion
         stopError = 0;
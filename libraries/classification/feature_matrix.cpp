@@ -0,0 +1,126 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "feature_matrix.h"
+
+FeatureMatrix::FeatureMatrix(const std::vector<FeatureVector>& _items):
+        buffer(NULL), nRows(0), nDim(0), nStride(0)
+{
+    fromItems(_items);
+}
+
+FeatureMatrix::~FeatureMatrix()
+{
+    clear();
+}
+
+void FeatureMatrix::clear()
+{
+    free(buffer);
+    buffer = NULL;
+    nRows = nDim = nStride = 0;
+}
+
+void FeatureMatrix::resize(size_t _rows, size_t _dim)
+{
+    size_t stride = ((_dim + lanes - 1) / lanes) * lanes;
+    size_t bytes = _rows * stride * sizeof(floatFeature);
+    if (_rows * stride != nRows * nStride)
+    {
+        clear();
+        if (bytes > 0)
+        {
+            void* ptr;
+            if (posix_memalign(&ptr, 64, bytes) != 0)
+                throw std::bad_alloc();
+            buffer = (floatFeature*)ptr;
+        }
+    }
+    nRows = _rows;
+    nDim = _dim;
+    nStride = stride;
+    if (bytes > 0)
+        memset(buffer, 0, bytes);
+}
+
+void FeatureMatrix::fromItems(const std::vector<FeatureVector>& _items)
+{
+    size_t dim = _items.empty() ? 0 : _items[0].size();
+    resize(_items.size(), dim);
+    for (size_t i = 0; i < nRows; i++)
+    {
+        if (_items[i].size() != dim)
+            throw std::runtime_error("FeatureMatrix: vectors of different size");
+        if (dim > 0)
+            memcpy(row(i), &_items[i][0], dim * sizeof(floatFeature));
+    }
+}
+
+void FeatureMatrix::toItems(std::vector<FeatureVector>& _items) const
+{
+    _items.resize(nRows);
+    for (size_t i = 0; i < nRows; i++)
+    {
+        _items[i].resize(nDim);
+        if (nDim > 0)
+            memcpy(&_items[i][0], row(i), nDim * sizeof(floatFeature));
+    }
+}
+
+void squaredDistances(const FeatureMatrix& _X, size_t _i0, size_t _i1,
+                      const FeatureMatrix& _C, double* _D)
+{
+    if (_X.stride() != _C.stride())
+        throw std::runtime_error("squaredDistances: matrices of different dimension");
+    size_t stride = _X.stride();
+    size_t nC = _C.rows();
+    for (size_t i = _i0; i < _i1; i++)
+    {
+        const floatFeature* ptrX = _X.row(i);
+        for (size_t c = 0; c < nC; c++)
+            *_D++ = squaredDistance(ptrX, _C.row(c), stride);
+    }
+}
+
+void parallelRows(size_t _N, int _threads,
+                  const std::function<void (int, size_t, size_t)>& _f)
+{
+    size_t nThreads = std::max(1, _threads);
+    if (nThreads > _N)
+        nThreads = std::max((size_t)1, _N);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < nThreads; t++)
+        workers.emplace_back(_f, (int)t, (t * _N) / nThreads, ((t + 1) * _N) / nThreads);
+    _f(0, 0, _N / nThreads);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
@@ -0,0 +1,177 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+//-----------------------------------------------------------------------------
+// FeatureMatrix.h
+// Contiguous storage of feature vectors for the training loops
+//-----------------------------------------------------------------------------
+
+#ifndef XMIPPFEATUREMATRIX_H
+#define XMIPPFEATUREMATRIX_H
+
+#include <functional>
+
+#include "data_types.h"
+
+/**@defgroup FeatureMatrix Contiguous feature storage
+   @ingroup ClassificationLibrary */
+//@{
+/**
+ * Dense row-major storage of a set of feature vectors.
+ * The training sets and codebooks keep every item in its own std::vector,
+ * which is convenient but forces the inner loops to chase one pointer per
+ * item. The training algorithms copy them into a FeatureMatrix once and run
+ * over it. The buffer starts on a 64 byte boundary and every row is padded
+ * with zeros up to a multiple of FeatureMatrix::lanes (32 bytes), so that the
+ * kernels below work on whole blocks without remainder loops. The padding
+ * does not change any distance since it is zero in all rows.
+ */
+class FeatureMatrix
+{
+public:
+    /// Number of features processed together by the kernels
+    static const size_t lanes = 8;
+
+    /// Empty matrix
+    FeatureMatrix(): buffer(NULL), nRows(0), nDim(0), nStride(0)
+    {};
+
+    /// Copy of a set of items
+    FeatureMatrix(const std::vector<FeatureVector>& _items);
+
+    /// Destructor
+    ~FeatureMatrix();
+
+    /**
+     * Resizes the matrix, all the features are set to zero.
+     * Parameter: _rows  Number of rows
+     * Parameter: _dim   Number of features per row
+     */
+    void resize(size_t _rows, size_t _dim);
+
+    /**
+     * Copies a set of items, all of them must have the same size
+     * Parameter: _items  Feature vectors
+     */
+    void fromItems(const std::vector<FeatureVector>& _items);
+
+    /**
+     * Copies the rows back to a set of items. _items is resized if needed.
+     * Parameter: _items  Feature vectors
+     */
+    void toItems(std::vector<FeatureVector>& _items) const;
+
+    /// Releases the memory
+    void clear();
+
+    /// Number of rows
+    size_t rows() const
+    {
+        return nRows;
+    };
+
+    /// Number of features per row
+    size_t dim() const
+    {
+        return nDim;
+    };
+
+    /// Distance in floats between consecutive rows (multiple of lanes)
+    size_t stride() const
+    {
+        return nStride;
+    };
+
+    /// Pointer to the first feature of a row
+    floatFeature* row(size_t _i)
+    {
+        return buffer + _i * nStride;
+    };
+
+    /// Pointer to the first feature of a row
+    const floatFeature* row(size_t _i) const
+    {
+        return buffer + _i * nStride;
+    };
+
+private:
+    floatFeature* buffer;
+    size_t nRows, nDim, nStride;
+
+    FeatureMatrix(const FeatureMatrix&);
+    FeatureMatrix& operator=(const FeatureMatrix&);
+};
+
+/**
+ * Squared euclidean distance between two padded rows.
+ * _stride must be a multiple of FeatureMatrix::lanes. The lanes are
+ * accumulated separately in double precision, which lets the compiler turn
+ * the inner loop into vector instructions.
+ */
+inline double squaredDistance(const floatFeature* _a, const floatFeature* _b, size_t _stride)
+{
+    double acc[FeatureMatrix::lanes];
+    for (size_t l = 0; l < FeatureMatrix::lanes; l++)
+        acc[l] = 0.;
+    for (size_t j = 0; j < _stride; j += FeatureMatrix::lanes)
+        for (size_t l = 0; l < FeatureMatrix::lanes; l++)
+        {
+            double diff = (double)_a[j + l] - (double)_b[j + l];
+            acc[l] += diff * diff;
+        }
+    double sum = 0.;
+    for (size_t l = 0; l < FeatureMatrix::lanes; l++)
+        sum += acc[l];
+    return sum;
+}
+
+/**
+ * Adds a weighted row to a double accumulator: _acc += _w * _x.
+ * Both have _stride elements.
+ */
+inline void addScaledRow(double* _acc, double _w, const floatFeature* _x, size_t _stride)
+{
+    for (size_t j = 0; j < _stride; j++)
+        _acc[j] += _w * (double)_x[j];
+}
+
+/**
+ * Squared distances of a block of rows of _X to all the rows of _C.
+ * _D must have room for (_i1-_i0)*_C.rows() values, it is filled row by row.
+ */
+void squaredDistances(const FeatureMatrix& _X, size_t _i0, size_t _i1,
+                      const FeatureMatrix& _C, double* _D);
+
+/**
+ * Runs _f on consecutive chunks of [0,_N) in up to _threads threads.
+ * _f receives the thread index (0 is the calling thread) and the chunk
+ * limits [begin,end). The partition only depends on _N and _threads, so that
+ * sums accumulated per thread and added in thread order are reproducible.
+ */
+void parallelRows(size_t _N, int _threads,
+                  const std::function<void (int, size_t, size_t)>& _f);
+
+//@}
+#endif
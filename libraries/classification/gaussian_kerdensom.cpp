@@ -29,6 +29,7 @@
 // Uses a Gaussian Kernel Function.
 //-----------------------------------------------------------------------------
 
+#include <algorithm>
 #include <fstream>
 #include <ctime>
 
@@ -55,11 +56,8 @@ void GaussianKerDenSOM::train(FuzzyMap& _som, TS& _examples, FileName& _fn,
     dim = _examples.theItems[0].size();
     tmpV.resize(dim, 0.);
     tmpDens.resize(numNeurons, 0.);
-    tmpMap.resize(numNeurons);
-    for (size_t i = 0; i < numNeurons; i++)
-        tmpMap[i].resize(dim, 0.);
-    tmpD.resize(numNeurons);
-    tmpD1.resize(numNeurons);
+    packedTS = NULL; // The training set may have changed since the last call
+    packExamples(&_examples);
     double stopError;
 
     int verbosity = listener->getVerbosity();
@@ -232,9 +230,9 @@ void GaussianKerDenSOM::train(FuzzyMap& _som, TS& _examples, FileName& _fn,
     tmpV.clear();
     tmpDens.clear();
     tmpMap.clear();
-    tmpD.clear();
-    tmpD1.clear();
-
+    dataMatrix.clear();
+    codeMatrix.clear();
+    packedTS = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -244,58 +242,61 @@ void GaussianKerDenSOM::train(FuzzyMap& _som, TS& _examples, FileName& _fn,
 double GaussianKerDenSOM::updateU(FuzzyMap* _som, const TS* _examples,
 		                          const double& _sigma, double& _alpha)
 {
-    // Create auxiliar stuff
-    double auxDist;
-    double rr2, max1, d1, tmp, r1;
+    const FeatureMatrix &X = packExamples(_examples);
+    const FeatureMatrix &V = packCodeVectors(_som);
+    std::vector<double> partialAlpha(std::max(1, threads), 0.);
 
     double irr1 =1.0/( 2.0 * _sigma);
-    _alpha = 0;
+    double idim=1.0/dim;
 
     // Update Membership matrix
-    double *ptrTmpD=&tmpD[0];
-    double *ptrTmpD1=&tmpD1[0];
-    double idim=1.0/dim;
-    for (size_t k = 0; k < numVectors; k++)
+    parallelRows(numVectors, threads, [&](int thread, size_t k0, size_t k1)
     {
-        max1 = -MAXFLOAT;
-        const floatFeature *ptrExample=&(_examples->theItems[k][0]);
-        for (size_t i = 0; i < numNeurons; i ++)
+        // Create auxiliar stuff
+        double rr2, max1, d1, tmp, r1;
+        double alpha = 0;
+        std::vector<double> D(numNeurons), D1(numNeurons);
+        double *ptrTmpD=&D[0];
+        double *ptrTmpD1=&D1[0];
+        for (size_t k = k0; k < k1; k++)
         {
-            auxDist = 0;
-            const floatFeature *ptrCodeVector=&(_som->theItems[i][0]);
-            for (size_t j = 0; j < dim; j++)
+            max1 = -MAXFLOAT;
+            squaredDistances(X, k, k + 1, V, ptrTmpD);
+            for (size_t i = 0; i < numNeurons; i ++)
             {
-                double tmp=((double)ptrExample[j] - (double)ptrCodeVector[j]);
-                auxDist += tmp * tmp;
+                ptrTmpD[i] *= idim;
+                rr2 = -ptrTmpD[i] * irr1;
+                ptrTmpD1[i] = rr2;
+                if (max1 < rr2)
+                    max1 = rr2;
             }
-            auxDist*=idim;
-            ptrTmpD[i] = auxDist;
-            rr2 = -auxDist * irr1;
-            ptrTmpD1[i] = rr2;
-            if (max1 < rr2)
-                max1 = rr2;
-        }
-        r1 = 0;
-        for (size_t j = 0; j < numNeurons; j ++)
-        {
-            rr2 = ptrTmpD1[j] - max1;
-            if (rr2 < MAXZ)
-                d1 = 0;
-            else
-                d1 = (double)exp(rr2);
-            r1 += d1;
-            ptrTmpD1[j] = d1;
-        }
-        double ir1=1.0/r1;
+            r1 = 0;
+            for (size_t j = 0; j < numNeurons; j ++)
+            {
+                rr2 = ptrTmpD1[j] - max1;
+                if (rr2 < MAXZ)
+                    d1 = 0;
+                else
+                    d1 = (double)exp(rr2);
+                r1 += d1;
+                ptrTmpD1[j] = d1;
+            }
+            double ir1=1.0/r1;
 
-        floatFeature *ptrSomMembK=&(_som->memb[k][0]);
-        for (size_t j = 0; j < numNeurons; j ++)
-        {
-            tmp = ptrTmpD1[j] * ir1;
-            ptrSomMembK[j] = (floatFeature) tmp;
-            _alpha += tmp * ptrTmpD[j];
-        }
-    } // for k
+            floatFeature *ptrSomMembK=&(_som->memb[k][0]);
+            for (size_t j = 0; j < numNeurons; j ++)
+            {
+                tmp = ptrTmpD1[j] * ir1;
+                ptrSomMembK[j] = (floatFeature) tmp;
+                alpha += tmp * ptrTmpD[j];
+            }
+        } // for k
+        partialAlpha[thread] = alpha;
+    });
+
+    _alpha = 0;
+    for (size_t n = 0; n < partialAlpha.size(); n++)
+        _alpha += partialAlpha[n];
     return 0.0;
 }
 
@@ -327,20 +328,14 @@ double GaussianKerDenSOM::updateSigmaII(FuzzyMap* _som, const TS* _examples, con
 /**
  * Estimate the PD (Method 1: Using the code vectors)
  */
-double GaussianKerDenSOM::codeDens(const FuzzyMap* _som, const FeatureVector* _example, double _sigma) const
+double GaussianKerDenSOM::codeDens(const FeatureMatrix& _codeVectors, const floatFeature* _example, double _sigma) const
 {
     double s = 0;
     double K=-1.0/(2*_sigma);
-    const floatFeature *ptrExample=&((*_example)[0]);
+    size_t stride=_codeVectors.stride();
     for (size_t cc = 0; cc < numNeurons; cc++)
     {
-        double t = 0;
-        const floatFeature *ptrCodeVector=&(_som->theItems[cc][0]);
-        for (size_t j = 0; j < dim; j++)
-        {
-            double diff=(double)(ptrExample[j]) - (double)(ptrCodeVector[j]);
-            t += diff*diff;
-        }
+        double t = squaredDistance(_example, _codeVectors.row(cc), stride);
         t *= K;
         if (t < MAXZ)
             t = 0;
@@ -387,18 +382,28 @@ double GaussianKerDenSOM::functional(const TS* _examples, const FuzzyMap* _som,
 		                             double _sigma, double _reg, double& _likelihood,
 		                             double& _penalty)
 {
-    unsigned j, vv, cc;
+    unsigned j, cc;
     double t;
-    _likelihood = 0;
-    for (vv = 0; vv < numVectors; vv++)
+    const FeatureMatrix &X = packExamples(_examples);
+    const FeatureMatrix &V = packCodeVectors(_som);
+    std::vector<double> partialLikelihood(std::max(1, threads), 0.);
+    parallelRows(numVectors, threads, [&](int thread, size_t v0, size_t v1)
     {
-        t = codeDens(_som, &(_examples->theItems[vv]), _sigma);
-        if (t == 0)
+        double likelihood = 0;
+        for (size_t vv = v0; vv < v1; vv++)
         {
-            t = 1e-300;
+            double t = codeDens(V, X.row(vv), _sigma);
+            if (t == 0)
+            {
+                t = 1e-300;
+            }
+            likelihood += log(t);
         }
-        _likelihood += log(t);
-    }
+        partialLikelihood[thread] = likelihood;
+    });
+    _likelihood = 0;
+    for (size_t n = 0; n < partialLikelihood.size(); n++)
+        _likelihood += partialLikelihood[n];
     _likelihood = -_likelihood;
     _penalty = 0;
 
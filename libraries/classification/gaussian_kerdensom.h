@@ -93,7 +93,7 @@ protected:
     virtual double updateSigmaII(FuzzyMap* _som, const TS* _examples, const double& _reg, const double& _alpha);
 
     // Estimate the PD (Method 1: Using the code vectors)
-    virtual double codeDens(const FuzzyMap* _som, const FeatureVector* _example, double _sigma) const;
+    virtual double codeDens(const FeatureMatrix& _codeVectors, const floatFeature* _example, double _sigma) const;
 #ifdef UNUSED // detected as unused 29.6.2018
     // Estimate the PD (Method 2: Using the data)
     virtual double dataDens(const TS* _examples, const FeatureVector* _example, double _sigma) const;
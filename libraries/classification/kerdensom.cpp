@@ -29,6 +29,7 @@
 // This is an abstract base class for different variants of the KerDenSOM algorithm
 //-----------------------------------------------------------------------------
 
+#include <algorithm>
 #include <fstream>
 
 #include "kerdensom.h"
@@ -111,31 +112,87 @@ double KerDenSOM::test(const FuzzyMap& _som, const TS& _examples) const
 
 
 /**
- * Update Code Vectors
+ * Contiguous copy of the training set. It is only copied again when the
+ * training set changes.
  */
-void KerDenSOM::updateV(FuzzyMap* _som, const TS* _examples, const double& _reg)
+const FeatureMatrix& KerDenSOM::packExamples(const TS* _examples)
 {
-    unsigned t2 = 0;  // Iteration index
+    if (packedTS != _examples || dataMatrix.rows() != _examples->size())
+    {
+        dataMatrix.fromItems(_examples->theItems);
+        packedTS = _examples;
+    }
+    return dataMatrix;
+}
 
-    // Calculate Temporal scratch values
-    for (size_t cc = 0; cc < numNeurons; cc++)
+/**
+ * Contiguous copy of the code vectors
+ */
+const FeatureMatrix& KerDenSOM::packCodeVectors(const FuzzyMap* _som)
+{
+    codeMatrix.fromItems(_som->theItems);
+    return codeMatrix;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Weighted sums of the training vectors with the memberships of each neuron.
+ * The training set is scanned only once, each thread accumulates its own
+ * vectors and the partial sums are added at the end.
+ */
+void KerDenSOM::accumulateMemberships(const FuzzyMap* _som, const FeatureMatrix& _X)
+{
+    size_t stride = _X.stride();
+    size_t mapSize = numNeurons * stride;
+    size_t nThreads = std::max(1, threads);
+    tmpMap.assign(nThreads * mapSize, 0.);
+    tmpDens.assign(nThreads * numNeurons, 0.);
+
+    parallelRows(numVectors, threads, [&](int thread, size_t v0, size_t v1)
     {
-    	double *ptrTmpMap_cc=&(tmpMap[cc][0]);
-    	memset(ptrTmpMap_cc,0,dim*sizeof(double));
-    	double &tmpDens_cc=tmpDens[cc];
-        if (_reg != 0)
-        	tmpDens_cc = _reg * _som->getLayout().numNeig(_som, (SomPos) _som->indexToPos(cc));
-        else
-        	tmpDens_cc = 0.;
-        for (size_t vv = 0; vv < numVectors; vv++)
+        double *ptrTmpMap = &tmpMap[thread * mapSize];
+        double *ptrTmpDens = &tmpDens[thread * numNeurons];
+        for (size_t vv = v0; vv < v1; vv++)
         {
-            double tmpU = (double) _som->memb[vv][cc];
-            tmpDens_cc += tmpU;
-            const floatFeature * ptrExample=&(_examples->theItems[vv][0]);
-            for (size_t j = 0; j < dim; j++)
-            	ptrTmpMap_cc[j] +=  tmpU * ptrExample[j];
+            const floatFeature *ptrMemb = &(_som->memb[vv][0]);
+            const floatFeature *ptrExample = _X.row(vv);
+            for (size_t cc = 0; cc < numNeurons; cc++)
+            {
+                double tmpU = (double) ptrMemb[cc];
+                ptrTmpDens[cc] += tmpU;
+                addScaledRow(ptrTmpMap + cc * stride, tmpU, ptrExample, stride);
+            }
         }
+    });
+
+    for (size_t t = 1; t < nThreads; t++)
+    {
+        const double *ptrTmpMap_t = &tmpMap[t * mapSize];
+        for (size_t n = 0; n < mapSize; n++)
+            tmpMap[n] += ptrTmpMap_t[n];
+        const double *ptrTmpDens_t = &tmpDens[t * numNeurons];
+        for (size_t cc = 0; cc < numNeurons; cc++)
+            tmpDens[cc] += ptrTmpDens_t[cc];
     }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Update Code Vectors
+ */
+void KerDenSOM::updateV(FuzzyMap* _som, const TS* _examples, const double& _reg)
+{
+    unsigned t2 = 0;  // Iteration index
+
+    // Calculate Temporal scratch values
+    const FeatureMatrix &X = packExamples(_examples);
+    size_t stride = X.stride();
+    accumulateMemberships(_som, X);
+    if (_reg != 0)
+        for (size_t cc = 0; cc < numNeurons; cc++)
+            tmpDens[cc] += _reg * _som->getLayout().numNeig(_som, (SomPos) _som->indexToPos(cc));
 
     // Update Code vectors using a sort of Gauss-Seidel iterative algorithm.
     // Usually 100 iterations are enough.
@@ -150,7 +207,7 @@ void KerDenSOM::updateV(FuzzyMap* _som, const TS* _examples, const double& _reg)
         {
             if (_reg != 0)
                 _som->localAve(_som->indexToPos(cc), tmpV);
-        	double *ptrTmpMap_cc=&(tmpMap[cc][0]);
+        	double *ptrTmpMap_cc=&tmpMap[cc * stride];
         	double iTmpDens_cc=1.0/tmpDens[cc];
         	floatFeature *ptrCodeVector_cc=&(_som->theItems[cc][0]);
             for (size_t j = 0; j < dim; j++)
@@ -206,26 +263,28 @@ double KerDenSOM::mainIterations(FuzzyMap* _som, const TS* _examples, double& _s
 // Estimate Sigma Part I
 double KerDenSOM::updateSigmaI(FuzzyMap* _som, const TS* _examples)
 {
-    double t = 0;
+    const FeatureMatrix &X = packExamples(_examples);
+    const FeatureMatrix &V = packCodeVectors(_som);
+    size_t stride = X.stride();
+    std::vector<double> partial(std::max(1, threads), 0.);
 
     // Computing Sigma (Part I)
-    for (size_t vv = 0; vv < numVectors; vv++)
+    parallelRows(numVectors, threads, [&](int thread, size_t v0, size_t v1)
     {
-    	const FeatureVector &example=_examples->theItems[vv];
-    	const floatFeature *ptrExample0=&example[0];
-        for (size_t cc = 0; cc < numNeurons; cc++)
+        double t = 0;
+        for (size_t vv = v0; vv < v1; vv++)
         {
-            double r = 0.0;
-        	const floatFeature *ptrExample=ptrExample0;
-        	const floatFeature *ptrCodeVector=&(_som->theItems[cc][0]);
-            for (size_t j = 0; j < dim; j++)
-            {
-            	double diff=(double)(*ptrExample++) - (double)(*ptrCodeVector++);
-                r += diff*diff;
-            }
-            t += r * (double)(_som->memb[vv][cc]);
+            const floatFeature *ptrExample = X.row(vv);
+            const floatFeature *ptrMemb = &(_som->memb[vv][0]);
+            for (size_t cc = 0; cc < numNeurons; cc++)
+                t += squaredDistance(ptrExample, V.row(cc), stride) * (double)(ptrMemb[cc]);
         }
-    }
+        partial[thread] = t;
+    });
+
+    double t = 0;
+    for (size_t n = 0; n < partial.size(); n++)
+        t += partial[n];
     return (double)(t / (double)(numVectors*dim));
 }
 
@@ -241,36 +300,18 @@ double KerDenSOM::updateSigmaI(FuzzyMap* _som, const TS* _examples)
  */
 void KerDenSOM::updateV1(FuzzyMap* _som, const TS* _examples)
 {
-    for (size_t cc = 0; cc < numNeurons; cc++)
-    {
-    	std::vector<double> &tmpMap_cc=tmpMap[cc];
-    	double *ptrTmpMap_cc0=&tmpMap_cc[0];
-    	memset(ptrTmpMap_cc0,0,dim*sizeof(double));
-        double &tmpDens_cc=tmpDens[cc];
-        tmpDens_cc = 0.0;
-        for (size_t vv = 0; vv < numVectors; vv++)
-        {
-            double tmpU = _som->memb[vv][cc];
-            tmpDens_cc += tmpU;
-            const floatFeature *ptrExample=&(_examples->theItems[vv][0]);
-            double *ptrTmpMap_cc=ptrTmpMap_cc0;
-            for (size_t j = 0; j < dim; j++)
-            {
-            	*ptrTmpMap_cc += tmpU * (*ptrExample);
-            	++ptrExample;
-            	++ptrTmpMap_cc;
-            }
-        }
-    }
+    const FeatureMatrix &X = packExamples(_examples);
+    size_t stride = X.stride();
+    accumulateMemberships(_som, X);
 
     for (size_t cc = 0; cc < numNeurons; cc++)
     {
-    	const std::vector<double> &tmpMap_cc=tmpMap[cc];
+        const double *ptrTmpMap_cc = &tmpMap[cc * stride];
         double itmpDens_cc=1.0/tmpDens[cc];
     	FeatureVector &codevector=_som->theItems[cc];
         for (size_t j = 0; j < dim; j++)
         {
-            double tmpU =tmpMap_cc[j] * itmpDens_cc;
+            double tmpU =ptrTmpMap_cc[j] * itmpDens_cc;
             codevector[j] = (floatFeature) tmpU;
         }
     } // for
@@ -282,40 +323,48 @@ void KerDenSOM::updateV1(FuzzyMap* _som, const TS* _examples)
  */
 void KerDenSOM::updateU1(FuzzyMap* _som, const TS* _examples)
 {
-
-    double auxProd, auxDist, tmp;
-    size_t k, j, i;
+    const FeatureMatrix &X = packExamples(_examples);
+    const FeatureMatrix &V = packCodeVectors(_som);
 
     // Update Membership matrix
-    for (k = 0; k < numVectors; k++)
+    parallelRows(numVectors, threads, [&](int thread, size_t k0, size_t k1)
     {
-        auxProd = 1;
-        for (j = 0; j < numNeurons; j++)
-            auxProd *= euclideanDistance(_som->theItems[j], _examples->theItems[k]);
-
-        if (auxProd == 0.)
-        { // Apply k-means criterion (Data-CB) must be > 0
-            for (j = 0; j < numNeurons; j ++)
-                if (euclideanDistance(_som->theItems[j], _examples->theItems[k]) == 0.)
-                    _som->memb[k][j] = 1.0;
-                else
-                    _som->memb[k][j] =  0.0;
-        }
-        else
+        double auxProd, auxDist, tmp;
+        std::vector<double> dist(numNeurons);
+        for (size_t k = k0; k < k1; k++)
         {
-            for (i = 0; i < numNeurons; i ++)
+            squaredDistances(X, k, k + 1, V, &dist[0]);
+            auxProd = 1;
+            for (size_t j = 0; j < numNeurons; j++)
+            {
+                dist[j] = sqrt(dist[j]);
+                auxProd *= dist[j];
+            }
+
+            floatFeature *ptrMemb = &(_som->memb[k][0]);
+            if (auxProd == 0.)
+            { // Apply k-means criterion (Data-CB) must be > 0
+                for (size_t j = 0; j < numNeurons; j ++)
+                    if (dist[j] == 0.)
+                        ptrMemb[j] = 1.0;
+                    else
+                        ptrMemb[j] =  0.0;
+            }
+            else
             {
-                auxDist = 0;
-                for (j = 0; j < numNeurons; j ++)
+                for (size_t i = 0; i < numNeurons; i ++)
                 {
-                    tmp = euclideanDistance(_som->theItems[i], _examples->theItems[k]) /
-                    		euclideanDistance(_som->theItems[j], _examples->theItems[k]);
-                    auxDist += pow(tmp, 2);
-                } // for j
-                _som->memb[k][i] = (floatFeature) 1.0 / auxDist;
-            } // for i
-        } // if auxProd
-    } // for k
+                    auxDist = 0;
+                    for (size_t j = 0; j < numNeurons; j ++)
+                    {
+                        tmp = dist[i] / dist[j];
+                        auxDist += tmp * tmp;
+                    } // for j
+                    ptrMemb[i] = (floatFeature) 1.0 / auxDist;
+                } // for i
+            } // if auxProd
+        } // for k
+    });
 }
 
 //-----------------------------------------------------------------------------
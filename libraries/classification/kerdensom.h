@@ -34,6 +34,7 @@
 
 #include "base_algorithm.h"
 #include "map.h"
+#include "feature_matrix.h"
 
 /**@defgroup Kendersom Kendersom: Smoothly Distributed Kernel Probability Density Estimator Self Organizing Map
    @ingroup ClassificationLibrary */
@@ -56,7 +57,7 @@ public:
     KerDenSOM(double _reg0, double _reg1, unsigned long _annSteps,
                    double _epsilon, unsigned long _nSteps)
             : ClassificationAlgorithm<FuzzyMap>(), annSteps(_annSteps), reg0(_reg0), reg1(_reg1),
-            epsilon(_epsilon), somNSteps(_nSteps)
+            epsilon(_epsilon), somNSteps(_nSteps), packedTS(NULL)
     {};
 
     /**
@@ -132,8 +133,12 @@ protected:
     size_t numNeurons;
     size_t numVectors;
     size_t dim;
-    std::vector < std::vector<double> > tmpMap;
-    std::vector<double> tmpD, tmpD1, tmpDens, tmpV;
+    std::vector<double> tmpMap; // numNeurons x stride per thread
+    std::vector<double> tmpDens, tmpV;
+
+    // Contiguous copies of the training vectors and of the code vectors
+    FeatureMatrix dataMatrix, codeMatrix;
+    const TS* packedTS; // Training set currently copied in dataMatrix
 
 
     /** Declaration of virtual method */
@@ -148,8 +153,8 @@ protected:
     // Estimate Sigma II
     virtual double updateSigmaII(FuzzyMap* _som, const TS* _examples, const double& _reg, const double& _alpha) = 0;
 
-    // Estimate the PD (Method 1: Using the code vectors)
-    virtual double codeDens(const FuzzyMap* _som, const FeatureVector* _example, double _sigma) const = 0;
+    // Estimate the PD (Method 1: Using the code vectors, packed in a FeatureMatrix)
+    virtual double codeDens(const FeatureMatrix& _codeVectors, const floatFeature* _example, double _sigma) const = 0;
 
 #ifdef UNUSED // detected as unused 29.6.2018
     // Estimate the PD (Method 2: Using the data)
@@ -158,6 +163,16 @@ protected:
 
     /* Some other common methods */
 
+    // Contiguous copy of the training set, made only when it changes
+    const FeatureMatrix& packExamples(const TS* _examples);
+
+    // Contiguous copy of the code vectors (in codeMatrix)
+    const FeatureMatrix& packCodeVectors(const FuzzyMap* _som);
+
+    // tmpMap[cc] = sum_v memb[v][cc] x_v and tmpDens[cc] = sum_v memb[v][cc]
+    // (in the first numNeurons x stride values of tmpMap)
+    void accumulateMemberships(const FuzzyMap* _som, const FeatureMatrix& _X);
+
     // Update Code vectors
     virtual void updateV(FuzzyMap* _som, const TS* _examples, const double& _sigma);
 
@@ -29,6 +29,7 @@
 //-----------------------------------------------------------------------------
 
 #include "som.h"
+#include "feature_matrix.h"
 
 /**
  * Construct a SOM from the code vectors in a stream
@@ -84,25 +85,41 @@ void SOM::train(ClassificationMap& _som, ClassicTrainingVectors& _ts) const
         listener->OnInitOperation(somNSteps);
 
 
+    // Contiguous copies of the examples and the code vectors. The map is
+    // copied back when the training finishes.
+    FeatureMatrix X(_ts.theItems);
+    FeatureMatrix V(_som.theItems);
+    size_t stride = X.stride();
+    size_t numNeurons = V.rows();
+
     while (t < somNSteps)
     {
-        for (std::vector<SomIn>::iterator i = _ts.theItems.begin();
-             t < somNSteps && i < _ts.theItems.end() ; i++, t++)
+        for (size_t i = 0; t < somNSteps && i < X.rows() ; i++, t++)
         {
             // get the best matching.
-            SomIn& theBest = _som.test(*i)
-                             ;
+            const floatFeature *ptrExample = X.row(i);
+            size_t best = 0;
+            double bestDist = squaredDistance(ptrExample, V.row(0), stride);
+            for (size_t it = 1; it < numNeurons; it++)
+            {
+                double dist = squaredDistance(ptrExample, V.row(it), stride);
+                if (dist < bestDist)
+                {
+                    bestDist = dist;
+                    best = it;
+                }
+            }
             if (somNeigh == BUBBLE)
             { // Bubble
                 // update the neighborhood around the best one
-                std::vector<unsigned> neig = _som.neighborhood(_som.codVecPos(theBest),
+                std::vector<unsigned> neig = _som.neighborhood(_som.indexToPos(best),
                                              ceil(somRadius(t, somNSteps)));
+                double alpha = somAlpha(t, somNSteps);
                 for (std::vector<unsigned>::iterator it = neig.begin();it < neig.end();it++)
                 {
-                    SomIn& v = _som.theItems[*it]
-                               ;
-                    for (unsigned j = 0; j < v.size(); j++)
-                        v[j] += ((*i)[j] - v[j]) * somAlpha(t, somNSteps);
+                    floatFeature *v = V.row(*it);
+                    for (size_t j = 0; j < stride; j++)
+                        v[j] += (ptrExample[j] - v[j]) * alpha;
                 }
             }
             else
@@ -110,13 +127,14 @@ void SOM::train(ClassificationMap& _som, ClassicTrainingVectors& _ts) const
                 // update all neighborhood convoluted by a gaussian
                 double radius = somRadius(t, somNSteps);
                 double alpha = somAlpha(t, somNSteps);
-                for (unsigned it = 0 ; it < _som.size(); it++)
+                SomPos bestPos = _som.indexToPos(best);
+                for (unsigned it = 0 ; it < numNeurons; it++)
                 {
-                    double dist = _som.neighDist(_som.codVecPos(theBest), _som.indexToPos(it));
+                    double dist = _som.neighDist(bestPos, _som.indexToPos(it));
                     double alp = alpha * (double) exp((double)(-dist * dist / (2.0 * radius * radius)));
-                    SomIn& v = _som.theItems[it];
-                    for (unsigned j = 0; j < v.size(); j++)
-                        v[j] += ((*i)[j] - v[j]) * alp;
+                    floatFeature *v = V.row(it);
+                    for (size_t j = 0; j < stride; j++)
+                        v[j] += (ptrExample[j] - v[j]) * alp;
                 }
             } // else
 
@@ -132,6 +150,7 @@ void SOM::train(ClassificationMap& _som, ClassicTrainingVectors& _ts) const
             listener->OnReportOperation((std::string) s);
         }
     } // while t < somSteps
+    V.toItems(_som.theItems);
 
 
     if (verbosity == 1 || verbosity == 3)
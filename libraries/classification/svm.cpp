@@ -11,6 +11,11 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <locale.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "svm.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
@@ -79,6 +84,11 @@ public:
 	// (p >= len if nothing needs to be filled)
 	int get_data(const int index, Qfloat **data, int len);
 	void swap_index(int i, int j);	
+
+	// allocate all the columns with their full length l, so that nothing
+	// is ever evicted; columns[i] receives column i, which must be filled
+	// by the caller. Returns false (and does nothing) if they do not fit
+	bool allocate_all(Qfloat **columns);
 private:
 	int l;
 	long int size;
@@ -157,6 +167,23 @@ int Cache::get_data(const int index, Qfloat **data, int len)
 	return len;
 }
 
+bool Cache::allocate_all(Qfloat **columns)
+{
+	if(size < (long int)l * l)
+		return false;
+	for(int i=0;i<l;i++)
+	{
+		head_t *h = &head[i];
+		if(h->len) lru_delete(h);
+		h->data = (Qfloat *)realloc(h->data,sizeof(Qfloat)*l);
+		size -= l - h->len;
+		h->len = l;
+		lru_insert(h);
+		columns[i] = h->data;
+	}
+	return true;
+}
+
 void Cache::swap_index(int i, int j)
 {
 	if(i==j) return;
@@ -188,6 +215,90 @@ void Cache::swap_index(int i, int j)
 	}
 }
 
+//
+// Team of threads evaluating kernel values. The threads are created once
+// per kernel and wait between jobs, since a job (one column of Q) may take
+// only a few tens of microseconds. The calling thread works as thread 0.
+//
+class KernelThreads
+{
+public:
+	KernelThreads(int n);
+	~KernelThreads();
+	int size() const { return n; }
+
+	// run job(t) for t=0..n-1 and wait until all of them have finished
+	void run(const std::function<void (int)> &job);
+private:
+	int n;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	const std::function<void (int)> *job;
+	unsigned long generation;
+	int pending;
+	bool stop;
+	void work(int t);
+};
+
+KernelThreads::KernelThreads(int n_):n(max(n_,1)),job(NULL),generation(0),pending(0),stop(false)
+{
+	for(int t=1;t<n;t++)
+		workers.push_back(std::thread(&KernelThreads::work,this,t));
+}
+
+KernelThreads::~KernelThreads()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for(size_t t=0;t<workers.size();t++)
+		workers[t].join();
+}
+
+void KernelThreads::run(const std::function<void (int)> &job_)
+{
+	if(n==1)
+	{
+		job_(0);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &job_;
+		pending = n-1;
+		generation++;
+	}
+	wake.notify_all();
+	job_(0);
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock,[this]{ return pending==0; });
+	job = NULL;
+}
+
+void KernelThreads::work(int t)
+{
+	unsigned long seen = 0;
+	while(true)
+	{
+		const std::function<void (int)> *myJob;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock,[&]{ return stop || generation!=seen; });
+			if(stop)
+				return;
+			seen = generation;
+			myJob = job;
+		}
+		(*myJob)(t);
+		std::lock_guard<std::mutex> lock(mutex);
+		if(--pending==0)
+			done.notify_one();
+	}
+}
+
 //
 // Kernel evaluation
 //
@@ -221,7 +332,18 @@ protected:
 
 	double (Kernel::*kernel_function)(int i, int j) const;
 
+	// fill data[start,len) of column i of the kernel matrix, multiplied by
+	// y[i]*y[j] if y is not NULL. Long columns are split among the threads
+	void fill_column(int i, Qfloat *data, int start, int len, const schar *y) const;
+
+	// compute the whole l x l matrix at once if param.precompute_kernel
+	// is set and it fits in the cache. Only the upper triangle is evaluated
+	void fill_all_columns(Cache *cache, int l, const schar *y, const svm_parameter& param) const;
+
 private:
+	KernelThreads *threads;
+	void fill_column_range(int i, Qfloat *data, int start, int end, const schar *y) const;
+
 	const svm_node **x;
 	double *x_square;
 
@@ -287,14 +409,82 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 	}
 	else
 		x_square = 0;
+
+	threads = (param.nr_threads > 1) ? new KernelThreads(param.nr_threads) : NULL;
 }
 
 Kernel::~Kernel()
 {
+	delete threads;
 	delete[] x;
 	delete[] x_square;
 }
 
+// columns shorter than this are not worth waking up the threads
+#define MIN_PARALLEL_COLUMN 1024
+
+void Kernel::fill_column_range(int i, Qfloat *data, int start, int end, const schar *y) const
+{
+	if(y)
+		for(int j=start;j<end;j++)
+			data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
+	else
+		for(int j=start;j<end;j++)
+			data[j] = (Qfloat)(this->*kernel_function)(i,j);
+}
+
+void Kernel::fill_column(int i, Qfloat *data, int start, int len, const schar *y) const
+{
+	if(threads == NULL || len-start < MIN_PARALLEL_COLUMN)
+	{
+		fill_column_range(i,data,start,len,y);
+		return;
+	}
+	int n = threads->size();
+	threads->run([&](int t)
+	{
+		int j0 = start + (int)((long int)(len-start)*t/n);
+		int j1 = start + (int)((long int)(len-start)*(t+1)/n);
+		fill_column_range(i,data,j0,j1,y);
+	});
+}
+
+void Kernel::fill_all_columns(Cache *cache, int l, const schar *y, const svm_parameter& param) const
+{
+	if(!param.precompute_kernel)
+		return;
+	std::vector<Qfloat *> columns(l);
+	if(l == 0 || !cache->allocate_all(&columns[0]))
+	{
+		info("Kernel matrix does not fit in the cache, it will be computed on demand\n");
+		return;
+	}
+
+	// the rows are dealt cyclically to balance the triangles among threads
+	int n = threads ? threads->size() : 1;
+	std::function<void (int)> upper = [&](int t)
+	{
+		for(int i=t;i<l;i+=n)
+			fill_column_range(i,columns[i],i,l,y);
+	};
+	std::function<void (int)> lower = [&](int t)
+	{
+		for(int i=t;i<l;i+=n)
+			for(int j=0;j<i;j++)
+				columns[i][j] = columns[j][i];
+	};
+	if(threads)
+	{
+		threads->run(upper);
+		threads->run(lower);
+	}
+	else
+	{
+		upper(0);
+		lower(0);
+	}
+}
+
 double Kernel::dot(const svm_node *px, const svm_node *py)
 {
 	double sum = 0;
@@ -1278,17 +1468,15 @@ public:
 		QD = new double[prob.l];
 		for(int i=0;i<prob.l;i++)
 			QD[i] = (this->*kernel_function)(i,i);
+		fill_all_columns(cache,prob.l,y,param);
 	}
 	
 	Qfloat *get_Q(int i, int len) const
 	{
 		Qfloat *data;
-		int start, j;
+		int start;
 		if((start = cache->get_data(i,&data,len)) < len)
-		{
-			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
-		}
+			fill_column(i,data,start,len,y);
 		return data;
 	}
 
@@ -1327,17 +1515,15 @@ public:
 		QD = new double[prob.l];
 		for(int i=0;i<prob.l;i++)
 			QD[i] = (this->*kernel_function)(i,i);
+		fill_all_columns(cache,prob.l,NULL,param);
 	}
 	
 	Qfloat *get_Q(int i, int len) const
 	{
 		Qfloat *data;
-		int start, j;
+		int start;
 		if((start = cache->get_data(i,&data,len)) < len)
-		{
-			for(j=start;j<len;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(i,j);
-		}
+			fill_column(i,data,start,len,NULL);
 		return data;
 	}
 
@@ -1386,6 +1572,7 @@ public:
 		buffer[0] = new Qfloat[2*l];
 		buffer[1] = new Qfloat[2*l];
 		next_buffer = 0;
+		fill_all_columns(cache,l,NULL,param);
 	}
 
 	void swap_index(int i, int j) const
@@ -1400,10 +1587,7 @@ public:
 		Qfloat *data;
 		int j, real_i = index[i];
 		if(cache->get_data(real_i,&data,l) < l)
-		{
-			for(j=0;j<l;j++)
-				data[j] = (Qfloat)(this->*kernel_function)(real_i,j);
-		}
+			fill_column(real_i,data,0,l,NULL);
 
 		// reorder and copy
 		Qfloat *buf = buffer[next_buffer];
@@ -2463,7 +2647,9 @@ double svm_get_svr_probability(const svm_model *model)
 }
 #endif
 
-double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+// decision values and predicted label from the kernel values between
+// the sample and every support vector
+static double svm_predict_from_kernel(const svm_model *model, const double *kvalue, double* dec_values)
 {
 	int i;
 	if(model->param.svm_type == ONE_CLASS ||
@@ -2473,7 +2659,7 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 		double *sv_coef = model->sv_coef[0];
 		double sum = 0;
 		for(i=0;i<model->l;i++)
-			sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
+			sum += sv_coef[i] * kvalue[i];
 		sum -= model->rho[0];
 		*dec_values = sum;
 
@@ -2485,11 +2671,6 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 	else
 	{
 		int nr_class = model->nr_class;
-		int l = model->l;
-		
-		double *kvalue = Malloc(double,l);
-		for(i=0;i<l;i++)
-			kvalue[i] = Kernel::k_function(x,model->SV[i],model->param);
 
 		int *start = Malloc(int,nr_class);
 		start[0] = 0;
@@ -2532,23 +2713,71 @@ double svm_predict_values(const svm_model *model, const svm_node *x, double* dec
 			if(vote[i] > vote[vote_max_idx])
 				vote_max_idx = i;
 
-		free(kvalue);
 		free(start);
 		free(vote);
 		return model->label[vote_max_idx];
 	}
 }
 
-double svm_predict(const svm_model *model, const svm_node *x)
+// class probabilities and most probable label from the pairwise decision
+// values of a C_SVC/NU_SVC model with probability information
+static double svm_probability_from_decision(const svm_model *model, const double *dec_values, double *prob_estimates)
 {
+	int i;
 	int nr_class = model->nr_class;
-	double *dec_values;
+	double min_prob=1e-7;
+	double **pairwise_prob=Malloc(double *,nr_class);
+	for(i=0;i<nr_class;i++)
+		pairwise_prob[i]=Malloc(double,nr_class);
+	int k=0;
+	for(i=0;i<nr_class;i++)
+		for(int j=i+1;j<nr_class;j++)
+		{
+			pairwise_prob[i][j]=min(max(sigmoid_predict(dec_values[k],model->probA[k],model->probB[k]),min_prob),1-min_prob);
+			pairwise_prob[j][i]=1-pairwise_prob[i][j];
+			k++;
+		}
+	multiclass_probability(nr_class,pairwise_prob,prob_estimates);
+
+	int prob_max_idx = 0;
+	for(i=1;i<nr_class;i++)
+		if(prob_estimates[i] > prob_estimates[prob_max_idx])
+			prob_max_idx = i;
+	for(i=0;i<nr_class;i++)
+		free(pairwise_prob[i]);
+	free(pairwise_prob);
+	return model->label[prob_max_idx];
+}
+
+static bool svm_has_probability(const svm_model *model)
+{
+	return (model->param.svm_type == C_SVC || model->param.svm_type == NU_SVC) &&
+	       model->probA!=NULL && model->probB!=NULL;
+}
+
+static int svm_nr_dec_values(const svm_model *model)
+{
 	if(model->param.svm_type == ONE_CLASS ||
 	   model->param.svm_type == EPSILON_SVR ||
 	   model->param.svm_type == NU_SVR)
-		dec_values = Malloc(double, 1);
-	else 
-		dec_values = Malloc(double, nr_class*(nr_class-1)/2);
+		return 1;
+	return model->nr_class*(model->nr_class-1)/2;
+}
+
+double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+{
+	int l = model->l;
+	double *kvalue = Malloc(double,l);
+	for(int i=0;i<l;i++)
+		kvalue[i] = Kernel::k_function(x,model->SV[i],model->param);
+	double label = svm_predict_from_kernel(model,kvalue,dec_values);
+	free(kvalue);
+	return label;
+}
+
+double svm_predict(const svm_model *model, const svm_node *x)
+{
+	double *dec_values = Malloc(double, svm_nr_dec_values(model));
 	double pred_result = svm_predict_values(model, x, dec_values);
 	free(dec_values);
 	return pred_result;
@@ -2557,40 +2786,194 @@ double svm_predict(const svm_model *model, const svm_node *x)
 double svm_predict_probability(
 	const svm_model *model, const svm_node *x, double *prob_estimates)
 {
-	if ((model->param.svm_type == C_SVC || model->param.svm_type == NU_SVC) &&
-	    model->probA!=NULL && model->probB!=NULL)
+	if (svm_has_probability(model))
 	{
-		int i;
-		int nr_class = model->nr_class;
-		double *dec_values = Malloc(double, nr_class*(nr_class-1)/2);
+		double *dec_values = Malloc(double, svm_nr_dec_values(model));
 		svm_predict_values(model, x, dec_values);
+		double label = svm_probability_from_decision(model, dec_values, prob_estimates);
+		free(dec_values);
+		return label;
+	}
+	else 
+		return svm_predict(model, x);
+}
 
-		double min_prob=1e-7;
-		double **pairwise_prob=Malloc(double *,nr_class);
-		for(i=0;i<nr_class;i++)
-			pairwise_prob[i]=Malloc(double,nr_class);
-		int k=0;
-		for(i=0;i<nr_class;i++)
-			for(int j=i+1;j<nr_class;j++)
+//
+// Batch prediction of dense samples. The support vectors are copied once
+// into a dense, transposed layout in blocks of SV_BLOCK vectors, so that
+// the kernel values of one sample against a whole block are accumulated
+// with unit stride (and the compiler can vectorize across support vectors).
+// Every kernel value is accumulated in the same index order as the sparse
+// Kernel::k_function, so the results are the same as svm_predict_probability
+//
+#define SV_BLOCK 8
+
+class DenseSupportVectors
+{
+public:
+	DenseSupportVectors(const svm_model *model, int dim);
+	~DenseSupportVectors() { free(sv); }
+
+	// number of components of the dense support vectors
+	int size() const { return dim; }
+
+	// kernel values between the sample and all SVs. x has the sample size,
+	// xpad is NULL if it equals size() or a zero padded copy of x otherwise
+	void kernel(const double *x, double *xpad, double *kvalue) const;
+private:
+	const svm_parameter& param;
+	int l, dim, nblock;
+	double *sv; // sv[(b*dim+j)*SV_BLOCK+k] is component j of SV b*SV_BLOCK+k
+};
+
+DenseSupportVectors::DenseSupportVectors(const svm_model *model, int dim_):param(model->param)
+{
+	l = model->l;
+	// support vectors may have nonzero components beyond the sample size
+	dim = dim_;
+	for(int i=0;i<l;i++)
+		for(const svm_node *p=model->SV[i];p->index!=-1;++p)
+			dim = max(dim,p->index);
+	nblock = (l+SV_BLOCK-1)/SV_BLOCK;
+	sv = Malloc(double,(size_t)nblock*dim*SV_BLOCK+1);
+	memset(sv,0,sizeof(double)*((size_t)nblock*dim*SV_BLOCK+1));
+	for(int i=0;i<l;i++)
+	{
+		double *block = sv+(size_t)(i/SV_BLOCK)*dim*SV_BLOCK+i%SV_BLOCK;
+		for(const svm_node *p=model->SV[i];p->index!=-1;++p)
+			if(p->index>=1)
+				block[(size_t)(p->index-1)*SV_BLOCK] = p->value;
+	}
+}
+
+void DenseSupportVectors::kernel(const double *x, double *xpad, double *kvalue) const
+{
+	const double *xx = xpad ? xpad : x;
+	for(int b=0;b<nblock;b++)
+	{
+		const double *block = sv+(size_t)b*dim*SV_BLOCK;
+		double acc[SV_BLOCK];
+		for(int k=0;k<SV_BLOCK;k++)
+			acc[k] = 0;
+		if(param.kernel_type == RBF)
+			for(int j=0;j<dim;j++)
+			{
+				double xj = xx[j];
+				const double *s = block+(size_t)j*SV_BLOCK;
+				for(int k=0;k<SV_BLOCK;k++)
+				{
+					double d = xj-s[k];
+					acc[k] += d*d;
+				}
+			}
+		else
+			for(int j=0;j<dim;j++)
+			{
+				double xj = xx[j];
+				const double *s = block+(size_t)j*SV_BLOCK;
+				for(int k=0;k<SV_BLOCK;k++)
+					acc[k] += xj*s[k];
+			}
+		int kmax = min(SV_BLOCK,l-b*SV_BLOCK);
+		double *kv = kvalue+b*SV_BLOCK;
+		for(int k=0;k<kmax;k++)
+			switch(param.kernel_type)
 			{
-				pairwise_prob[i][j]=min(max(sigmoid_predict(dec_values[k],model->probA[k],model->probB[k]),min_prob),1-min_prob);
-				pairwise_prob[j][i]=1-pairwise_prob[i][j];
-				k++;
+				case LINEAR1:
+					kv[k] = acc[k];
+					break;
+				case POLY:
+					kv[k] = powi(param.gamma*acc[k]+param.coef0,param.degree);
+					break;
+				case RBF:
+					kv[k] = exp(-param.gamma*acc[k]);
+					break;
+				case SIGMOID:
+					kv[k] = tanh(param.gamma*acc[k]+param.coef0);
+					break;
+				default:
+					kv[k] = 0;
 			}
-		multiclass_probability(nr_class,pairwise_prob,prob_estimates);
+	}
+}
 
-		int prob_max_idx = 0;
-		for(i=1;i<nr_class;i++)
-			if(prob_estimates[i] > prob_estimates[prob_max_idx])
-				prob_max_idx = i;
-		for(i=0;i<nr_class;i++)
-			free(pairwise_prob[i]);
+void svm_predict_dense(const svm_model *model, const double *x, int n, int dim,
+		       double *labels, double *prob_estimates, int nr_threads)
+{
+	if(n<=0)
+		return;
+	int nr_class = model->nr_class;
+	bool probability = prob_estimates!=NULL && svm_has_probability(model);
+	nr_threads = max(1,min(nr_threads,n));
+
+	if(model->param.kernel_type == PRECOMPUTED)
+	{
+		// there is nothing to vectorize, use the sparse path
+		std::function<void (int)> job = [&](int t)
+		{
+			svm_node *node = Malloc(svm_node,dim+1);
+			for(int i=(int)((long int)n*t/nr_threads);i<(int)((long int)n*(t+1)/nr_threads);i++)
+			{
+				const double *xi = x+(size_t)i*dim;
+				int cnt = 0;
+				for(int j=0;j<dim;j++)
+					if(xi[j]!=0)
+					{
+						node[cnt].index = j+1;
+						node[cnt].value = xi[j];
+						cnt++;
+					}
+				node[cnt].index = -1;
+				if(probability)
+					labels[i] = svm_predict_probability(model,node,prob_estimates+(size_t)i*nr_class);
+				else
+					labels[i] = svm_predict(model,node);
+			}
+			free(node);
+		};
+		std::vector<std::thread> workers;
+		for(int t=1;t<nr_threads;t++)
+			workers.push_back(std::thread(job,t));
+		job(0);
+		for(size_t t=0;t<workers.size();t++)
+			workers[t].join();
+		return;
+	}
+
+	DenseSupportVectors SV(model,dim);
+	int svdim = SV.size();
+
+	std::function<void (int)> job = [&](int t)
+	{
+		double *kvalue = Malloc(double,model->l+SV_BLOCK);
+		double *dec_values = Malloc(double,svm_nr_dec_values(model));
+		double *xpad = NULL;
+		if(svdim>dim)
+		{
+			xpad = Malloc(double,svdim);
+			for(int j=dim;j<svdim;j++)
+				xpad[j] = 0;
+		}
+		for(int i=(int)((long int)n*t/nr_threads);i<(int)((long int)n*(t+1)/nr_threads);i++)
+		{
+			const double *xi = x+(size_t)i*dim;
+			if(xpad)
+				memcpy(xpad,xi,sizeof(double)*dim);
+			SV.kernel(xi,xpad,kvalue);
+			labels[i] = svm_predict_from_kernel(model,kvalue,dec_values);
+			if(probability)
+				labels[i] = svm_probability_from_decision(model,dec_values,prob_estimates+(size_t)i*nr_class);
+		}
+		free(xpad);
 		free(dec_values);
-		free(pairwise_prob);	     
-		return model->label[prob_max_idx];
-	}
-	else 
-		return svm_predict(model, x);
+		free(kvalue);
+	};
+	std::vector<std::thread> workers;
+	for(int t=1;t<nr_threads;t++)
+		workers.push_back(std::thread(job,t));
+	job(0);
+	for(size_t t=0;t<workers.size();t++)
+		workers[t].join();
 }
 
 static const char *svm_type_table[] =
@@ -2730,6 +3113,8 @@ svm_model *svm_load_model(const char *model_file_name)
 
 	svm_model *model = Malloc(svm_model,1);
 	svm_parameter& param = model->param;
+	param.nr_threads = 1;
+	param.precompute_kernel = 0;
 	model->rho = NULL;
 	model->probA = NULL;
 	model->probB = NULL;
@@ -3014,6 +3399,9 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 	if(param->cache_size <= 0)
 		return "cache_size <= 0";
 
+	if(param->nr_threads < 1)
+		return "nr_threads < 1";
+
 	if(param->eps <= 0)
 		return "eps <= 0";
 
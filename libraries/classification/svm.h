@@ -48,6 +48,8 @@ struct svm_parameter
 	double p;	/* for EPSILON_SVR */
 	int shrinking;	/* use the shrinking heuristics */
 	int probability; /* do probability estimates */
+	int nr_threads;	/* threads computing the kernel columns */
+	int precompute_kernel; /* compute the whole kernel matrix before training if it fits in cache_size */
 };
 
 //
@@ -95,6 +97,12 @@ double svm_predict_values(const struct svm_model *model, const struct svm_node *
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
 
+/* Predict n dense samples stored row by row in x (n x dim, component j is
+   feature index j+1). prob_estimates (n x nr_class) may be NULL; it is only
+   filled for models with probability information */
+void svm_predict_dense(const struct svm_model *model, const double *x, int n, int dim,
+		       double *labels, double *prob_estimates, int nr_threads);
+
 void svm_free_model_content(struct svm_model *model_ptr);
 void svm_free_and_destroy_model(struct svm_model **model_ptr_ptr);
 void svm_destroy_param(struct svm_parameter *param);
@@ -51,10 +51,21 @@ void SVMClassifier::setParameters(double c,double gamma)
     param.nr_weight = 0;
     param.weight_label = NULL;
     param.weight = NULL;
+    param.nr_threads = 1;
+    param.precompute_kernel = 0;
     model=NULL;
     prob.y=NULL;
     prob.x=NULL;
 }
+void SVMClassifier::setThreads(int nthreads)
+{
+    param.nr_threads = std::max(nthreads,1);
+}
+void SVMClassifier::setKernelCache(double cacheSizeMB, bool precompute)
+{
+    param.cache_size = cacheSizeMB;
+    param.precompute_kernel = precompute ? 1 : 0;
+}
 SVMClassifier::~SVMClassifier()
 {
     svm_free_and_destroy_model(&model);
@@ -132,6 +143,32 @@ double SVMClassifier::predict(MultidimArray<double> &featVec,double &score)
     delete [] x_space;
     return label;
 }
+void SVMClassifier::predict(const MultidimArray<double> &featVecs, MultidimArray<double> &labels,
+                            MultidimArray<double> &scores)
+{
+    int n=YSIZE(featVecs);
+    int nr_class=svm_get_nr_class(model);
+    labels.initZeros(n);
+    scores.initZeros(n);
+    if (n==0)
+        return;
+    double *prob_estimates=new double[(size_t)n*nr_class];
+    for (size_t i=0;i<(size_t)n*nr_class;i++)
+        prob_estimates[i]=0;
+    svm_predict_dense(model,MULTIDIM_ARRAY(featVecs),n,XSIZE(featVecs),
+                      MULTIDIM_ARRAY(labels),prob_estimates,param.nr_threads);
+    // Extracting the probability of the selected class
+    for (int i=0;i<n;i++)
+    {
+        const double *p=prob_estimates+(size_t)i*nr_class;
+        double score=p[0];
+        for (int k=1;k<nr_class;++k)
+            if (p[k]>score)
+                score=p[k];
+        DIRECT_A1D_ELEM(scores,i)=score;
+    }
+    delete [] prob_estimates;
+}
 void SVMClassifier::SaveModel(const FileName &fnModel)
 {
     if (model->l!=0)
@@ -51,9 +51,20 @@ public:
     ~SVMClassifier();
     void SVMTrain(MultidimArray<double> &trainSet,MultidimArray<double> &lable);
     double  predict(MultidimArray<double> &featVec,double &score);
+    /** Predict the label and score of every row of featVecs at once.
+     *  Rows are split among the threads set with setThreads.
+     */
+    void predict(const MultidimArray<double> &featVecs, MultidimArray<double> &labels,
+                 MultidimArray<double> &scores);
     void SaveModel(const FileName &fnModel);
     void LoadModel(const FileName &fnModel);
     void setParameters(double c,double gamma);
+    /// Threads used to compute the kernel in training and batch prediction
+    void setThreads(int nthreads);
+    /** Kernel cache size in MB. If precompute is true and the whole kernel
+     *  matrix fits in the cache, it is computed before training.
+     */
+    void setKernelCache(double cacheSizeMB, bool precompute);
 #ifdef UNUSED // detected as unused 29.6.2018
     int getNumClasses();
 #endif
@@ -0,0 +1,76 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef LIBRARIES_DATA_BENCHMARK_H_
+#define LIBRARIES_DATA_BENCHMARK_H_
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <core/xmipp_strings.h>
+
+/**@defgroup Benchmark Helpers of the benchmark programs
+   @ingroup DataLibrary */
+//@{
+
+/** Wall time in seconds of a call to f. */
+inline double wallTime(const std::function<void()> &f)
+{
+    auto t0=std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+}
+
+/** Header of the table printed by reportThreadScaling.
+ * units is the name of the speed column, e.g. "images/s".
+ */
+inline void reportThreadScalingHeader(const String &units, std::ostream &out=std::cout)
+{
+    out << formatString("%-9s %7s %11s %9s %11s","engine","threads",units.c_str(),"speed-up","efficiency")
+        << std::endl;
+}
+
+/** Speed of an engine with 1, 2, 4, ... maxThreads threads.
+ * speed(threads) returns the items processed per second. One row is printed
+ * for each number of threads with the speed, the speed-up over one thread
+ * and the parallel efficiency. The speed with one thread is returned.
+ */
+inline double reportThreadScaling(const String &engine, int maxThreads,
+                                  const std::function<double(int)> &speed,
+                                  std::ostream &out=std::cout)
+{
+    double speed1=0;
+    for (int threads=1; threads<=maxThreads; threads*=2)
+    {
+        double s=speed(threads);
+        if (threads==1)
+            speed1=s;
+        out << formatString("%-9s %7d %11.1f %9.2f %11.2f",
+                            engine.c_str(),threads,s,s/speed1,s/(speed1*threads)) << std::endl;
+    }
+    return speed1;
+}
+//@}
+#endif /* LIBRARIES_DATA_BENCHMARK_H_ */
@@ -0,0 +1,101 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef LIBRARIES_DATA_BOUNDED_QUEUE_H_
+#define LIBRARIES_DATA_BOUNDED_QUEUE_H_
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Thread-safe FIFO queue with limited capacity, meant for producer/consumer
+ * pipelines (e.g. a reader thread prefetching data for worker threads).
+ * Producers block while the queue is full, consumers block while it is empty.
+ * Once closed, no more items are accepted and consumers drain the rest.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) :
+            capacity(capacity), closed(false) {
+    }
+
+    /**
+     * Inserts item to the queue, waiting until there is a space for it
+     * @return false if the queue has been closed (item is not inserted)
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] {return closed || (items.size() < capacity);});
+        if (closed) {
+            return false;
+        }
+        items.push(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * Removes the oldest item from the queue, waiting until there is some
+     * @return false if the queue has been closed and there are no more items
+     */
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] {return closed || ! items.empty();});
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop();
+        notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * No more items will be inserted. Waiting threads are woken up.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+
+private:
+    const size_t capacity;
+    bool closed;
+    std::queue<T> items;
+    mutable std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+#endif /* LIBRARIES_DATA_BOUNDED_QUEUE_H_ */
@@ -27,6 +27,9 @@
 #include <core/xmipp_fft.h>
 #include <core/xmipp_fftw.h>
 #include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 bool containsCTFBasicLabels(const MetaData & md)
 {
@@ -1817,5 +1820,118 @@ void CTFDescription::forcePhysicalMeaning()
 }
 #undef DEBUG
 
+/* Evaluate a row of the CTF ---------------------------------------------- */
+template <typename T>
+void CTFDescription::evaluateCTFRow(const T *fx, T fy, int n, T *out, bool damping) const
+{
+    const T k1=(T)K1, k2=(T)K2, k3=(T)K3, k6=(T)K6, k7=(T)K7;
+    const T ksin=(T)Ksin, kcos=(T)Kcos, gain=(T)K;
+    const T defocusAvg=(T)defocus_average, defocusDev=(T)defocus_deviation;
+    const T cos2az=(T)cos(2*rad_azimuth), sin2az=(T)sin(2*rad_azimuth);
+    const T r0=(T)envR0, r1=(T)envR1, r2=(T)envR2;
+    // The phase plate term vanishes with a zero gain
+    const bool hasVPP=round(VPP_radius*1000)!=0;
+    const T vppGain=hasVPP ? (T)(-phase_shift) : (T)0;
+    const T vppScale=hasVPP ? (T)(1.0/(2*VPP_radius*VPP_radius)) : (T)0;
+    const T fy2=fy*fy;
+
+    const int chunk=256;
+    T u2[chunk], u[chunk], deltaf[chunk], E[chunk];
+    for (int j0=0; j0<n; j0+=chunk)
+    {
+        int m=std::min(chunk, n-j0);
+        const T *x=fx+j0;
+        T *ctf=out+j0;
+
+        // Defocus and phase. cos(2(ang-azimuth)) is expanded in terms of
+        // cos(2 ang)=(x^2-y^2)/u^2 and sin(2 ang)=2xy/u^2 to avoid atan2.
+        // At the origin deltaf is irrelevant because it always goes with u.
+        for (int k=0; k<m; ++k)
+        {
+            T x2=x[k]*x[k];
+            T u2k=x2+fy2;
+            T iu2=u2k>0 ? 1/u2k : 0;
+            T deltafk=defocusAvg+defocusDev*((x2-fy2)*cos2az+2*x[k]*fy*sin2az)*iu2;
+            T argument=vppGain*(1-std::exp(-u2k*vppScale))+k1*deltafk*u2k+k2*u2k*u2k;
+            ctf[k]=kcos*std::cos(argument)-ksin*std::sin(argument);
+            u2[k]=u2k;
+            u[k]=std::sqrt(u2k);
+            deltaf[k]=deltafk;
+        }
+        if (!damping)
+            continue;
 
+        // Bessel and sinc terms are only available in double
+        for (int k=0; k<m; ++k)
+            E[k]=(T)(bessj0(K5*u2[k])*SINC(u[k]*DeltaR));
 
+        for (int k=0; k<m; ++k)
+        {
+            T aux=k7*u2[k]*u[k]+deltaf[k]*u[k];
+            T Ek=E[k]*std::exp(-k3*u2[k]*u2[k])*std::exp(-k6*aux*aux)+r0+r1*u[k]+r2*u2[k];
+            Ek=Ek<0 ? 0 : Ek;
+            ctf[k]*=gain*Ek;
+        }
+    }
+}
+
+template void CTFDescription::evaluateCTFRow<float>(const float *fx, float fy, int n, float *out, bool damping) const;
+template void CTFDescription::evaluateCTFRow<double>(const double *fx, double fy, int n, double *out, bool damping) const;
+
+/* Generate many CTF images ------------------------------------------------ */
+template <class T>
+void generateCTFImages(std::vector<CTFDescription> &ctfs, int Ydim, int Xdim,
+                       std::vector< MultidimArray<T> > &CTFs, int nThreads,
+                       double Ts, bool damping, bool singlePrecision)
+{
+    CTFs.resize(ctfs.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for (size_t n=next++; n<ctfs.size(); n=next++)
+            ctfs[n].generateCTFFast(Ydim, Xdim, CTFs[n], Ts, damping, singlePrecision);
+    };
+    nThreads=std::max(1, std::min(nThreads, (int)ctfs.size()));
+    std::vector<std::thread> threads;
+    for (int t=1; t<nThreads; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+}
+
+template void generateCTFImages<float>(std::vector<CTFDescription> &, int, int,
+    std::vector< MultidimArray<float> > &, int, double, bool, bool);
+template void generateCTFImages<double>(std::vector<CTFDescription> &, int, int,
+    std::vector< MultidimArray<double> > &, int, double, bool, bool);
+
+/* Accuracy of the fast CTF ------------------------------------------------ */
+double checkCTFFastAccuracy(CTFDescription &ctf, int Ydim, int Xdim, bool singlePrecision, bool show)
+{
+    MultidimArray<double> reference, fast;
+    auto t0=std::chrono::steady_clock::now();
+    ctf.generateCTF(Ydim, Xdim, reference);
+    auto t1=std::chrono::steady_clock::now();
+    ctf.generateCTFFast(Ydim, Xdim, fast, -1, true, singlePrecision);
+    auto t2=std::chrono::steady_clock::now();
+
+    double maxError=0, meanError=0;
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(reference)
+    {
+        double error=fabs(DIRECT_MULTIDIM_ELEM(reference,n)-DIRECT_MULTIDIM_ELEM(fast,n));
+        maxError=std::max(maxError,error);
+        meanError+=error;
+    }
+    meanError/=reference.nzyxdim;
+    if (show)
+    {
+        double tScalar=std::chrono::duration<double>(t1-t0).count();
+        double tFast=std::chrono::duration<double>(t2-t1).count();
+        std::cout << "CTF " << Ydim << "x" << Xdim
+                  << (singlePrecision ? " (float)" : " (double)")
+                  << ": max error=" << maxError << " mean error=" << meanError
+                  << " scalar=" << tScalar << "s fast=" << tFast << "s"
+                  << std::endl;
+    }
+    return maxError;
+}
@@ -1284,6 +1284,41 @@ public:
     }
     #undef DEBUG
 
+    /** Evaluate the pure CTF along a row of frequencies.
+        fx holds n continuous X frequencies (1/A) and fy is the Y frequency
+        shared by the whole row. The result is the one of getValueAt() for a
+        CTF without noise, or of getValuePureWithoutDampingAt() if damping
+        is false. The angle of each frequency is not computed (no atan2),
+        and the row is processed in chunks of independent elements. The
+        cosine, sine and exponentials are still one library call per
+        element, and the Bessel and sinc terms are always computed in
+        double. With T=float the rest of the phase and the envelopes are
+        computed in single precision. */
+    template <typename T>
+    void evaluateCTFRow(const T *fx, T fy, int n, T *out, bool damping=true) const;
+
+    /** Generate CTF image (fast version).
+        Same image as generateCTF (or generateCTFWithoutDamping if damping is
+        false), but only half of the image is evaluated, the other half comes
+        from the symmetry CTF(-f)=CTF(f). If the CTF has no astigmatism and the
+        image is square, only one octant is evaluated. If singlePrecision is set,
+        the values are computed in float. The noise part is not supported, in
+        that case the call falls back to generateCTF. */
+    template <class T>
+    void generateCTFFast(int Ydim, int Xdim, MultidimArray < T > &CTF, double Ts=-1,
+                         bool damping=true, bool singlePrecision=false)
+    {
+        if (damping && (enable_CTFnoise || !enable_CTF))
+        {
+            generateCTF(Ydim, Xdim, CTF, Ts);
+            return;
+        }
+        if (singlePrecision)
+            generateCTFFastTyped<T, float>(Ydim, Xdim, CTF, Ts, damping);
+        else
+            generateCTFFastTyped<T, double>(Ydim, Xdim, CTF, Ts, damping);
+    }
+
     /** Check physical meaning.
         true if the CTF parameters have physical meaning.
         Call this function after produstd::cing side information */
@@ -1291,6 +1326,90 @@ public:
 
     /** Force physical meaning.*/
     void forcePhysicalMeaning();
+
+private:
+    // Fast generation with values computed in type R
+    template <class T, typename R>
+    void generateCTFFastTyped(int Ydim, int Xdim, MultidimArray < T > &CTF, double Ts, bool damping)
+    {
+        CTF.resizeNoCopy(Ydim, Xdim);
+        if (Ts<0)
+            Ts=Tm;
+        double iTs=1.0/Ts;
+
+        if (Ydim==Xdim && fabs(defocus_deviation)<1e-3)
+        {
+            // No astigmatism: the CTF only depends on |f|. Evaluate the octant
+            // 0<=p<=q<=Xdim/2 and read the rest by symmetry.
+            int half=Xdim/2;
+            std::vector<R> fx(half+1), radial((half+1)*(half+1));
+            for (int q=0; q<=half; ++q)
+                fx[q]=(R)(q*iTs/Xdim);
+            for (int p=0; p<=half; ++p)
+                evaluateCTFRow(&fx[p], fx[p], half+1-p, &radial[p*(half+1)+p], damping);
+            for (int i=0; i<Ydim; ++i)
+            {
+                int p=std::min(i, Ydim-i);
+                for (int j=0; j<Xdim; ++j)
+                {
+                    int q=std::min(j, Xdim-j);
+                    DIRECT_A2D_ELEM(CTF, i, j) = (T) (p<=q ? radial[p*(half+1)+q] : radial[q*(half+1)+p]);
+                }
+            }
+            return;
+        }
+
+        std::vector<R> fx(Xdim), row(Xdim);
+        for (int j=0; j<Xdim; ++j)
+        {
+            double wx;
+            FFT_IDX2DIGFREQ(j, Xdim, wx);
+            fx[j]=(R)(wx*iTs);
+        }
+        int lastComputedRow=Ydim/2;
+        for (int i=0; i<Ydim; ++i)
+        {
+            double wy;
+            FFT_IDX2DIGFREQ(i, Ydim, wy);
+            R fy=(R)(wy*iTs);
+            if (i<=lastComputedRow)
+            {
+                evaluateCTFRow(&fx[0], fy, Xdim, &row[0], damping);
+                for (int j=0; j<Xdim; ++j)
+                    DIRECT_A2D_ELEM(CTF, i, j) = (T) row[j];
+            }
+            else
+            {
+                // Friedel mate of (i,j) is (Ydim-i,Xdim-j), already computed.
+                // The Nyquist column of an even image has no mate in the grid.
+                int imate=Ydim-i;
+                for (int j=0; j<Xdim; ++j)
+                    DIRECT_A2D_ELEM(CTF, i, j) = DIRECT_A2D_ELEM(CTF, imate, (Xdim-j)%Xdim);
+                if (Xdim%2==0)
+                {
+                    int j=Xdim/2;
+                    evaluateCTFRow(&fx[j], fy, 1, &row[j], damping);
+                    DIRECT_A2D_ELEM(CTF, i, j) = (T) row[j];
+                }
+            }
+        }
+    }
 };
 
+/** Generate the CTF images of many particles in parallel.
+    Each CTF must have its side information produced. CTFs[n] is generated
+    with ctfs[n].generateCTFFast using nThreads threads that take the
+    particles dynamically. */
+template <class T>
+void generateCTFImages(std::vector<CTFDescription> &ctfs, int Ydim, int Xdim,
+                       std::vector< MultidimArray<T> > &CTFs, int nThreads=1,
+                       double Ts=-1, bool damping=true, bool singlePrecision=false);
+
+/** Accuracy of the fast CTF generation.
+    Generates the CTF image with generateCTF and generateCTFFast and returns
+    the maximum absolute difference between them. If show is set, a short
+    report with the maximum and mean errors and both times is printed. */
+double checkCTFFastAccuracy(CTFDescription &ctf, int Ydim, int Xdim,
+                            bool singlePrecision=false, bool show=false);
+
 #endif
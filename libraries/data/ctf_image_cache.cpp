@@ -0,0 +1,157 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include "ctf_image_cache.h"
+
+CTFImageCache::CTFImageCache(double maxMB, double defocusStep, double angleStep,
+                             double CsStep, double kVStep, double Q0Step):
+    maxBytes((size_t)(maxMB*1024*1024)), defocusStep(defocusStep), angleStep(angleStep),
+    CsStep(CsStep), kVStep(kVStep), Q0Step(Q0Step), bytes(0), nHits(0), nMisses(0)
+{
+}
+
+double CTFImageCache::quantize(double value, double step)
+{
+    return step>0 ? round(value/step)*step : value;
+}
+
+CTFImageCache::ImagePtr CTFImageCache::getImage(const CTFDescription &ctf, int Ydim, int Xdim,
+        double Ts, bool damping)
+{
+    if (Ts<0)
+        Ts=ctf.Tm;
+
+    // The noise model is not part of the key, do not cache it
+    if (damping && ctf.enable_CTFnoise)
+    {
+        CTFDescription aux=ctf;
+        std::shared_ptr<MultidimArray<double> > I(new MultidimArray<double>());
+        aux.generateCTFFast(Ydim, Xdim, *I, Ts, damping);
+        std::lock_guard<std::mutex> lock(mutex);
+        nMisses++;
+        return I;
+    }
+
+    CTFDescription quantized=ctf;
+    quantized.DeltafU=quantize(ctf.DeltafU, defocusStep);
+    quantized.DeltafV=quantize(ctf.DeltafV, defocusStep);
+    quantized.azimuthal_angle=quantize(ctf.azimuthal_angle, angleStep);
+    quantized.Cs=quantize(ctf.Cs, CsStep);
+    quantized.kV=quantize(ctf.kV, kVStep);
+    quantized.Q0=quantize(ctf.Q0, Q0Step);
+
+    Key key {quantized.DeltafU, quantized.DeltafV, quantized.azimuthal_angle,
+             quantized.Cs, quantized.kV, quantized.Q0,
+             (double)Ydim, (double)Xdim, Ts, (double)damping, (double)ctf.enable_CTF,
+             ctf.K, ctf.Ca, ctf.espr, ctf.ispr, ctf.alpha, ctf.DeltaF, ctf.DeltaR,
+             ctf.envR0, ctf.envR1, ctf.envR2, ctf.phase_shift, ctf.VPP_radius};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it=index.find(key);
+        if (it!=index.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            nHits++;
+            return it->second->second;
+        }
+        nMisses++;
+    }
+
+    // Generate outside the lock so that other threads are not blocked
+    quantized.produceSideInfo();
+    std::shared_ptr<MultidimArray<double> > I(new MultidimArray<double>());
+    quantized.generateCTFFast(Ydim, Xdim, *I, Ts, damping);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it=index.find(key);
+    if (it!=index.end())
+        return it->second->second; // Another thread generated it meanwhile
+    lru.emplace_front(key, I);
+    index[key]=lru.begin();
+    bytes+=I->nzyxdim*sizeof(double);
+    evict();
+    return I;
+}
+
+void CTFImageCache::setMaxMemory(double maxMB)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    maxBytes=(size_t)(maxMB*1024*1024);
+    evict();
+}
+
+void CTFImageCache::setDefocusStep(double defocusStep, double angleStep)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->defocusStep=defocusStep;
+    this->angleStep=angleStep;
+}
+
+void CTFImageCache::evict()
+{
+    while (bytes>maxBytes && !lru.empty())
+    {
+        const ImagePtr &I=lru.back().second;
+        bytes-=I->nzyxdim*sizeof(double);
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+size_t CTFImageCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nHits;
+}
+
+size_t CTFImageCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nMisses;
+}
+
+size_t CTFImageCache::memoryUsed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+void CTFImageCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    bytes=nHits=nMisses=0;
+}
+
+void CTFImageCache::show(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t requests=nHits+nMisses;
+    out << "CTF image cache: " << nHits << " hits, " << nMisses << " misses";
+    if (requests>0)
+        out << " (" << 100.0*nHits/requests << "% hit rate)";
+    out << ", " << lru.size() << " images in " << bytes/(1024.0*1024.0) << " MB" << std::endl;
+}
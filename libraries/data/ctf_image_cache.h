@@ -0,0 +1,116 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef _CORE_CTF_IMAGE_CACHE_HH
+#define _CORE_CTF_IMAGE_CACHE_HH
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ctf.h"
+
+/**@defgroup CTFImageCache CTF image cache
+   @ingroup DataLibrary */
+//@{
+/** LRU cache of CTF images.
+    Particles coming from the same micrograph have very similar defoci, so
+    their CTF images can be shared. The images are indexed by the defocus U,
+    defocus V, azimuthal angle, Cs, voltage and Q0 quantized with the given
+    steps, and by the exact value of the rest of parameters that affect the
+    image (size, sampling, envelope, phase plate, ...). The image is generated
+    with the quantized values, so the result does not depend on which particle
+    arrived first. When the images take more memory than the limit, the least
+    recently used ones are discarded. The cache can be shared by several threads.
+
+    @code
+    CTFImageCache cache(128);
+    std::shared_ptr<const MultidimArray<double> > ctfImage=cache.getImage(ctf, Ydim, Xdim);
+    ...
+    cache.show();
+    @endcode
+*/
+class CTFImageCache
+{
+public:
+    /// Shared pointer to a CTF image
+    typedef std::shared_ptr<const MultidimArray<double> > ImagePtr;
+
+    /** Empty constructor.
+        maxMB is the memory limit, with 0 images are generated but never kept.
+        The steps are in Angstroms (defocus), degrees (angle), millimeters (Cs),
+        kV (voltage) and Q0 units. */
+    CTFImageCache(double maxMB=256, double defocusStep=1, double angleStep=0.01,
+                  double CsStep=1e-3, double kVStep=1e-3, double Q0Step=1e-4);
+
+    /** Get the CTF image of this CTF.
+        It is the image produced by generateCTFFast(Ydim, Xdim, I, Ts, damping).
+        The image is kept alive while the returned pointer is in use, even if
+        it is discarded from the cache. */
+    ImagePtr getImage(const CTFDescription &ctf, int Ydim, int Xdim, double Ts=-1, bool damping=true);
+
+    /// Change the memory limit (in MB)
+    void setMaxMemory(double maxMB);
+
+    /// Change the quantization of defocus (in Angstroms) and azimuthal angle (in degrees)
+    void setDefocusStep(double defocusStep, double angleStep);
+
+    /// Number of requests served from the cache
+    size_t hits() const;
+
+    /// Number of requests that generated a new image
+    size_t misses() const;
+
+    /// Memory used by the cached images (in bytes)
+    size_t memoryUsed() const;
+
+    /// Remove all images and reset the counters
+    void clear();
+
+    /// Show the counters
+    void show(std::ostream &out=std::cout) const;
+
+private:
+    typedef std::vector<double> Key;
+    typedef std::list<std::pair<Key, ImagePtr> > LRUList;
+
+    // Round value to a multiple of step
+    static double quantize(double value, double step);
+
+    // Discard the least recently used images until the limit is met
+    void evict();
+
+    size_t maxBytes;
+    double defocusStep, angleStep, CsStep, kVStep, Q0Step;
+
+    // Most recently used first
+    LRUList lru;
+    std::map<Key, LRUList::iterator> index;
+    size_t bytes, nHits, nMisses;
+    mutable std::mutex mutex;
+};
+//@}
+#endif
@@ -78,40 +78,216 @@ void Projection::assign(const Projection &P)
 }
 
 
-FourierProjector::FourierProjector(double paddFactor, double maxFreq, int degree)
+/* Trilinear interpolation with zero outside the volume, as interpolatedElement3D */
+template <typename T>
+static inline std::complex<T> interpolateLinear(const MultidimArray< std::complex<T> > &coefs,
+        double x, double y, double z)
 {
-    paddingFactor = paddFactor;
-    maxFrequency = maxFreq;
-    BSplineDeg = degree;
+    int x0=(int)floor(x);
+    int y0=(int)floor(y);
+    int z0=(int)floor(z);
+    T fx=(T)(x-x0);
+    T fy=(T)(y-y0);
+    T fz=(T)(z-z0);
+    T wx[2]={1-fx, fx}, wy[2]={1-fy, fy}, wz[2]={1-fz, fz};
+    T re=0, im=0;
+    for (int dz=0; dz<2; ++dz)
+    {
+        int k=z0+dz;
+        if (k<STARTINGZ(coefs) || k>FINISHINGZ(coefs))
+            continue;
+        for (int dy=0; dy<2; ++dy)
+        {
+            int i=y0+dy;
+            if (i<STARTINGY(coefs) || i>FINISHINGY(coefs))
+                continue;
+            for (int dx=0; dx<2; ++dx)
+            {
+                int j=x0+dx;
+                if (j<STARTINGX(coefs) || j>FINISHINGX(coefs))
+                    continue;
+                const T *ptr=(const T *)&A3D_ELEM(coefs,k,i,j);
+                T w=wz[dz]*wy[dy]*wx[dx];
+                re+=ptr[0]*w;
+                im+=ptr[1]*w;
+            }
+        }
+    }
+    return std::complex<T>(re,im);
+}
+
+/* Mirror an index outside [0,dim) as the B-spline coefficients are symmetric */
+static inline int mirrorIndex(int idx, int dim)
+{
+    if (idx<0)
+        return -idx-1;
+    else if (idx>=dim)
+        return 2*dim-idx-1;
+    return idx;
+}
+
+/* Cubic B-spline interpolation, as interpolatedElementBSpline3D.
+ * The weights and the mirrored indexes of each axis are computed once, and
+ * the innermost loop is a short dot product over contiguous complex values. */
+template <typename T>
+static inline std::complex<T> interpolateBSpline3(const MultidimArray< std::complex<T> > &coefs,
+        double x, double y, double z)
+{
+    // Logical to physical
+    z -= STARTINGZ(coefs);
+    y -= STARTINGY(coefs);
+    x -= STARTINGX(coefs);
+
+    int l1 = (int)ceil(x - 2);
+    int m1 = (int)ceil(y - 2);
+    int n1 = (int)ceil(z - 2);
+
+    T wx[4], wy[4], wz[4];
+    int ix[4], iy[4], iz[4];
+    for (int k=0; k<4; ++k)
+    {
+        double aux;
+        BSPLINE03(aux, x - (double) (l1+k));
+        wx[k]=(T)aux;
+        BSPLINE03(aux, y - (double) (m1+k));
+        wy[k]=(T)aux;
+        BSPLINE03(aux, z - (double) (n1+k));
+        wz[k]=(T)aux;
+        ix[k]=2*mirrorIndex(l1+k,(int)XSIZE(coefs));
+        iy[k]=mirrorIndex(m1+k,(int)YSIZE(coefs));
+        iz[k]=mirrorIndex(n1+k,(int)ZSIZE(coefs));
+    }
+
+    T re = 0, im = 0;
+    for (int n = 0; n < 4; ++n)
+    {
+        T yxsumRe = 0, yxsumIm = 0;
+        for (int m = 0; m < 4; ++m)
+        {
+            const T *row=(const T *)&DIRECT_A3D_ELEM(coefs,iz[n],iy[m],0);
+            T xsumRe = 0, xsumIm = 0;
+            for (int l = 0; l < 4; ++l)
+            {
+                xsumRe += row[ix[l]] * wx[l];
+                xsumIm += row[ix[l]+1] * wx[l];
+            }
+            yxsumRe += xsumRe * wy[m];
+            yxsumIm += xsumIm * wy[m];
+        }
+        re += yxsumRe * wz[n];
+        im += yxsumIm * wz[n];
+    }
+    return std::complex<T>(re,im);
+}
+
+/* Store real and imaginary coefficients interleaved, releasing the inputs */
+template <typename T>
+static void interleaveCoefficients(MultidimArray<double> &re, MultidimArray<double> &im,
+                                   MultidimArray< std::complex<T> > &coefs)
+{
+    coefs.resizeNoCopy(ZSIZE(re),YSIZE(re),XSIZE(re));
+    STARTINGZ(coefs)=STARTINGZ(re);
+    STARTINGY(coefs)=STARTINGY(re);
+    STARTINGX(coefs)=STARTINGX(re);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(re)
+    DIRECT_MULTIDIM_ELEM(coefs,n)=std::complex<T>((T)DIRECT_MULTIDIM_ELEM(re,n),(T)DIRECT_MULTIDIM_ELEM(im,n));
+    re.clear();
+    im.clear();
 }
 
-FourierProjector::FourierProjector(MultidimArray<double> &V, double paddFactor, double maxFreq, int degree)
+FourierProjectorVolume::FourierProjectorVolume(MultidimArray<double> &V, double paddFactor, double maxFreq,
+        int degree, bool singlePrecision)
 {
     paddingFactor = paddFactor;
     maxFrequency = maxFreq;
     BSplineDeg = degree;
-    updateVolume(V);
+    this->singlePrecision = singlePrecision;
+    volumeSize=XSIZE(V);
+    // Zero padding
+    MultidimArray<double> Vpadded;
+    int paddedDim=(int)(paddingFactor*volumeSize);
+    // JMRT: TODO: I think it is a very poor design to modify the volume passed
+    // in the construct, it will be padded anyway, so new memory should be allocated
+    V.window(Vpadded,FIRST_XMIPP_INDEX(paddedDim),FIRST_XMIPP_INDEX(paddedDim),FIRST_XMIPP_INDEX(paddedDim),
+             LAST_XMIPP_INDEX(paddedDim),LAST_XMIPP_INDEX(paddedDim),LAST_XMIPP_INDEX(paddedDim));
+    V.clear();
+    // Make Fourier transform, shift the volume origin to the volume center and center it
+    MultidimArray< std::complex<double> > Vfourier;
+    FourierTransformer transformer3D;
+    transformer3D.completeFourierTransform(Vpadded,Vfourier);
+    ShiftFFT(Vfourier, FIRST_XMIPP_INDEX(XSIZE(Vpadded)), FIRST_XMIPP_INDEX(YSIZE(Vpadded)), FIRST_XMIPP_INDEX(ZSIZE(Vpadded)));
+    CenterFFT(Vfourier,true);
+    Vfourier.setXmippOrigin();
+
+    // Compensate for the Fourier normalization factor
+    double K=(double)(XSIZE(Vpadded)*XSIZE(Vpadded)*XSIZE(Vpadded))/(double)(volumeSize*volumeSize);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Vfourier)
+    DIRECT_MULTIDIM_ELEM(Vfourier,n)*=K;
+    volumePaddedSize=XSIZE(Vpadded);
+    Vpadded.clear();
+    // Compute Bspline coefficients
+    MultidimArray< double > VfourierRealCoefs, VfourierImagCoefs;
+    if (BSplineDeg==3)
+    {
+        MultidimArray< double > VfourierRealAux, VfourierImagAux;
+        Complex2RealImag(Vfourier, VfourierRealAux, VfourierImagAux);
+        Vfourier.clear();
+        produceSplineCoefficients(BSPLINE3,VfourierRealCoefs,VfourierRealAux);
+
+        // Release memory as soon as you can
+        VfourierRealAux.clear();
+
+        // Remove all those coefficients we are sure we will not use during the projections
+        int idxMax=maxFrequency*XSIZE(VfourierRealCoefs)+10; // +10 is a safety guard
+        idxMax=std::min(FINISHINGX(VfourierRealCoefs),idxMax);
+        int idxMin=std::max(-idxMax,STARTINGX(VfourierRealCoefs));
+        VfourierRealCoefs.selfWindow(idxMin,idxMin,idxMin,idxMax,idxMax,idxMax);
+
+        produceSplineCoefficients(BSPLINE3,VfourierImagCoefs,VfourierImagAux);
+        VfourierImagAux.clear();
+        VfourierImagCoefs.selfWindow(idxMin,idxMin,idxMin,idxMax,idxMax,idxMax);
+    }
+    else
+        Complex2RealImag(Vfourier, VfourierRealCoefs, VfourierImagCoefs);
+    if (singlePrecision)
+        interleaveCoefficients(VfourierRealCoefs, VfourierImagCoefs, VfourierCoefsFloat);
+    else
+        interleaveCoefficients(VfourierRealCoefs, VfourierImagCoefs, VfourierCoefs);
+
+    // Calculate phase shift terms, the size is that of the Fourier transform of a projection
+    phaseShiftImgA.initZeros(volumeSize,volumeSize/2+1);
+    phaseShiftImgB.initZeros(volumeSize,volumeSize/2+1);
+    double shift=-FIRST_XMIPP_INDEX(volumeSize);
+    double xxshift = -2 * PI * shift / volumeSize;
+    for (size_t i=0; i<YSIZE(phaseShiftImgA); ++i)
+    {
+        double phasey=(double)(i) * xxshift;
+        for (size_t j=0; j<XSIZE(phaseShiftImgA); ++j)
+        {
+            // Phase shift to move the origin of the image to the corner
+            double dotp = (double)(j) * xxshift + phasey;
+            sincos(dotp,&DIRECT_A2D_ELEM(phaseShiftImgB,i,j),&DIRECT_A2D_ELEM(phaseShiftImgA,i,j));
+        }
+    }
 }
 
-void FourierProjector::updateVolume(MultidimArray<double> &V)
+
+void FourierProjectorVolume::projectFourier(const Matrix2D<double> &E,
+        MultidimArray< std::complex<double> > &projectionFourier, const MultidimArray<double> *ctf) const
 {
-    volume = &V;
-    volumeSize=XSIZE(*volume);
-    produceSideInfo();
+    if (singlePrecision)
+        projectFourier(VfourierCoefsFloat,E,projectionFourier,ctf);
+    else
+        projectFourier(VfourierCoefs,E,projectionFourier,ctf);
 }
 
-
-void FourierProjector::project(double rot, double tilt, double psi, const MultidimArray<double> *ctf)
+template <typename T>
+void FourierProjectorVolume::projectFourier(const MultidimArray< std::complex<T> > &coefs, const Matrix2D<double> &E,
+        MultidimArray< std::complex<double> > &projectionFourier, const MultidimArray<double> *ctf) const
 {
     double freqy, freqx;
-    std::complex< double > f;
-    Euler_angles2matrix(rot,tilt,psi,E);
-
     projectionFourier.initZeros();
     double maxFreq2=maxFrequency*maxFrequency;
-    int Xdim=(int)XSIZE(VfourierRealCoefs);
-    int Ydim=(int)YSIZE(VfourierRealCoefs);
-    int Zdim=(int)ZSIZE(VfourierRealCoefs);
 
     for (size_t i=0; i<YSIZE(projectionFourier); ++i)
     {
@@ -135,101 +311,19 @@ void FourierProjector::project(double rot, double tilt, double psi, const Multid
             double freqvol_Y=freqYvol_Y+MAT_ELEM(E,0,1)*freqx;
             double freqvol_Z=freqYvol_Z+MAT_ELEM(E,0,2)*freqx;
 
-            double c,d;
+            // Compute corresponding index in the volume
+            double kVolume=freqvol_Z*volumePaddedSize;
+            double iVolume=freqvol_Y*volumePaddedSize;
+            double jVolume=freqvol_X*volumePaddedSize;
+            std::complex<T> cd;
             if (BSplineDeg==0)
-            {
-                // 0 order interpolation
-                // Compute corresponding index in the volume
-                int kVolume=(int)round(freqvol_Z*volumePaddedSize);
-                int iVolume=(int)round(freqvol_Y*volumePaddedSize);
-                int jVolume=(int)round(freqvol_X*volumePaddedSize);
-                c = A3D_ELEM(VfourierRealCoefs,kVolume,iVolume,jVolume);
-                d = A3D_ELEM(VfourierImagCoefs,kVolume,iVolume,jVolume);
-            }
+                cd=A3D_ELEM(coefs,(int)round(kVolume),(int)round(iVolume),(int)round(jVolume));
             else if (BSplineDeg==1)
-            {
-                // B-spline linear interpolation
-                double kVolume=freqvol_Z*volumePaddedSize;
-                double iVolume=freqvol_Y*volumePaddedSize;
-                double jVolume=freqvol_X*volumePaddedSize;
-                c=VfourierRealCoefs.interpolatedElement3D(jVolume,iVolume,kVolume);
-                d=VfourierImagCoefs.interpolatedElement3D(jVolume,iVolume,kVolume);
-            }
+                cd=interpolateLinear(coefs,jVolume,iVolume,kVolume);
             else
-            {
-                // B-spline cubic interpolation
-                double kVolume=freqvol_Z*volumePaddedSize;
-                double iVolume=freqvol_Y*volumePaddedSize;
-                double jVolume=freqvol_X*volumePaddedSize;
-
-                // Commented for speed-up, the corresponding code is below
-                // c=VfourierRealCoefs.interpolatedElementBSpline3D(jVolume,iVolume,kVolume);
-                // d=VfourierImagCoefs.interpolatedElementBSpline3D(jVolume,iVolume,kVolume);
-
-                // The code below is a replicate for speed reasons of interpolatedElementBSpline3D
-                double z=kVolume;
-                double y=iVolume;
-                double x=jVolume;
-
-                // Logical to physical
-                z -= STARTINGZ(VfourierRealCoefs);
-                y -= STARTINGY(VfourierRealCoefs);
-                x -= STARTINGX(VfourierRealCoefs);
-
-                int l1 = (int)ceil(x - 2);
-                int l2 = l1 + 3;
-
-                int m1 = (int)ceil(y - 2);
-                int m2 = m1 + 3;
-
-                int n1 = (int)ceil(z - 2);
-                int n2 = n1 + 3;
-
-                c = d = 0.0;
-                double aux;
-                for (int nn = n1; nn <= n2; nn++)
-                {
-                    int equivalent_nn=nn;
-                    if      (nn<0)
-                        equivalent_nn=-nn-1;
-                    else if (nn>=Zdim)
-                        equivalent_nn=2*Zdim-nn-1;
-                    double yxsumRe = 0.0, yxsumIm = 0.0;
-                    for (int m = m1; m <= m2; m++)
-                    {
-                        int equivalent_m=m;
-                        if      (m<0)
-                            equivalent_m=-m-1;
-                        else if (m>=Ydim)
-                            equivalent_m=2*Ydim-m-1;
-                        double xsumRe = 0.0, xsumIm = 0.0;
-                        for (int l = l1; l <= l2; l++)
-                        {
-                            double xminusl = x - (double) l;
-                            int equivalent_l=l;
-                            if      (l<0)
-                                equivalent_l=-l-1;
-                            else if (l>=Xdim)
-                                equivalent_l=2*Xdim-l-1;
-                            double CoeffRe = (double) DIRECT_A3D_ELEM(VfourierRealCoefs,equivalent_nn,equivalent_m,equivalent_l);
-                            double CoeffIm = (double) DIRECT_A3D_ELEM(VfourierImagCoefs,equivalent_nn,equivalent_m,equivalent_l);
-                            BSPLINE03(aux,xminusl);
-                            xsumRe += CoeffRe * aux;
-                            xsumIm += CoeffIm * aux;
-                        }
-
-                        double yminusm = y - (double) m;
-                        BSPLINE03(aux,yminusm);
-						yxsumRe += xsumRe * aux;
-						yxsumIm += xsumIm * aux;
-                    }
-
-                    double zminusn = z - (double) nn;
-                    BSPLINE03(aux,zminusn);
-					c += yxsumRe * aux;
-					d += yxsumIm * aux;
-                }
-            }
+                cd=interpolateBSpline3(coefs,jVolume,iVolume,kVolume);
+            double c=cd.real();
+            double d=cd.imag();
 
             // Phase shift to move the origin of the image to the corner
             double a=DIRECT_A2D_ELEM(phaseShiftImgA,i,j);
@@ -252,76 +346,77 @@ void FourierProjector::project(double rot, double tilt, double psi, const Multid
             *(ptrI_ij+1) = ab_cd - ac - bd;
         }
     }
-    transformer2D.inverseFourierTransform();
 }
 
-void FourierProjector::produceSideInfo()
+FourierProjector::FourierProjector(double paddFactor, double maxFreq, int degree, bool singlePrecision)
 {
-    // Zero padding
-    MultidimArray<double> Vpadded;
-    int paddedDim=(int)(paddingFactor*volumeSize);
-    // JMRT: TODO: I think it is a very poor design to modify the volume passed
-    // in the construct, it will be padded anyway, so new memory should be allocated
-    volume->window(Vpadded,FIRST_XMIPP_INDEX(paddedDim),FIRST_XMIPP_INDEX(paddedDim),FIRST_XMIPP_INDEX(paddedDim),
-                   LAST_XMIPP_INDEX(paddedDim),LAST_XMIPP_INDEX(paddedDim),LAST_XMIPP_INDEX(paddedDim));
-    volume->clear();
-    // Make Fourier transform, shift the volume origin to the volume center and center it
-    MultidimArray< std::complex<double> > Vfourier;
-    FourierTransformer transformer3D;
-    transformer3D.completeFourierTransform(Vpadded,Vfourier);
-    ShiftFFT(Vfourier, FIRST_XMIPP_INDEX(XSIZE(Vpadded)), FIRST_XMIPP_INDEX(YSIZE(Vpadded)), FIRST_XMIPP_INDEX(ZSIZE(Vpadded)));
-    CenterFFT(Vfourier,true);
-    Vfourier.setXmippOrigin();
-
-    // Compensate for the Fourier normalization factor
-    double K=(double)(XSIZE(Vpadded)*XSIZE(Vpadded)*XSIZE(Vpadded))/(double)(volumeSize*volumeSize);
-    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Vfourier)
-    DIRECT_MULTIDIM_ELEM(Vfourier,n)*=K;
-    Vpadded.clear();
-    // Compute Bspline coefficients
-    if (BSplineDeg==3)
-    {
-        MultidimArray< double > VfourierRealAux, VfourierImagAux;
-        Complex2RealImag(Vfourier, VfourierRealAux, VfourierImagAux);
-        Vfourier.clear();
-        produceSplineCoefficients(BSPLINE3,VfourierRealCoefs,VfourierRealAux);
+    paddingFactor = paddFactor;
+    maxFrequency = maxFreq;
+    BSplineDeg = degree;
+    this->singlePrecision = singlePrecision;
+}
 
-        // Release memory as soon as you can
-        VfourierRealAux.clear();
+FourierProjector::FourierProjector(MultidimArray<double> &V, double paddFactor, double maxFreq, int degree,
+                                   bool singlePrecision)
+{
+    paddingFactor = paddFactor;
+    maxFrequency = maxFreq;
+    BSplineDeg = degree;
+    this->singlePrecision = singlePrecision;
+    updateVolume(V);
+}
 
-        // Remove all those coefficients we are sure we will not use during the projections
-        volumePaddedSize=XSIZE(VfourierRealCoefs);
-        int idxMax=maxFrequency*XSIZE(VfourierRealCoefs)+10; // +10 is a safety guard
-        idxMax=std::min(FINISHINGX(VfourierRealCoefs),idxMax);
-        int idxMin=std::max(-idxMax,STARTINGX(VfourierRealCoefs));
-        VfourierRealCoefs.selfWindow(idxMin,idxMin,idxMin,idxMax,idxMax,idxMax);
+FourierProjector::FourierProjector(const std::shared_ptr<const FourierProjectorVolume> &sharedVolume)
+{
+    paddingFactor = sharedVolume->paddingFactor;
+    maxFrequency = sharedVolume->maxFrequency;
+    BSplineDeg = sharedVolume->BSplineDeg;
+    singlePrecision = sharedVolume->singlePrecision;
+    volume = NULL;
+    this->sharedVolume = sharedVolume;
+    produceSideInfo();
+}
 
-        produceSplineCoefficients(BSPLINE3,VfourierImagCoefs,VfourierImagAux);
-        VfourierImagAux.clear();
-        VfourierImagCoefs.selfWindow(idxMin,idxMin,idxMin,idxMax,idxMax,idxMax);
-    }
-    else
-        Complex2RealImag(Vfourier, VfourierRealCoefs, VfourierImagCoefs);
+void FourierProjector::updateVolume(MultidimArray<double> &V)
+{
+    volume = &V;
+    sharedVolume = std::shared_ptr<const FourierProjectorVolume>(
+                       new FourierProjectorVolume(V, paddingFactor, maxFrequency, (int)BSplineDeg, singlePrecision));
+    produceSideInfo();
+}
 
+void FourierProjector::produceSideInfo()
+{
     // Allocate memory for the 2D Fourier transform
+    volumeSize = sharedVolume->volumeSize;
     projection().initZeros(volumeSize,volumeSize);
     projection().setXmippOrigin();
     transformer2D.FourierTransform(projection(),projectionFourier,false);
+}
 
-    // Calculate phase shift terms
-    phaseShiftImgA.initZeros(projectionFourier);
-    phaseShiftImgB.initZeros(projectionFourier);
-    double shift=-FIRST_XMIPP_INDEX(volumeSize);
-    double xxshift = -2 * PI * shift / volumeSize;
-    for (size_t i=0; i<YSIZE(projectionFourier); ++i)
+void FourierProjector::project(double rot, double tilt, double psi, const MultidimArray<double> *ctf)
+{
+    Matrix2D<double> Euler;
+    Euler_angles2matrix(rot,tilt,psi,Euler);
+    project(Euler,ctf);
+}
+
+void FourierProjector::project(const Matrix2D<double> &Euler, const MultidimArray<double> *ctf)
+{
+    E=Euler;
+    sharedVolume->projectFourier(E,projectionFourier,ctf);
+    transformer2D.inverseFourierTransform();
+}
+
+void FourierProjector::projectBatch(const std::vector< Matrix2D<double> > &Es,
+                                    std::vector< MultidimArray<double> > &projections,
+                                    const MultidimArray<double> *ctf)
+{
+    projections.resize(Es.size());
+    for (size_t n=0; n<Es.size(); ++n)
     {
-        double phasey=(double)(i) * xxshift;
-        for (size_t j=0; j<XSIZE(projectionFourier); ++j)
-        {
-            // Phase shift to move the origin of the image to the corner
-            double dotp = (double)(j) * xxshift + phasey;
-            sincos(dotp,&DIRECT_A2D_ELEM(phaseShiftImgB,i,j),&DIRECT_A2D_ELEM(phaseShiftImgA,i,j));
-        }
+        project(Es[n],ctf);
+        projections[n]=projection();
     }
 }
 
@@ -28,6 +28,7 @@
 #include <core/xmipp_image.h>
 #include <core/xmipp_program.h>
 #include <core/xmipp_fftw.h>
+#include <memory>
 
 /**@defgroup FourierProjection Fourier projection
    @ingroup ReconsLibrary */
@@ -114,7 +115,78 @@ public:
     void assign(const Projection& P);
 };
 
-/** Program class to create projections in Fourier space */
+/** Fourier transform of a volume prepared for projection.
+ *
+ * The B-spline coefficients of the Fourier transform of the volume are
+ * stored with their real and imaginary parts interleaved, so that each
+ * interpolation reads both from the same cache line. In single precision
+ * mode they are kept in float, which halves the memory and the bandwidth
+ * of the interpolation; the projections are still computed in double.
+ *
+ * The object is not modified after construction, so a single instance can
+ * be shared by the FourierProjector of several threads.
+ */
+class FourierProjectorVolume
+{
+public:
+    /// Padding factor
+    double paddingFactor;
+    /// Maximum Frequency for pixels
+    double maxFrequency;
+    /// The order of B-Spline for interpolation
+    int BSplineDeg;
+    /// Interpolate in single precision
+    bool singlePrecision;
+
+    // B-spline coefficients for Fourier of the volume (double precision mode)
+    MultidimArray< std::complex<double> > VfourierCoefs;
+
+    // B-spline coefficients for Fourier of the volume (single precision mode)
+    MultidimArray< std::complex<float> > VfourierCoefsFloat;
+
+    // Phase shift image
+    MultidimArray<double> phaseShiftImgB, phaseShiftImgA;
+
+    // Original volume size
+    int volumeSize;
+
+    // Volume padded size
+    int volumePaddedSize;
+public:
+    /** Constructor.
+     * The volume is released to save memory.
+     */
+    FourierProjectorVolume(MultidimArray<double> &V, double paddFactor, double maxFreq, int BSplinedegree,
+                           bool singlePrecision=false);
+
+    /** Fourier transform of the projection along the Euler matrix E.
+     * projectionFourier must have the size of the Fourier transform of a
+     * volumeSize x volumeSize image.
+     */
+    void projectFourier(const Matrix2D<double> &E, MultidimArray< std::complex<double> > &projectionFourier,
+                        const MultidimArray<double> *ctf=NULL) const;
+private:
+    template <typename T>
+    void projectFourier(const MultidimArray< std::complex<T> > &coefs, const Matrix2D<double> &E,
+                        MultidimArray< std::complex<double> > &projectionFourier,
+                        const MultidimArray<double> *ctf) const;
+};
+
+/** Program class to create projections in Fourier space.
+ *
+ * It holds the scratch memory of a projection (Fourier and real space
+ * images and the inverse FFT plan) and a FourierProjectorVolume with the
+ * coefficients of the volume. To project the same volume from several
+ * threads, create the first projector from the volume and the rest from
+ * its shared volume, so that there is a single copy of the coefficients:
+ *
+ * @code
+ * FourierProjector projector(V, 2, 0.5, BSPLINE3);
+ * std::vector<FourierProjector *> threadProjector;
+ * for (int t=0; t<Nthreads; t++)
+ *     threadProjector.push_back(new FourierProjector(projector.getSharedVolume()));
+ * @endcode
+ */
 class FourierProjector
 {
 public:
@@ -124,6 +196,8 @@ public:
     double maxFrequency;
     /// The order of B-Spline for interpolation
     double BSplineDeg;
+    /// Interpolate in single precision
+    bool singlePrecision;
 
 public:
     // Auxiliary FFT transformer
@@ -132,8 +206,8 @@ public:
     // Volume to project
     MultidimArray<double> *volume;
 
-    // Real and imaginary B-spline coefficients for Fourier of the volume
-    MultidimArray< double > VfourierRealCoefs, VfourierImagCoefs;
+    // Coefficients of the volume, possibly shared with other projectors
+    std::shared_ptr<const FourierProjectorVolume> sharedVolume;
 
     // Projection in Fourier space
     MultidimArray< std::complex<double> > projectionFourier;
@@ -141,37 +215,53 @@ public:
     // Projection in real space
     Image<double> projection;
 
-    // Phase shift image
-    MultidimArray<double> phaseShiftImgB, phaseShiftImgA;
-
     // Original volume size
     int volumeSize;
 
-    // Volume padded size
-    int volumePaddedSize;
-
     // Euler matrix
     Matrix2D<double> E;
 public:
     /* Empty constructor */
-    FourierProjector(double paddFactor, double maxFreq, int degree);
+    FourierProjector(double paddFactor, double maxFreq, int degree, bool singlePrecision=false);
 
     /*
      * The constructor of the class
      */
-    FourierProjector(MultidimArray<double> &V, double paddFactor, double maxFreq, int BSplinedegree);
+    FourierProjector(MultidimArray<double> &V, double paddFactor, double maxFreq, int BSplinedegree,
+                     bool singlePrecision=false);
+
+    /** Projector on an already prepared volume.
+     * Only the memory for a projection is allocated.
+     */
+    FourierProjector(const std::shared_ptr<const FourierProjectorVolume> &sharedVolume);
 
     /**
      * This method gets the volume's Fourier and the Euler's angles as the inputs and interpolates the related projection
      */
     void project(double rot, double tilt, double psi, const MultidimArray<double> *ctf=NULL);
 
+    /** Same as the previous one, but with the Euler matrix already computed. */
+    void project(const Matrix2D<double> &Euler, const MultidimArray<double> *ctf=NULL);
+
+    /** Project many orientations in one call.
+     * projections[n] receives the real space projection for the Euler matrix
+     * Es[n]. The Euler matrices can be computed once and reused for several
+     * volumes or iterations.
+     */
+    void projectBatch(const std::vector< Matrix2D<double> > &Es,
+                      std::vector< MultidimArray<double> > &projections,
+                      const MultidimArray<double> *ctf=NULL);
+
     /** Update volume */
     void updateVolume(MultidimArray<double> &V);
+
+    /** Coefficients of the volume, to create other projectors on them */
+    std::shared_ptr<const FourierProjectorVolume> getSharedVolume() const
+    {
+        return sharedVolume;
+    }
 private:
-    /*
-     * This is a private method which provides the values for the class variable
-     */
+    // Allocate the projection images for the current volume
     void produceSideInfo();
 };
 
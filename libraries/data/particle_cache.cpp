@@ -0,0 +1,123 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include "particle_cache.h"
+
+ParticleCache::ParticleCache(): Nslots(0), Nused(0), Ydim(0), Xdim(0), mapped(false)
+{
+}
+
+void ParticleCache::initialize(size_t Nimages, size_t _Ydim, size_t _Xdim, double maxMB)
+{
+    clear();
+    if (Nimages==0)
+        return;
+    Nslots=Nimages;
+    Ydim=_Ydim;
+    Xdim=_Xdim;
+    double sizeMB=(double)Nslots*Ydim*Xdim*sizeof(float)/(1024.0*1024.0);
+    mapped=maxMB>=0 && sizeMB>maxMB;
+    stack.setMmap(mapped);
+    stack.resize(Nslots, 1, Ydim, Xdim);
+}
+
+bool ParticleCache::get(size_t objId, MultidimArray<double> &I) const
+{
+    size_t n;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it=slot.find(objId);
+        if (it==slot.end())
+            return false;
+        n=it->second;
+    }
+    I.resizeNoCopy(Ydim, Xdim);
+    const float *ptrSrc=&DIRECT_NZYX_ELEM(stack, n, 0, 0, 0);
+    double *ptrDest=MULTIDIM_ARRAY(I);
+    for (size_t i=0; i<YXSIZE(stack); ++i)
+        ptrDest[i]=ptrSrc[i];
+    I.setXmippOrigin();
+    return true;
+}
+
+bool ParticleCache::put(size_t objId, const MultidimArray<double> &I)
+{
+    // Disabled cache (not initialized or with Nimages=0)
+    if (Nslots==0)
+        return false;
+    if (YSIZE(I)!=Ydim || XSIZE(I)!=Xdim)
+        REPORT_ERROR(ERR_MULTIDIM_SIZE, "ParticleCache: the image does not have the size of the cache");
+    size_t n;
+    bool isNew=false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it=slot.find(objId);
+        if (it!=slot.end())
+            n=it->second;
+        else if (Nused<Nslots)
+        {
+            n=Nused++;
+            isNew=true;
+        }
+        else
+            return false;
+    }
+    // The slot is only visible to get() once it has been filled
+    float *ptrDest=&DIRECT_NZYX_ELEM(stack, n, 0, 0, 0);
+    const double *ptrSrc=MULTIDIM_ARRAY(I);
+    for (size_t i=0; i<YXSIZE(stack); ++i)
+        ptrDest[i]=(float)ptrSrc[i];
+    if (isNew)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot[objId]=n;
+    }
+    return true;
+}
+
+size_t ParticleCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return slot.size();
+}
+
+size_t ParticleCache::capacity() const
+{
+    return Nslots;
+}
+
+bool ParticleCache::isMapped() const
+{
+    return mapped;
+}
+
+void ParticleCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    slot.clear();
+    stack.clear();
+    Nslots=Nused=Ydim=Xdim=0;
+    mapped=false;
+}
@@ -0,0 +1,103 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef _CORE_PARTICLE_CACHE_HH
+#define _CORE_PARTICLE_CACHE_HH
+
+#include <map>
+#include <mutex>
+#include <core/multidim_array.h>
+
+/**@defgroup ParticleCache Particle cache
+   @ingroup DataLibrary */
+//@{
+/** Cache of the particles used along the iterations of a program.
+    Iterative classifiers read and preprocess (e.g. normalize) the same
+    particles at every iteration. This cache keeps the preprocessed images,
+    in single precision, so that they are read from disk only once. Every
+    process reserves room only for its share of the particles, and the slots
+    are assigned as the images are stored. If the images do not fit in the
+    memory limit, the stack is kept in a memory mapped file. When the cache
+    is full, new images are simply not stored. The cache can be shared by
+    several threads.
+
+    @code
+    ParticleCache cache;
+    cache.initialize(Nimgs/Nprocs+1, Ydim, Xdim, 1024);
+    if (!cache.get(objId, I()))
+    {
+        I.read(fnImg);
+        I().statisticsAdjust(0, 1);
+        cache.put(objId, I());
+    }
+    @endcode
+*/
+class ParticleCache
+{
+public:
+    /// Empty constructor
+    ParticleCache();
+
+    /** Reserve room for Nimages of size Ydim x Xdim.
+        If they take more than maxMB (in MB), the stack is memory mapped.
+        With maxMB<0 it is always kept in memory, and with Nimages=0 the
+        cache is disabled. */
+    void initialize(size_t Nimages, size_t Ydim, size_t Xdim, double maxMB=-1);
+
+    /** Get a cached image.
+        Returns false if the image is not in the cache. The image is
+        returned with its origin at the center. */
+    bool get(size_t objId, MultidimArray<double> &I) const;
+
+    /** Store an image.
+        It must have the size given at initialization. Images already stored
+        are overwritten. Returns false if there is no room for it or the
+        cache is disabled. */
+    bool put(size_t objId, const MultidimArray<double> &I);
+
+    /// Number of images in the cache
+    size_t size() const;
+
+    /// Maximum number of images
+    size_t capacity() const;
+
+    /// The stack is kept in a memory mapped file
+    bool isMapped() const;
+
+    /// Remove all images and release the memory
+    void clear();
+
+private:
+    // Preprocessed images, one per slot
+    MultidimArray<float> stack;
+
+    // Slot assigned to each objId
+    std::map<size_t, size_t> slot;
+    size_t Nslots, Nused, Ydim, Xdim;
+    bool mapped;
+    mutable std::mutex mutex;
+};
+//@}
+#endif
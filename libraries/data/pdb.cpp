@@ -99,6 +99,19 @@ void computePDBgeometry(const std::string &fnPDB,
                         Matrix1D<double> &centerOfMass,
                         Matrix1D<double> &limit0, Matrix1D<double> &limitF,
                         const std::string &intensityColumn)
+{
+    std::ifstream fh_pdb;
+    fh_pdb.open(fnPDB.c_str());
+    if (!fh_pdb)
+        REPORT_ERROR(ERR_IO_NOTEXIST, fnPDB);
+    computePDBgeometry(fh_pdb, centerOfMass, limit0, limitF, intensityColumn);
+    fh_pdb.close();
+}
+
+void computePDBgeometry(std::istream &fh_pdb,
+                        Matrix1D<double> &centerOfMass,
+                        Matrix1D<double> &limit0, Matrix1D<double> &limitF,
+                        const std::string &intensityColumn)
 {
     // Initialization
     centerOfMass.initZeros(3);
@@ -108,12 +121,6 @@ void computePDBgeometry(const std::string &fnPDB,
     limitF.initConstant(-1e30);
     double total_mass = 0;
 
-    // Open the file
-    std::ifstream fh_pdb;
-    fh_pdb.open(fnPDB.c_str());
-    if (!fh_pdb)
-        REPORT_ERROR(ERR_IO_NOTEXIST, fnPDB);
-
     // Process all lines of the file
     int col=1;
     if (intensityColumn=="Bfactor")
@@ -172,9 +179,6 @@ void computePDBgeometry(const std::string &fnPDB,
 
     // Finish calculations
     centerOfMass /= total_mass;
-
-    // Close file
-    fh_pdb.close();
 }
 
 /* Apply geometry ---------------------------------------------------------- */
@@ -361,23 +365,30 @@ void PDBRichPhantom::read(const FileName &fnPDB, double pseudoatoms, double thre
 /* Write phantom to PDB --------------------------------------------------- */
 void PDBRichPhantom::write(const FileName &fnPDB)
 {
-    FILE* fh_out=fopen(fnPDB.c_str(),"w");
+    std::ofstream fh_out(fnPDB.c_str());
     if (!fh_out)
         REPORT_ERROR(ERR_IO_NOWRITE, fnPDB);
+    write(fh_out);
+    fh_out.close();
+}
+
+void PDBRichPhantom::write(std::ostream &out) const
+{
     size_t imax=remarks.size();
     for (size_t i=0; i<imax; ++i)
-    	fprintf(fh_out,"%s\n",remarks[i].c_str());
+    	out << remarks[i] << "\n";
     imax=atomList.size();
+    char line[128];
     for (size_t i=0; i<imax; ++i)
     {
     	const RichAtom &atom=atomList[i];
-    	fprintf (fh_out,"ATOM  %5lu %4s%c%-4s%c%4d%c   %8.3f%8.3f%8.3f%6.2f%6.2f      %4s\n",
+    	snprintf(line,sizeof(line),"ATOM  %5lu %4s%c%-4s%c%4d%c   %8.3f%8.3f%8.3f%6.2f%6.2f      %4s\n",
     			(unsigned long int)i+1,atom.name.c_str(),
     			atom.altloc,atom.resname.c_str(),atom.chainid,
     			atom.resseq,atom.icode,atom.x,atom.y,atom.z,atom.occupancy,atom.bfactor,
     			atom.name.c_str());
+    	out << line;
     }
-    fclose(fh_out);
 }
 
 /* Atom descriptors -------------------------------------------------------- */
@@ -30,6 +30,7 @@
 #define _XMIPP_PDB_HH
 
 #include <string>
+#include <iostream>
 #include <core/matrix1d.h>
 #include <data/projection.h>
 #include <core/histogram.h>
@@ -60,6 +61,14 @@ void computePDBgeometry(const std::string &fnPDB,
                         Matrix1D<double> &limit0, Matrix1D<double> &limitF,
                         const std::string &intensityColumn);
 
+/** Compute the center of mass and limits of a PDB given as a stream.
+    Same as above, but the PDB lines are read from an already open stream
+    (e.g., a PDB kept in memory). */
+void computePDBgeometry(std::istream &fhPDB,
+                        Matrix1D<double> &centerOfMass,
+                        Matrix1D<double> &limit0, Matrix1D<double> &limitF,
+                        const std::string &intensityColumn);
+
 /** Apply geometry transformation to an input PDB.
     The result is written in the output PDB. Set centerPDB if you
     want to compute the center of mass first and apply the transformation
@@ -193,6 +202,9 @@ public:
     /// Write to PDB file
     void write(const FileName &fnPDB);
 
+    /// Write the PDB lines to a stream
+    void write(std::ostream &out) const;
+
 };
 
 /** Description of the electron scattering factors.
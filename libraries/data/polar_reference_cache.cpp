@@ -0,0 +1,200 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include "polar_reference_cache.h"
+
+const Polar<std::complex<double> > &PolarReferenceCache::Reference::getPolar(
+    Polar<std::complex<double> > &buffer) const
+{
+    if (!singlePrecision)
+        return fP;
+    buffer.mode=fPfloat.mode;
+    buffer.oversample=fPfloat.oversample;
+    buffer.ring_radius=fPfloat.ring_radius;
+    buffer.rings.resize(fPfloat.rings.size());
+    for (size_t i=0; i<fPfloat.rings.size(); ++i)
+    {
+        const MultidimArray<std::complex<float> > &ring=fPfloat.rings[i];
+        MultidimArray<std::complex<double> > &out=buffer.rings[i];
+        out.resizeNoCopy(ring);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(ring)
+        DIRECT_MULTIDIM_ELEM(out,n)=DIRECT_MULTIDIM_ELEM(ring,n);
+    }
+    return buffer;
+}
+
+const MultidimArray<double> &PolarReferenceCache::Reference::getImage(
+    MultidimArray<double> &buffer) const
+{
+    if (!singlePrecision)
+        return image;
+    typeCast(imageFloat,buffer);
+    buffer.setXmippOrigin();
+    return buffer;
+}
+
+size_t PolarReferenceCache::Reference::bytes() const
+{
+    size_t retval=0;
+    if (singlePrecision)
+    {
+        for (size_t i=0; i<fPfloat.rings.size(); ++i)
+            retval+=fPfloat.rings[i].nzyxdim*sizeof(std::complex<float>);
+        retval+=imageFloat.nzyxdim*sizeof(float);
+    }
+    else
+    {
+        for (size_t i=0; i<fP.rings.size(); ++i)
+            retval+=fP.rings[i].nzyxdim*sizeof(std::complex<double>);
+        retval+=image.nzyxdim*sizeof(double);
+    }
+    return retval;
+}
+
+PolarReferenceCache::PolarReferenceCache(double maxMB, bool singlePrecision):
+    maxBytes((size_t)(maxMB*1024*1024)), singlePrecision(singlePrecision),
+    bytes(0), nHits(0), nMisses(0)
+{
+}
+
+PolarReferenceCache::ReferencePtr PolarReferenceCache::get(size_t refno)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it=index.find(refno);
+    if (it==index.end())
+    {
+        nMisses++;
+        return ReferencePtr();
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    nHits++;
+    return it->second->second;
+}
+
+PolarReferenceCache::ReferencePtr PolarReferenceCache::put(size_t refno,
+        const Polar<std::complex<double> > &fP, double stddev, const MultidimArray<double> &image)
+{
+    // Convert outside the lock so that other threads are not blocked
+    std::shared_ptr<Reference> ref(new Reference());
+    ref->stddev=stddev;
+    ref->singlePrecision=singlePrecision;
+    if (singlePrecision)
+    {
+        ref->fPfloat.mode=fP.mode;
+        ref->fPfloat.oversample=fP.oversample;
+        ref->fPfloat.ring_radius=fP.ring_radius;
+        ref->fPfloat.rings.resize(fP.rings.size());
+        for (size_t i=0; i<fP.rings.size(); ++i)
+        {
+            const MultidimArray<std::complex<double> > &ring=fP.rings[i];
+            MultidimArray<std::complex<float> > &out=ref->fPfloat.rings[i];
+            out.resizeNoCopy(ring);
+            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(ring)
+            DIRECT_MULTIDIM_ELEM(out,n)=std::complex<float>(DIRECT_MULTIDIM_ELEM(ring,n));
+        }
+        typeCast(image,ref->imageFloat);
+    }
+    else
+    {
+        ref->fP=fP;
+        ref->image=image;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it=index.find(refno);
+    if (it!=index.end())
+        return it->second->second; // Another thread stored it meanwhile
+    lru.emplace_front(refno, ref);
+    index[refno]=lru.begin();
+    bytes+=ref->bytes();
+    evict();
+    return ref;
+}
+
+void PolarReferenceCache::setMaxMemory(double maxMB)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    maxBytes=(size_t)(maxMB*1024*1024);
+    evict();
+}
+
+void PolarReferenceCache::setSinglePrecision(bool singlePrecision)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->singlePrecision=singlePrecision;
+}
+
+void PolarReferenceCache::evict()
+{
+    while (bytes>maxBytes && !lru.empty())
+    {
+        bytes-=lru.back().second->bytes();
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+size_t PolarReferenceCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nHits;
+}
+
+size_t PolarReferenceCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nMisses;
+}
+
+size_t PolarReferenceCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return lru.size();
+}
+
+size_t PolarReferenceCache::memoryUsed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+void PolarReferenceCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    bytes=nHits=nMisses=0;
+}
+
+void PolarReferenceCache::show(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t requests=nHits+nMisses;
+    out << "Reference cache: " << nHits << " hits, " << nMisses << " misses";
+    if (requests>0)
+        out << " (" << 100.0*nHits/requests << "% hit rate)";
+    out << ", " << lru.size() << " references in " << bytes/(1024.0*1024.0) << " MB"
+        << (singlePrecision ? " (single precision)" : "") << std::endl;
+}
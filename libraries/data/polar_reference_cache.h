@@ -0,0 +1,148 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef _CORE_POLAR_REFERENCE_CACHE_HH
+#define _CORE_POLAR_REFERENCE_CACHE_HH
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "polar.h"
+
+/**@defgroup PolarReferenceCache Polar reference cache
+   @ingroup DataLibrary */
+//@{
+/** LRU cache of references prepared for polar alignment.
+    Each reference keeps the Fourier transform of its polar rings, the
+    standard deviation of the rings and the reference image itself. The
+    references are indexed by an integer (e.g., the reference number in
+    the gallery). When they take more memory than the limit, the least
+    recently used ones are discarded. The data can be kept in single
+    precision to fit twice as many references in the same memory; it is
+    converted back to double by the accessors. The cache can be shared
+    by several threads.
+
+    @code
+    PolarReferenceCache cache(1024);
+    PolarReferenceCache::ReferencePtr ref=cache.get(refno);
+    if (!ref)
+        ref=cache.put(refno, fP, stddev, I);
+    Polar<std::complex<double> > buffer;
+    const Polar<std::complex<double> > &fPref=ref->getPolar(buffer);
+    ...
+    cache.show();
+    @endcode
+*/
+class PolarReferenceCache
+{
+public:
+    /// Reference prepared for polar alignment
+    class Reference
+    {
+    public:
+        /// Standard deviation of the polar rings
+        double stddev;
+
+        /** Fourier transform of the polar rings.
+            In single precision a copy is made in buffer and buffer is returned. */
+        const Polar<std::complex<double> > &getPolar(Polar<std::complex<double> > &buffer) const;
+
+        /** Reference image.
+            In single precision a copy is made in buffer and buffer is returned. */
+        const MultidimArray<double> &getImage(MultidimArray<double> &buffer) const;
+
+        /// Memory used by the reference (in bytes)
+        size_t bytes() const;
+
+    private:
+        friend class PolarReferenceCache;
+        bool singlePrecision;
+        Polar<std::complex<double> > fP;
+        Polar<std::complex<float> > fPfloat;
+        MultidimArray<double> image;
+        MultidimArray<float> imageFloat;
+    };
+
+    /// Shared pointer to a reference
+    typedef std::shared_ptr<const Reference> ReferencePtr;
+
+    /** Empty constructor.
+        maxMB is the memory limit, with 0 references are never kept. */
+    PolarReferenceCache(double maxMB=1024, bool singlePrecision=false);
+
+    /** Get a reference.
+        Returns an empty pointer if it is not in the cache. The reference
+        is kept alive while the returned pointer is in use, even if it is
+        discarded from the cache. */
+    ReferencePtr get(size_t refno);
+
+    /** Store a reference.
+        If another thread stored the same reference meanwhile, that one is
+        kept and returned. */
+    ReferencePtr put(size_t refno, const Polar<std::complex<double> > &fP, double stddev,
+                     const MultidimArray<double> &image);
+
+    /// Change the memory limit (in MB)
+    void setMaxMemory(double maxMB);
+
+    /// Keep the references stored from now on in single precision
+    void setSinglePrecision(bool singlePrecision);
+
+    /// Number of requests served from the cache
+    size_t hits() const;
+
+    /// Number of requests not found in the cache
+    size_t misses() const;
+
+    /// Number of references in the cache
+    size_t size() const;
+
+    /// Memory used by the cached references (in bytes)
+    size_t memoryUsed() const;
+
+    /// Remove all references and reset the counters
+    void clear();
+
+    /// Show the counters
+    void show(std::ostream &out=std::cout) const;
+
+private:
+    typedef std::list<std::pair<size_t, ReferencePtr> > LRUList;
+
+    // Discard the least recently used references until the limit is met
+    void evict();
+
+    size_t maxBytes;
+    bool singlePrecision;
+
+    // Most recently used first
+    LRUList lru;
+    std::map<size_t, LRUList::iterator> index;
+    size_t bytes, nHits, nMisses;
+    mutable std::mutex mutex;
+};
+//@}
+#endif
@@ -25,6 +25,7 @@
 
 #include "projection.h"
 #include <core/geometry.h>
+#include <memory>
 
 #define x0   STARTINGX(IMGMATRIX(proj))
 #define xF   FINISHINGX(IMGMATRIX(proj))
@@ -33,12 +34,6 @@
 #define xDim XSIZE(IMGMATRIX(proj))
 #define yDim YSIZE(IMGMATRIX(proj))
 
-// These two structures are needed when projecting and backprojecting using
-// threads. They make mutual exclusion and synchronization possible.
-barrier_t project_barrier;
-pthread_mutex_t project_mutex = PTHREAD_MUTEX_INITIALIZER;
-project_thread_params * project_threads;
-
 ParametersProjectionTomography::ParametersProjectionTomography()
 {
     proj_Xdim = 0;
@@ -754,7 +749,8 @@ void project_Crystal_SimpleGrid(Image<double> &vol, const SimpleGrid &grid,
                                 const Matrix1D<double> &shift,
                                 const Matrix1D<double> &aint, const Matrix1D<double> &bint,
                                 const Matrix2D<double> &D,  const Matrix2D<double> &Dinv,
-                                const MultidimArray<int> &mask, int FORW, int eq_mode)
+                                const MultidimArray<int> &mask, int FORW, int eq_mode,
+                                int thread_id, int numthreads)
 {
     Matrix1D<double> prjX(3);                // Coordinate: Projection of the
     Matrix1D<double> prjY(3);                // 3 grid vectors
@@ -923,7 +919,10 @@ void project_Crystal_SimpleGrid(Image<double> &vol, const SimpleGrid &grid,
 #endif
 
     // This type conversion gives more speed
+    // Each thread takes one of every numthreads planes
     int ZZ_lowest = (int) ZZ(grid.lowest);
+    if (thread_id != -1)
+        ZZ_lowest += thread_id;
     int YY_lowest = XMIPP_MAX((int) YY(grid.lowest), STARTINGY(mask));
     int XX_lowest = XMIPP_MAX((int) XX(grid.lowest), STARTINGX(mask));
     int ZZ_highest = (int) ZZ(grid.highest);
@@ -965,7 +964,7 @@ void project_Crystal_SimpleGrid(Image<double> &vol, const SimpleGrid &grid,
 #endif
 
     Matrix1D<double> grid_index(3);
-    for (k = ZZ_lowest; k <= ZZ_highest; k++)
+    for (k = ZZ_lowest; k <= ZZ_highest; k += numthreads)
     {
         // Corner of the row defined by Y
         beginY = beginZ;
@@ -1103,7 +1102,7 @@ void project_Crystal_SimpleGrid(Image<double> &vol, const SimpleGrid &grid,
             }
             V2_PLUS_V2(beginY, beginY, prjY);
         }
-        V2_PLUS_V2(beginZ, beginZ, prjZ);
+        V2_PLUS_V2(beginZ, beginZ, prjZ * numthreads);
     }
     //#define DEBUG_AT_THE_END
 #ifdef DEBUG_AT_THE_END
@@ -1119,6 +1118,61 @@ void project_Crystal_SimpleGrid(Image<double> &vol, const SimpleGrid &grid,
 #undef DEBUG_LITTLE
 #undef wrap_as_Crystal
 
+/* Threaded projection ----------------------------------------------------- */
+std::mutex &ProjectionThreads::mutex()
+{
+    static std::mutex teamMutex;
+    return teamMutex;
+}
+
+ProjectionThreads &ProjectionThreads::get(int threads)
+{
+    static std::unique_ptr<ProjectionThreads> team;
+    if (!team || team->threads != threads)
+    {
+        team.reset();
+        team.reset(new ProjectionThreads(threads));
+    }
+    return *team;
+}
+
+ProjectionThreads::ProjectionThreads(int threads): threads(threads), job(NULL)
+{
+    proj.resize(threads - 1);
+    norm_proj.resize(threads - 1);
+    manager = new ThreadManager(threads, this);
+}
+
+ProjectionThreads::~ProjectionThreads()
+{
+    delete manager;
+}
+
+void ProjectionThreads::run(const std::function<void (int)> &job)
+{
+    this->job = &job;
+    manager->run(runJob);
+    this->job = NULL;
+}
+
+void ProjectionThreads::runJob(ThreadArgument &thArg)
+{
+    ProjectionThreads *team = (ProjectionThreads *) thArg.workClass;
+    (*team->job)(thArg.thread_id);
+}
+
+void ProjectionThreads::addBand(MultidimArray<double> &V, const MultidimArray<double> &W,
+                                int thread_id, int numthreads)
+{
+    size_t N = MULTIDIM_SIZE(V);
+    size_t n0 = N * thread_id / numthreads;
+    size_t n1 = N * (thread_id + 1) / numthreads;
+    double *ptrV = MULTIDIM_ARRAY(V);
+    const double *ptrW = MULTIDIM_ARRAY(W);
+    for (size_t n = n0; n < n1; n++)
+        ptrV[n] += ptrW[n];
+}
+
 /* Project a Grid Volume --------------------------------------------------- */
 //#define DEBUG
 void project_Crystal_Volume(
@@ -1139,8 +1193,14 @@ void project_Crystal_Volume(
     //   norm_proj is calculated
     // 0 if we are backprojecting
     //   norm_proj must be valid
-    int eq_mode)                          // ARTK, CAVARTK, CAVK or CAV
+    int eq_mode,                          // ARTK, CAVARTK, CAVK or CAV
+    int threads)                          // Number of threads
 {
+    // Check it here, the threads cannot report it
+    if (basis.type != Basis::blobs)
+        REPORT_ERROR(ERR_VALUE_INCORRECT, "project_Crystal_Volume: Cannot project other than "
+                     "blob volumes");
+
     // If projecting forward initialise projections
     if (FORW)
     {
@@ -1152,8 +1212,16 @@ void project_Crystal_Volume(
     // Project each subvolume
     for (size_t i = 0; i < vol.VolumesNo(); i++)
     {
-        project_Crystal_SimpleGrid(vol(i), vol.grid(i), basis,
-                                   proj, norm_proj, shift, aint, bint, D, Dinv, mask, FORW, eq_mode);
+        Image<double> &subvol = vol(i);
+        const SimpleGrid &subgrid = vol.grid(i);
+        runThreadedProjection(proj, norm_proj, FORW, threads,
+                              [&](Projection &P, Projection &Pnorm,
+                                  int thread_id, int numthreads)
+                              {
+                                  project_Crystal_SimpleGrid(subvol, subgrid, basis,
+                                                             P, Pnorm, shift, aint, bint, D, Dinv, mask,
+                                                             FORW, eq_mode, thread_id, numthreads);
+                              });
 
 #ifdef DEBUG
 
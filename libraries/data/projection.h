@@ -32,11 +32,9 @@
 #include "basis.h"
 #include <core/xmipp_program.h>
 #include <data/fourier_projection.h>
-
-// These two structures are needed when projecting and backprojecting using
-// threads. They make mutual exclusion and synchronization possible.
-extern barrier_t project_barrier;
-extern pthread_mutex_t project_mutex;
+#include <functional>
+#include <mutex>
+#include <vector>
 
 /* Projection parameters for tomography --------------------------- */
 /** Projecting parameters. This class reads a set of projection parameters
@@ -114,35 +112,6 @@ public:
                                    const Matrix1D<double> &sinplane);
 };
 
-/** Structure for threaded projections.
-   This structure contains all the information needed by a thread
-   working on the projecting/backprojecting of a projection. This is
-   structure is needed to pass parameters from the master thread to the
-   working threads as they run as a function which does not accept passed
-   parameters other than a void * structure.
-   */
-typedef struct
-{
-    int thread_id;
-    int threads_count;
-    Image<double> * vol;
-    const SimpleGrid * grid;
-    const Basis * basis;
-    Projection * global_proj;
-    Projection * global_norm_proj;
-    int FORW;
-    int eq_mode;
-    const Image<int> *VNeq;
-    Matrix2D<double> *M;
-    const MultidimArray<int> *mask;
-    double ray_length;
-    double rot,tilt,psi;
-    bool destroy;
-}
-project_thread_params;
-
-extern project_thread_params * project_threads;
-
 template <class T>
 void project_SimpleGrid(Image<T> *vol, const SimpleGrid *grid,
                         const Basis *basis,
@@ -226,6 +195,9 @@ void count_eqs_in_projection(GridVolumeT<int> &GVNeq,
     vectors (D and Dinv). a=D*ai;
 
     Valid eq_modes are ARTK, CAVARTK and CAV.
+
+    The grid planes are distributed among the given number of threads
+    (see runThreadedProjection).
 */
 void project_Crystal_Volume(GridVolume &vol, const Basis &basis,
                             Projection &proj, Projection &norm_proj,
@@ -233,7 +205,8 @@ void project_Crystal_Volume(GridVolume &vol, const Basis &basis,
                             double rot, double tilt, double psi, const Matrix1D<double> &shift,
                             const Matrix1D<double> &aint, const Matrix1D<double> &bint,
                             const Matrix2D<double> &D, const Matrix2D<double> &Dinv,
-                            const MultidimArray<int> &mask, int FORW, int eq_mode = ARTK);
+                            const MultidimArray<int> &mask, int FORW, int eq_mode = ARTK,
+                            int threads = 1);
 
 // Implementations =========================================================
 // Some aliases
@@ -282,105 +255,6 @@ void project_Crystal_Volume(GridVolume &vol, const Basis &basis,
 //#define DEBUG
 const int ART_PIXEL_SUBSAMPLING = 2;
 
-/** Threaded projection for simple grids
-*/
-template <class T>
-void *project_SimpleGridThread( void * params )
-{
-    project_thread_params * thread_data = (project_thread_params *)params;
-
-    Image<T> * vol;
-    const SimpleGrid * grid;
-
-    int thread_id = thread_data->thread_id;
-    int threads_count = thread_data->threads_count;
-
-    const Basis * basis;
-
-    Projection * proj;
-    Projection * norm_proj;
-
-    Projection * forw_proj = new Projection();
-    Projection * forw_norm_proj = new Projection();
-
-    Projection * global_proj;
-    Projection * global_norm_proj;
-
-    int FORW;
-    int eq_mode;
-    const Image<int> *VNeq=NULL;
-    Matrix2D<double> *M=NULL;
-    const MultidimArray<int> *mask=NULL;
-    double ray_length;
-
-    double rot,tilt,psi;
-
-    do
-    {
-        barrier_wait( &project_barrier );
-
-        if( thread_data->destroy == true )
-            break;
-
-        vol = thread_data->vol;
-        grid = thread_data->grid;
-        basis = thread_data->basis;
-        FORW = thread_data->FORW;
-        eq_mode = thread_data->eq_mode;
-        VNeq = thread_data->VNeq;
-        M = thread_data->M;
-        mask = thread_data->mask;
-        ray_length = thread_data->ray_length;
-        global_proj = thread_data->global_proj;
-        global_norm_proj = thread_data->global_norm_proj;
-
-        rot = thread_data->rot;
-        tilt = thread_data->tilt;
-        psi = thread_data->psi;
-
-        if( FORW )
-        {
-            proj = forw_proj;
-            norm_proj = forw_norm_proj;
-
-            proj->reset(YSIZE( (*global_proj)() ), XSIZE( (*global_proj)() ));
-            proj->setAngles(rot, tilt, psi);
-            (*norm_proj)().initZeros((*proj)());
-        }
-        else
-        {
-            proj = global_proj;
-            norm_proj = global_norm_proj;
-        }
-
-        project_SimpleGrid( vol, grid,
-                            basis,
-                            proj,
-                            norm_proj, FORW, eq_mode,
-                            VNeq, M, mask,
-                            ray_length,
-                            thread_id,
-                            threads_count
-                          );
-
-        if( FORW )
-        {
-
-            pthread_mutex_lock( &project_mutex );
-
-            (*global_proj)() = (*global_proj)() + (*proj)();
-            (*global_norm_proj)() = (*global_norm_proj)() + (*norm_proj)();
-
-            pthread_mutex_unlock( &project_mutex );
-        }
-
-        barrier_wait( &project_barrier );
-    }
-    while(1);
-
-    return (void *)NULL;
-}
-
 /** Projection of a Simple Grid.
     Valid eq_modes are ARTK, CAVARTK and CAV.
 */
@@ -926,6 +800,103 @@ void project_SimpleGrid(Image<T> *vol, const SimpleGrid *grid,
 #undef DEBUG
 #undef DEBUG_LITTLE
 
+/* Threaded projection ----------------------------------------------------- */
+/** Team of threads used by runThreadedProjection.
+    ART projects and backprojects every image, usually small ones, twice per
+    subvolume. So the threads and the private projections used by the forward
+    projection are kept from one call to the next. There is a single team per
+    process, which is rebuilt when a different number of threads is asked
+    for. Callers must hold mutex() while they use it. */
+class ProjectionThreads
+{
+public:
+    /// Mutex serializing the users of the team
+    static std::mutex &mutex();
+
+    /// Team of the process with the given number of threads
+    static ProjectionThreads &get(int threads);
+
+    /// Destructor
+    ~ProjectionThreads();
+
+    /// Number of threads
+    int size() const
+    {
+        return threads;
+    }
+
+    /// Run job(thread_id) on all the threads and wait for them
+    void run(const std::function<void (int)> &job);
+
+    /// Private projections of the threads 1...size()-1 (at thread_id-1)
+    std::vector<Projection> proj, norm_proj;
+
+    /// Add to V the band thread_id of the numthreads bands of the pixels of W
+    static void addBand(MultidimArray<double> &V, const MultidimArray<double> &W,
+                        int thread_id, int numthreads);
+
+private:
+    ProjectionThreads(int threads);
+    static void runJob(ThreadArgument &thArg);
+
+    int threads;
+    ThreadManager *manager;
+    const std::function<void (int)> *job;
+};
+
+/** Run a grid projector on several threads.
+
+    The projector is called as projector(proj, norm_proj, thread_id, numthreads)
+    and it must only visit the grid planes k with (k-k0)%numthreads==thread_id,
+    as project_SimpleGrid does. When projecting forward, thread 0 accumulates
+    directly onto proj and norm_proj while the rest of threads accumulate onto
+    private zeroed copies that are added at the end, so that no locking is
+    needed around the footprints. When backprojecting, proj and norm_proj are
+    only read and each thread corrects its own set of basis coefficients.
+    The threads and the private copies are those of ProjectionThreads.
+
+    With threads<=1 the projector is simply called with thread_id=-1. */
+template <class Projector>
+void runThreadedProjection(Projection &proj, Projection &norm_proj,
+                           int FORW, int threads, const Projector &projector)
+{
+    if (threads <= 1)
+    {
+        projector(proj, norm_proj, -1, 1);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(ProjectionThreads::mutex());
+    ProjectionThreads &team = ProjectionThreads::get(threads);
+    team.run([&](int t)
+             {
+                 if (t == 0 || !FORW)
+                 {
+                     projector(proj, norm_proj, t, threads);
+                     return;
+                 }
+                 // Same size as in the previous call, so no memory is allocated
+                 Projection &P = team.proj[t - 1];
+                 Projection &Pnorm = team.norm_proj[t - 1];
+                 P = proj;
+                 P().initZeros();
+                 Pnorm = norm_proj;
+                 Pnorm().initZeros();
+                 projector(P, Pnorm, t, threads);
+             });
+
+    if (FORW)
+        // Add the private projections, each thread a band of pixels
+        team.run([&](int t)
+                 {
+                     for (int s = 0; s < threads - 1; s++)
+                     {
+                         ProjectionThreads::addBand(proj(), team.proj[s](), t, threads);
+                         ProjectionThreads::addBand(norm_proj(), team.norm_proj[s](), t, threads);
+                     }
+                 });
+}
+
 /* Project a Grid Volume --------------------------------------------------- */
 /** Projection of a Grid Volume.
 
@@ -951,7 +922,9 @@ void project_SimpleGrid(Image<T> *vol, const SimpleGrid *grid,
 
     As for the mode, valid modes are ARTK, CAVK, COUNT_EQ, CAVARTK.
 
-    M is the matrix corresponding to the projection process.
+    M is the matrix corresponding to the projection process. When it is
+    given the projection is computed by a single thread, otherwise the grid
+    planes are distributed among threads (see runThreadedProjection).
 */
 //#define DEBUG
 //#define DEBUG_LITTLE
@@ -984,23 +957,9 @@ void project_GridVolume(
         norm_proj().initZeros(proj());
     }
 
-    if( threads > 1 )
-    {
-        for( int c = 0 ; c < threads ; c++ )
-        {
-            project_threads[c].global_proj = &proj;
-            project_threads[c].global_norm_proj = &norm_proj;
-            project_threads[c].FORW = FORW;
-            project_threads[c].eq_mode = eq_mode;
-            project_threads[c].basis = &basis;
-            project_threads[c].M = M;
-            project_threads[c].rot = rot;
-            project_threads[c].tilt = tilt;
-            project_threads[c].psi = psi;
-            project_threads[c].ray_length = ray_length;
-        }
-    }
-
+    // The system matrix is filled in basis order by a single thread
+    if (M != NULL)
+        threads = 1;
 
 #ifdef DEBUG_LITTLE
     if (FORW)
@@ -1022,29 +981,17 @@ void project_GridVolume(
         else
             VNeq = NULL;
 
-        if( threads > 1 )
-        {
-            for( int c = 0 ; c < threads ; c++ )
-            {
-                project_threads[c].vol = &(vol(i));
-                project_threads[c].grid = &(vol.grid(i));
-                project_threads[c].VNeq = VNeq;
-                project_threads[c].mask = mask;
-            }
-
-            barrier_wait( &project_barrier );
-
-            // Here is being processed the volume by the threads
-
-            barrier_wait( &project_barrier );
-        }
-        else
-        {
-            // create no thread to do the job
-            project_SimpleGrid(&(vol(i)), &(vol.grid(i)), &basis,
-                               &proj, &norm_proj, FORW, eq_mode,
-                               VNeq, M, mask, ray_length);
-        }
+        Image<T> *subvol = &(vol(i));
+        const SimpleGrid *subgrid = &(vol.grid(i));
+        runThreadedProjection(proj, norm_proj, FORW, threads,
+                              [&](Projection &P, Projection &Pnorm,
+                                  int thread_id, int numthreads)
+                              {
+                                  project_SimpleGrid(subvol, subgrid, &basis,
+                                                     &P, &Pnorm, FORW, eq_mode,
+                                                     VNeq, M, mask, ray_length,
+                                                     thread_id, numthreads);
+                              });
 
 #ifdef DEBUG
         Image<double> save;
@@ -42,7 +42,7 @@ SparseMatrix2D::SparseMatrix2D(std::vector<SparseElement> &_elements, int _Nelem
 
 	values.resizeNoCopy(ln);
 	jIdx.resizeNoCopy(ln);
-	iIdx.resizeNoCopy(N);
+	iIdx.initZeros(N); // Rows without elements keep a 0
 
 	int actualRow = -1;
 	int i         =  0; // Iterator for the vectors "values" and "jIdx"
@@ -51,10 +51,18 @@ SparseMatrix2D::SparseMatrix2D(std::vector<SparseElement> &_elements, int _Nelem
 	{
 		if(_elements.at(k).value != 0.0) // Searching that there isn't any zero value
 		{
+			int rse = _elements.at(k).i;
+
+			// Repeated elements are added
+			if( i > 0 && rse == actualRow && DIRECT_MULTIDIM_ELEM(jIdx,i-1) == (int)_elements.at(k).j +1 )
+			{
+				DIRECT_MULTIDIM_ELEM(values,i-1) += _elements.at(k).value;
+				continue;
+			}
+
 			DIRECT_MULTIDIM_ELEM(values,i) = _elements.at(k).value;
 			DIRECT_MULTIDIM_ELEM(jIdx,i)   = _elements.at(k).j +1;
 
-			int rse = _elements.at(k).i;
 			while( rse > actualRow )
 			{
 				actualRow++;
@@ -69,6 +77,10 @@ SparseMatrix2D::SparseMatrix2D(std::vector<SparseElement> &_elements, int _Nelem
 			++i;
 		}
 	}
+
+	// Zeros and repeated elements are not stored
+	values.resize(i);
+	jIdx.resize(i);
 }
 
 /*
@@ -125,30 +137,26 @@ SparseMatrix2D &SparseMatrix2D::operator =(const SparseMatrix2D &X)
 /**
  * It computes y <- this*x
  */
-void SparseMatrix2D::multMv(double* x, double* y)
+void SparseMatrix2D::multMv(const double* x, double* y) const
 {
-	int col, rowEnd, rowBeg;
-	double val;
-	memset(y,0,N*sizeof(double));
-
-	size_t nnz=XSIZE(values);
-    for(int i = 0; i< N; i++)
-    {
-    	// We get the gap where are the elements of the row i in value's vector
-		rowBeg = DIRECT_MULTIDIM_ELEM(iIdx,i) -1;
-		if( i != N-1 )
-			rowEnd = DIRECT_MULTIDIM_ELEM(iIdx,i+1) -1;
-		else
-			rowEnd = nnz;
-
-		val = 0.0;
-		for(int j = rowBeg; j < rowEnd ; j++)
+	// Rows are visited from the last one, so that the end of a row is the
+	// beginning of the next row with elements
+	int rowEnd = XSIZE(values);
+	for(int i = N-1; i >= 0; i--)
+	{
+		int rowBeg = DIRECT_MULTIDIM_ELEM(iIdx,i) -1;
+		double val = 0.0;
+		if( rowBeg >= 0 )
 		{
-			col = DIRECT_MULTIDIM_ELEM(jIdx,j) -1;// Column with a nonzero element in this row of the matrix
-			val += DIRECT_MULTIDIM_ELEM(values,j) * x[col];
+			for(int j = rowBeg; j < rowEnd ; j++)
+			{
+				int col = DIRECT_MULTIDIM_ELEM(jIdx,j) -1;// Column with a nonzero element in this row of the matrix
+				val += DIRECT_MULTIDIM_ELEM(values,j) * x[col];
+			}
+			rowEnd = rowBeg;
 		}
 		y[i] = val;
-    }
+	}
 }
 
 /*
@@ -172,12 +180,17 @@ std::ostream & operator << (std::ostream &out, const SparseMatrix2D &X)
 double SparseMatrix2D::getElemIJ(int row, int col) const
 {
 	int rowBeg = DIRECT_MULTIDIM_ELEM(iIdx,row) -1;
-	int rowEnd;
+	if( rowBeg < 0 )
+		return 0.0;
 
-	if( row != N-1 )
-		rowEnd = DIRECT_MULTIDIM_ELEM(iIdx,row+1) -1;
-	else
-		rowEnd = XSIZE(values);
+	// The row ends where the next row with elements begins
+	int rowEnd = XSIZE(values);
+	for(int nextRow = row+1; nextRow < N ; nextRow++)
+		if( DIRECT_MULTIDIM_ELEM(iIdx,nextRow) != 0 )
+		{
+			rowEnd = DIRECT_MULTIDIM_ELEM(iIdx,nextRow) -1;
+			break;
+		}
 
 	// If there is a non-zero element, the column is in jIdx
 	for(int i = rowBeg; i < rowEnd ; i++)
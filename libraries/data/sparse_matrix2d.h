@@ -91,6 +91,7 @@ public:
 
     /** Constructor from a set of i,j indexes and their corresponding values.
      * N is the total dimension of the square, sparse matrix.
+     * The values of repeated i,j indexes are added.
      */
     SparseMatrix2D(std::vector<SparseElement> &_elements, int _Nelements);
 
@@ -103,7 +104,7 @@ public:
     /** Computes y=this*x
      * y and x are vectors of size Nx1
      */
-    void multMv(double* x, double* y);
+    void multMv(const double* x, double* y) const;
 
     /// Computes Y=this*X
     void multMM(const SparseMatrix2D &X, SparseMatrix2D &Y);
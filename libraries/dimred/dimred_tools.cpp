@@ -23,7 +23,9 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <algorithm>
 #include "dimred_tools.h"
+#include "nearestNeighbours.h"
 
 void GenerateData::generateNewDataset(const String& method, int N, double noise)
 {
@@ -190,6 +192,15 @@ void insertNeighbour(Matrix2D<int> &idx, Matrix2D<double> &distance, int i1, int
 }
 
 void kNearestNeighbours(const Matrix2D<double> &X, int K, Matrix2D<int> &idx, Matrix2D<double> &distance, DimRedDistance2 f, bool computeSqrt)
+{
+	NearestNeighbourSearch knn;
+	knn.search(X,K,idx,distance,f);
+	if (computeSqrt)
+		FOR_ALL_ELEMENTS_IN_MATRIX2D(distance)
+			MAT_ELEM(distance,i,j)=sqrt(MAT_ELEM(distance,i,j));
+}
+
+void kNearestNeighboursAllPairs(const Matrix2D<double> &X, int K, Matrix2D<int> &idx, Matrix2D<double> &distance, DimRedDistance2 f, bool computeSqrt)
 {
 	K=std::min(K,(int)MAT_YSIZE(X)-1);
 	idx.initConstant(MAT_YSIZE(X),K,-1);
@@ -299,6 +310,42 @@ void computeSimilarityMatrix(Matrix2D<double> &D2, double sigma, bool skipZeros,
 	}
 }
 
+void computeSparseSimilarityGraph(const Matrix2D<double> &X, int K, double sigma, SparseMatrix2D &G,
+                                  Matrix1D<double> &degree, DimRedDistance2 f)
+{
+	Matrix2D<int> idx;
+	Matrix2D<double> D2;
+	kNearestNeighbours(X,K,idx,D2,f,false);
+	double maxDistance=D2.computeMax();
+	double Kexp=-0.5/(sigma*sigma*maxDistance);
+
+	// Both directions of every edge, the repeated ones are removed
+	std::vector<SparseElement> elements;
+	elements.reserve(2*MAT_YSIZE(idx)*MAT_XSIZE(idx));
+	FOR_ALL_ELEMENTS_IN_MATRIX2D(idx)
+	{
+		double d2=MAT_ELEM(D2,i,j);
+		if (d2==0)
+			continue;
+		SparseElement e;
+		e.i=i;
+		e.j=MAT_ELEM(idx,i,j);
+		e.value=exp(d2*Kexp);
+		elements.push_back(e);
+		std::swap(e.i,e.j);
+		elements.push_back(e);
+	}
+	std::sort(elements.begin(),elements.end());
+	elements.erase(std::unique(elements.begin(),elements.end(),
+	                           [](const SparseElement &a, const SparseElement &b) { return a.i==b.i && a.j==b.j; }),
+	               elements.end());
+
+	degree.initZeros(MAT_YSIZE(X));
+	for (size_t n=0; n<elements.size(); ++n)
+		VEC_ELEM(degree,elements[n].i)+=elements[n].value;
+	G=SparseMatrix2D(elements,MAT_YSIZE(X));
+}
+
 void computeGraphLaplacian(const Matrix2D<double> &G, Matrix2D<double> &L)
 {
 	Matrix1D<double> d;
@@ -435,6 +482,7 @@ DimRedAlgorithm::DimRedAlgorithm()
 {
 	X=NULL;
 	distance=NULL;
+	sparse=false;
 }
 
 void DimRedAlgorithm::setInputData(Matrix2D<double> &X)
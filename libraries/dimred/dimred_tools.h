@@ -27,6 +27,7 @@
 
 #include <core/matrix2d.h>
 #include <core/matrix1d.h>
+#include <data/sparse_matrix2d.h>
 
 /**@defgroup DimRedTools Tools for dimensionality reduction
    @ingroup DimRedLibrary */
@@ -92,6 +93,16 @@ void computeDistanceToNeighbours(const Matrix2D<double> &X, int K, Matrix2D<doub
  */
 void computeSimilarityMatrix(Matrix2D<double> &D2, double sigma, bool skipZeros=false, bool normalize=false);
 
+/** Compute a sparse similarity graph of the K nearest neighbours.
+ * This is the sparse counterpart of computeDistanceToNeighbours(X,K,D2,f,false)
+ * followed by computeSimilarityMatrix(D2,sigma,true,true). G(i,j) is
+ * exp(-dij^2/(2*sigma^2*max(dij^2))) if i is among the K nearest neighbours of j
+ * or viceversa, and 0 otherwise. degree(i) is the sum of the i-th row of G.
+ * The memory is O(NK) instead of O(N^2).
+ */
+void computeSparseSimilarityGraph(const Matrix2D<double> &X, int K, double sigma, SparseMatrix2D &G,
+                                  Matrix1D<double> &degree, DimRedDistance2 f=NULL);
+
 /** Compute graph laplacian.
  * L=D-G where D is a diagonal matrix with the row sums of G.
  */
@@ -121,9 +132,18 @@ double intrinsicDimensionality(Matrix2D<double> &X, const String &method="MLE",
  * The element i,j of the output matrices is the index(distance) of the j-th nearest neighbor to the i-th sample.
  *
  * You can provide a distance function of your own. If not, Euclidean distance is used.
+ *
+ * The search is done by NearestNeighbourSearch with its default settings
+ * (KD-tree for low dimensional data, blocked brute force otherwise, all cores).
  */
 void kNearestNeighbours(const Matrix2D<double> &X, int K, Matrix2D<int> &idx, Matrix2D<double> &distance, DimRedDistance2 f=NULL, bool computeSqrt=true);
 
+/** k-Nearest neighbours with an all-pairs search.
+ * Single threaded O(N^2) search, kept as a reference for kNearestNeighbours.
+ * It gives the same result.
+ */
+void kNearestNeighboursAllPairs(const Matrix2D<double> &X, int K, Matrix2D<int> &idx, Matrix2D<double> &distance, DimRedDistance2 f=NULL, bool computeSqrt=true);
+
 /** Extract k-nearest neighbours.
  * This function extracts from the matrix X, the neighbours given by idx for the i-th observation.
  */
@@ -147,6 +167,11 @@ public:
 
 	/// Save mapping
 	FileName fnMapping;
+
+	/** Use sparse matrices and an iterative eigensolver.
+	 * Only for the methods that support it (LE and LTSA), the rest ignore it.
+	 */
+	bool sparse;
 public:
 	/// Empty constructor
 	DimRedAlgorithm();
@@ -0,0 +1,252 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include "lanczos.h"
+
+void smallSymmetricEigs(std::vector<double> &A, int n, std::vector<double> &lambda,
+                        std::vector<double> &Q)
+{
+	Q.assign((size_t)n*n,0.0);
+	for (int i=0; i<n; ++i)
+		Q[i*n+i]=1;
+
+	for (int sweep=0; sweep<100; ++sweep)
+	{
+		double offDiagonal=0, diagonal=0;
+		for (int i=0; i<n; ++i)
+		{
+			diagonal+=A[i*n+i]*A[i*n+i];
+			for (int j=i+1; j<n; ++j)
+				offDiagonal+=A[i*n+j]*A[i*n+j];
+		}
+		if (offDiagonal<=1e-30*diagonal || offDiagonal==0)
+			break;
+
+		for (int p=0; p<n-1; ++p)
+			for (int q=p+1; q<n; ++q)
+			{
+				double apq=A[p*n+q];
+				if (apq==0)
+					continue;
+				// Rotation that annihilates A(p,q)
+				double theta=(A[q*n+q]-A[p*n+p])/(2*apq);
+				double t=(theta>=0 ? 1.0 : -1.0)/(fabs(theta)+sqrt(theta*theta+1));
+				double c=1/sqrt(t*t+1), s=t*c;
+				for (int k=0; k<n; ++k)
+				{
+					double akp=A[k*n+p], akq=A[k*n+q];
+					A[k*n+p]=c*akp-s*akq;
+					A[k*n+q]=s*akp+c*akq;
+				}
+				for (int k=0; k<n; ++k)
+				{
+					double apk=A[p*n+k], aqk=A[q*n+k];
+					A[p*n+k]=c*apk-s*aqk;
+					A[q*n+k]=s*apk+c*aqk;
+				}
+				for (int k=0; k<n; ++k)
+				{
+					double qkp=Q[k*n+p], qkq=Q[k*n+q];
+					Q[k*n+p]=c*qkp-s*qkq;
+					Q[k*n+q]=s*qkp+c*qkq;
+				}
+			}
+	}
+
+	// Sort in decreasing order
+	std::vector<int> order(n);
+	std::iota(order.begin(),order.end(),0);
+	std::sort(order.begin(),order.end(),[&](int a, int b) { return A[a*n+a]>A[b*n+b]; });
+	std::vector<double> sortedQ((size_t)n*n);
+	lambda.resize(n);
+	for (int j=0; j<n; ++j)
+	{
+		lambda[j]=A[order[j]*n+order[j]];
+		for (int i=0; i<n; ++i)
+			sortedQ[i*n+j]=Q[i*n+order[j]];
+	}
+	Q.swap(sortedQ);
+}
+
+LanczosEigensolver::LanczosEigensolver()
+{
+	basisSize=0;
+	tolerance=1e-8;
+	maxRestarts=1000;
+	seed=0;
+	restarts=0;
+	converged=false;
+}
+
+// Orthogonalize w against the first n vectors of V (twice, for stability).
+// The projections are accumulated in h
+static void reorthogonalize(const std::vector<double> &V, size_t N, int n,
+                            double *w, std::vector<double> &h)
+{
+	h.assign(n,0.0);
+	for (int pass=0; pass<2; ++pass)
+		for (int i=0; i<n; ++i)
+		{
+			const double *vi=&V[i*N];
+			double dot=0;
+			for (size_t l=0; l<N; ++l)
+				dot+=vi[l]*w[l];
+			for (size_t l=0; l<N; ++l)
+				w[l]-=dot*vi[l];
+			h[i]+=dot;
+		}
+}
+
+static double norm2(const double *w, size_t N)
+{
+	double sum=0;
+	for (size_t l=0; l<N; ++l)
+		sum+=w[l]*w[l];
+	return sqrt(sum);
+}
+
+void LanczosEigensolver::largest(const SymmetricOperator &A, size_t N, int k,
+                                 Matrix1D<double> &lambda, Matrix2D<double> &V)
+{
+	k=std::max(0,std::min(k,(int)N));
+	lambda.initZeros(k);
+	V.initZeros(N,k);
+	restarts=0;
+	converged=true;
+	if (k==0)
+		return;
+
+	int m=basisSize>0 ? basisSize : std::max(2*k+1,k+40);
+	m=std::max(m,k+1);
+	m=(int)std::min((size_t)m,N);
+
+	// Basis vectors are stored one after the other, there is room for m+1
+	std::vector<double> basis((size_t)(m+1)*N), T((size_t)m*m,0.0), h, theta, Y, ritz;
+	std::mt19937 generator(seed);
+	std::normal_distribution<double> gaussian;
+	auto randomVector=[&](int j)
+	{
+		double *v=&basis[j*N];
+		double normv=0;
+		for (int attempt=0; attempt<10 && normv==0; ++attempt)
+		{
+			for (size_t l=0; l<N; ++l)
+				v[l]=gaussian(generator);
+			reorthogonalize(basis,N,j,v,h);
+			normv=norm2(v,N);
+		}
+		for (size_t l=0; l<N; ++l)
+			v[l]/=normv;
+	};
+	randomVector(0);
+
+	int l=0; // Number of kept Ritz vectors
+	double betaLast=0, scale=0;
+	converged=false;
+	while (true)
+	{
+		// Extend the basis from l to m vectors
+		for (int j=l; j<m; ++j)
+		{
+			double *w=&basis[(j+1)*N];
+			A(&basis[j*N],w);
+			reorthogonalize(basis,N,j+1,w,h);
+			for (int i=0; i<=j; ++i)
+				T[i*m+j]=T[j*m+i]=h[i];
+			scale=std::max(scale,fabs(h[j]));
+			double beta=norm2(w,N);
+			if (j<m-1)
+			{
+				if (beta<=1e-12*scale)
+				{
+					// Invariant subspace, continue with a new direction
+					randomVector(j+1);
+					beta=0;
+				}
+				else
+					for (size_t n=0; n<N; ++n)
+						w[n]/=beta;
+				T[(j+1)*m+j]=T[j*m+j+1]=beta;
+			}
+			else
+			{
+				betaLast=beta;
+				if (beta>0)
+					for (size_t n=0; n<N; ++n)
+						w[n]/=beta;
+			}
+		}
+
+		// Rayleigh-Ritz
+		std::vector<double> Tcopy(T);
+		smallSymmetricEigs(Tcopy,m,theta,Y);
+		double spectrumScale=std::max(fabs(theta[0]),fabs(theta[m-1]));
+		if (spectrumScale==0)
+			spectrumScale=1;
+		converged=true;
+		for (int i=0; i<k && converged; ++i)
+			converged=fabs(betaLast*Y[(m-1)*m+i])<=tolerance*spectrumScale;
+		if (converged || m==(int)N || restarts>=maxRestarts)
+			break;
+		++restarts;
+
+		// Thick restart: keep the best Ritz vectors and the residual direction
+		l=std::min(k+(m-k)/2,m-1);
+		ritz.assign((size_t)l*N,0.0);
+		for (int i=0; i<l; ++i)
+		{
+			double *r=&ritz[i*N];
+			for (int j=0; j<m; ++j)
+			{
+				double yji=Y[j*m+i];
+				const double *vj=&basis[j*N];
+				for (size_t n=0; n<N; ++n)
+					r[n]+=yji*vj[n];
+			}
+		}
+		std::copy(basis.begin()+(size_t)m*N,basis.begin()+(size_t)(m+1)*N,basis.begin()+(size_t)l*N);
+		std::copy(ritz.begin(),ritz.end(),basis.begin());
+		std::fill(T.begin(),T.end(),0.0);
+		for (int i=0; i<l; ++i)
+			T[i*m+i]=theta[i];
+	}
+
+	// Ritz vectors of the wanted eigenvalues
+	for (int i=0; i<k; ++i)
+	{
+		VEC_ELEM(lambda,i)=theta[i];
+		for (int j=0; j<m; ++j)
+		{
+			double yji=Y[j*m+i];
+			const double *vj=&basis[j*N];
+			for (size_t n=0; n<N; ++n)
+				MAT_ELEM(V,n,i)+=yji*vj[n];
+		}
+	}
+}
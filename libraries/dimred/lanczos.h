@@ -0,0 +1,97 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef _LANCZOS_H
+#define _LANCZOS_H
+
+#include <functional>
+#include <vector>
+#include <core/matrix2d.h>
+#include <core/matrix1d.h>
+
+/**@defgroup Lanczos Iterative eigensolver for large symmetric matrices
+   @ingroup DimRedLibrary */
+//@{
+/** Symmetric linear operator.
+ * It must compute y=A*x, where x and y are vectors of size N.
+ */
+typedef std::function<void (const double *x, double *y)> SymmetricOperator;
+
+/** Thick-restart Lanczos eigensolver.
+ * Computes the k largest (algebraic) eigenvalues of a symmetric operator and
+ * their eigenvectors. Only the product of the operator by a vector is needed,
+ * so the operator may be a large sparse matrix. The memory used is about
+ * basisSize vectors of size N.
+ *
+ * The Lanczos basis is fully reorthogonalized. When it is full, the Ritz
+ * vectors closest to convergence are kept and the basis is extended again
+ * from them (Wu and Simon, SIAM J. Matrix Anal. Appl. 22:602, 2000).
+ *
+ * The smallest eigenvalues of a positive semidefinite matrix B can be
+ * computed as the largest of sigma*I-B, with sigma an upper bound of the
+ * spectrum of B such as its largest absolute row sum.
+ */
+class LanczosEigensolver
+{
+public:
+	/// Number of vectors of the basis (0=automatic, k+40)
+	int basisSize;
+
+	/// A Ritz pair is converged when its residual is below tolerance*|largest eigenvalue|
+	double tolerance;
+
+	/// Maximum number of restarts
+	int maxRestarts;
+
+	/// Seed of the random starting vector
+	unsigned int seed;
+
+	/// Number of restarts of the last run
+	int restarts;
+
+	/// Whether the last run converged
+	bool converged;
+public:
+	/// Empty constructor
+	LanczosEigensolver();
+
+	/** Compute the k largest eigenvalues of A (size NxN).
+	 * The eigenvalues are returned in decreasing order and the corresponding
+	 * (unit norm) eigenvectors are the columns of V (Nxk).
+	 */
+	void largest(const SymmetricOperator &A, size_t N, int k,
+	             Matrix1D<double> &lambda, Matrix2D<double> &V);
+};
+
+/** Eigenvalues and eigenvectors of a small, dense symmetric matrix.
+ * A is a n x n matrix stored by rows. On output, lambda has the eigenvalues in
+ * decreasing order and the i-th column of Q (stored by rows) the i-th eigenvector.
+ * Cyclic Jacobi rotations are used, which is accurate and fast enough for the
+ * Rayleigh-Ritz problems of the Lanczos eigensolver.
+ */
+void smallSymmetricEigs(std::vector<double> &A, int n, std::vector<double> &lambda,
+                        std::vector<double> &Q);
+//@}
+#endif
@@ -25,6 +25,7 @@
  ***************************************************************************/
 
 #include "laplacianEigenmaps.h"
+#include "lanczos.h"
 
 void LaplacianEigenmap::setSpecificParameters(double sigma, size_t numberOfNeighbours)
 {
@@ -34,6 +35,12 @@ void LaplacianEigenmap::setSpecificParameters(double sigma, size_t numberOfNeigh
 
 void LaplacianEigenmap::reduceDimensionality()
 {
+	if (sparse)
+	{
+		reduceDimensionalitySparse();
+		return;
+	}
+
 	Matrix2D<double> G,L,D;
 	Matrix1D<double> mappedX;
 	//Construct neighborhood graph
@@ -50,3 +57,39 @@ void LaplacianEigenmap::reduceDimensionality()
 	generalizedEigs(L,D,mappedX,Y);
 	keepColumns(Y,1,(int)outputDim);
 }
+
+void LaplacianEigenmap::reduceDimensionalitySparse()
+{
+	//Construct the sparse neighborhood graph with the heat kernel weights
+	SparseMatrix2D G;
+	Matrix1D<double> degree;
+	computeSparseSimilarityGraph(*X,numberOfNeighbours,sigma,G,degree,distance);
+
+	//L*v=lambda*D*v is equivalent to D^-1/2*G*D^-1/2*u=(1-lambda)*u with v=D^-1/2*u,
+	//so the smallest generalized eigenvalues are the largest of the normalized graph
+	size_t N=MAT_YSIZE(*X);
+	std::vector<double> isqrtDegree(N), aux(N);
+	for (size_t i=0; i<N; ++i)
+		isqrtDegree[i]=VEC_ELEM(degree,i)>0 ? 1/sqrt(VEC_ELEM(degree,i)) : 0;
+	SymmetricOperator normalizedG=[&](const double *x, double *y)
+	{
+		for (size_t i=0; i<N; ++i)
+			aux[i]=isqrtDegree[i]*x[i];
+		G.multMv(&aux[0],y);
+		for (size_t i=0; i<N; ++i)
+			y[i]*=isqrtDegree[i];
+	};
+
+	LanczosEigensolver solver;
+	Matrix1D<double> mu;
+	Matrix2D<double> U;
+	solver.largest(normalizedG,N,(int)outputDim+1,mu,U);
+	if (!solver.converged)
+		std::cerr << "LaplacianEigenmap: the eigensolver did not converge after "
+		          << solver.restarts << " restarts" << std::endl;
+
+	//The first eigenvector is the trivial one
+	Y.resizeNoCopy(N,outputDim);
+	FOR_ALL_ELEMENTS_IN_MATRIX2D(Y)
+		MAT_ELEM(Y,i,j)=MAT_ELEM(U,i,j+1)*isqrtDegree[i];
+}
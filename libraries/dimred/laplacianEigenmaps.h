@@ -45,6 +45,11 @@ public:
 
 	/// Reduce dimensionality
 	void reduceDimensionality();
+
+	/** Reduce dimensionality with a sparse graph and the Lanczos eigensolver.
+	 * The generalized eigenvectors are D-orthonormal.
+	 */
+	void reduceDimensionalitySparse();
 };
 //@}
 #endif
@@ -21,7 +21,9 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <algorithm>
 #include "ltsa.h"
+#include "lanczos.h"
 
 void LTSA::setSpecificParameters(int k)
 {
@@ -53,34 +55,45 @@ void getLessWeightNColumns(const Matrix2D<double> &A, const Matrix1D<int> &weigh
             }
 }
 
-void LTSA::computeAlignmentMatrix(Matrix2D<double> &B)
+void LTSA::computeNeighbourhoods(Matrix2D<int> &ni)
 {
 	subtractColumnMeans(*X);
-
-	size_t n = MAT_YSIZE(*X);
-	Matrix2D<int> ni;
 	Matrix2D<double> D;
 	kNearestNeighbours(*X, k, ni, D);
-	Matrix2D<double> Xi(MAT_XSIZE(ni), MAT_XSIZE(*X)), W, Vi, Vi2, Si, Gi;
+}
 
-	B.initIdentity(n);
+void LTSA::computeLocalAlignment(Matrix2D<int> &ni, size_t iLoop, Matrix2D<double> &Gi)
+{
+	Matrix2D<double> Xi(MAT_XSIZE(ni), MAT_XSIZE(*X)), W, Vi, Vi2, Si;
 	Matrix1D<int> weightVector;
-	for (size_t iLoop = 0; iLoop < n; ++iLoop)
-	{
-		extractNearestNeighbours(*X, ni, iLoop, Xi);
-		subtractColumnMeans(Xi);
 
-		matrixOperation_AAt(Xi, W); // W=X*X^t
-		schur(W, Vi, Si);           // W=Vi*Si*Vi^t
+	extractNearestNeighbours(*X, ni, iLoop, Xi);
+	subtractColumnMeans(Xi);
 
-		computeWeightsVector(Si, weightVector);
+	matrixOperation_AAt(Xi, W); // W=X*X^t
+	schur(W, Vi, Si);           // W=Vi*Si*Vi^t
 
-		Vi2.resizeNoCopy(MAT_YSIZE(Vi), outputDim + 1);
-		Vi2.setConstantCol(0, 1/sqrt(k)); //Vi2(0,:)=1/sqrt(k)
-		getLessWeightNColumns(Vi, weightVector, Vi2);
+	computeWeightsVector(Si, weightVector);
 
-		matrixOperation_AAt(Vi2, Gi); // Gi=Vi2*Vi2^t
-		matrixOperation_IminusA(Gi);  // Gi=I-Gi
+	Vi2.resizeNoCopy(MAT_YSIZE(Vi), outputDim + 1);
+	Vi2.setConstantCol(0, 1/sqrt(k)); //Vi2(0,:)=1/sqrt(k)
+	getLessWeightNColumns(Vi, weightVector, Vi2);
+
+	matrixOperation_AAt(Vi2, Gi); // Gi=Vi2*Vi2^t
+	matrixOperation_IminusA(Gi);  // Gi=I-Gi
+}
+
+void LTSA::computeAlignmentMatrix(Matrix2D<double> &B)
+{
+	Matrix2D<int> ni;
+	computeNeighbourhoods(ni);
+
+	size_t n = MAT_YSIZE(*X);
+	Matrix2D<double> Gi;
+	B.initIdentity(n);
+	for (size_t iLoop = 0; iLoop < n; ++iLoop)
+	{
+		computeLocalAlignment(ni, iLoop, Gi);
 
 		// Compute partial B with correlation matrix Gi
 		FOR_ALL_ELEMENTS_IN_MATRIX2D(Gi)
@@ -89,11 +102,79 @@ void LTSA::computeAlignmentMatrix(Matrix2D<double> &B)
 	}
 }
 
+void LTSA::computeSparseAlignmentMatrix(SparseMatrix2D &B)
+{
+	Matrix2D<int> ni;
+	computeNeighbourhoods(ni);
+
+	// The identity of the dense version is cancelled by the -1 of every
+	// iteration, so B is just the sum of the local alignments
+	size_t n = MAT_YSIZE(*X);
+	Matrix2D<double> Gi;
+	std::vector<SparseElement> elements;
+	elements.reserve(n*MAT_XSIZE(ni)*MAT_XSIZE(ni));
+	for (size_t iLoop = 0; iLoop < n; ++iLoop)
+	{
+		computeLocalAlignment(ni, iLoop, Gi);
+		FOR_ALL_ELEMENTS_IN_MATRIX2D(Gi)
+		{
+			SparseElement e;
+			e.i = MAT_ELEM(ni,iLoop,i);
+			e.j = MAT_ELEM(ni,iLoop,j);
+			e.value = MAT_ELEM(Gi, i, j);
+			elements.push_back(e);
+		}
+	}
+	B = SparseMatrix2D(elements, n); // Repeated elements are added
+}
+
 void LTSA::reduceDimensionality()
 {
+	if (sparse)
+	{
+		reduceDimensionalitySparse();
+		return;
+	}
+
 	Matrix2D<double> B;
     computeAlignmentMatrix(B);
 
     Matrix1D<double> DEigs;
     eigsBetween(B, 1, outputDim, DEigs, Y);
 }
+
+void LTSA::reduceDimensionalitySparse()
+{
+	SparseMatrix2D B;
+	computeSparseAlignmentMatrix(B);
+
+	// The smallest eigenvalues of B are the largest of sigma*I-B, with sigma
+	// the largest absolute row sum of B (Gershgorin)
+	size_t N = MAT_YSIZE(*X);
+	std::vector<double> ones(N, 1.0), rowSum(N);
+	SparseMatrix2D absB(B);
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(absB.values)
+		DIRECT_MULTIDIM_ELEM(absB.values, n) = fabs(DIRECT_MULTIDIM_ELEM(absB.values, n));
+	absB.multMv(&ones[0], &rowSum[0]);
+	double sigma = *std::max_element(rowSum.begin(), rowSum.end());
+
+	SymmetricOperator shiftedB=[&](const double *x, double *y)
+	{
+		B.multMv(x, y);
+		for (size_t i = 0; i < N; ++i)
+			y[i] = sigma*x[i] - y[i];
+	};
+
+	LanczosEigensolver solver;
+	Matrix1D<double> lambda;
+	Matrix2D<double> U;
+	solver.largest(shiftedB, N, (int)outputDim + 1, lambda, U);
+	if (!solver.converged)
+		std::cerr << "LTSA: the eigensolver did not converge after "
+		          << solver.restarts << " restarts" << std::endl;
+
+	// The first eigenvector is the constant one
+	Y.resizeNoCopy(N, outputDim);
+	FOR_ALL_ELEMENTS_IN_MATRIX2D(Y)
+		MAT_ELEM(Y, i, j) = MAT_ELEM(U, i, j + 1);
+}
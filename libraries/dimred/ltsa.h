@@ -43,9 +43,21 @@ public:
 
 	/// Reduce dimensionality
 	virtual void reduceDimensionality();
+
+	/// Reduce dimensionality with a sparse alignment matrix and the Lanczos eigensolver
+	void reduceDimensionalitySparse();
 protected:
+	/// Center the data and find the neighbourhoods
+	void computeNeighbourhoods(Matrix2D<int> &ni);
+
+	/// Alignment matrix (KxK) of the neighbourhood of the iLoop-th observation
+	void computeLocalAlignment(Matrix2D<int> &ni, size_t iLoop, Matrix2D<double> &Gi);
+
 	/// Common part
 	void computeAlignmentMatrix(Matrix2D<double> &B);
+
+	/// Sparse alignment matrix, O(NK^2) memory
+	void computeSparseAlignmentMatrix(SparseMatrix2D &B);
 };
 //@}
 #endif
@@ -53,6 +53,7 @@ void ProgDimRed::readParams()
     	Niter=getIntParam("-m",1);
     if (dimRefMethod=="SPE")
     	global=getIntParam("-m",2)==1;
+    sparse=checkParam("--sparse");
 }
 
 // Show ====================================================================
@@ -77,6 +78,8 @@ void ProgDimRed::show()
     	std::cout << "Niter=" << Niter << std::endl;
     if (dimRefMethod=="SPE")
     	std::cout << "Global=" << global << std::endl;
+    if (dimRefMethod=="LE" || dimRefMethod=="LTSA")
+    	std::cout << "Sparse=" << sparse << std::endl;
 }
 
 // usage ===================================================================
@@ -104,6 +107,8 @@ void ProgDimRed::defineParams()
     addParamsLine("  [--saveMapping <fn=\"\">] : Save mapping if available (PCA, LLTSA, LPP, pPCA, NPE) so that it can be reused later (Y=X*M)");
     addParamsLine("                            :+X is the input matrix with individuals as rows");
     addParamsLine("                            :+Y is the output matrix with individuals as rows");
+    addParamsLine("  [--sparse]                : Use sparse matrices and an iterative eigensolver (LE and LTSA)");
+    addParamsLine("                            :+The memory grows with N*k instead of N^2, so that large datasets can be embedded");
 }
 
 // Produce Side info  ====================================================================
@@ -156,6 +161,7 @@ void ProgDimRed::produceSideInfo()
 
     algorithm->setOutputDimensionality(outputDim);
     algorithm->fnMapping=fnMapping;
+    algorithm->sparse=sparse;
 }
 
 // Estimate dimension
@@ -63,6 +63,7 @@ public:
     double t; // Markov random walk
     double sigma; // Sigma of kernel
     bool global; // Global for SPE
+    bool sparse; // Sparse matrices for LE and LTSA
 public:
     Matrix2D<double> X; // Input data
     DimRedAlgorithm*  algorithm;
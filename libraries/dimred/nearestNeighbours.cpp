@@ -0,0 +1,334 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include "nearestNeighbours.h"
+
+class NearestNeighbourSearch::NeighbourHeap
+{
+public:
+	// Pairs (distance,index), the worst one at the front
+	std::vector< std::pair<double,int> > heap;
+	int K;
+
+	NeighbourHeap(int _K): K(_K)
+	{
+		heap.reserve(K);
+	}
+
+	inline bool full() const
+	{
+		return (int)heap.size()==K;
+	}
+
+	inline double worst() const
+	{
+		return full() ? heap.front().first : std::numeric_limits<double>::max();
+	}
+
+	// Ties are resolved in favour of the smallest index as in the all-pairs search
+	inline void push(double d, int i)
+	{
+		std::pair<double,int> candidate(d,i);
+		if ((int)heap.size()<K)
+		{
+			heap.push_back(candidate);
+			std::push_heap(heap.begin(),heap.end());
+		}
+		else if (candidate<heap.front())
+		{
+			std::pop_heap(heap.begin(),heap.end());
+			heap.back()=candidate;
+			std::push_heap(heap.begin(),heap.end());
+		}
+	}
+
+	// Write the neighbours sorted by distance in row i and empty the heap
+	void store(Matrix2D<int> &idx, Matrix2D<double> &distance, size_t i)
+	{
+		std::sort_heap(heap.begin(),heap.end());
+		for (size_t k=0; k<heap.size(); ++k)
+		{
+			MAT_ELEM(distance,i,k)=heap[k].first;
+			MAT_ELEM(idx,i,k)=heap[k].second;
+		}
+		heap.clear();
+	}
+};
+
+NearestNeighbourSearch::NearestNeighbourSearch()
+{
+	method=AUTO;
+	threads=std::max(1,(int)std::thread::hardware_concurrency());
+	approximation=0;
+	leafSize=16;
+	maxTreeDim=16;
+	dim=0;
+}
+
+NearestNeighbourSearch::Method NearestNeighbourSearch::chooseMethod(size_t N, size_t D) const
+{
+	if (method!=AUTO)
+		return method;
+	// A tree only prunes when there are many more points than cells
+	if (D<=maxTreeDim && N>=(size_t)(8*leafSize))
+		return KDTREE;
+	return BRUTE_FORCE;
+}
+
+void NearestNeighbourSearch::search(const Matrix2D<double> &X, int K, Matrix2D<int> &idx,
+                                    Matrix2D<double> &distance, DimRedDistance2 f)
+{
+	size_t N=MAT_YSIZE(X);
+	K=std::max(0,std::min(K,(int)N-1));
+	idx.initConstant(N,K,-1);
+	distance.initConstant(N,K,1e38);
+	if (K==0)
+		return;
+
+	if (f==NULL && chooseMethod(N,MAT_XSIZE(X))==KDTREE)
+		searchTree(X,K,idx,distance);
+	else
+		searchBruteForce(X,K,idx,distance,f);
+}
+
+template <class Function>
+void NearestNeighbourSearch::parallelFor(size_t N, size_t blockSize, int nThreads, const Function &function) const
+{
+	size_t Nblocks=(N+blockSize-1)/blockSize;
+	std::atomic<size_t> nextBlock(0);
+	auto worker=[&]()
+	{
+		size_t block;
+		while ((block=nextBlock++)<Nblocks)
+			function(block*blockSize,std::min(N,(block+1)*blockSize));
+	};
+
+	int Nthreads=(int)std::min((size_t)std::max(1,nThreads),Nblocks);
+	std::vector<std::thread> workers;
+	for (int t=1; t<Nthreads; ++t)
+		workers.emplace_back(worker);
+	worker();
+	for (size_t t=0; t<workers.size(); ++t)
+		workers[t].join();
+}
+
+/* KD-tree ----------------------------------------------------------------- */
+void NearestNeighbourSearch::buildTree(const Matrix2D<double> &X)
+{
+	int N=(int)MAT_YSIZE(X);
+	dim=MAT_XSIZE(X);
+	order.resize(N);
+	for (int i=0; i<N; ++i)
+		order[i]=i;
+	nodes.clear();
+	nodes.reserve(4*N/std::max(1,leafSize)+1);
+	buildNode(X,0,N);
+
+	points.resize((size_t)N*dim);
+	for (int p=0; p<N; ++p)
+		memcpy(&points[(size_t)p*dim],&MAT_ELEM(X,order[p],0),dim*sizeof(double));
+}
+
+int NearestNeighbourSearch::buildNode(const Matrix2D<double> &X, int begin, int end)
+{
+	int n=(int)nodes.size();
+	Node node;
+	node.begin=begin;
+	node.end=end;
+	node.left=node.right=-1;
+	node.dim=0;
+	node.split=0;
+	nodes.push_back(node);
+	if (end-begin<=leafSize)
+		return n;
+
+	// Split along the dimension of largest spread
+	double bestSpread=0;
+	int bestDim=0;
+	for (size_t j=0; j<dim; ++j)
+	{
+		double minj=MAT_ELEM(X,order[begin],j), maxj=minj;
+		for (int p=begin+1; p<end; ++p)
+		{
+			double x=MAT_ELEM(X,order[p],j);
+			if (x<minj)
+				minj=x;
+			else if (x>maxj)
+				maxj=x;
+		}
+		if (maxj-minj>bestSpread)
+		{
+			bestSpread=maxj-minj;
+			bestDim=(int)j;
+		}
+	}
+	if (bestSpread==0)
+		return n; // All points are equal
+
+	int mid=(begin+end)/2;
+	std::nth_element(order.begin()+begin,order.begin()+mid,order.begin()+end,
+	                 [&](int a, int b) { return MAT_ELEM(X,a,bestDim)<MAT_ELEM(X,b,bestDim); });
+	double split=MAT_ELEM(X,order[mid],bestDim);
+	int left=buildNode(X,begin,mid);
+	int right=buildNode(X,mid,end);
+	nodes[n].dim=bestDim;
+	nodes[n].split=split;
+	nodes[n].left=left;
+	nodes[n].right=right;
+	return n;
+}
+
+void NearestNeighbourSearch::searchNode(int n, const double *q, double *off, double rd,
+                                        NeighbourHeap &heap, int self, double eps2) const
+{
+	const Node &node=nodes[n];
+	if (node.left<0)
+	{
+		for (int p=node.begin; p<node.end; ++p)
+		{
+			int i=order[p];
+			if (i==self)
+				continue;
+			// A partial sum above the worst neighbour cannot enter the heap
+			const double *x=&points[(size_t)p*dim];
+			double worst=heap.worst();
+			double d=0;
+			for (size_t j=0; j<dim && d<=worst; ++j)
+			{
+				double diff=x[j]-q[j];
+				d+=diff*diff;
+			}
+			if (d<=worst)
+				heap.push(d,i);
+		}
+		return;
+	}
+
+	// Left points are <= split and right points >= split
+	double diff=q[node.dim]-node.split;
+	int nearChild=node.left, farChild=node.right;
+	if (diff>=0)
+	{
+		nearChild=node.right;
+		farChild=node.left;
+	}
+	searchNode(nearChild,q,off,rd,heap,self,eps2);
+
+	double oldOff=off[node.dim];
+	double farRd=rd-oldOff*oldOff+diff*diff;
+	if (farRd*eps2<=heap.worst())
+	{
+		off[node.dim]=diff;
+		searchNode(farChild,q,off,farRd,heap,self,eps2);
+		off[node.dim]=oldOff;
+	}
+}
+
+void NearestNeighbourSearch::searchTree(const Matrix2D<double> &X, int K, Matrix2D<int> &idx,
+                                        Matrix2D<double> &distance)
+{
+	buildTree(X);
+	double eps2=(1+approximation)*(1+approximation);
+
+	// Queries are visited in tree order so that consecutive queries follow
+	// almost the same path and find the same leaves in cache
+	parallelFor(order.size(),256,threads,[&](size_t p0, size_t p1)
+	{
+		NeighbourHeap heap(K);
+		std::vector<double> off(dim);
+		for (size_t p=p0; p<p1; ++p)
+		{
+			std::fill(off.begin(),off.end(),0.0);
+			searchNode(0,&points[p*dim],&off[0],0,heap,order[p],eps2);
+			heap.store(idx,distance,order[p]);
+		}
+	});
+}
+
+/* Brute force ------------------------------------------------------------- */
+void NearestNeighbourSearch::searchBruteForce(const Matrix2D<double> &X, int K, Matrix2D<int> &idx,
+                                              Matrix2D<double> &distance, DimRedDistance2 f)
+{
+	size_t N=MAT_YSIZE(X);
+	size_t D=MAT_XSIZE(X);
+
+	if (f!=NULL)
+	{
+		// Distance functions given by the caller may be expensive and keep
+		// state (the correlation distance of transform_dimred aligns the two
+		// images), so each pair is computed once, as (i1,i2) with i1<i2, by a
+		// single thread and given to both observations, as in the all-pairs search
+		std::vector<NeighbourHeap> heaps(N,NeighbourHeap(K));
+		for (size_t i1=0; i1<N; ++i1)
+			for (size_t i2=i1+1; i2<N; ++i2)
+			{
+				double d=(*f)(X,i1,i2);
+				heaps[i1].push(d,(int)i2);
+				heaps[i2].push(d,(int)i1);
+			}
+		for (size_t i=0; i<N; ++i)
+			heaps[i].store(idx,distance,i);
+		return;
+	}
+
+	// A block of queries is compared against a block of observations of
+	// about 256KB, that is reused from cache by all the queries of the block
+	const size_t queryBlock=64;
+	const size_t refBlock=std::max((size_t)16,(size_t)32768/std::max((size_t)1,D));
+	parallelFor(N,queryBlock,threads,[&](size_t q0, size_t q1)
+	{
+		std::vector<NeighbourHeap> heaps(q1-q0,NeighbourHeap(K));
+		for (size_t r0=0; r0<N; r0+=refBlock)
+		{
+			size_t r1=std::min(N,r0+refBlock);
+			for (size_t q=q0; q<q1; ++q)
+			{
+				NeighbourHeap &heap=heaps[q-q0];
+				const double *xq=&MAT_ELEM(X,q,0);
+				for (size_t r=r0; r<r1; ++r)
+				{
+					if (r==q)
+						continue;
+					const double *xr=&MAT_ELEM(X,r,0);
+					double worst=heap.worst();
+					double d=0;
+					for (size_t j=0; j<D && d<=worst; ++j)
+					{
+						double diff=xq[j]-xr[j];
+						d+=diff*diff;
+					}
+					heap.push(d,(int)r);
+				}
+			}
+		}
+		for (size_t q=q0; q<q1; ++q)
+			heaps[q-q0].store(idx,distance,q);
+	});
+}
@@ -0,0 +1,147 @@
+/***************************************************************************
+ *
+ * Authors:    Xmipp team (xmipp@cnb.csic.es)
+ *
+ * Unidad de  Bioinformatica of Centro Nacional de Biotecnologia , CSIC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ * 02111-1307  USA
+ *
+ *  All comments concerning this program package may be sent to the
+ *  e-mail address 'xmipp@cnb.csic.es'
+ ***************************************************************************/
+
+#ifndef _NEAREST_NEIGHBOURS_H
+#define _NEAREST_NEIGHBOURS_H
+
+#include <vector>
+#include "dimred_tools.h"
+
+/**@defgroup NearestNeighbours k-Nearest neighbours search
+   @ingroup DimRedLibrary */
+//@{
+/** k-Nearest neighbours search.
+ * Each row of the data matrix is an observation. For every observation the K
+ * closest other observations are returned sorted by (squared) Euclidean
+ * distance, ties being broken by the smallest index, so that the result is
+ * the same as the one of an all-pairs search.
+ *
+ * Two engines are available:
+ * - A KD-tree (median split along the dimension of largest spread) which is
+ *   the fastest option for low dimensional data.
+ * - A blocked brute force in which blocks of queries are compared with
+ *   blocks of observations small enough to stay in cache. The inner loop runs
+ *   over contiguous memory so that it is vectorized by the compiler.
+ *
+ * Both engines distribute the queries among threads. The KD-tree can also
+ * run an approximate search in which a node is only visited if it may
+ * contain a point closer than the current K-th distance divided by
+ * (1+approximation). An approximation of 0 gives the exact neighbours.
+ *
+ * @code
+ * NearestNeighbourSearch knn;
+ * knn.threads=8;
+ * knn.search(X,12,idx,D2);
+ * @endcode
+ */
+class NearestNeighbourSearch
+{
+public:
+	/// Engines
+	enum Method {AUTO, KDTREE, BRUTE_FORCE};
+
+	/// Engine to use. AUTO chooses the KD-tree for low dimensional data.
+	Method method;
+
+	/// Number of threads (by default, the number of cores)
+	int threads;
+
+	/// Approximation factor for the KD-tree (0=exact)
+	double approximation;
+
+	/// Maximum number of observations in a leaf of the KD-tree
+	int leafSize;
+
+	/// Data dimensionality up to which AUTO uses the KD-tree
+	size_t maxTreeDim;
+public:
+	/// Empty constructor
+	NearestNeighbourSearch();
+
+	/** Search the K nearest neighbours of every observation.
+	 * idx(i,k) is the index of the k-th neighbour of the i-th observation and
+	 * distance(i,k) its squared distance. If f is given, that squared
+	 * distance function is called once per pair of observations, as
+	 * f(X,i1,i2) with i1<i2, in a single thread. Distance functions may be
+	 * expensive and keep state between calls (e.g. the correlation distance
+	 * of transform_dimred).
+	 */
+	void search(const Matrix2D<double> &X, int K, Matrix2D<int> &idx,
+	            Matrix2D<double> &distance, DimRedDistance2 f=NULL);
+
+	/// Method actually used for data of size NxD
+	Method chooseMethod(size_t N, size_t D) const;
+
+protected:
+	// KD-tree node. Leaves have left=-1.
+	struct Node
+	{
+		int begin, end;
+		int left, right;
+		int dim;
+		double split;
+	};
+
+	// Nodes of the tree, the root is the first one
+	std::vector<Node> nodes;
+
+	// Observation index of each position of the tree
+	std::vector<int> order;
+
+	// Observations copied in tree order so that leaves are contiguous
+	std::vector<double> points;
+
+	// Dimensionality of the observations in the tree
+	size_t dim;
+
+	// Build the tree for X
+	void buildTree(const Matrix2D<double> &X);
+
+	// Build the subtree of the positions [begin,end), returns the node index
+	int buildNode(const Matrix2D<double> &X, int begin, int end);
+
+	// Run a function on all queries [0,N) split in blocks among nThreads threads
+	template <class Function>
+	void parallelFor(size_t N, size_t blockSize, int nThreads, const Function &function) const;
+
+	// Bounded set of the best neighbours of a query
+	class NeighbourHeap;
+
+	// Search the subtree of node n for the query q. off holds the offsets
+	// of q to the box of the node along each dimension and rd their squared sum
+	void searchNode(int n, const double *q, double *off, double rd,
+	                NeighbourHeap &heap, int self, double eps2) const;
+
+	// Search with the tree
+	void searchTree(const Matrix2D<double> &X, int K, Matrix2D<int> &idx,
+	                Matrix2D<double> &distance);
+
+	// Blocked brute force
+	void searchBruteForce(const Matrix2D<double> &X, int K, Matrix2D<int> &idx,
+	                      Matrix2D<double> &distance, DimRedDistance2 f);
+};
+
+//@}
+#endif
@@ -49,6 +49,11 @@ void MpiProgReconstructSignificant::synchronize()
 	node->barrierWait();
 }
 
+void MpiProgReconstructSignificant::gatherCoarseSearchCheck(size_t *counters, int n)
+{
+	MPI_Allreduce(MPI_IN_PLACE, counters, n, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+}
+
 void MpiProgReconstructSignificant::gatherAlignment()
 {
 	// Share weights and cc volumes
@@ -53,6 +53,9 @@ public:
 
 	// Redefine how to gather the alignment
     void gatherAlignment();
+
+	// Redefine how to gather the coarse search check
+    void gatherCoarseSearchCheck(size_t *counters, int n);
 };
 //@}
 #endif
@@ -32,32 +32,104 @@ MpiTaskDistributor::MpiTaskDistributor(size_t nTasks, size_t bSize,
         ThreadTaskDistributor(nTasks, bSize)
 {
     this->node = node;
+    schedule = SCHEDULE_FIXED;
+    prefetch = masterWorks = report = false;
+    reportOut = NULL;
+    finalizedWorkers = 0;
+    prefetchPending = false;
+    tasksDone = 0;
+    idleTime = 0;
+    startTime = std::chrono::steady_clock::now();
+}
+
+void MpiTaskDistributor::setSchedule(TaskSchedule schedule)
+{
+    this->schedule = schedule;
+}
+
+void MpiTaskDistributor::setPrefetch(bool prefetch)
+{
+    this->prefetch = prefetch;
+}
+
+void MpiTaskDistributor::setMasterWorks(bool masterWorks)
+{
+    this->masterWorks = masterWorks;
+}
+
+void MpiTaskDistributor::setReport(bool report, std::ostream *out)
+{
+    this->report = report;
+    reportOut = out;
 }
 
 bool MpiTaskDistributor::distribute(size_t &first, size_t &last)
 {
-    return node->isMaster() ? distributeMaster() : distributeSlaves(first, last);
+    auto t0 = std::chrono::steady_clock::now();
+    bool moreTasks = node->isMaster() ? distributeMaster(first, last) : distributeSlaves(first, last);
+    idleTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (moreTasks)
+        tasksDone += last - first + 1;
+    return moreTasks;
+}
+
+bool MpiTaskDistributor::assignBlock(size_t &first, size_t &last, bool singleTask)
+{
+    if (schedule == SCHEDULE_FIXED && !singleTask)
+        return ThreadTaskDistributor::distribute(first, last);
+
+    if (assignedTasks >= numberOfTasks)
+        return false;
+    size_t n = 1;
+    if (!singleTask)
+    {
+        size_t workingNodes = node->size - 1 + (masterWorks ? 1 : 0);
+        size_t remaining = numberOfTasks - assignedTasks;
+        n = XMIPP_MAX(blockSize, (remaining + 2 * workingNodes - 1) / (2 * workingNodes));
+    }
+    first = assignedTasks;
+    assignedTasks = XMIPP_MIN(assignedTasks + n, numberOfTasks);
+    last = assignedTasks - 1;
+    return true;
 }
 
-bool MpiTaskDistributor::distributeMaster()
+void MpiTaskDistributor::serveRequests(bool untilFinished)
 {
-    int size = node->size;
     size_t workBuffer[3];
     MPI_Status status;
-    int finalizedWorkers = 0;
 
-    while (finalizedWorkers < size - 1)
+    while (finalizedWorkers < node->size - 1)
     {
+        if (!untilFinished)
+        {
+            int pendingRequest;
+            MPI_Iprobe(MPI_ANY_SOURCE, TAG_WORK_REQUEST, MPI_COMM_WORLD, &pendingRequest, &status);
+            if (!pendingRequest)
+                break;
+        }
         //wait for request form workers
         MPI_Recv(0, 0, MPI_INT, MPI_ANY_SOURCE, TAG_WORK_REQUEST, MPI_COMM_WORLD, &status);
 
-        workBuffer[0] = ThreadTaskDistributor::distribute(workBuffer[1], workBuffer[2]) ? 1 : 0;
+        workBuffer[0] = assignBlock(workBuffer[1], workBuffer[2], false) ? 1 : 0;
 
         if (workBuffer[0] == 0) //no more jobs, count finalized workers
             finalizedWorkers++;
         //send response (either task or finish answer)
         MPI_Send(workBuffer, 3, MPI_LONG_LONG_INT, status.MPI_SOURCE, TAG_WORK_RESPONSE, MPI_COMM_WORLD);
     }
+}
+
+bool MpiTaskDistributor::distributeMaster(size_t &first, size_t &last)
+{
+    if (masterWorks)
+    {
+        // Keep the workers busy and then take a single task, so that
+        // the next requests are not delayed by a long block
+        serveRequests(false);
+        if (assignBlock(first, last, true))
+            return true;
+    }
+    serveRequests(true);
     return false;
 }
 
@@ -70,19 +142,74 @@ bool MpiTaskDistributor::distributeSlaves(size_t &first, size_t &last)
   //   workBuffer[2] = last
   size_t workBuffer[3];
   MPI_Status status;
-  //any message from the master, is tag is TAG_STOP then stop
-  MPI_Send(0, 0, MPI_INT, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
-  MPI_Recv(workBuffer, 3, MPI_LONG_LONG_INT, 0, TAG_WORK_RESPONSE, MPI_COMM_WORLD, &status);
+  if (prefetchPending)
+  {
+      MPI_Wait(&prefetchRequest, &status);
+      prefetchPending = false;
+      for (int i = 0; i < 3; i++)
+          workBuffer[i] = prefetchBuffer[i];
+  }
+  else
+  {
+      //any message from the master, is tag is TAG_STOP then stop
+      MPI_Send(0, 0, MPI_INT, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
+      MPI_Recv(workBuffer, 3, MPI_LONG_LONG_INT, 0, TAG_WORK_RESPONSE, MPI_COMM_WORLD, &status);
+  }
 
   first = workBuffer[1];
   last = workBuffer[2];
-
-  return (workBuffer[0] == 1);
+  bool moreTasks = (workBuffer[0] == 1);
+
+  // Ask for the next block while this one is processed. Every request
+  // is answered, so no request is left pending after the last block
+  if (moreTasks && prefetch)
+  {
+      MPI_Irecv(prefetchBuffer, 3, MPI_LONG_LONG_INT, 0, TAG_WORK_RESPONSE, MPI_COMM_WORLD, &prefetchRequest);
+      MPI_Send(0, 0, MPI_INT, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
+      prefetchPending = true;
+  }
+
+  return moreTasks;
 }
 
 void MpiTaskDistributor::wait()
 {
+    double busyTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() - idleTime;
     node->barrierWait();
+    if (report)
+    {
+        double totalTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        reportLoadBalance(busyTime, totalTime - busyTime);
+    }
+}
+
+void MpiTaskDistributor::reportLoadBalance(double busyTime, double waitTime)
+{
+    double myStats[3] = { (double)tasksDone, busyTime, waitTime };
+    std::vector<double> stats(3 * node->size);
+    MPI_Gather(myStats, 3, MPI_DOUBLE, &stats[0], 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (!node->isMaster() || reportOut == NULL)
+        return;
+
+    std::ostream &out = *reportOut;
+    double maxBusy = 0, sumBusy = 0;
+    size_t workingNodes = 0;
+    out << "MPI load balance:" << std::endl
+        << formatString("%6s %10s %10s %10s", "rank", "tasks", "busy(s)", "idle(s)") << std::endl;
+    for (size_t rank = 0; rank < node->size; rank++)
+    {
+        double *rankStats = &stats[3 * rank];
+        out << formatString("%6lu %10lu %10.2f %10.2f", rank, (size_t)rankStats[0], rankStats[1], rankStats[2])
+            << std::endl;
+        if (rankStats[0] > 0)
+        {
+            maxBusy = XMIPP_MAX(maxBusy, rankStats[1]);
+            sumBusy += rankStats[1];
+            workingNodes++;
+        }
+    }
+    if (workingNodes > 0 && sumBusy > 0)
+        out << "Imbalance (max/mean busy time): " << maxBusy / (sumBusy / workingNodes) << std::endl;
 }
 
 // ================= FILE MUTEX ==========================
@@ -287,6 +414,7 @@ MpiMetadataProgram::MpiMetadataProgram()
 {
     node = NULL;
     distributor = NULL;
+    guidedSchedule = prefetchTasks = masterWorks = reportLoad = false;
 }
 
 MpiMetadataProgram::~MpiMetadataProgram()
@@ -305,11 +433,23 @@ void MpiMetadataProgram::defineParams()
 {
     addParamsLine("== MPI ==");
     addParamsLine(" [--mpi_job_size <size=0>]     : Number of images sent simultaneously to a mpi node");
+    addParamsLine(" [--mpi_schedule <schedule=fixed>] : How the images are divided among the mpi nodes");
+    addParamsLine("        where <schedule>");
+    addParamsLine("              fixed            : All jobs have mpi_job_size images");
+    addParamsLine("              guided           : Jobs shrink as the images are processed, down to mpi_job_size (1 by default).");
+    addParamsLine("                               : Use it when the cost of the images varies");
+    addParamsLine(" [--mpi_prefetch]              : Nodes ask for their next job while processing the current one");
+    addParamsLine(" [--mpi_master_works]          : The master node also processes images between the requests of the nodes");
+    addParamsLine(" [--mpi_report]                : Show the tasks, busy and idle time of every node at the end");
 }
 
 void MpiMetadataProgram::readParams()
 {
     blockSize = getIntParam("--mpi_job_size");
+    guidedSchedule = String(getParam("--mpi_schedule")) == "guided";
+    prefetchTasks = checkParam("--mpi_prefetch");
+    masterWorks = checkParam("--mpi_master_works");
+    reportLoad = checkParam("--mpi_report");
 }
 
 void MpiMetadataProgram::createTaskDistributor(MetaData &mdIn,
@@ -317,12 +457,16 @@ void MpiMetadataProgram::createTaskDistributor(MetaData &mdIn,
 {
     size_t size = mdIn.size();
     if (blockSize < 1)
-        blockSize = XMIPP_MAX(1, size/(node->size * 5));
+        blockSize = guidedSchedule ? 1 : XMIPP_MAX(1, size/(node->size * 5));
     else if (blockSize > size)
         blockSize = size;
 
     mdIn.findObjects(imgsId);
     distributor = new MpiTaskDistributor(size, blockSize, node);
+    distributor->setSchedule(guidedSchedule ? SCHEDULE_GUIDED : SCHEDULE_FIXED);
+    distributor->setPrefetch(prefetchTasks);
+    distributor->setMasterWorks(masterWorks);
+    distributor->setReport(reportLoad, verbose ? &std::cout : NULL);
 }
 
 //Now use the distributor to grasp images
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
+#include <chrono>
 
 #include <core/xmipp_threads.h>
 #include <core/xmipp_program.h>
@@ -81,10 +82,24 @@ protected:
 #define TAG_WORK_REQUEST 100
 #define TAG_WORK_RESPONSE 101
 
+/** How the tasks are divided in blocks */
+enum TaskSchedule
+{
+    SCHEDULE_FIXED, ///< All blocks have the block size
+    SCHEDULE_GUIDED ///< Blocks shrink with the remaining tasks, down to the block size
+};
+
 /** This class is another implementation of ParallelTaskDistributor with MPI workers.
  * It extends from ThreadTaskDistributor and adds the MPI call
  * for making the distribution and extra locking mechanisms among
  * MPI nodes.
+ *
+ * By default the master only serves blocks of bSize tasks. With a guided
+ * schedule every block is the remaining tasks divided by twice the number
+ * of working nodes, so that the last blocks are small and no node is left
+ * behind with a large block. Workers may prefetch their next block while
+ * they process the current one, and the master may also process tasks,
+ * one at a time, serving the pending requests between them.
  */
 class MpiTaskDistributor: public ThreadTaskDistributor
 {
@@ -97,17 +112,59 @@ public:
     MpiTaskDistributor(size_t nTasks, size_t bSize, MpiNode *node);
     /** All nodes wait until distribution is done.
      * In particular, the master node should wait for the distribution thread.
+     * If the report is enabled, the load balance of all nodes is gathered.
      */
     void wait();
 
+    /** Set the schedule. Must be the same in all nodes. */
+    void setSchedule(TaskSchedule schedule);
+
+    /** Workers ask for the next block as soon as they receive one */
+    void setPrefetch(bool prefetch);
+
+    /** The master also processes tasks. Must be the same in all nodes. */
+    void setMasterWorks(bool masterWorks);
+
+    /** Gather the tasks, busy and idle time of every node in wait().
+     * Must be the same in all nodes, the report is written by the master to out
+     * (if not NULL).
+     */
+    void setReport(bool report, std::ostream *out=NULL);
+
 private:
+    TaskSchedule schedule;
+    bool prefetch, masterWorks, report;
+    std::ostream *reportOut;
+
+    /// Number of workers that already received the no more tasks answer
+    size_t finalizedWorkers;
+
+    /// Block requested in advance by a worker
+    size_t prefetchBuffer[3];
+    MPI_Request prefetchRequest;
+    bool prefetchPending;
+
+    /// Load balance of this node
+    size_t tasksDone;
+    double idleTime;
+    std::chrono::steady_clock::time_point startTime;
+
     /** Method that should be called in the master only.
      * It will listen for job requests from nodes, assign tasks and
-     * sent the response back
+     * sent the response back. If the master works, it returns its own
+     * next task after serving the pending requests.
+     */
+    bool distributeMaster(size_t &first, size_t &last);
+    /** Answer the requests of the workers. If untilFinished is false,
+     * only the requests already received are answered.
      */
-    bool distributeMaster();
+    void serveRequests(bool untilFinished);
+    /** Take the next block of tasks (only in the master) */
+    bool assignBlock(size_t &first, size_t &last, bool singleTask);
     /** Workers should ask for jobs from master. */
     bool distributeSlaves(size_t &first, size_t &last);
+    /** Gather and show the load balance */
+    void reportLoadBalance(double busyTime, double waitTime);
 }
 ;//end of class MpiTaskDistributor
 
@@ -189,6 +246,8 @@ class MpiMetadataProgram: public XmippMpiProgram
 protected:
     /** Divide the job in this number block with this number of images */
     int blockSize;
+    /** Task distribution options */
+    bool guidedSchedule, prefetchTasks, masterWorks, reportLoad;
     MpiTaskDistributor *distributor;
     std::vector<size_t> imgsId;
     size_t first, last;
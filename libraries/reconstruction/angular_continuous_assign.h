@@ -81,6 +81,21 @@ public:
         An exception is thrown if any of the files is not found*/
     void preProcess();
 
+    /** Prepare the reference volume.
+        Computes the weighting masks and the DFT of the given volume. It is
+        called by preProcess with the volume in fn_ref, but it can also be
+        called directly with a volume that is already in memory. */
+    void prepareVolume(const MultidimArray<double> &V);
+
+    /** Refine the pose of an image in memory.
+        The angles and shifts must contain the initial guess, and at the
+        output they contain the refined pose (unless it moved beyond
+        max_angular_change or max_shift, in which case the initial guess
+        is kept and -1 is returned). The image is modified (it is weighted
+        by the real space mask). Returns the cost of the assignment. */
+    double refinePose(MultidimArray<double> &img, double &rot, double &tilt,
+                      double &psi, double &shiftX, double &shiftY);
+
     /** Predict angles and shift.
         At the input the pose parameters must have an initial guess of the
         parameters. At the output they have the estimated pose.*/
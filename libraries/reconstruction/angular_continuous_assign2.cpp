@@ -40,7 +40,6 @@ ProgAngularContinuousAssign2::ProgAngularContinuousAssign2()
 ProgAngularContinuousAssign2::~ProgAngularContinuousAssign2()
 {
 	delete projector;
-	delete ctfImage;
 }
 
 // Read arguments ==========================================================
@@ -68,6 +67,8 @@ void ProgAngularContinuousAssign2::readParams()
     penalization = getDoubleParam("--penalization");
     fnResiduals = getParam("--oresiduals");
     fnProjections = getParam("--oprojections");
+    ctfCacheMB = getDoubleParam("--ctfCache", 0);
+    ctfCacheStep = getDoubleParam("--ctfCache", 1);
 }
 
 // Show ====================================================================
@@ -98,6 +99,8 @@ void ProgAngularContinuousAssign2::show()
     << "Penalization:        " << penalization       << std::endl
     << "Output residuals:    " << fnResiduals        << std::endl
     << "Output projections:  " << fnProjections      << std::endl
+    << "CTF cache (MB):      " << ctfCacheMB         << std::endl
+    << "CTF cache step (A):  " << ctfCacheStep       << std::endl
     ;
 }
 
@@ -131,6 +134,8 @@ void ProgAngularContinuousAssign2::defineParams()
     addParamsLine("  [--penalization <l=100>]     : Penalization for the average term");
     addParamsLine("  [--oresiduals <stack=\"\">]  : Output stack for the residuals");
     addParamsLine("  [--oprojections <stack=\"\">] : Output stack for the projections");
+    addParamsLine("  [--ctfCache <MB=0> <step=1>] : Memory for the cache of CTF images and its defocus quantization (A). Not used with --optimizeDefocus");
+    addParamsLine("                               : Particles with the same defocus (up to the step) share the CTF image");
     addExampleLine("A typical use is:",false);
     addExampleLine("xmipp_angular_continuous_assign2 -i anglesFromDiscreteAssignment.xmd --ref reference.vol -o assigned_angles.stk");
 }
@@ -152,6 +157,8 @@ void ProgAngularContinuousAssign2::preProcess()
     V.read(fnVol);
     V().setXmippOrigin();
     Xdim=XSIZE(V());
+    ctfCache.setMaxMemory(ctfCacheMB);
+    ctfCache.setDefocusStep(ctfCacheStep, 0.01);
 
     Ip().initZeros(Xdim,Xdim);
     E().initZeros(Xdim,Xdim);
@@ -208,16 +215,27 @@ void ProgAngularContinuousAssign2::updateCTFImage(double defocusU, double defocu
 	currentDefocusV=ctf.DeltafV=defocusV;
 	currentAngle=ctf.azimuthal_angle=angle;
 	ctf.produceSideInfo();
-	if (ctfImage==NULL)
+	int Ydim=YSIZE(projector->projection()), Xdim=XSIZE(projector->projection());
+	// The cache quantizes the defocus, which would make the cost piecewise
+	// constant while the defocus is being optimized
+	if (ctfCacheMB>0 && !optimizeDefocus)
 	{
-		ctfImage = new MultidimArray<double>();
-		ctfImage->resizeNoCopy(projector->projection());
-		STARTINGY(*ctfImage)=STARTINGX(*ctfImage)=0;
+		cachedCtfImage=ctfCache.getImage(ctf,Ydim,Xdim,Ts);
+		ctfImage=cachedCtfImage.get();
+		if (!phaseFlipped)
+			return;
+		ctfImageBuffer.resizeNoCopy(*ctfImage);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(ctfImageBuffer)
+			DIRECT_MULTIDIM_ELEM(ctfImageBuffer,n)=fabs(DIRECT_MULTIDIM_ELEM(*ctfImage,n));
 	}
-	ctf.generateCTF(YSIZE(projector->projection()),XSIZE(projector->projection()),*ctfImage,Ts);
-	if (phaseFlipped)
-		FOR_ALL_ELEMENTS_IN_ARRAY2D(*ctfImage)
-			A2D_ELEM(*ctfImage,i,j)=fabs(A2D_ELEM(*ctfImage,i,j));
+	else
+	{
+		ctf.generateCTFFast(Ydim,Xdim,ctfImageBuffer,Ts);
+		if (phaseFlipped)
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(ctfImageBuffer)
+				DIRECT_MULTIDIM_ELEM(ctfImageBuffer,n)=fabs(DIRECT_MULTIDIM_ELEM(ctfImageBuffer,n));
+	}
+	ctfImage=&ctfImageBuffer;
 }
 
 //#define DEBUG
@@ -232,7 +250,7 @@ double tranformImage(ProgAngularContinuousAssign2 *prm, double rot, double tilt,
     	if (defocusU!=prm->currentDefocusU || defocusV!=prm->currentDefocusV || angle!=prm->currentAngle)
     		prm->updateCTFImage(defocusU,defocusV,angle);
     }
-	projectVolume(*(prm->projector), prm->P, (int)XSIZE(prm->I()), (int)XSIZE(prm->I()),  rot, tilt, psi, (const MultidimArray<double> *)prm->ctfImage);
+	projectVolume(*(prm->projector), prm->P, (int)XSIZE(prm->I()), (int)XSIZE(prm->I()),  rot, tilt, psi, prm->ctfImage);
     double cost=0;
 	if (prm->old_flip)
 	{
@@ -659,4 +677,6 @@ void ProgAngularContinuousAssign2::postProcess()
 	}
 
 	ptrMdOut.write(fn_out.replaceExtension("xmd"));
+	if (verbose && ctfCache.hits()+ctfCache.misses()>0)
+		ctfCache.show();
 }
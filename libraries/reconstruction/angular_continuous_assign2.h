@@ -28,6 +28,7 @@
 
 #include <core/xmipp_program.h>
 #include <data/ctf.h>
+#include <data/ctf_image_cache.h>
 #include <data/fourier_projection.h>
 #include <data/fourier_filter.h>
 
@@ -84,6 +85,10 @@ public:
     bool phaseFlipped;
     // Penalization for the average
     double penalization;
+    // Memory for the CTF image cache (MB)
+    double ctfCacheMB;
+    // Defocus quantization of the CTF image cache (A)
+    double ctfCacheStep;
 public:
     // 2D mask in real space
     MultidimArray<int> mask2D;
@@ -123,8 +128,14 @@ public:
 	int contCost;
 	// Current defoci
 	double currentDefocusU, currentDefocusV, currentAngle;
-	// CTF image
-	MultidimArray<double> *ctfImage;
+	// CTF image, either the cached one or ctfImageBuffer
+	const MultidimArray<double> *ctfImage;
+	// CTF image taken from the cache
+	CTFImageCache::ImagePtr cachedCtfImage;
+	// CTF image generated here (no cache, optimized defocus or phase flipped)
+	MultidimArray<double> ctfImageBuffer;
+	// CTF images of recently seen defoci
+	CTFImageCache ctfCache;
 public:
     /// Empty constructor
     ProgAngularContinuousAssign2();
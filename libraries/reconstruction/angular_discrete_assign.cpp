@@ -39,6 +39,13 @@ ProgAngularDiscreteAssign::ProgAngularDiscreteAssign()
 {
     produces_a_metadata = true;
     produces_an_output = true;
+    library_images = NULL;
+}
+
+ProgAngularDiscreteAssign::~ProgAngularDiscreteAssign()
+{
+    for (size_t m = 0; m < library.size(); m++)
+        delete library[m];
 }
 
 // Read arguments ==========================================================
@@ -144,14 +151,7 @@ void ProgAngularDiscreteAssign::preProcess()
     SF_ref.read(fn_ref);
     size_t refYdim, refXdim, refZdim, refNdim;
     getImageSize(SF_ref,refYdim, refXdim, refZdim, refNdim);
-    if (refYdim != NEXT_POWER_OF_2(refYdim) || refXdim != NEXT_POWER_OF_2(refXdim))
-        REPORT_ERROR(ERR_MULTIDIM_SIZE,
-                     "reference images must be of a size that is power of 2");
-
-    // Produce side info of the angular distance computer
-    distance_prm.fn_ang1 = distance_prm.fn_ang2 = "";
-    distance_prm.fn_sym = fn_sym;
-    distance_prm.produce_side_info();
+    produceSideInfo(refYdim, refXdim);
 
     // Read the angle file
     rot.resize(SF_ref.size());
@@ -164,6 +164,24 @@ void ProgAngularDiscreteAssign::preProcess()
         i++;
     }
 
+    // Produce library
+    produce_library();
+
+    // Save a little space
+    SF_ref.clear();
+}
+
+void ProgAngularDiscreteAssign::produceSideInfo(size_t refYdim, size_t refXdim)
+{
+    if (refYdim != NEXT_POWER_OF_2(refYdim) || refXdim != NEXT_POWER_OF_2(refXdim))
+        REPORT_ERROR(ERR_MULTIDIM_SIZE,
+                     "reference images must be of a size that is power of 2");
+
+    // Produce side info of the angular distance computer
+    distance_prm.fn_ang1 = distance_prm.fn_ang2 = "";
+    distance_prm.fn_sym = fn_sym;
+    distance_prm.produce_side_info();
+
     // Build mask for subbands
     Mask_no.resize(refYdim, refXdim);
     Mask_no.initConstant(-1);
@@ -171,7 +189,7 @@ void ProgAngularDiscreteAssign::preProcess()
     if (smax == -1)
         smax = Get_Max_Scale(refYdim) - 3;
     SBNo = (smax - smin + 1) * 3 + 1;
-    SBsize.resize(SBNo);
+    SBsize.initZeros(SBNo);
 
     Mask Mask(INT_MASK);
     Mask.type = BINARY_DWT_CIRCULAR_MASK;
@@ -201,12 +219,6 @@ void ProgAngularDiscreteAssign::preProcess()
             m++;
         }
     }
-
-    // Produce library
-    produce_library();
-
-    // Save a little space
-    SF_ref.clear();
 }
 
 // PostProcess ---------------------------------------------------------------
@@ -217,21 +229,52 @@ void ProgAngularDiscreteAssign::postProcess()
 }
 
 // Produce library -----------------------------------------------------------
-void ProgAngularDiscreteAssign::produce_library()
+void ProgAngularDiscreteAssign::allocate_library(int number_of_imgs)
 {
-    Image<double> I;
-    int number_of_imgs = SF_ref.size();
     set_DWT_type(DAUB12);
 
-    // Create space for all the DWT coefficients of the library
-    Matrix1D<int> SBidx(SBNo);
-    for (int m = 0; m < SBNo; m++)
+    // Create space for all the DWT coefficients of the library. The space
+    // of a previous library with the same number of images is reused
+    if (library.size() != (size_t)SBNo || YSIZE(*library[0]) != (size_t)number_of_imgs)
     {
-        MultidimArray<double> *subband = new MultidimArray<double>;
-        subband->resize(number_of_imgs, SBsize(m));
-        library.push_back(subband);
+        for (size_t m = 0; m < library.size(); m++)
+            delete library[m];
+        library.clear();
+        for (int m = 0; m < SBNo; m++)
+        {
+            MultidimArray<double> *subband = new MultidimArray<double>;
+            subband->resize(number_of_imgs, SBsize(m));
+            library.push_back(subband);
+        }
     }
     library_power.initZeros(number_of_imgs, SBNo);
+}
+
+void ProgAngularDiscreteAssign::add_to_library(int n, MultidimArray<double> &I)
+{
+    // Make and distribute its DWT coefficients in the different PCA bins
+    I.statisticsAdjust(0, 1);
+    DWT(I, I);
+    Matrix1D<int> SBidx(SBNo);
+    FOR_ALL_ELEMENTS_IN_ARRAY2D(Mask_no)
+    {
+        int m = Mask_no(i, j);
+        if (m != -1)
+        {
+            double coef = A2D_ELEM(I, i, j), coef2 = coef * coef;
+            (*library[m])(n, SBidx(m)++) = coef;
+            for (int mp = m; mp < SBNo; mp++)
+                library_power(n, mp) += coef2;
+        }
+    }
+}
+
+void ProgAngularDiscreteAssign::produce_library()
+{
+    Image<double> I;
+    int number_of_imgs = SF_ref.size();
+    allocate_library(number_of_imgs);
+    library_images = NULL;
 
     if (verbose)
     {
@@ -243,22 +286,7 @@ void ProgAngularDiscreteAssign::produce_library()
     {
         I.readApplyGeo(SF_ref,__iter.objId);
         library_name.push_back(I.name());
-
-        // Make and distribute its DWT coefficients in the different PCA bins
-        I().statisticsAdjust(0, 1);
-        DWT(I(), I());
-        SBidx.initZeros();
-        FOR_ALL_ELEMENTS_IN_ARRAY2D(Mask_no)
-        {
-            int m = Mask_no(i, j);
-            if (m != -1)
-            {
-                double coef = I(i, j), coef2 = coef * coef;
-                (*library[m])(n, SBidx(m)++) = coef;
-                for (int mp = m; mp < SBNo; mp++)
-                    library_power(n, mp) += coef2;
-            }
-        }
+        add_to_library(n, I());
 
         // Prepare for next iteration
         if (++n % nstep == 0 && verbose)
@@ -268,6 +296,24 @@ void ProgAngularDiscreteAssign::produce_library()
         progress_bar(SF_ref.size());
 }
 
+void ProgAngularDiscreteAssign::produce_library(const std::vector< MultidimArray<double> > &references)
+{
+    int number_of_imgs = references.size();
+    allocate_library(number_of_imgs);
+    library_images = &references;
+    library_name.clear();
+
+    // The logical indexes of the library start at 0, as for the images
+    // read from disk
+    MultidimArray<double> I;
+    for (int n = 0; n < number_of_imgs; n++)
+    {
+        I = references[n];
+        STARTINGX(I) = STARTINGY(I) = 0;
+        add_to_library(n, I);
+    }
+}
+
 // Build candidate list ------------------------------------------------------
 void ProgAngularDiscreteAssign::build_ref_candidate_list(const Image<double> &I,
         bool *candidate_list, std::vector<double> &cumulative_corr,
@@ -720,8 +766,24 @@ void ProgAngularDiscreteAssign::processImage(const FileName &fnImg, const FileNa
     if (rowIn.containsLabel(MDL_ANGLE_PSI))
     	img.setPsi(-img.psi());
 
-    double best_rot, best_tilt, best_psi, best_shiftX, best_shiftY,
-    best_score = 0, best_rate;
+    double best_rot, best_tilt, best_psi, best_shiftX, best_shiftY;
+    double best_score = predictPose(img, best_rot, best_tilt, best_psi,
+                                    best_shiftX, best_shiftY);
+
+    // Save results
+    rowOut.setValue(MDL_ANGLE_ROT,  best_rot);
+    rowOut.setValue(MDL_ANGLE_TILT, best_tilt);
+    rowOut.setValue(MDL_ANGLE_PSI,  -best_psi);
+    rowOut.setValue(MDL_SHIFT_X,    best_shiftX);
+    rowOut.setValue(MDL_SHIFT_Y,    best_shiftY);
+    rowOut.setValue(MDL_MAXCC,      best_score);
+}
+
+double ProgAngularDiscreteAssign::predictPose(Image<double> &img,
+        double &best_rot, double &best_tilt, double &best_psi,
+        double &best_shiftX, double &best_shiftY)
+{
+    double best_score = 0, best_rate;
 
     Image<double> Ip;
     Ip = img;
@@ -1046,7 +1108,10 @@ void ProgAngularDiscreteAssign::processImage(const FileName &fnImg, const FileNa
         Image<double> Iref;
         //Iref.readApplyGeo(library_name[vref_idx[ibest]]);
         //TODO: Check if this is correct
-        Iref.read(library_name[vref_idx[ibest]]);
+        if (library_images != NULL)
+            Iref() = (*library_images)[vref_idx[ibest]];
+        else
+            Iref.read(library_name[vref_idx[ibest]]);
         Iref().setXmippOrigin();
         selfRotate(LINEAR,Iref(),-vpsi[ibest]);
         if (Xoff == 0 && Yoff == 0)
@@ -1092,13 +1157,7 @@ void ProgAngularDiscreteAssign::processImage(const FileName &fnImg, const FileNa
         << " rate= " << best_rate << std::endl << std::endl;
     }
 
-    // Save results
-    rowOut.setValue(MDL_ANGLE_ROT,  best_rot);
-    rowOut.setValue(MDL_ANGLE_TILT, best_tilt);
-    rowOut.setValue(MDL_ANGLE_PSI,  -best_psi);
-    rowOut.setValue(MDL_SHIFT_X,    best_shiftX);
-    rowOut.setValue(MDL_SHIFT_Y,    best_shiftY);
-    rowOut.setValue(MDL_MAXCC,      best_score);
+    return best_score;
 }
 #undef DEBUG
 
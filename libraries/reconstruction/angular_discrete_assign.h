@@ -98,6 +98,9 @@ public:
     std::vector<MultidimArray<double> * > library;
     // Vector with all the names of the library images
     std::vector<FileName> library_name;
+    // Library images kept in memory by the caller, NULL if they are read
+    // from library_name
+    const std::vector< MultidimArray<double> > *library_images;
     // Power of the library images at different
     // subbands
     MultidimArray<double> library_power;
@@ -111,6 +114,9 @@ public:
     /// Empty constructor
     ProgAngularDiscreteAssign();
 
+    /// Destructor
+    ~ProgAngularDiscreteAssign();
+
     /// Read argument from command line
     void readParams();
 
@@ -126,9 +132,21 @@ public:
     /** Write output metadata */
     void postProcess();
 
+    /** Side info that only depends on the size of the references.
+        The subband masks and the angular distance. The size must be a
+        power of 2. */
+    void produceSideInfo(size_t refYdim, size_t refXdim);
+
     /** Produce library.*/
     void produce_library();
 
+    /** Produce library from references in memory.
+        rot and tilt must contain the directions of the references. The
+        references are not copied, they must be kept while images are
+        assigned. The space of the previous library is reused if the number
+        of references does not change. */
+    void produce_library(const std::vector< MultidimArray<double> > &references);
+
     /** Build candidate list.
         Build a candidate list with all possible reference projections
         which are not further than the maximum allowed change from
@@ -187,15 +205,27 @@ public:
     double predict_rot_tilt_angles(Image<double> &I,
                                    double &assigned_rot, double &assigned_tilt, int &best_ref_idx);
 
-    /** Process one image.
-        Predict angles and shift.
+    /** Predict angles and shift of an image in memory.
         This function searches in the shift-psi space and for each combination
-        it correlates with the whole reference set. */
+        it correlates with the whole reference set. The initial angles and
+        shifts are taken from the image header. The score is returned. */
+    double predictPose(Image<double> &img, double &best_rot, double &best_tilt,
+                       double &best_psi, double &best_shiftX, double &best_shiftY);
+
+    /** Process one image.
+        Read it and predict its angles and shift. */
     void processImage(const FileName &fnImg, const FileName &fnImgOut, const MDRow &rowIn, MDRow &rowOut);
 
     /** Finish processing.
         Close all output files. */
 //    void postProcess();
+
+private:
+    // Allocate the library for a number of images
+    void allocate_library(int number_of_imgs);
+
+    // Put the DWT coefficients of the n-th reference in the library
+    void add_to_library(int n, MultidimArray<double> &I);
 };
 //@}
 #endif
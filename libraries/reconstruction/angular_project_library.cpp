@@ -25,6 +25,9 @@
  ***************************************************************************/
 
 #include "angular_project_library.h"
+#include <atomic>
+#include <memory>
+#include <thread>
 
 /* Empty constructor ------------------------------------------------------- */
 ProgAngularProjectLibrary::ProgAngularProjectLibrary()
@@ -83,6 +86,8 @@ void ProgAngularProjectLibrary::readParams()
         else
             REPORT_ERROR(ERR_ARG_BADCMDLINE, "The interpolation kernel can be : nearest, linear, bspline");
     }
+    singlePrecision = checkParam("--single_precision");
+    numThreads = std::max(1, getIntParam("--thr"));
 
     //NOTE perturb in computed after the even sampling is computes
     //     and max tilt min tilt applied
@@ -134,6 +139,10 @@ void ProgAngularProjectLibrary::defineParams()
     addParamsLine("                                              : nearest:          Nearest Neighborhood  ");
     addParamsLine("                                              : linear:           Linear  ");
     addParamsLine("                                              : bspline:          Cubic BSpline  ");
+    addParamsLine("  [--single_precision]          : Interpolate the Fourier projections in single precision");
+    addParamsLine("                                : it uses half of the memory and it is faster");
+    addParamsLine("  [--thr <N=1>]                 : Number of threads for the Fourier projections");
+    addParamsLine("                                : all of them share a single copy of the volume");
     addParamsLine("  [--perturb <sigma=0.0>]       : gaussian noise projection unit vectors ");
     addParamsLine("                                : a value=sin(sampling_rate)/4  ");
     addParamsLine("                                : may be a good starting point ");
@@ -176,6 +185,8 @@ void ProgAngularProjectLibrary::show()
             std::cout << " linear" <<std::endl;
         else if (BSplineDeg == BSPLINE3)
             std::cout << " bspline" <<std::endl;
+        std::cout << "     single precision: " << singlePrecision <<std::endl;
+        std::cout << "     threads: " << numThreads <<std::endl;
     }
     else if (projType == REALSPACE)
         std::cout << " realspace " <<std::endl;
@@ -222,7 +233,63 @@ void ProgAngularProjectLibrary::project_angle_vector (int my_init, int my_end, b
         Vfourier=new FourierProjector(inputVol(),
         		                      paddFactor,
         		                      maxFrequency,
-        		                      BSplineDeg);
+        		                      BSplineDeg,
+        		                      singlePrecision);
+
+    if (projType == FOURIER && numThreads>1)
+    {
+        // The projections are computed by several threads, each one with its
+        // own projector on the same coefficients. They are written in order
+        // by this thread, a block at a time.
+        std::vector< std::pair<double,int> > jobs;
+        for (double mypsi=0;mypsi<360;mypsi += psi_sampling)
+            for (int i=my_init;i<=my_end;i++)
+                jobs.emplace_back(mypsi,i);
+        std::vector< std::unique_ptr<FourierProjector> > projectors;
+        for (int t=0; t<numThreads; t++)
+            projectors.emplace_back(new FourierProjector(Vfourier->getSharedVolume()));
+
+        size_t blockSize=4*numThreads;
+        std::vector<Projection> block(blockSize);
+        for (size_t k0=0; k0<jobs.size(); k0+=blockSize)
+        {
+            size_t k1=std::min(jobs.size(),k0+blockSize);
+            std::atomic<size_t> next(k0);
+            auto worker = [&](int t)
+            {
+                for (size_t k=next++; k<k1; k=next++)
+                {
+                    double mypsi=jobs[k].first;
+                    int i=jobs[k].second;
+                    double psi= mypsi+ZZ(mysampling.no_redundant_sampling_points_angles[i]);
+                    double tilt=      YY(mysampling.no_redundant_sampling_points_angles[i]);
+                    double rot=       XX(mysampling.no_redundant_sampling_points_angles[i]);
+                    Projection &Pk=block[k-k0];
+                    projectVolume(*projectors[t], Pk, Ydim, Xdim, rot, tilt, psi);
+                    Pk.setEulerAngles(rot,tilt,psi);
+                    Pk.setDataMode(_DATA_ALL);
+                }
+            };
+            std::vector<std::thread> threads;
+            for (int t=1; t<numThreads; t++)
+                threads.emplace_back(worker,t);
+            worker(0);
+            for (auto &thread : threads)
+                thread.join();
+
+            for (size_t k=k0; k<k1; k++)
+            {
+                double mypsi=jobs[k].first;
+                int i=jobs[k].second;
+                if (verbose)
+                    progress_bar(i-my_init);
+                block[k-k0].write(output_file,(size_t) (numberStepsPsi * i + mypsi +1),true,WRITE_REPLACE);
+            }
+        }
+        if (verbose)
+            progress_bar(mySize);
+        return;
+    }
 
     for (double mypsi=0;mypsi<360;mypsi += psi_sampling)
     {
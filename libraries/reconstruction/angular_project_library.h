@@ -82,6 +82,10 @@ public:
     double maxFrequency;
     /// The type of interpolation (NEAR
     int BSplineDeg;
+    /// Interpolate the Fourier projections in single precision
+    bool singlePrecision;
+    /// Number of threads for the Fourier projections
+    int numThreads;
 
 #ifdef NEVERDEFINED
     /** vector with valid proyection directions after looking for 
@@ -32,7 +32,6 @@
 //#define TIMING
 
 // For blocking of threads
-pthread_mutex_t update_refs_in_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t debug_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
@@ -54,6 +53,7 @@ void ProgAngularProjectionMatching::readParams()
     numOrientations = getIntParam("--number_orientations");
 
     avail_memory = getDoubleParam("--mem");
+    float_refs = checkParam("--float_refs");
     if (checkParam("--ctf"))
         fn_ctf  = getParam("--ctf");
     phase_flipped = checkParam("--phase_flipped");
@@ -106,6 +106,7 @@ void ProgAngularProjectionMatching::defineParams()
     addParamsLine("    alias --scale;");
     addParamsLine("==+Extra parameters==");
     addParamsLine("  [--mem <mem=1>]             : Available memory for reference library (Gb)");
+    addParamsLine("  [--float_refs]              : Keep the reference library in single precision (twice as many references in memory)");
     addParamsLine("  [--max_shift <max_shift=-1>]   : Max. change in origin offset (+/- pixels; neg= no limit)");
     addParamsLine("  [--ctf <filename>]            : CTF to apply to the reference projections, either a");
     addParamsLine("                     : CTF parameter file or a 2D image with the CTF amplitudes");
@@ -135,6 +136,8 @@ void ProgAngularProjectionMatching::show()
         std::cout << "  Number of references    : " << total_nr_refs << std::endl
         << "  Nr. refs in memory      : " << max_nr_refs_in_memory << " (using " << avail_memory <<" Gb)" << std::endl
         ;
+        if (float_refs)
+            std::cout << "    + References stored in single precision" << std::endl;
     }
     else
     {
@@ -183,6 +186,9 @@ void ProgAngularProjectionMatching::run()
 
     processAllImages();
 
+    if (verbose)
+        refCache.show();
+
     writeOutputFiles();
 
     destroyAndClean();
@@ -192,12 +198,10 @@ void ProgAngularProjectionMatching::run()
 
 void ProgAngularProjectionMatching::destroyAndClean()
 {
-    delete [] fP_ref;
-    delete [] proj_ref;
     delete [] fP_img;
     delete [] fPm_img;
-    delete [] stddev_ref;
     delete [] stddev_img;
+    refCache.clear();
 
 }
 
@@ -280,6 +284,8 @@ void ProgAngularProjectionMatching::produceSideInfo()
         memory_per_ref += (double) fP.getSampleNo(i) * 2 * sizeof(double);
     }
     memory_per_ref += dim * dim * sizeof(double);
+    if (float_refs)
+        memory_per_ref /= 2;
     max_nr_imgs_in_memory = ROUND( 1024 * 1024 * 1024 * avail_memory / memory_per_ref);
 
     // Set up angular sampling
@@ -307,10 +313,10 @@ void ProgAngularProjectionMatching::produceSideInfo()
     // Don't reserve more memory than necessary
     max_nr_refs_in_memory = XMIPP_MIN(max_nr_imgs_in_memory, total_nr_refs);
 
-    // Initialize pointers for reference retrieval
-    pointer_allrefs2refsinmem.resize(mysampling.numberSamplesAsymmetricUnit,-1);
-    pointer_refsinmem2allrefs.resize(max_nr_refs_in_memory,-1);
-    counter_refs_in_memory = 0;
+    // Initialize the reference cache
+    refCache.clear();
+    refCache.setSinglePrecision(float_refs);
+    refCache.setMaxMemory(1024 * avail_memory);
     loop_forward_refs=true;
 
     // Initialize 5D search vectors
@@ -345,12 +351,9 @@ void ProgAngularProjectionMatching::produceSideInfo()
     // Initialize all arrays
     try
     {
-        fP_ref = new Polar<std::complex<double> >[max_nr_refs_in_memory];
-        proj_ref = new MultidimArray<double>[max_nr_refs_in_memory];
         fP_img = new Polar<std::complex<double> >[nr_trans];
         fPm_img = new Polar<std::complex<double> >[nr_trans];
 
-        stddev_ref = new double[max_nr_refs_in_memory];
         stddev_img = new double[nr_trans];
     }
     catch (std::bad_alloc&)
@@ -401,9 +404,13 @@ void ProgAngularProjectionMatching::produceSideInfo()
     DFexp.findObjects(ids);
 }
 
-void ProgAngularProjectionMatching::getCurrentReference(int refno,
+PolarReferenceCache::ReferencePtr ProgAngularProjectionMatching::getCurrentReference(int refno,
         Polar_fftw_plans &local_plans)
 {
+    PolarReferenceCache::ReferencePtr ref = refCache.get(refno);
+    if (ref)
+        return ref;
+
     FileName                      fnt;
     Image<double>                 img;
     double                        mean,stddev;
@@ -483,44 +490,8 @@ void ProgAngularProjectionMatching::getCurrentReference(int refno,
     P -= mean;
     fourierTransformRings(P,fP,local_plans,true);
 
-    pthread_mutex_lock(  &update_refs_in_memory_mutex );
-
-    int counter = counter_refs_in_memory % max_nr_refs_in_memory;
-    pointer_allrefs2refsinmem[refno] = counter;
-    if (pointer_refsinmem2allrefs[counter] != -1)
-    {
-        // This position was in use already
-        // Images will be overwritten, so reset the
-        // pointer_allrefs2refsinmem of the old images to -1
-        pointer_allrefs2refsinmem[pointer_refsinmem2allrefs[counter]] = -1;
-    }
-    pointer_refsinmem2allrefs[counter] = refno;
-    fP_ref[counter] = fP;
-    stddev_ref[counter] = stddev;
-    proj_ref[counter] = img();
-    //#define DEBUG
-#ifdef DEBUG
-
-    std::cerr<<"counter= "<<counter<<"refno= "<<refno<<" stddev = "<<stddev;
-    std::cerr<<" refsinmem2allrefs= "<<pointer_refsinmem2allrefs[counter];
-    std::cerr<<" allrefs2refsinmem= "<<pointer_allrefs2refsinmem[pointer_refsinmem2allrefs[counter]] <<std::endl;
-    std::cerr << "pointer_allrefs2refsinmem" <<std::endl;
-    for (std::vector<int>::iterator i = pointer_allrefs2refsinmem.begin();
-         i != pointer_allrefs2refsinmem.end();
-         ++i)
-        std::cerr << *i << " ";
-    std::cerr <<std::endl;
-    std::cerr << "pointer_refsinmem2allrefs" <<std::endl;
-    for (std::vector<int>::iterator i = pointer_refsinmem2allrefs.begin();
-         i != pointer_refsinmem2allrefs.end();
-         ++i)
-        std::cerr << *i << " ";
-    std::cerr <<std::endl;
-#endif
-
-    counter_refs_in_memory++;
-    pthread_mutex_unlock(  &update_refs_in_memory_mutex );
-    //    local_transformer.cleanup();
+    // If another thread stored it meanwhile, its copy is returned
+    return refCache.put(refno, fP, stddev, img());
 }
 
 void * threadRotationallyAlignOneImage( void * data )
@@ -545,7 +516,8 @@ void * threadRotationallyAlignOneImage( void * data )
     MultidimArray<double>       ang, corr;
     MultidimArray<int>       	indxCorr;
     size_t                      myinit, myfinal, myincr;
-    int                         refno;
+    PolarReferenceCache::ReferencePtr ref;
+    Polar<std::complex <double> > fPrefBuffer;
     bool                        done_once=false;
     double                      mean, stddev;
     Polar<double>               P;
@@ -638,34 +610,9 @@ void * threadRotationallyAlignOneImage( void * data )
             annotate_time(&t1);
 #endif
             // Get pointer to the current reference image
-#ifdef DEBUG
-
-            if(prm->mysampling.my_neighbors[imgno][i]==58)
-            {
-                std::cerr << "XXXXpointer_allrefs2refsinmemXXXXXX" <<std::endl;
-                for (std::vector<int>::iterator i = prm->
-                                                    pointer_allrefs2refsinmem.begin();
-                     i != prm->pointer_allrefs2refsinmem.end();
-                     ++i)
-                    std::cerr << *i << std::endl;
-                std::cerr << "XXXXpointer_refsinmem2allrefsXXXXXX" <<std::endl;
-                for (std::vector<int>
-                     ::iterator i = prm->pointer_refsinmem2allrefs.begin();
-                     i != prm->pointer_refsinmem2allrefs.end();
-                     ++i)
-                    std::cerr << *i << std::endl;
-                std::cerr <<std::endl;
-
-            }
-#endif
-
-            refno = prm->pointer_allrefs2refsinmem[prm->mysampling.my_neighbors[imgno][i]];
-            if (refno == -1)
-            {
-                // Reference is not stored in memory (anymore): (re-)read from disc
-                prm->getCurrentReference(prm->mysampling.my_neighbors[imgno][i],local_plans);
-                refno = prm->pointer_allrefs2refsinmem[prm->mysampling.my_neighbors[imgno][i]];
-            }
+            // (re-)read from disc if it is not stored in memory (anymore)
+            ref = prm->getCurrentReference(prm->mysampling.my_neighbors[imgno][i],local_plans);
+            const Polar<std::complex <double> > &fPref = ref->getPolar(fPrefBuffer);
 
 
 #ifdef TIMING
@@ -675,8 +622,7 @@ void * threadRotationallyAlignOneImage( void * data )
 #ifdef DEBUG
 
             std::cerr << "imgno " << imgno <<std::endl;
-            std::cerr<<"Got refno= "<<refno
-            <<" pointer= "<<prm->mysampling.my_neighbors[imgno][i]<<std::endl;
+            std::cerr<<"Got pointer= "<<prm->mysampling.my_neighbors[imgno][i]<<std::endl;
 #endif
 
             // Loop over all 5D-search translations
@@ -684,8 +630,8 @@ void * threadRotationallyAlignOneImage( void * data )
             {
 #ifdef DEBUG
 
-                std::cerr<< "prm->stddev_ref[refno], prm->stddev_img[itrans]: " <<
-                prm->stddev_ref[refno] << " " <<
+                std::cerr<< "ref->stddev, prm->stddev_img[itrans]: " <<
+                ref->stddev << " " <<
                 prm->stddev_img[itrans];
 #endif
 
@@ -695,16 +641,16 @@ void * threadRotationallyAlignOneImage( void * data )
 
                 // A. Check straight image
                 rotationalCorrelation(prm->fP_img[itrans],
-                                      prm->fP_ref[refno],
+                                      fPref,
                                       ang,rotAux);
-                corr /= prm->stddev_ref[refno] * prm->stddev_img[itrans]; // for normalized ccf
+                corr /= ref->stddev * prm->stddev_img[itrans]; // for normalized ccf
 
 
                 memcpy(&dAi(allCorr,0),&dAi(corr,0),XSIZE(corr)*sizeof(double));
                 memcpy(&dAi(allAng,0),&dAi(ang,0),XSIZE(ang)*sizeof(double));
 
-                rotationalCorrelation(prm->fPm_img[itrans],prm->fP_ref[refno],ang,rotAux);
-                corr /= prm->stddev_ref[refno] * prm->stddev_img[itrans]; // for normalized ccf
+                rotationalCorrelation(prm->fPm_img[itrans],fPref,ang,rotAux);
+                corr /= ref->stddev * prm->stddev_img[itrans]; // for normalized ccf
                 memcpy(&dAi(allCorr,XSIZE(corr)),&dAi(corr,0),XSIZE(corr)*sizeof(double));
                 memcpy(&dAi(allAng,XSIZE(corr)),&dAi(ang,0),XSIZE(corr)*sizeof(double));
 
@@ -779,7 +725,7 @@ void ProgAngularProjectionMatching::translationallyAlignOneImage(MultidimArray<d
 {
 
 	MultidimArray<double> Mtrans,Mimg,Mref;
-    int refno;
+    PolarReferenceCache::ReferencePtr ref;
     Mtrans.setXmippOrigin();
     Mimg.setXmippOrigin();
     Mref.setXmippOrigin();
@@ -792,21 +738,16 @@ void ProgAngularProjectionMatching::translationallyAlignOneImage(MultidimArray<d
 
 #ifdef DEBUG
 
-    std::cerr<<"start trans: opt_refno= "<<opt_refno<<" pointer= "<<pointer_allrefs2refsinmem[opt_refno]<<" opt_psi= "<<opt_psi<<"opt_flip= "<<opt_flip<<std::endl;
+    std::cerr<<"start trans: opt_refno= "<<opt_refno<<" opt_psi= "<<opt_psi<<"opt_flip= "<<opt_flip<<std::endl;
 #endif
 
-    // Get pointer to the correct reference image in memory
-    refno = pointer_allrefs2refsinmem[opt_refno];
-    if (refno == -1)
-    {
-        // Reference is not stored in memory (anymore): (re-)read from disc
-        getCurrentReference(opt_refno,global_plans);
-        refno = pointer_allrefs2refsinmem[opt_refno];
-    }
+    // Get pointer to the correct reference image in memory,
+    // (re-)read from disc if it is not stored in memory (anymore)
+    ref = getCurrentReference(opt_refno,global_plans);
 
     // Rotate stored reference projection by phi degrees
-    rotate(BSPLINE3,Mref,proj_ref[refno],opt_psi,DONT_WRAP);
-    //rotate(BSPLINE3,Mref,proj_ref[refno],-opt_psi,DONT_WRAP);
+    rotate(BSPLINE3,Mref,ref->getImage(Mimg),opt_psi,DONT_WRAP);
+    //rotate(BSPLINE3,Mref,ref->getImage(Mimg),-opt_psi,DONT_WRAP);
 
 #ifdef DEBUG
 
@@ -875,7 +816,7 @@ void ProgAngularProjectionMatching::scaleAlignOneImage(MultidimArray<double> &im
         double &maxcorr)
 {
     MultidimArray<double> Mscale,Mtrans,Mref,Mimg;
-    int refno;
+    PolarReferenceCache::ReferencePtr ref;
 
     Mscale.setXmippOrigin();
     Mtrans.setXmippOrigin();
@@ -918,15 +859,10 @@ void ProgAngularProjectionMatching::scaleAlignOneImage(MultidimArray<double> &im
         MAT_ELEM(A,0, 1) *= -1.;
     }
 
-    // Get pointer to the correct reference image in memory
-    refno = pointer_allrefs2refsinmem[opt_refno];
-    if (refno == -1)
-    {
-        // Reference is not stored in memory (anymore): (re-)read from disc
-        getCurrentReference(opt_refno,global_plans);
-        refno = pointer_allrefs2refsinmem[opt_refno];
-    }
-    applyGeometry(LINEAR, Mref, proj_ref[refno], A, IS_NOT_INV, DONT_WRAP);
+    // Get pointer to the correct reference image in memory,
+    // (re-)read from disc if it is not stored in memory (anymore)
+    ref = getCurrentReference(opt_refno,global_plans);
+    applyGeometry(LINEAR, Mref, ref->getImage(Mimg), A, IS_NOT_INV, DONT_WRAP);
 
 
     Mtrans = img;
@@ -34,6 +34,7 @@
 #include <data/filters.h>
 #include <data/mask.h>
 #include <data/polar.h>
+#include <data/polar_reference_cache.h>
 #include <core/xmipp_fftw.h>
 #include <core/xmipp_threads.h>
 #include <pthread.h>
@@ -99,23 +100,20 @@ public:
     int max_nr_imgs_in_memory;
     /** Total number of references */
     int total_nr_refs;
-    /** Counter for current filling of memory with references */
-    int counter_refs_in_memory;
-    /** Pointers for reference retrieval */
-    std::vector<int> pointer_allrefs2refsinmem;   //order after removing redundant
-    std::vector<int> pointer_refsinmem2allrefs;   //order in memory
+    /** Keep the references in memory in single precision */
+    bool float_refs;
+    /** Least recently used cache with the references in memory */
+    PolarReferenceCache refCache;
     /** Vector to assign reference number to stack positions*/
     std::vector <size_t> convert_refno_to_stack_position;
     /** Array containing the images ids in metadata */
     std::vector<size_t> ids;
-    /** Array with Polars of references and of translated images and their mirrors */
-    Polar<std::complex<double> >   *fP_ref, *fP_img, *fPm_img;
-    /** Array with reference images */
-    MultidimArray<double> *proj_ref;
+    /** Array with Polars of translated images and their mirrors */
+    Polar<std::complex<double> >   *fP_img, *fPm_img;
     /** Global plans for fftw transformers of all polar rings */
     Polar_fftw_plans global_plans;
-    /** vector with stddevs for all reference projections */
-    double *stddev_ref, *stddev_img;
+    /** vector with stddevs for all translated images */
+    double *stddev_img;
     /** sampling object */
     Sampling mysampling;
     /** Flag whether to loop from low to high or from high to low
@@ -187,8 +185,10 @@ public:
 
     /** Get pointer to the current reference image
       If this image wasn't stored in memory yet, read it from disc and
-      store FT of the polar transform as well as the original image */
-    void getCurrentReference(int refno, Polar_fftw_plans &local_plans);
+      store FT of the polar transform as well as the original image.
+      The returned reference stays valid even if it is evicted from the cache
+      by another thread. */
+    PolarReferenceCache::ReferencePtr getCurrentReference(int refno, Polar_fftw_plans &local_plans);
 
     /** Get images to process.
      * This function will return the id's of images to process.
@@ -311,7 +311,7 @@ void CrystalARTRecons::singleStep(
                            corr_proj, YSIZE(read_proj()), XSIZE(read_proj()),
                            read_proj.rot(), read_proj.tilt(), read_proj.psi(), shift,
                            aint, bint, *(artPrm.D), *(artPrm.Dinv), this->unit_cell_mask,
-                           FORWARD, artPrm.eq_mode);
+                           FORWARD, artPrm.eq_mode, artPrm.threads);
     double shift_X, shift_Y;
 
     //   #define DEBUG_SHIFT
@@ -377,7 +377,7 @@ void CrystalARTRecons::singleStep(
                            corr_proj, YSIZE(read_proj()), XSIZE(read_proj()),
                            read_proj.rot(), read_proj.tilt(), read_proj.psi(), shift,
                            aint, bint, *(artPrm.D), *(artPrm.Dinv), this->unit_cell_mask,
-                           BACKWARD, artPrm.eq_mode);
+                           BACKWARD, artPrm.eq_mode, artPrm.threads);
 }
 
 
@@ -24,6 +24,7 @@
  ***************************************************************************/
 
 #include <algorithm>
+#include <chrono>
 #include "base_art_recons.h"
 #include "recons_misc.h"
 #include <data/fourier_filter.h>
@@ -149,6 +150,8 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
     bool iv_launched=false;
     for (int it = 0; it < artPrm.no_it; it++)
     {
+        auto itStart = std::chrono::steady_clock::now();
+
         // Initialization of some variables
         global_mean_error = 0;
         global_mean_error_1stblock = 0;
@@ -510,6 +513,12 @@ void ARTReconsBase::iterations(GridVolume &vol_basis, int rank)
                 *artPrm.fh_hist << "   POCS Global mean squared error: "
                 << POCS.POCS_global_mean_error/POCS.POCS_N << std::endl;
             }
+
+            double itTime = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - itStart).count();
+            std::cout        << "   Iteration time: " << itTime << " s ("
+            << artPrm.threads << " threads)" << std::endl;
+            *artPrm.fh_hist << "   Iteration time: " << itTime << " s" << std::endl;
         }
 
         // Convert volume and write if not last iteration
@@ -790,38 +799,6 @@ void ARTReconsBase::applySymmetry(GridVolume &vol_in, GridVolume *vol_out,int gr
 }
 
 
-void SinPartARTRecons::preProcess(GridVolume & vol_basis0, int level, int rank)
-{
-    ARTReconsBase::preProcess(vol_basis0, level, rank);
-
-    // As this is a threaded implementation, create structures for threads, and
-    // create threads
-    if( artPrm.threads > 1 )
-    {
-        th_ids = (pthread_t *)malloc( artPrm.threads * sizeof( pthread_t));
-
-        // Initialize the structures which will contain the parameters passed to different
-        // threads
-        project_threads = (project_thread_params *) malloc ( artPrm.threads * sizeof( project_thread_params ) );
-
-        // Initialize barrier to wait for working threads and the master thread.
-        barrier_init( &project_barrier, (artPrm.threads+1) );
-
-        // Threads are created in a waiting state. They can only run when master thread unlocks them by calling
-        // barrier_wait()
-
-        for( int c = 0 ; c < artPrm.threads ; c++ )
-        {
-            project_threads[c].thread_id = c;
-            project_threads[c].threads_count = artPrm.threads;
-            project_threads[c].destroy = false;
-
-            pthread_create( (th_ids+c), NULL, project_SimpleGridThread<double>, (void *)(project_threads+c) );
-        }
-    }
-}
-
-
 void SinPartARTRecons::singleStep(GridVolume &vol_in, GridVolume *vol_out,
                                   Projection &theo_proj, Projection &read_proj,
                                   int sym_no,
@@ -1019,36 +996,3 @@ void SinPartARTRecons::singleStep(GridVolume &vol_in, GridVolume *vol_out,
 }
 
 
-void SinPartARTRecons::postProcess(GridVolume & vol_basis)
-{
-    // Destroy created threads. This is done in a tricky way. At this point, threads
-    // are "slept" waiting for a barrier to be reached by the master thread to continue
-    // projecting/backprojecting a new projection. Here we set the flag destroy=true so
-    // the threads won't process a projections but will return.
-    if( artPrm.threads > 1 )
-    {
-        for( int c = 0 ; c < artPrm.threads ; c++ )
-        {
-            project_threads[c].destroy = true;
-        }
-
-        // Trigger threads "self-destruction"
-        barrier_wait( &project_barrier );
-
-        // Wait for effective threads death
-        for( int c = 0 ; c < artPrm.threads ; c++ )
-        {
-            pthread_join(*(th_ids+c),NULL);
-        }
-
-        // Destroy barrier and mutex, as they are no longer needed.
-        // Sjors, 27march2009
-        // NO, don't do this, because running a second threaded-ART
-        // in a single program will not have mutexes anymore...
-        //pthread_mutex_destroy( &project_mutex );
-        //barrier_destroy( &project_barrier );
-    }
-}
-
-
-
@@ -144,10 +144,13 @@ public:
 
 
 
+/** Single particle ART.
+    Projections and backprojections are threaded inside project_GridVolume
+    (see runThreadedProjection and ProjectionThreads), so no thread pool is
+    kept here. The projections of a SIRT block are processed one after
+    another. */
 class SinPartARTRecons : public ARTReconsBase
 {
-    pthread_t *th_ids;
-
 public:
     SinPartARTRecons()
     {}
@@ -155,8 +158,6 @@ public:
     virtual ~SinPartARTRecons()
     {}
 
-    void preProcess(GridVolume &vol_basis0, int level = FULL, int rank = -1);
-
     virtual void singleStep(GridVolume &vol_in, GridVolume *vol_out,
                             Projection &theo_proj, Projection &read_proj,
                             int sym_no,
@@ -164,8 +165,6 @@ public:
                             double &mean_error, int numIMG, double lambda, int act_proj,
                             const FileName &fn_ctf, const MultidimArray<int> *maskPtr,
                             bool refine);
-
-    void postProcess(GridVolume &vol_basis);
 }
 ;
 
@@ -30,6 +30,11 @@ std::pair<Matrix1D<float>, Matrix1D<float>> BSplineHelper::computeBSplineCoeffs(
         const LocalAlignmentResult<float> &alignment,
         const Dimensions &controlPoints, const std::pair<size_t, size_t> &noOfPatches,
         int verbosity, int solverIters);
+template
+std::pair<Matrix1D<double>, Matrix1D<double>> BSplineHelper::computeBSplineCoeffs(const Dimensions &movieSize,
+        const LocalAlignmentResult<double> &alignment,
+        const Dimensions &controlPoints, const std::pair<size_t, size_t> &noOfPatches,
+        int verbosity, int solverIters);
 template<typename T>
 std::pair<Matrix1D<T>, Matrix1D<T>> BSplineHelper::computeBSplineCoeffs(const Dimensions &movieSize,
         const LocalAlignmentResult<T> &alignment,
@@ -119,11 +119,7 @@ void ProgCorrectWiener2D::generateWienerFilter(MultidimArray<double> &Mwien, CTF
 	ctfIm.resize(1, 1, paddimY, paddimX,false);
 	//Esto puede estar mal. Cuidado con el sampling de la ctf!!!
 
-	if (correct_envelope)
-		ctf.generateCTF(paddimY, paddimX, ctfComplex);
-
-	else
-		ctf.generateCTFWithoutDamping(paddimY, paddimX, ctfComplex);
+	ctf.generateCTFFast(paddimY, paddimX, ctfComplex, -1, correct_envelope);
 
 	FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(ctfIm)
 	{
@@ -92,24 +92,27 @@ void actualPhaseFlip(MultidimArray<double> &I, CTFDescription ctf)
     MultidimArray< std::complex<double> > M_inFourier;
     transformer.FourierTransform(I,M_inFourier,false);
 
-    Matrix1D<double> freq(2); // Frequencies for Fourier plane
     int yDim=YSIZE(I);
     int xDim=XSIZE(I);
     double iTm=1.0/ctf.Tm;
     ctf.phase_shift = (ctf.phase_shift*PI)/180;
 
+    // Only the sign of the CTF is needed, evaluate it a row at a time
+    std::vector<double> fx(XSIZE(M_inFourier)), ctfRow(XSIZE(M_inFourier));
+    for (size_t j=0; j<XSIZE(M_inFourier); ++j)
+    {
+    	FFT_IDX2DIGFREQ(j, xDim, fx[j]);
+    	fx[j] *= iTm;
+    }
     for (size_t i=0; i<YSIZE(M_inFourier); ++i)
     {
-    	FFT_IDX2DIGFREQ(i, yDim, YY(freq));
-    	YY(freq) *= iTm;
+    	double fy;
+    	FFT_IDX2DIGFREQ(i, yDim, fy);
+    	fy *= iTm;
+    	ctf.evaluateCTFRow(&fx[0], fy, (int)fx.size(), &ctfRow[0], false);
         for (size_t j=0; j<XSIZE(M_inFourier); ++j)
-        {
-        	FFT_IDX2DIGFREQ(j, xDim, XX(freq));
-        	XX(freq) *= iTm;
-            ctf.precomputeValues(XX(freq),YY(freq));
-            if (ctf.getValuePureWithoutDampingAt()<0)
+            if (ctfRow[j]<0)
                 DIRECT_A2D_ELEM(M_inFourier,i,j)*=-1;
-        }
     }
 
     // Perform inverse Fourier transform and finish
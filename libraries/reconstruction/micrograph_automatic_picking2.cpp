@@ -31,12 +31,17 @@
 #include <core/xmipp_fft.h>
 #include <core/xmipp_filename.h>
 #include <algorithm>
+#include <thread>
 #include <classification/uniform.h>
+#include <data/bounded_queue.h>
 
 int flagAbort=0;
 
 AutoParticlePicking2::AutoParticlePicking2()
-{}
+{
+    Nthreads=1;
+    thread=NULL;
+}
 
 AutoParticlePicking2::AutoParticlePicking2(int pSize, int filterNum, int corrNum, int basisPCA,
         const FileName &model_name, const std::vector<MDRow> &vMicList)
@@ -69,6 +74,7 @@ AutoParticlePicking2::AutoParticlePicking2(int pSize, int filterNum, int corrNum
     // Set the parameters for two SVM classifiers.
     classifier.setParameters(8.0, 0.125);
     classifier2.setParameters(1.0, 0.25);
+    setThreads(1);
 
     // If models were generated then load them to memory.
     if (fnPCAModel.exists())
@@ -91,6 +97,13 @@ AutoParticlePicking2::AutoParticlePicking2(int pSize, int filterNum, int corrNum
     thread = NULL;
 }
 
+void AutoParticlePicking2::setThreads(int nthreads)
+{
+    Nthreads=std::max(nthreads,1);
+    classifier.setThreads(Nthreads);
+    classifier2.setThreads(Nthreads);
+}
+
 // This method is required by the JAVA part.
 void AutoParticlePicking2::setSize(int pSize)
 {
@@ -544,9 +557,6 @@ int AutoParticlePicking2::automaticallySelectParticles(FileName fnmicrograph, in
     auto_candidates.clear();
     //    md.clear();
 
-    double label, score;
-    Particle2 p;
-    MultidimArray<double> featVec, featVecNN;
     std::vector<Particle2> positionArray;
 
     if (thread == NULL)
@@ -573,78 +583,106 @@ int AutoParticlePicking2::automaticallySelectParticles(FileName fnmicrograph, in
     //    generateFeatVec(fnmicrograph,proc_prec,positionArray);
     //    classifier.LoadModel(fnSVMModel);
     int num=(int)(positionArray.size()*(proc_prec/100.0));
-    featVec.resize(num_features);
-    //    negative_candidates.clear();
+    classifyCandidates(autoFeatVec,positionArray,num);
+    if (auto_candidates.size() == 0)
+        return 0;
+    removeOccludedParticles();
+    saveAutoParticles(md);
+    if (readNextMic(fnmicrograph))
+        thread->workOnMicrograph(fnmicrograph, proc_prec);
+    return auto_candidates.size();
+}
+
+void AutoParticlePicking2::classifyCandidates(const MultidimArray<double> &featVecs,
+        const std::vector<Particle2> &positionArray, int num)
+{
+    MultidimArray<double> featVecsNormal, labels, scores;
+    Particle2 p;
 
+    // Normalize every feature vector to [0,1] and classify all of them at once
+    featVecsNormal.resize(num,num_features);
     for (int k=0;k<num;k++)
     {
-        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
-        DIRECT_A1D_ELEM(featVec,i)=DIRECT_A2D_ELEM(autoFeatVec,k,i);
-        featVecNN=featVec;
-        double max=featVec.computeMax();
-        double min=featVec.computeMin();
-        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
-        DIRECT_A1D_ELEM(featVec,i)=0+((1)*((DIRECT_A1D_ELEM(featVec,i)-min)/(max-min)));
-        int j=positionArray[k].x;
-        int i=positionArray[k].y;
-        label= classifier.predict(featVec, score);
-        if (label==1)
+        double max=DIRECT_A2D_ELEM(featVecs,k,0);
+        double min=max;
+        for (int i=1;i<num_features;i++)
         {
-            p.x=j;
-            p.y=i;
-            p.status=1;
-            p.cost=score;
-            p.vec=featVecNN;
-            auto_candidates.push_back(p);
-
+            double v=DIRECT_A2D_ELEM(featVecs,k,i);
+            if (v>max)
+                max=v;
+            if (v<min)
+                min=v;
         }
-        //        else
-        //        {
-        //            p.x=j;
-        //            p.y=i;
-        //            p.status=1;
-        //            p.cost=score;
-        //            p.vec=featVecNN;
-        //            negative_candidates.push_back(p);
-        //        }
+        for (int i=0;i<num_features;i++)
+            DIRECT_A2D_ELEM(featVecsNormal,k,i)=0+((1)*((DIRECT_A2D_ELEM(featVecs,k,i)-min)/(max-min)));
     }
-    if (auto_candidates.size() == 0)
-        return 0;
-    // Remove the occluded particles
-    for (size_t i=0;i<auto_candidates.size();++i)
-        for (size_t j=0;j<auto_candidates.size()-i-1;j++)
-            if (auto_candidates[j].cost<auto_candidates[j+1].cost)
-            {
-                p=auto_candidates[j+1];
-                auto_candidates[j+1]=auto_candidates[j];
-                auto_candidates[j]=p;
-            }
-    for (size_t i=0;i<auto_candidates.size()-1;++i)
-    {
-        if (auto_candidates[i].status==-1)
-            continue;
-        p=auto_candidates[i];
-        for (size_t j=i+1;j<auto_candidates.size();j++)
+    classifier.predict(featVecsNormal,labels,scores);
+
+    for (int k=0;k<num;k++)
+        if (DIRECT_A1D_ELEM(labels,k)==1)
         {
-            if (auto_candidates[j].x>p.x-particle_radius
-                && auto_candidates[j].x<p.x+particle_radius
-                && auto_candidates[j].y>p.y-particle_radius
-                && auto_candidates[j].y<p.y+particle_radius)
+            p.x=positionArray[k].x;
+            p.y=positionArray[k].y;
+            p.status=1;
+            p.cost=DIRECT_A1D_ELEM(scores,k);
+            p.vec.resize(num_features);
+            for (int i=0;i<num_features;i++)
+                DIRECT_A1D_ELEM(p.vec,i)=DIRECT_A2D_ELEM(featVecs,k,i);
+            auto_candidates.push_back(p);
+        }
+}
+
+void AutoParticlePicking2::removeOccludedParticles()
+{
+    // Best candidates first, keeping the original order among equal costs
+    std::stable_sort(auto_candidates.begin(),auto_candidates.end(),
+                     [](const Particle2 &a, const Particle2 &b)
+                     {
+                         return a.cost>b.cost;
+                     });
+
+    // A candidate is removed if it is occluded by a better one that has not
+    // been removed. The kept candidates are put in a grid of cells of size
+    // particle_radius, so only the 3x3 neighbouring cells have to be checked.
+    int cellSize=std::max(particle_radius,1);
+    int minX=auto_candidates[0].x, minY=auto_candidates[0].y;
+    int maxX=minX, maxY=minY;
+    for (size_t n=1;n<auto_candidates.size();++n)
+    {
+        minX=std::min(minX,auto_candidates[n].x);
+        maxX=std::max(maxX,auto_candidates[n].x);
+        minY=std::min(minY,auto_candidates[n].y);
+        maxY=std::max(maxY,auto_candidates[n].y);
+    }
+    int gridX=(maxX-minX)/cellSize+1;
+    int gridY=(maxY-minY)/cellSize+1;
+    std::vector< std::vector<size_t> > grid((size_t)gridX*gridY);
+    for (size_t n=0;n<auto_candidates.size();++n)
+    {
+        Particle2 &p=auto_candidates[n];
+        int cx=(p.x-minX)/cellSize;
+        int cy=(p.y-minY)/cellSize;
+        bool occluded=false;
+        for (int gy=std::max(cy-1,0);gy<=std::min(cy+1,gridY-1) && !occluded;++gy)
+            for (int gx=std::max(cx-1,0);gx<=std::min(cx+1,gridX-1) && !occluded;++gx)
             {
-                if (p.cost<auto_candidates[j].cost)
+                const std::vector<size_t> &cell=grid[(size_t)gy*gridX+gx];
+                for (size_t m=0;m<cell.size();++m)
                 {
-                    auto_candidates[i].status=-1;
-                    p=auto_candidates[j];
+                    const Particle2 &q=auto_candidates[cell[m]];
+                    if (p.x>q.x-particle_radius && p.x<q.x+particle_radius &&
+                        p.y>q.y-particle_radius && p.y<q.y+particle_radius)
+                    {
+                        occluded=true;
+                        break;
+                    }
                 }
-                else
-                    auto_candidates[j].status=-1;
             }
-        }
+        if (occluded)
+            p.status=-1;
+        else
+            grid[(size_t)cy*gridX+cx].push_back(n);
     }
-    saveAutoParticles(md);
-    if (readNextMic(fnmicrograph))
-        thread->workOnMicrograph(fnmicrograph, proc_prec);
-    return auto_candidates.size();
 }
 
 int AutoParticlePicking2::automaticWithouThread(FileName fnmicrograph, int proc_prec, const FileName &fn)
@@ -652,107 +690,109 @@ int AutoParticlePicking2::automaticWithouThread(FileName fnmicrograph, int proc_
     // Read the SVM model
     //    classifier.LoadModel(fnSVMModel);
 
-    double label, score;
-    Particle2 p;
-    MultidimArray<double> featVec, featVecNN;
     std::vector<Particle2> positionArray;
     MetaData md;
 
     generateFeatVec(fnmicrograph,proc_prec,positionArray);
 
     int num=(int)(positionArray.size()*(proc_prec/100.0));
-    featVec.resize(num_features);
-    for (int k=0;k<num;k++)
-    {
-        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
-        DIRECT_A1D_ELEM(featVec,i)=DIRECT_A2D_ELEM(autoFeatVec,k,i);
-        featVecNN=featVec;
-        double max=featVec.computeMax();
-        double min=featVec.computeMin();
-        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
-        DIRECT_A1D_ELEM(featVec,i)=0+((1)*((DIRECT_A1D_ELEM(featVec,i)-min)/(max-min)));
-        int j=positionArray[k].x;
-        int i=positionArray[k].y;
-        label= classifier.predict(featVec, score);
-        if (label==1)
-        {
-            p.x=j;
-            p.y=i;
-            p.status=1;
-            p.cost=score;
-            p.vec=featVecNN;
-            auto_candidates.push_back(p);
-
-        }
-    }
-
+    classifyCandidates(autoFeatVec,positionArray,num);
     if (auto_candidates.size() == 0)
         return 0;
-    // Remove the occluded particles
-    for (size_t i=0;i<auto_candidates.size();++i)
-        for (size_t j=0;j<auto_candidates.size()-i-1;j++)
-            if (auto_candidates[j].cost<auto_candidates[j+1].cost)
-            {
-                p=auto_candidates[j+1];
-                auto_candidates[j+1]=auto_candidates[j];
-                auto_candidates[j]=p;
-            }
-    for (size_t i=0;i<auto_candidates.size()-1;++i)
-    {
-        if (auto_candidates[i].status==-1)
-            continue;
-        p=auto_candidates[i];
-        for (size_t j=i+1;j<auto_candidates.size();j++)
-        {
-            if (auto_candidates[j].x>p.x-particle_radius
-                && auto_candidates[j].x<p.x+particle_radius
-                && auto_candidates[j].y>p.y-particle_radius
-                && auto_candidates[j].y<p.y+particle_radius)
-            {
-                if (p.cost<auto_candidates[j].cost)
-                {
-                    auto_candidates[i].status=-1;
-                    p=auto_candidates[j];
-                }
-                else
-                    auto_candidates[j].status=-1;
-            }
-        }
-    }
+    removeOccludedParticles();
     saveAutoParticles(md);
     md.write(fn,MD_OVERWRITE);
     return auto_candidates.size();
 }
 
+/* Features of one micrograph, extracted ahead of its classification */
+struct PickingFeatures
+{
+    size_t idx;
+    std::vector<Particle2> positionArray;
+    MultidimArray<double> featVecs;
+};
 
-void AutoParticlePicking2::generateFeatVec(const FileName &fnmicrograph, int proc_prec, std::vector<Particle2> &positionArray)
+size_t AutoParticlePicking2::automaticallySelectList(const std::vector<FileName> &fnMics, int proc_prec,
+        const std::vector<FileName> &fnOut, int prefetch)
 {
-    MultidimArray<double> IpolarCorr;
-    MultidimArray<double> featVec;
-    MultidimArray<double> pieceImage;
-    MultidimArray<double> staticVec;
+    // The reader thread owns the micrograph related members (microImage,
+    // micrographStack, autoFeatVec...) and passes on copies of the features,
+    // while this thread only touches the classifier and auto_candidates.
+    BoundedQueue<PickingFeatures> ready(std::max(prefetch,1));
+    std::thread reader([&]()
+    {
+        for (size_t n=0;n<fnMics.size();++n)
+        {
+            PickingFeatures f;
+            f.idx=n;
+            generateFeatVec(fnMics[n],proc_prec,f.positionArray);
+            f.featVecs=autoFeatVec;
+            if (!ready.push(std::move(f)))
+                break;
+        }
+        ready.close();
+    });
+
+    size_t total=0;
+    PickingFeatures f;
+    while (ready.pop(f))
+    {
+        MetaData md;
+        auto_candidates.clear();
+        int num=(int)(f.positionArray.size()*(proc_prec/100.0));
+        classifyCandidates(f.featVecs,f.positionArray,num);
+        if (auto_candidates.size()>0)
+            removeOccludedParticles();
+        saveAutoParticles(md);
+        md.write(fnOut[f.idx],MD_OVERWRITE);
+        total+=md.size();
+    }
+    reader.join();
+    return total;
+}
 
+void AutoParticlePicking2::generateFeatVec(const FileName &fnmicrograph, int proc_prec, std::vector<Particle2> &positionArray)
+{
     readMic(fnmicrograph,1);
-    IpolarCorr.initZeros(num_correlation,1,NangSteps,NRsteps);
     buildSearchSpace(positionArray,true);
 
     int num=(int)(positionArray.size()*(proc_prec/100.0));
     autoFeatVec.resize(num,num_features);
-    for (int k=0;k<num;k++)
-    {
-        if (flagAbort)
-            return;
-        int j=positionArray[k].x;
-        int i=positionArray[k].y;
-        buildInvariant(IpolarCorr,j,i,0);
-        extractParticle(j,i,microImage(),pieceImage,false);
-        pieceImage.resize(1,1,1,XSIZE(pieceImage)*YSIZE(pieceImage));
-        extractStatics(pieceImage,staticVec);
-        buildVector(IpolarCorr,staticVec,featVec,pieceImage);
-        // Keep the features on memory to classify later on
-        FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
-        DIRECT_A2D_ELEM(autoFeatVec,k,i)=DIRECT_A1D_ELEM(featVec,i);
-    }
+
+    // The candidates are dealt cyclically among the threads (they are sorted
+    // by correlation, so this balances the load). Each thread has its own
+    // work arrays and writes the rows of its candidates only.
+    int nThreads=std::max(1,std::min(Nthreads,num));
+    auto extractFeatures=[&](int t)
+    {
+        MultidimArray<double> IpolarCorr;
+        MultidimArray<double> featVec;
+        MultidimArray<double> pieceImage;
+        MultidimArray<double> staticVec;
+        IpolarCorr.initZeros(num_correlation,1,NangSteps,NRsteps);
+        for (int k=t;k<num;k+=nThreads)
+        {
+            if (flagAbort)
+                return;
+            int j=positionArray[k].x;
+            int i=positionArray[k].y;
+            buildInvariant(IpolarCorr,j,i,0);
+            extractParticle(j,i,microImage(),pieceImage,false);
+            pieceImage.resize(1,1,1,XSIZE(pieceImage)*YSIZE(pieceImage));
+            extractStatics(pieceImage,staticVec);
+            buildVector(IpolarCorr,staticVec,featVec,pieceImage);
+            // Keep the features on memory to classify later on
+            FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(featVec)
+            DIRECT_A2D_ELEM(autoFeatVec,k,i)=DIRECT_A1D_ELEM(featVec,i);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t=1;t<nThreads;t++)
+        workers.push_back(std::thread(extractFeatures,t));
+    extractFeatures(0);
+    for (size_t t=0;t<workers.size();t++)
+        workers[t].join();
 }
 
 FeaturesThread::FeaturesThread(AutoParticlePicking2 * picker)
@@ -1661,14 +1701,11 @@ void AutoParticlePicking2::buildSearchSpace(std::vector<Particle2> &positionArra
                 p.status=0;
                 positionArray.push_back(p);
             }
-    for (size_t i=0;i<positionArray.size();++i)
-        for (size_t j=0;j<positionArray.size()-i-1;j++)
-            if (positionArray[j].cost<positionArray[j + 1].cost)
-            {
-                p=positionArray[j+1];
-                positionArray[j+1]=positionArray[j];
-                positionArray[j]=p;
-            }
+    std::stable_sort(positionArray.begin(),positionArray.end(),
+                     [](const Particle2 &a, const Particle2 &b)
+                     {
+                         return a.cost>b.cost;
+                     });
 }
 
 void AutoParticlePicking2::applyConvolution(bool fast)
@@ -1756,6 +1793,8 @@ void ProgMicrographAutomaticPicking2::readParams()
         fn_train = getParam("--mode", 1);
     }
     fn_root = getParam("--outputRoot");
+    if (checkParam("--batch"))
+        fn_batch = getParam("--batch");
     autoPicking=new AutoParticlePicking2();
     autoPicking->readParams(this);
 }
@@ -1787,6 +1826,8 @@ void AutoParticlePicking2::defineParams(XmippProgram * program)
     program->addParamsLine("  --model <model_rootname>      : Bayesian model of the particles to pick");
     program->addParamsLine("  --particleSize <size>         : Particle size in pixels");
     program->addParamsLine("  [--thr <p=1>]                 : Number of threads for automatic picking");
+    program->addParamsLine("  [--batch <odir=\".\">]        : Input is a metadata with a list of micrographs (label micrograph), all of them are picked");
+    program->addParamsLine("                                : +The particles of each micrograph are stored in odir/<micrograph>.pos");
     program->addParamsLine("  [--fast]                      : Perform a fast preprocessing of the micrograph (Fourier filter instead of Wavelet filter)");
     program->addParamsLine("  [--in_core]                   : Read the micrograph in memory");
     program->addParamsLine("  [--filter_num <n=6>]          : The number of filters in filter bank");
@@ -1799,6 +1840,8 @@ void AutoParticlePicking2::defineParams(XmippProgram * program)
     program->addExampleLine("xmipp_micrograph_automatic_picking -i micrograph.tif --particleSize 100 --model model --thr 4 --outputRoot micrograph --mode train manual.pos");
     program->addExampleLine("Automatically select particles after training:", false);
     program->addExampleLine("xmipp_micrograph_automatic_picking -i micrograph.tif --particleSize 100 --model model --thr 4 --outputRoot micrograph --mode autoselect");
+    program->addExampleLine("Automatically select particles in all the micrographs of a set:", false);
+    program->addExampleLine("xmipp_micrograph_automatic_picking -i micrographs.xmd --particleSize 100 --model model --thr 4 --outputRoot micrograph --mode autoselect --batch pickedDir");
 }
 void ProgMicrographAutomaticPicking2::defineParams()
 {
@@ -1817,6 +1860,22 @@ void ProgMicrographAutomaticPicking2::run()
     MD.read(fn_model.beforeLastOf("/")+"/config.xmd");
     MD.getValue( MDL_PICKING_AUTOPICKPERCENT,proc_prec,MD.firstObject());
 
+    int Nthreads = autoPicking->Nthreads;
     autoPicking = new AutoParticlePicking2(autoPicking->particle_size,autoPicking->filter_num,autoPicking->corr_num,autoPicking->NPCA,fn_model,std::vector<MDRow>());
-    autoPicking->automaticWithouThread(fn_micrograph,proc_prec,fnAutoParticles);
+    autoPicking->setThreads(Nthreads);
+    if (fn_batch.empty())
+        autoPicking->automaticWithouThread(fn_micrograph,proc_prec,fnAutoParticles);
+    else
+    {
+        MetaData MDmics(fn_micrograph);
+        std::vector<FileName> fnMics, fnOut;
+        FileName fnMic;
+        FOR_ALL_OBJECTS_IN_METADATA(MDmics)
+        {
+            MDmics.getValue(MDL_MICROGRAPH,fnMic,__iter.objId);
+            fnMics.push_back(fnMic);
+            fnOut.push_back(formatString("particles_auto@%s/%s.pos", fn_batch.c_str(), fnMic.getBaseName().c_str()));
+        }
+        autoPicking->automaticallySelectList(fnMics,proc_prec,fnOut);
+    }
 }
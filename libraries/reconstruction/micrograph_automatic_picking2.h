@@ -152,6 +152,32 @@ public:
 
     int automaticWithouThread(FileName fnmicrograph, int proc_prec, const FileName &fn);
 
+    /*
+     * Automatically pick a list of micrographs, writing the particles of
+     * fnMics[i] to fnOut[i]. The features of the next micrographs are
+     * extracted in the background (up to prefetch micrographs ahead) while
+     * the current one is classified and saved. Returns the number of
+     * picked particles.
+     */
+    size_t automaticallySelectList(const std::vector<FileName> &fnMics, int proc_prec,
+                                   const std::vector<FileName> &fnOut, int prefetch=2);
+
+    /// Number of threads for feature extraction and classification
+    void setThreads(int nthreads);
+
+    /*
+     * Classify the first num candidates, whose features are the rows of
+     * featVecs, and put those labelled as particles in auto_candidates.
+     */
+    void classifyCandidates(const MultidimArray<double> &featVecs,
+                            const std::vector<Particle2> &positionArray, int num);
+
+    /*
+     * Sort auto_candidates by decreasing cost and mark with status -1 those
+     * closer than particle_radius (in x and y) to a better one.
+     */
+    void removeOccludedParticles();
+
     void saveAutoParticles(MetaData &md);
 
     void saveAutoParticles(std::vector<MDRow> &md);
@@ -384,6 +410,8 @@ public:
     /// Number of threads
     /// Output rootname
     FileName fn_root;
+    /// Output directory when the input is a list of micrographs
+    FileName fn_batch;
     AutoParticlePicking2 *autoPicking;
 public:
     /// Read parameters
@@ -37,6 +37,7 @@ ProgML2D::ProgML2D()
 {
     do_ML3D = false;
     refs_per_class = 1;
+    barrierWakeup = false;
 }
 
 
@@ -63,6 +64,8 @@ void ProgML2D::defineParams()
     defineBasicParams(this);
 
     defineAdditionalParams(this, "==+ Additional options ==");
+    addParamsLine(" [ --cacheImages <MB=2048> ]     : Read the images only once and keep them in memory between iterations");
+    addParamsLine("                                : If they take more than MB, they are kept in a memory mapped file");
     defineHiddenParams(this);
 
     addExampleLine("A typical use of this program is:", false);
@@ -185,6 +188,9 @@ void ProgML2D::readParams()
     }
 
     no_iem = checkParam("--no_iem");
+    cacheImages = checkParam("--cacheImages");
+    if (cacheImages)
+        cacheMB = getDoubleParam("--cacheImages");
 
     //std::cerr << "DEBUG_JM: exiting after readParams..." <<std::endl;
     //exit(1);
@@ -387,6 +393,8 @@ void ProgML2D::produceSideInfo2()
     }
 
     setNumberOfLocalImages();
+    if (cacheImages)
+        particles.initialize(nr_images_local, dim, dim, cacheMB);
     // prepare masks for rotated references
     mask.resize(dim, dim);
     mask.setXmippOrigin();
@@ -703,12 +711,15 @@ void ProgML2D::expectationSingleImage(Matrix1D<double> &opt_offsets)
     timer.tic(ESI_E1);
 #endif
 
-    MultidimArray<double> Maux, Mweight;
+    // The master uses the extra entry of threads_d, since it also
+    // works as thread 0 inside the tasks
+    MultidimArray<double> &Maux = threads_d[threads].Maux;
+    MultidimArray<double> Mweight;
     MultidimArray<std::complex<double> > Faux;
     double my_mindiff;
     bool is_ok_trymindiff = false;
     double sigma_noise2 = model.sigma_noise * model.sigma_noise;
-    FourierTransformer local_transformer;
+    FourierTransformer &local_transformer = threads_d[threads].transformer;
     ioptx = iopty = 0;
 
     // Update sigdim, i.e. the number of pixels that will be considered in the translations
@@ -717,8 +728,6 @@ void ProgML2D::expectationSingleImage(Matrix1D<double> &opt_offsets)
     sigdim = XMIPP_MIN(dim, sigdim);
 
     // Setup matrices
-    Maux.resize(dim, dim);
-    Maux.setXmippOrigin();
     Mweight.initZeros(sigdim, sigdim);
     Mweight.setXmippOrigin();
 
@@ -930,36 +939,63 @@ void ProgML2D::createThreads()
 {
 
     //Initialize some variables for using for threads
-
-    th_ids = new pthread_t[threads];
-    threads_d = new structThreadTasks[threads];
-
-    barrier_init(&barrier, threads + 1);
-    barrier_init(&barrier2, threads + 1);
-    barrier_init(&barrier3, threads);//Main thread will not wait here
-
-    for (int i = 0; i < threads; i++)
+    threads_d = new structThreadTasks[threads + 1];
+    for (int i = 0; i <= threads; i++)
     {
         threads_d[i].thread_id = i;
         threads_d[i].prm = this;
+        threads_d[i].Maux.resize(dim, dim);
+        threads_d[i].Maux.setXmippOrigin();
+    }
 
-        int result = pthread_create((th_ids + i), NULL, doThreadsTasks,
-                                    (void *) (threads_d + i));
+    barrier_init(&barrier3, threads);//All threads doing the task, master included
+    poolGeneration = 0;
+    poolPending = 0;
+    workers.clear();
 
-        if (result != 0)
-        {
-            REPORT_ERROR(ERR_THREADS_NOTINIT, "");
-        }
+    if (barrierWakeup)
+    {
+        //The master does not work in the tasks, it waits in barrier2
+        barrier_init(&barrier, threads + 1);
+        barrier_init(&barrier2, threads + 1);
+        for (int i = 0; i < threads; i++)
+            workers.push_back(std::thread(doThreadsTasksBarrier, (void *) (threads_d + i)));
+        return;
     }
 
+    //Thread 0 is the master itself
+    for (int i = 1; i < threads; i++)
+        workers.push_back(std::thread(doThreadsTasks, (void *) (threads_d + i)));
+
 }//close function createThreads
 
 /** Free threads memory and exit */
 void ProgML2D::destroyThreads()
 {
-    threadTask = TH_EXIT;
-    barrier_wait(&barrier);
-    delete[] th_ids;
+    if (barrierWakeup)
+    {
+        threadTask = TH_EXIT;
+        barrier_wait(&barrier);
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            threadTask = TH_EXIT;
+            poolPending = 0;
+            ++poolGeneration;
+        }
+        poolWakeup.notify_all();
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    workers.clear();
+    if (barrierWakeup)
+    {
+        barrier_destroy(&barrier);
+        barrier_destroy(&barrier2);
+    }
+    barrier_destroy(&barrier3);
     delete[] threads_d;
 }
 
@@ -969,55 +1005,88 @@ void * doThreadsTasks(void * data)
     structThreadTasks * thread_data = (structThreadTasks *) data;
 
     ProgML2D * prm = thread_data->prm;
-
-    barrier_t & barrier = prm->barrier;
-    barrier_t & barrier2 = prm->barrier2;
+    size_t generation = 0;
 
     //Loop until the threadTask become TH_EXIT
-
     do
     {
         //Wait until main threads order to start
-        //debug_print("Waiting on barrier, th ", thread_id);
-        barrier_wait(&barrier);
-
-        //Check task to do
-
-        switch (prm->threadTask)
         {
+            std::unique_lock<std::mutex> lock(prm->poolMutex);
+            prm->poolWakeup.wait(lock, [&]{ return prm->poolGeneration != generation; });
+            generation = prm->poolGeneration;
+        }
 
-        case TH_PFS_REFNO:
-            prm->doThreadPreselectFastSignificantRefno();
+        if (prm->threadTask == TH_EXIT)
             break;
 
-        case TH_ESI_REFNO:
-            prm->doThreadExpectationSingleImageRefno();
-            break;
+        prm->runThreadTask(*thread_data);
 
-        case TH_ESI_UPDATE_REFNO:
-            prm->doThreadESIUpdateRefno();
-            break;
+        //Tell the master when the last one is done
+        std::lock_guard<std::mutex> lock(prm->poolMutex);
+        if (--prm->poolPending == 0)
+            prm->poolDone.notify_one();
+    }
+    while (1);
 
-        case TH_RR_REFNO:
-            prm->doThreadRotateReferenceRefno();
-            break;
+    return NULL;
+}//close function doThreadsTasks
 
-        case TH_RRR_REFNO:
-            prm->doThreadReverseRotateReferenceRefno();
-            break;
+/// Same as doThreadsTasks, woken with barriers (see ProgML2D::barrierWakeup)
+void * doThreadsTasksBarrier(void * data)
+{
+    structThreadTasks * thread_data = (structThreadTasks *) data;
 
-        case TH_EXIT:
-            pthread_exit(NULL);
-            break;
+    ProgML2D * prm = thread_data->prm;
 
-        }
+    //Loop until the threadTask become TH_EXIT
+    do
+    {
+        //Wait until main threads order to start
+        barrier_wait(&prm->barrier);
 
-        barrier_wait(&barrier2);
+        if (prm->threadTask == TH_EXIT)
+            break;
 
+        prm->runThreadTask(*thread_data);
+
+        barrier_wait(&prm->barrier2);
     }
     while (1);
 
-}//close function doThreadsTasks
+    return NULL;
+}//close function doThreadsTasksBarrier
+
+void ProgML2D::runThreadTask(structThreadTasks &thread_data)
+{
+    //Check task to do
+    switch (threadTask)
+    {
+
+    case TH_PFS_REFNO:
+        doThreadPreselectFastSignificantRefno();
+        break;
+
+    case TH_ESI_REFNO:
+        doThreadExpectationSingleImageRefno(thread_data);
+        break;
+
+    case TH_ESI_UPDATE_REFNO:
+        doThreadESIUpdateRefno();
+        break;
+
+    case TH_RR_REFNO:
+        doThreadRotateReferenceRefno(thread_data);
+        break;
+
+    case TH_RRR_REFNO:
+        doThreadReverseRotateReferenceRefno(thread_data);
+        break;
+
+    case TH_EXIT:
+        break;
+    }
+}
 
 
 /// Function to assign refno jobs to threads
@@ -1045,30 +1114,49 @@ int ProgML2D::getThreadRefnoJob(int &refno)
 ///Function for awake threads for different tasks
 void ProgML2D::awakeThreads(ThreadTask task, int start_refno, int load)
 {
-    threadTask = task;
-    refno_index = start_refno;
-    refno_count = 0;
-    refno_load = load;
-    barrier_wait(&barrier);
-    //Wait until done
-    barrier_wait(&barrier2);
+    if (barrierWakeup)
+    {
+        threadTask = task;
+        refno_index = start_refno;
+        refno_count = 0;
+        refno_load = load;
+        barrier_wait(&barrier);
+        //Wait until done
+        barrier_wait(&barrier2);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        threadTask = task;
+        refno_index = start_refno;
+        refno_count = 0;
+        refno_load = load;
+        poolPending = threads - 1;
+        ++poolGeneration;
+    }
+    poolWakeup.notify_all();
+
+    //The master works as thread 0 instead of sleeping until done
+    runThreadTask(threads_d[0]);
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    poolDone.wait(lock, [&]{ return poolPending == 0; });
 }//close function awakeThreads
 
 
-void ProgML2D::doThreadRotateReferenceRefno()
+void ProgML2D::doThreadRotateReferenceRefno(structThreadTasks &thread_data)
 {
 #ifdef DEBUG
     std::cerr << "entering doThreadRotateReference " << std::endl;
 #endif
 
     double AA, stdAA=0., psi, dum, avg;
-    MultidimArray<double> Maux(dim, dim);
+    MultidimArray<double> &Maux = thread_data.Maux;
     MultidimArray<std::complex<double> > Faux;
-    FourierTransformer local_transformer;
+    FourierTransformer &local_transformer = thread_data.transformer;
     int refnoipsi;
 
-    Maux.setXmippOrigin();
-
     FOR_ALL_THREAD_REFNO()
     {
         computeStats_within_binary_mask(omask, model.Iref[refno](), dum,
@@ -1116,14 +1204,14 @@ void ProgML2D::doThreadRotateReferenceRefno()
 
 }//close function doThreadRotateReferenceRefno
 
-void ProgML2D::doThreadReverseRotateReferenceRefno()
+void ProgML2D::doThreadReverseRotateReferenceRefno(structThreadTasks &thread_data)
 {
     double psi, dum, avg;
-    MultidimArray<double> Maux(dim, dim), Maux2(dim, dim), Maux3(dim, dim);
+    MultidimArray<double> &Maux = thread_data.Maux;
+    MultidimArray<double> Maux2(dim, dim), Maux3(dim, dim);
     MultidimArray<std::complex<double> > Faux;
-    FourierTransformer local_transformer;
+    FourierTransformer &local_transformer = thread_data.transformer;
 
-    Maux.setXmippOrigin();
     Maux2.setXmippOrigin();
     Maux3.setXmippOrigin();
 
@@ -1284,7 +1372,7 @@ void ProgML2D::doThreadPreselectFastSignificantRefno()
 
 }//close function doThreadPreselectFastSignificantRefno
 
-void ProgML2D::doThreadExpectationSingleImageRefno()
+void ProgML2D::doThreadExpectationSingleImageRefno(structThreadTasks &thread_data)
 {
     double diff;
     double aux, pdf, fracpdf, A2_plus_Xi2;
@@ -1298,13 +1386,12 @@ void ProgML2D::doThreadExpectationSingleImageRefno()
     int local_iopty=0, local_ioptx=0, local_iopt_psi=0, local_iopt_flip=0,
     local_opt_refno=0;
 
-    MultidimArray<double> Maux, Mweight;
+    MultidimArray<double> &Maux = thread_data.Maux;
+    MultidimArray<double> Mweight;
     MultidimArray<std::complex<double> > Faux, Fzero(dim, hdim + 1);
-    FourierTransformer local_transformer;
+    FourierTransformer &local_transformer = thread_data.transformer;
 
     // Setup matrices
-    Maux.resize(dim, dim);
-    Maux.setXmippOrigin();
     Mweight.resize(sigdim, sigdim);
     Mweight.setXmippOrigin();
     Fzero.initZeros();
@@ -1777,9 +1864,13 @@ void ProgML2D::expectation()
             //std::cerr << "\n ======>>> imgno: " << imgno << std::endl;
             mygroup = (factor_nref > 1) ? divide_equally_group(nr_images_global, factor_nref, imgno) : 0;
 
-            MDimg.getValue(MDL_IMAGE, fn_img, img_id[imgno]);
-            img.read(fn_img);
-            img().setXmippOrigin();
+            if (!particles.get(img_id[imgno], img()))
+            {
+                MDimg.getValue(MDL_IMAGE, fn_img, img_id[imgno]);
+                img.read(fn_img);
+                img().setXmippOrigin();
+                particles.put(img_id[imgno], img());
+            }
             Xi2 = img().sum2();
             Mimg = img();
 
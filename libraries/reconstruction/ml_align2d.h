@@ -26,7 +26,11 @@
 #ifndef _MLALIGN2D_H
 #define _MLALIGN2D_H
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "ml2d.h"
+#include <data/particle_cache.h>
 
 ///******** Some macro definitions ****************
 ///Useful macro for thread iteration and work over all refno
@@ -40,17 +44,22 @@ while ((load = getThreadRefnoJob(refno)) > 0) \
     for (int i = 0; i < load; i++, refno = (refno + 1) % model.n_ref)
 
 class ProgML2D;
-// This structure is needed to pass parameters to the threads
+// This structure is needed to pass parameters to the threads.
+// Each thread keeps its FFT plans and its work image between tasks,
+// so that they are only planned once per run.
 typedef struct
 {
     int thread_id;
     ProgML2D * prm;
+    FourierTransformer transformer;
+    MultidimArray<double> Maux;
 }
 structThreadTasks;
 
 #define SPECIAL_ITER 0
 
 void * doThreadsTasks(void * data);
+void * doThreadsTasksBarrier(void * data);
 
 /**@defgroup MLalign2D ml_align2d (Maximum likelihood in 2D)
    @ingroup ReconsLibrary */
@@ -62,11 +71,31 @@ class ProgML2D: public ML2DBaseProgram
 public:
   bool no_iem;
 
+    /** Keep the images of this node in memory between iterations */
+    bool cacheImages;
+    /** Memory for the image cache (in MB), beyond it the cache is memory mapped */
+    double cacheMB;
+    ParticleCache particles;
+
     MultidimArray<int> mask, omask;
-    /** Thread stuff */
+    /** Thread stuff.
+        The master thread works as thread 0, and threads-1 workers wait
+        in the pool for the next task. threads_d has one extra entry
+        with the FFT plans of the master outside the tasks.
+        Only one image is in flight: the tasks split the references of the
+        current image, whose state (Fimg_flip, weights, optimal offsets,
+        trymindiff) is kept in the members below.
+        With barrierWakeup, threads workers are woken with two barriers
+        per task while the master waits, as the previous engine did. It is
+        kept to compare both engines in xmipp_ml_align2d_benchmark. */
     int threadTask;
+    bool barrierWakeup;
     barrier_t barrier, barrier2, barrier3;
-    pthread_t * th_ids;
+    std::vector<std::thread> workers;
+    std::mutex poolMutex;
+    std::condition_variable poolWakeup, poolDone;
+    size_t poolGeneration;
+    int poolPending;
     structThreadTasks * threads_d;
 
     /** New class variables, taken from old MAIN */
@@ -158,17 +187,20 @@ public:
     /// Awake threads for different tasks
     void awakeThreads(ThreadTask task, int start_refno, int load = 1);
 
+    /// Run the current task (threadTask) in the calling thread
+    void runThreadTask(structThreadTasks &thread_data);
+
     /// Thread code to parallelize refno loop in rotateReference
-    void doThreadRotateReferenceRefno();
+    void doThreadRotateReferenceRefno(structThreadTasks &thread_data);
 
     ///Thread code to parallelize refno loop in reverseRotateReference
-    void doThreadReverseRotateReferenceRefno();
+    void doThreadReverseRotateReferenceRefno(structThreadTasks &thread_data);
 
     /// Thread code to parallelize refno loop in preselectFastSignificant
     void doThreadPreselectFastSignificantRefno();
 
     /// Thread code to parallelize refno loop in expectationSingleImage
-    void doThreadExpectationSingleImageRefno();
+    void doThreadExpectationSingleImageRefno(structThreadTasks &thread_data);
 
     /// Thread code to parallelize update loop in ESI
     void doThreadESIUpdateRefno();
@@ -28,7 +28,6 @@
 //#define JM_DEBUG
 
 // For blocking of threads
-pthread_mutex_t mltomo_weightedsum_update_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t mltomo_selfile_access_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Usage ===================================================================
@@ -113,6 +112,8 @@ ProgMLTomo::defineParams()
         " [ --maxres <float=0.5> ]       : Maximum resolution (in pixel^-1) to use ");
     addParamsLine(
         " [ --thr <int=1> ]              : Number of shared-memory threads to use in parallel ");
+    addParamsLine(
+        " [ --wedge_mem <float=256> ]    : Memory (in MB) to keep the rotated missing regions ");
 
     addParamsLine("==+ Additional options: ==");
     addParamsLine(
@@ -382,6 +383,8 @@ ProgMLTomo::readParams()
 
     // Number of threads
     threads = getIntParam("--thr");
+    wedge_cache_mem = getDoubleParam("--wedge_mem");
+    wedge_cache_bytes = 0;
 
 }
 
@@ -1668,6 +1671,49 @@ ProgMLTomo::getMissingRegion(MultidimArray<unsigned char> &Mmissing,
 #endif
 }
 
+const MultidimArray<unsigned char> &
+ProgMLTomo::getCachedMissingRegion(MultidimArray<unsigned char> &Mbuffer,
+                                   const int angno, const int missno)
+{
+    std::pair<int, int> key(angno, missno);
+    {
+        std::lock_guard<std::mutex> lock(wedge_cache_mutex);
+        std::map<std::pair<int, int>, MultidimArray<unsigned char> >::iterator it =
+            wedge_cache.find(key);
+        if (it != wedge_cache.end())
+            return it->second;
+    }
+
+    // Compute outside the lock, the other threads may keep on reading
+    if (angno < 0)
+    {
+        Matrix2D<double> I(4, 4);
+        I.initIdentity();
+        getMissingRegion(Mbuffer, I, missno);
+    }
+    else
+        getMissingRegion(Mbuffer, all_angle_info[angno].A, missno);
+
+    std::lock_guard<std::mutex> lock(wedge_cache_mutex);
+    size_t bytes = MULTIDIM_SIZE(Mbuffer) * sizeof(unsigned char);
+    if (wedge_cache_bytes + bytes > wedge_cache_mem * 1024 * 1024)
+        return Mbuffer;
+    // If another thread stored it meanwhile, its copy is kept
+    std::pair<std::map<std::pair<int, int>, MultidimArray<unsigned char> >::iterator, bool> inserted =
+        wedge_cache.insert(std::make_pair(key, Mbuffer));
+    if (inserted.second)
+        wedge_cache_bytes += bytes;
+    return inserted.first->second;
+}
+
+void
+ProgMLTomo::clearMissingRegionCache()
+{
+    std::lock_guard<std::mutex> lock(wedge_cache_mutex);
+    wedge_cache.clear();
+    wedge_cache_bytes = 0;
+}
+
 // Calculate probability density function of all in-plane transformations phi
 void
 ProgMLTomo::calculatePdfTranslations()
@@ -1944,10 +1990,11 @@ ProgMLTomo::precalculateA2(std::vector<Image<double> > &Iref)
 
                 for (int missno = 0; missno < nr_miss; ++missno)
                 {
-                    getMissingRegion(Mmissing, I, missno);
+                    const MultidimArray<unsigned char> &Mwedge =
+                        getCachedMissingRegion(Mmissing, -1, missno);
                     Faux.initZeros();
                     FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
-                    if (DIRECT_MULTIDIM_ELEM(Mmissing,n))
+                    if (DIRECT_MULTIDIM_ELEM(Mwedge,n))
                         DIRECT_MULTIDIM_ELEM(Faux,n) = DIRECT_MULTIDIM_ELEM(Faux2,n);
                     transformer.inverseFourierTransform();
                     A2.push_back(Maux.sum2());
@@ -2084,9 +2131,10 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
     if (do_missing)
     {
         // Enforce missing wedge
-        getMissingRegion(Mmissing, I, missno);
+        const MultidimArray<unsigned char> &Mwedge =
+            getCachedMissingRegion(Mmissing, -1, missno);
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
-        if (!DIRECT_MULTIDIM_ELEM(Mmissing,n))
+        if (!DIRECT_MULTIDIM_ELEM(Mwedge,n))
             DIRECT_MULTIDIM_ELEM(Faux,n) = complex_zero;
     }
     Fimg0 = Faux;
@@ -2306,16 +2354,17 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
                         if (do_missing)
                         {
                             // Store sum of wedges!
-                            getMissingRegion(Mmissing, A_rot, missno);
+                            const MultidimArray<unsigned char> &Mwedge =
+                                getCachedMissingRegion(Mmissing, angno, missno);
                             MultidimArray<double> &mysumweds_refno=mysumweds[refno];
-                            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mmissing)
-                            if (DIRECT_MULTIDIM_ELEM(Mmissing,n))
+                            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mwedge)
+                            if (DIRECT_MULTIDIM_ELEM(Mwedge,n))
                                 DIRECT_MULTIDIM_ELEM(mysumweds_refno,n) += my_sumweight;
 
                             // Again enforce missing region to avoid filling it with artifacts from the rotation
                             local_transformer.FourierTransform();
-                            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mmissing)
-                            if (!DIRECT_MULTIDIM_ELEM(Mmissing,n))
+                            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mwedge)
+                            if (!DIRECT_MULTIDIM_ELEM(Mwedge,n))
                                 DIRECT_MULTIDIM_ELEM(Faux,n)=complex_zero;
                             local_transformer.inverseFourierTransform();
                         }
@@ -2364,10 +2413,8 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
     YY(opt_offsets) = -(double) iopty;
     ZZ(opt_offsets) = -(double) ioptz;
 
-    // From here on lock threads
-    pthread_mutex_lock(&mltomo_weightedsum_update_mutex);
-
-    // Update all global weighted sums after division by sum_refw
+    // Update all weighted sums after division by sum_refw
+    // (they are private to this thread, no locking needed)
     wsum_sigma_noise += (2 * wsum_corr / sum_refw);
     wsum_sigma_offset += (wsum_offset / sum_refw);
     sumfracweight += fracweight;
@@ -2399,8 +2446,6 @@ ProgMLTomo::expectationSingleImage(MultidimArray<double> &Mimg, int imgno,
               - ddim3 * log(sqrt(2. * PI * sigma_noise2));
     LL += dLL;
 
-    pthread_mutex_unlock(&mltomo_weightedsum_update_mutex);
-
 #ifdef DEBUG_JM
 
     std::cerr << "   DEBUG_JM: my_mindiff: " << my_mindiff << std::endl;
@@ -2447,6 +2492,7 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
 
     MultidimArray<double> Mimg0, Maux, Mref;
     MultidimArray<unsigned char> Mmissing;
+    const MultidimArray<unsigned char> *Mwedge = &Mmissing;
     MultidimArray<std::complex<double> > Faux, Fimg0, Fref;
     FourierTransformer local_transformer;
     Matrix2D<double> A_rot(4, 4), I(4, 4), A_rot_inv(4, 4);
@@ -2481,9 +2527,9 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
     if (do_missing)
     {
         // Enforce missing wedge
-        getMissingRegion(Mmissing, I, missno);
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mmissing)
-        if (!DIRECT_MULTIDIM_ELEM(Mmissing,n))
+        Mwedge = &getCachedMissingRegion(Mmissing, -1, missno);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*Mwedge)
+        if (!DIRECT_MULTIDIM_ELEM(*Mwedge,n))
             DIRECT_MULTIDIM_ELEM(Faux,n)=complex_zero;
         // BE CAREFUL: inverseFourierTransform messes up Faux!!
         Fimg0 = Faux;
@@ -2582,7 +2628,7 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
                         // Enforce wedge on the reference
                         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
                         {
-                            DIRECT_MULTIDIM_ELEM(Faux,n) *= DIRECT_MULTIDIM_ELEM(Mmissing,n);
+                            DIRECT_MULTIDIM_ELEM(Faux,n) *= DIRECT_MULTIDIM_ELEM(*Mwedge,n);
                         }
                         // BE CAREFUL! inverseFourierTransform messes up Faux
                         Fref = Faux;
@@ -2664,13 +2710,13 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
     if (do_missing)
     {
         // Store sum of wedges
-        getMissingRegion(Mmissing, A_rot, missno);
+        Mwedge = &getCachedMissingRegion(Mmissing, opt_angno, missno);
         Maux = Mimg0;
         // Again enforce missing region to avoid filling it with artifacts from the rotation
         local_transformer.FourierTransform();
         FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
         {
-            DIRECT_MULTIDIM_ELEM(Faux,n) *= DIRECT_MULTIDIM_ELEM(Mmissing,n);
+            DIRECT_MULTIDIM_ELEM(Faux,n) *= DIRECT_MULTIDIM_ELEM(*Mwedge,n);
         }
         local_transformer.inverseFourierTransform();
         Mimg0 = Maux;
@@ -2679,21 +2725,17 @@ ProgMLTomo::maxConstrainedCorrSingleImage(MultidimArray<double> &Mimg,
     // Randomly choose 0 or 1 for FSC calculation
     int iran_fsc = ROUND(rnd_unif());
 
-    // From here on lock threads to add to sums
-    pthread_mutex_lock(&mltomo_weightedsum_update_mutex);
-
+    // Add to the sums (they are private to this thread, no locking needed)
     sumCC += maxCC;
     sumw(opt_refno) += 1.;
     wsumimgs[iran_fsc * nr_ref + opt_refno] += Mimg0;
     if (do_missing)
     {
         MultidimArray<double> &wsumweds_i=wsumweds[iran_fsc * nr_ref + opt_refno];
-        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mmissing)
-        DIRECT_MULTIDIM_ELEM(wsumweds_i,n)=DIRECT_MULTIDIM_ELEM(Mmissing,n);
+        FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(*Mwedge)
+        DIRECT_MULTIDIM_ELEM(wsumweds_i,n)+=DIRECT_MULTIDIM_ELEM(*Mwedge,n);
     }
 
-    pthread_mutex_unlock(&mltomo_weightedsum_update_mutex);
-
 #ifdef DEBUG
 
     std::cerr<<"finished maxConstrainedCorrSingleImage"<<std::endl;
@@ -2856,7 +2898,11 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
     // Perturb all angles
     // (Note that each mpi process will have a different random perturbation)
     if (do_perturb)
+    {
         perturbAngularSampling();
+        // The rotated missing regions no longer match the angular sampling
+        clearMissingRegionCache();
+    }
 
     if (do_ml)
     {
@@ -2883,6 +2929,21 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
     Mzero2.setXmippOrigin();
     wsumimgs.assign(2 * nr_ref, Mzero2);
     wsumweds.assign(2 * nr_ref, Mzero);
+
+    // Thread 0 accumulates directly into the weighted sums, the other
+    // threads into private copies that are added once all of them are done.
+    // This way the threads never wait for each other to update the sums.
+    std::vector<std::vector<MultidimArray<double> > > thr_wsumimgs(threads), thr_wsumweds(threads);
+    std::vector<MultidimArray<double> > thr_sumw(threads);
+    std::vector<double> thr_LL(threads, 0.), thr_sumfracweight(threads, 0.);
+    std::vector<double> thr_wsum_sigma_noise(threads, 0.), thr_wsum_sigma_offset(threads, 0.);
+    for (int c = 1; c < threads; c++)
+    {
+        thr_wsumimgs[c] = wsumimgs;
+        thr_wsumweds[c] = wsumweds;
+        thr_sumw[c] = sumw;
+    }
+
     // Call threads to calculate the expectation of each image in the selfile
     pthread_t * th_ids = (pthread_t *) malloc(threads * sizeof(pthread_t));
     structThreadExpectationSingleImage * threads_d =
@@ -2895,14 +2956,27 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
         threads_d[c].prm = this;
         threads_d[c].MDimg = &MDimg;
         threads_d[c].iter = &iter;
-        threads_d[c].wsum_sigma_noise = &wsum_sigma_noise;
-        threads_d[c].wsum_sigma_offset = &wsum_sigma_offset;
-        threads_d[c].sumfracweight = &sumfracweight;
-        threads_d[c].LL = &LL;
-        threads_d[c].wsumimgs = &wsumimgs;
-        threads_d[c].wsumweds = &wsumweds;
         threads_d[c].Iref = &Iref;
-        threads_d[c].sumw = &sumw;
+        if (c == 0)
+        {
+            threads_d[c].wsum_sigma_noise = &wsum_sigma_noise;
+            threads_d[c].wsum_sigma_offset = &wsum_sigma_offset;
+            threads_d[c].sumfracweight = &sumfracweight;
+            threads_d[c].LL = &LL;
+            threads_d[c].wsumimgs = &wsumimgs;
+            threads_d[c].wsumweds = &wsumweds;
+            threads_d[c].sumw = &sumw;
+        }
+        else
+        {
+            threads_d[c].wsum_sigma_noise = &thr_wsum_sigma_noise[c];
+            threads_d[c].wsum_sigma_offset = &thr_wsum_sigma_offset[c];
+            threads_d[c].sumfracweight = &thr_sumfracweight[c];
+            threads_d[c].LL = &thr_LL[c];
+            threads_d[c].wsumimgs = &thr_wsumimgs[c];
+            threads_d[c].wsumweds = &thr_wsumweds[c];
+            threads_d[c].sumw = &thr_sumw[c];
+        }
         threads_d[c].imgs_id = &imgs_id;
         threads_d[c].distributor = distributor;
         pthread_create(
@@ -2913,6 +2987,20 @@ ProgMLTomo::expectation(MetaData &MDimg, std::vector<Image<double> > &Iref,
     {
         pthread_join(*(th_ids + c), NULL);
     }
+    // Reduce the private sums of the other threads
+    for (int c = 1; c < threads; c++)
+    {
+        wsum_sigma_noise += thr_wsum_sigma_noise[c];
+        wsum_sigma_offset += thr_wsum_sigma_offset[c];
+        sumfracweight += thr_sumfracweight[c];
+        LL += thr_LL[c];
+        sumw += thr_sumw[c];
+        for (int i = 0; i < 2 * nr_ref; i++)
+        {
+            wsumimgs[i] += thr_wsumimgs[c][i];
+            wsumweds[i] += thr_wsumweds[c][i];
+        }
+    }
     //Free some memory
     delete distributor;
     free(threads_d);
@@ -41,6 +41,8 @@
 #include "symmetrize.h"
 #include <core/xmipp_threads.h>
 #include <vector>
+#include <map>
+#include <mutex>
 #include <core/xmipp_program.h>
 
 #define SIGNIFICANT_WEIGHT_LOW 1e-8
@@ -202,6 +204,16 @@ public:
     int nr_miss;
     /** vector to store all missing info */
     std::vector<MissingInfo> all_missing_info;
+    /** Memory for the cache of rotated missing regions (in MB) */
+    double wedge_cache_mem;
+    /** Missing regions rotated by each angular sample, indexed by (angno, missno).
+     * Entries are only removed between expectation steps, so references to
+     * them stay valid while the threads are running */
+    std::map<std::pair<int, int>, MultidimArray<unsigned char> > wedge_cache;
+    /** Memory used by the cached missing regions (in bytes) */
+    size_t wedge_cache_bytes;
+    /** Protects wedge_cache */
+    std::mutex wedge_cache_mutex;
 
     // Angular sampling information
     struct AnglesInfo
@@ -291,6 +303,16 @@ public:
                           const Matrix2D<double> &A,
                           const int missno);
 
+    /** Missing region rotated by the angular sample angno (-1 for no rotation).
+     * The regions are kept in memory up to wedge_cache_mem MB; beyond that
+     * they are computed in Mbuffer. The result must not be modified.
+     */
+    const MultidimArray<unsigned char> &getCachedMissingRegion(MultidimArray<unsigned char> &Mbuffer,
+            const int angno, const int missno);
+
+    /// Forget the cached missing regions (e.g. after perturbing the angular sampling)
+    void clearMissingRegionCache();
+
     void maskSphericalAverageOutside(MultidimArray<double> &Min);
 
     // Resize a volume, based on the max_resol
@@ -26,9 +26,47 @@
 
 #include "reconstruction/movie_alignment_correlation.h"
 
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::readParams() {
+    AProgMovieAlignmentCorrelation<T>::readParams();
+    nThreads = this->getIntParam("--thr");
+    if (nThreads < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT,
+            "At least one thread has to be used.");
+    threadAux.clear();
+    for (int t = 0; t < nThreads; ++t) {
+        threadAux.emplace_back(new ThreadAux());
+    }
+    patchesAvg = this->getIntParam("--patchesAvg");
+    if (patchesAvg < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT,
+            "Patch averaging has to be at least one.");
+    loadBufferSize = this->getIntParam("--loadBuffer");
+    if (loadBufferSize < 1)
+        REPORT_ERROR(ERR_ARG_INCORRECT,
+            "Load buffer has to hold at least one frame.");
+    keepFrames = this->checkParam("--keepFrames");
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::show() {
+    AProgMovieAlignmentCorrelation<T>::show();
+    if (!this->verbose)
+        return;
+    std::cout << "Threads:             " << nThreads << std::endl;
+    std::cout << "Patches avg:         " << patchesAvg << std::endl;
+    std::cout << "Load buffer:         " << loadBufferSize << std::endl;
+    std::cout << "Keep frames:         " << (keepFrames ? "yes" : "no") << std::endl;
+}
+
 template<typename T>
 void ProgMovieAlignmentCorrelation<T>::defineParams() {
     AProgMovieAlignmentCorrelation<T>::defineParams();
+    this->addParamsLine("  [--thr <N=1>]                : Number of threads used for the correlations and local alignment");
+    this->addParamsLine("  [--patchesAvg <avg=3>]       : Number of near frames used for averaging a single patch");
+    this->addParamsLine("  [--loadBuffer <n=4>]         : Number of frames prefetched by the reader thread");
+    this->addParamsLine("  [--keepFrames]               : Keep the corrected frames in memory, so that they are not read");
+    this->addParamsLine("                               : again while applying the shifts");
     this->addExampleLine(
                 "xmipp_movie_alignment_correlation -i movie.xmd --oaligned alignedMovie.stk --oavg alignedMicrograph.mrc");
     this->addSeeAlsoLine("xmipp_cuda_movie_alignment_correlation");
@@ -57,93 +95,629 @@ void ProgMovieAlignmentCorrelation<T>::applyShiftsComputeAverage(
             const MetaData& movie, const Image<T>& dark, const Image<T>& igain,
             Image<T>& initialMic, size_t& Ninitial, Image<T>& averageMicrograph,
             size_t& N, const LocalAlignmentResult<T> &alignment) {
-    throw std::logic_error("Not implemented");
+    if ( ! alignment.bsplineRep) {
+        REPORT_ERROR(ERR_VALUE_INCORRECT,
+            "Missing BSpline representation. This should not happen. Please contact developers.");
+    }
+    auto start = std::chrono::steady_clock::now();
+    // frames are kept in memory since the local alignment
+    if (0 == movieRawData->nzyxdim) {
+        loadMovie(movie, this->nfirst, this->nlast, dark, igain,
+                *movieRawData);
+    }
+    MultidimArray<T> frame;
+    Image<T> reducedFrame, shiftedFrame;
+    auto binIfNeeded = [&](MultidimArray<T> &img) {
+        if (this->bin > 0) {
+            scaleToSizeFourier(1, floor(YSIZE(img) / this->bin),
+                    floor(XSIZE(img) / this->bin),
+                    img, reducedFrame());
+            img = reducedFrame();
+        }
+    };
+    int frameIndex = -1;
+    Ninitial = N = 0;
+    FOR_ALL_OBJECTS_IN_METADATA(movie)
+    {
+        frameIndex++;
+        if ((frameIndex >= this->nfirstSum) && (frameIndex <= this->nlastSum)) {
+            // user might want to align frames 3..10, but sum only 4..6
+            // by deducting the first frame that was aligned, we get proper offset to the stored memory
+            int frameOffset = frameIndex - this->nfirst;
+            frame.aliasImageInStack(*movieRawData, frameOffset);
+
+            if ( ! this->fnInitialAvg.isEmpty()) {
+                MultidimArray<T> initialFrame = frame;
+                binIfNeeded(initialFrame);
+                if (frameIndex == this->nfirstSum)
+                    initialMic() = initialFrame;
+                else
+                    initialMic() += initialFrame;
+                Ninitial++;
+            }
+
+            if (this->fnAligned != "" || this->fnAvg != "") {
+                // shifts are described in the coordinates of the original frame,
+                // so binning has to be done afterwards
+                applyLocalShifts(alignment.bsplineRep.value(), alignment.movieDim,
+                        frameOffset, frame, shiftedFrame());
+                binIfNeeded(shiftedFrame());
+                if (this->fnAligned != "")
+                    shiftedFrame.write(this->fnAligned, frameOffset + 1, true,
+                        WRITE_REPLACE);
+                if (this->fnAvg != "") {
+                    if (frameIndex == this->nfirstSum)
+                        averageMicrograph() = shiftedFrame();
+                    else
+                        averageMicrograph() += shiftedFrame();
+                    N++;
+                }
+            }
+            if (this->verbose > 1) {
+                std::cout << "Frame " << std::to_string(frameIndex) << " processed." << std::endl;
+            }
+        }
+    }
+    if (this->verbose) {
+        double t = elapsed(start);
+        std::cout << "Local shifts applied in " << t << " s ("
+                << (this->nlastSum - this->nfirstSum + 1) / t << " frames/s)"
+                << std::endl;
+        reportPeakMemory();
+    }
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::applyLocalShifts(
+        const BSplineGrid<T> &grid, const Dimensions &movieDim,
+        size_t frameIndex, const MultidimArray<T> &input,
+        MultidimArray<T> &output) {
+    using std::max;
+    using std::min;
+    MultidimArray<T> coeffs;
+    produceSplineCoefficients(this->BsplineOrder, coeffs, input);
+    output.initZeros(input);
+
+    int lX = grid.getDim().x();
+    int lY = grid.getDim().y();
+    int lN = grid.getDim().n();
+    const T *coeffsX = grid.getCoeffsX().vdata;
+    const T *coeffsY = grid.getCoeffsY().vdata;
+    // take into account end points, see BSplineHelper::getShift
+    T hX = (lX == 3) ? movieDim.x() : (movieDim.x() / (T) ((lX - 3)));
+    T hY = (lY == 3) ? movieDim.y() : (movieDim.y() / (T) ((lY - 3)));
+    T hT = (lN == 3) ? movieDim.n() : (movieDim.n() / (T) ((lN - 3)));
+    T tPos = frameIndex / hT;
+
+    // each thread processes a block of rows. Contribution of the control points
+    // in time and Y is folded into one coefficient per control point in X,
+    // so only the X BSpline has to be evaluated per pixel
+    auto processRows = [&](int firstRow, int lastRow) {
+        std::vector<T> rowCoeffsX(lX);
+        std::vector<T> rowCoeffsY(lX);
+        for (int y = firstRow; y < lastRow; ++y) {
+            std::fill(rowCoeffsX.begin(), rowCoeffsX.end(), 0);
+            std::fill(rowCoeffsY.begin(), rowCoeffsY.end(), 0);
+            T yPos = y / hY;
+            for (int idxT = max(-1, (int) (tPos) - 1);
+                    idxT <= min((int) (tPos) + 2, lN - 2); ++idxT) {
+                T tmpT = BSplineHelper::Bspline03(tPos - idxT);
+                for (int idxY = max(-1, (int) (yPos) - 1);
+                        idxY <= min((int) (yPos) + 2, lY - 2); ++idxY) {
+                    T tmpTY = tmpT * BSplineHelper::Bspline03(yPos - idxY);
+                    size_t offset = (idxT + 1) * (lX * lY) + (idxY + 1) * lX;
+                    for (int i = 0; i < lX; ++i) {
+                        rowCoeffsX[i] += tmpTY * coeffsX[offset + i];
+                        rowCoeffsY[i] += tmpTY * coeffsY[offset + i];
+                    }
+                }
+            }
+            for (int x = 0; x < (int)XSIZE(input); ++x) {
+                T xPos = x / hX;
+                T shiftX = 0;
+                T shiftY = 0;
+                for (int idxX = max(-1, (int) (xPos) - 1);
+                        idxX <= min((int) (xPos) + 2, lX - 2); ++idxX) {
+                    T tmpX = BSplineHelper::Bspline03(xPos - idxX);
+                    shiftX += rowCoeffsX[idxX + 1] * tmpX;
+                    shiftY += rowCoeffsY[idxX + 1] * tmpX;
+                }
+                DIRECT_A2D_ELEM(output, y, x) = coeffs.interpolatedElementBSpline2D(
+                        x - shiftX, y - shiftY, this->BsplineOrder);
+            }
+        }
+    };
+
+    int rows = YSIZE(input);
+    int rowsPerThread = std::ceil(rows / (T)nThreads);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; ++t) {
+        int first = t * rowsPerThread;
+        if (first < rows) {
+            threads.emplace_back(processRows, first, min(rows, first + rowsPerThread));
+        }
+    }
+    processRows(0, min(rows, rowsPerThread));
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::loadMovie(const MetaData& movie,
+        int first, int last, const Image<T>& dark, const Image<T>& igain,
+        MultidimArray<T> &out) {
+    Image<T> frame;
+    int movieImgIndex = -1;
+    out.clear();
+    FOR_ALL_OBJECTS_IN_METADATA(movie)
+    {
+        // update variables
+        movieImgIndex++;
+        if (movieImgIndex < first) continue;
+        if (movieImgIndex > last) break;
+
+        // load image
+        this->loadFrame(movie, dark, igain, __iter.objId, frame);
+
+        if (0 == out.nzyxdim) {
+            out.resizeNoCopy(last - first + 1, 1,
+                    YSIZE(frame()), XSIZE(frame()));
+        }
+        // copy all frames to memory, consecutively
+        memcpy(MULTIDIM_ARRAY(out)
+                + ((movieImgIndex - first) * out.yxdim),
+                MULTIDIM_ARRAY(frame()), out.yxdim * sizeof(T));
+    }
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::prefetchMovie(const MetaData &movie,
+        int first, int last, const Image<T> &dark, const Image<T> &igain) {
+    // the rest of frames go through the ring buffer when the movie is
+    // processed, so that two whole movies are never in memory
+    last = std::min(last, first + loadBufferSize - 1);
+    loadMovie(movie, first, last, dark, igain, *prefetchedFrames);
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::usePrefetchedMovie() {
+    std::swap(firstFrames, prefetchedFrames);
+    prefetchedFrames->clear();
+}
+
+template<typename T>
+Dimensions ProgMovieAlignmentCorrelation<T>::getPatchDim(
+        const Dimensions &movie, const std::pair<T, T> &borders) {
+    // this should be a trade-off between speed and present signal,
+    // the same as on GPU
+    const size_t maxSize = 512;
+    auto getSize = [&](size_t movieSize, T border) {
+        size_t window = movieSize - 2 * (size_t)border;
+        return (std::min(maxSize, window) / 2) * 2;
+    };
+    return Dimensions(getSize(movie.x(), borders.first),
+            getSize(movie.y(), borders.second), 1, movie.n());
+}
+
+template<typename T>
+T ProgMovieAlignmentCorrelation<T>::getLocalAlignmentCorrelationDownscale(
+        const Dimensions &patchDim) {
+    // correlation has to be big enough to contain the max shift
+    T minScale = ((this->maxShift * 2) + 1)
+            / (T)std::min(patchDim.x(), patchDim.y());
+    return std::min((T)1, std::max(minScale, sizeFactor));
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::getPatchData(
+        const Rectangle<Point2D<T>> &patch,
+        const AlignmentResult<T> &globAlignment,
+        MultidimArray<T> &result) {
+    size_t n = NSIZE(*movieRawData);
+    size_t xdim = XSIZE(*movieRawData);
+    auto patchSize = patch.getSize();
+    result.initZeros(n, 1, patchSize.y, patchSize.x);
+    const T *allFrames = MULTIDIM_ARRAY(*movieRawData);
+    T *dest = MULTIDIM_ARRAY(result);
+    auto copyPatchData = [&](size_t srcFrameIdx, size_t t) {
+        size_t frameOffset = srcFrameIdx * movieRawData->yxdim;
+        size_t patchOffset = t * result.yxdim;
+        // keep the shift consistent while adding local shift
+        int xShift = std::round(globAlignment.shifts.at(srcFrameIdx).x);
+        int yShift = std::round(globAlignment.shifts.at(srcFrameIdx).y);
+        for (size_t y = 0; y < patchSize.y; ++y) {
+            size_t srcY = patch.tl.y + y;
+            if (yShift < 0) {
+                srcY -= (size_t)std::abs(yShift); // assuming shift is smaller than offset
+            } else {
+                srcY += yShift;
+            }
+            size_t srcIndex = frameOffset + (srcY * xdim) + (size_t)patch.tl.x;
+            if (xShift < 0) {
+                srcIndex -= (size_t)std::abs(xShift);
+            } else {
+                srcIndex += xShift;
+            }
+            size_t destIndex = patchOffset + y * patchSize.x;
+            for (size_t x = 0; x < patchSize.x; ++x) {
+                dest[destIndex + x] += allFrames[srcIndex + x];
+            }
+        }
+    };
+    for (size_t t = 0; t < n; ++t) {
+        // copy the data from specific frame
+        copyPatchData(t, t);
+        // add data from frames with lower indices
+        // while averaging odd num of frames, use copy equally from previous and following frames
+        // otherwise prefer following frames
+        for (int b = 1; b <= ((patchesAvg - 1) / 2); ++b) {
+            if (t >= b) {
+                copyPatchData(t - b, t);
+            }
+        }
+        // add data from frames with higher indices
+        for (int f = 1; f <= (patchesAvg / 2); ++f) {
+            if ((t + f) < n) {
+                copyPatchData(t + f, t);
+            }
+        }
+    }
+}
+
+template<typename T>
+AlignmentResult<T> ProgMovieAlignmentCorrelation<T>::alignPatch(
+        MultidimArray<T> &patchData, const MultidimArray<T> &filter,
+        int corrXdim, int corrYdim, const core::optional<size_t> &refFrame,
+        FourierTransformer &transformer, CorrelationAux &aux) {
+    size_t N = NSIZE(patchData);
+    T scale = XSIZE(patchData) / (T)corrXdim;
+    // downscale, transform and filter each frame of the patch
+    std::vector<MultidimArray<std::complex<T> > > patchFourier(N);
+    MultidimArray<T> frame, reducedFrame;
+    for (size_t n = 0; n < N; ++n) {
+        frame.aliasImageInStack(patchData, n);
+        scaleToSizeFourier(1, corrYdim, corrXdim, frame, reducedFrame);
+        transformer.FourierTransform(reducedFrame, patchFourier[n], true);
+        for (size_t nn = 0; nn < filter.nzyxdim; ++nn) {
+            DIRECT_MULTIDIM_ELEM(patchFourier[n], nn) *=
+                    DIRECT_MULTIDIM_ELEM(filter, nn);
+        }
+    }
+
+    // correlate each frame with following ones
+    Matrix2D<T> A(N * (N - 1) / 2, N - 1);
+    Matrix1D<T> bX(N * (N - 1) / 2), bY(N * (N - 1) / 2);
+    MultidimArray<T> Mcorr;
+    Mcorr.resizeNoCopy(corrYdim, corrXdim);
+    Mcorr.setXmippOrigin();
+    size_t idx = 0;
+    for (size_t i = 0; i < N - 1; ++i) {
+        for (size_t j = i + 1; j < N; ++j) {
+            bestShift(patchFourier[i], patchFourier[j], Mcorr, bX(idx),
+                    bY(idx), aux, NULL, this->maxShift / scale);
+            bX(idx) *= scale; // scale to expected size
+            bY(idx) *= scale;
+            for (int ij = i; ij < j; ij++)
+                A(idx, ij) = 1;
+            idx++;
+        }
+    }
+    return this->computeAlignment(bX, bY, A, refFrame, N, 0);
 }
 
 template<typename T>
 LocalAlignmentResult<T> ProgMovieAlignmentCorrelation<T>::computeLocalAlignment(
         const MetaData &movie, const Image<T> &dark, const Image<T> &igain,
         const AlignmentResult<T> &globAlignment) {
-    throw std::logic_error("Not implemented");
+    auto start = std::chrono::steady_clock::now();
+    // load movie to memory, it will be reused while applying the shifts
+    if (0 == movieRawData->nzyxdim) {
+        loadMovie(movie, this->nfirst, this->nlast, dark, igain,
+                *movieRawData);
+    }
+    double loadTime = elapsed(start);
+
+    auto stageStart = std::chrono::steady_clock::now();
+    sizeFactor = this->computeSizeFactor();
+    Dimensions movieDim(XSIZE(*movieRawData), YSIZE(*movieRawData), 1,
+            NSIZE(*movieRawData));
+    auto borders = this->getMovieBorders(globAlignment, this->verbose > 1);
+    Dimensions patchDim = getPatchDim(movieDim, borders);
+    auto patchesLocation = this->getPatchesLocation(borders, movieDim,
+            patchDim);
+    T downscale = getLocalAlignmentCorrelationDownscale(patchDim);
+    int corrXdim = ((int)(patchDim.x() * downscale) / 2) * 2;
+    int corrYdim = ((int)(patchDim.y() * downscale) / 2) * 2;
+    if (this->verbose > 1) {
+        std::cout << "Settings for the patches: " << patchDim << std::endl;
+        std::cout << "Settings for the correlations: " << corrXdim << " * "
+                << corrYdim << std::endl;
+    }
+    MultidimArray<T> filter = this->createLPF(this->getTargetOccupancy(),
+            corrXdim, corrYdim);
+    auto refFrame = core::optional<size_t>(globAlignment.refFrame);
+
+    // process patches in parallel, each thread has its own FFT plans and buffers
+    std::vector<AlignmentResult<T>> patchAlignments(patchesLocation.size());
+    std::atomic<size_t> nextPatch(0);
+    auto worker = [&](int thread) {
+        MultidimArray<T> patchData;
+        ThreadAux &aux = *threadAux.at(thread);
+        size_t p;
+        while ((p = nextPatch++) < patchesLocation.size()) {
+            getPatchData(patchesLocation.at(p).rec, globAlignment, patchData);
+            patchAlignments.at(p) = alignPatch(patchData, filter, corrXdim,
+                    corrYdim, refFrame, aux.patchTransformer,
+                    aux.patchCorrelation);
+            if (this->verbose > 1) {
+                std::cout << "Patch " << patchesLocation.at(p).id_x << " "
+                        << patchesLocation.at(p).id_y << " processed" << std::endl;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto &t : threads) {
+        t.join();
+    }
+    double alignTime = elapsed(stageStart);
+
+    // prepare result
+    stageStart = std::chrono::steady_clock::now();
+    LocalAlignmentResult<T> result { globalHint:globAlignment, movieDim:movieDim };
+    result.shifts.reserve(patchesLocation.size() * movieDim.n());
+    for (size_t p = 0; p < patchesLocation.size(); ++p) {
+        for (size_t i = 0; i < movieDim.n(); ++i) {
+            FramePatchMeta<T> tmp = patchesLocation.at(p);
+            // keep consistent with data loading
+            int globShiftX = std::round(globAlignment.shifts.at(i).x);
+            int globShiftY = std::round(globAlignment.shifts.at(i).y);
+            tmp.id_t = i;
+            // total shift is global shift + local shift
+            result.shifts.emplace_back(tmp, Point2D<T>(globShiftX, globShiftY)
+                    + patchAlignments.at(p).shifts.at(i));
+        }
+    }
+
+    auto coeffs = BSplineHelper::computeBSplineCoeffs(movieDim, result,
+            this->localAlignmentControlPoints, this->localAlignPatches,
+            this->verbose, this->solverIterations);
+    result.bsplineRep = core::optional<BSplineGrid<T>>(
+            BSplineGrid<T>(this->localAlignmentControlPoints, coeffs.first, coeffs.second));
+    double fitTime = elapsed(stageStart);
+
+    if (this->verbose) {
+        double total = elapsed(start);
+        std::cout << "Local alignment timing (" << nThreads << " threads):\n"
+                << "  loading:         " << loadTime << " s\n"
+                << "  patch alignment: " << alignTime << " s ("
+                << patchesLocation.size() << " patches)\n"
+                << "  BSpline fit:     " << fitTime << " s\n"
+                << "  total:           " << total << " s ("
+                << movieDim.n() / total << " frames/s)" << std::endl;
+    }
+    return result;
 }
 
 template<typename T>
 void ProgMovieAlignmentCorrelation<T>::loadData(const MetaData& movie,
         const Image<T>& dark, const Image<T>& igain) {
     sizeFactor = this->computeSizeFactor();
-    MultidimArray<T> filter;
-    FourierTransformer transformer;
-    bool firstImage = true;
+    size_t N = this->nlast - this->nfirst + 1;
+    std::vector<size_t> ids;
     int n = -1;
-    FileName fnFrame;
-    Image<T> croppedFrame, reducedFrame;
+    FOR_ALL_OBJECTS_IN_METADATA(movie)
+    {
+        ++n;
+        if (n >= this->nfirst && n <= this->nlast)
+            ids.push_back(__iter.objId);
+    }
 
     if (this->verbose) {
         std::cout << "Computing Fourier transform of frames ..." << std::endl;
-        init_progress_bar(movie.size());
+        init_progress_bar(N);
     }
 
-    FOR_ALL_OBJECTS_IN_METADATA(movie)
-    {
-        ++n;
-        if (n >= this->nfirst && n <= this->nlast) {
-            this->loadFrame(movie, dark, igain, __iter.objId, croppedFrame);
+    // Frames travel from the reader thread to the workers through a ring
+    // buffer of fixed size, so only 'loadBufferSize' raw frames are in memory
+    typedef std::pair<size_t, Image<T>*> LoadedFrame;
+    std::vector<Image<T>> ring(loadBufferSize);
+    BoundedQueue<Image<T>*> freeSlots(loadBufferSize);
+    BoundedQueue<LoadedFrame> loadedFrames(loadBufferSize);
 
-            if (firstImage) {
-                firstImage = false;
-                newXdim = croppedFrame().xdim * sizeFactor;
-                newYdim = croppedFrame().ydim * sizeFactor;
-                filter = this->createLPF(this->getTargetOccupancy(), newXdim,
-                    newYdim);
+    // frames might have been already loaded, all of them or only the first
+    // ones (prefetched in batch mode)
+    const bool preloaded = 0 != movieRawData->nzyxdim;
+    const size_t prefetched = (0 == firstFrames->nzyxdim) ? 0 : NSIZE(*firstFrames);
+    auto readFrame = [&](size_t k, Image<T> &frame) {
+        if (preloaded) {
+            MultidimArray<T> keptFrame;
+            keptFrame.aliasImageInStack(*movieRawData, k);
+            frame() = keptFrame;
+            return;
+        }
+        if (k < prefetched) {
+            MultidimArray<T> keptFrame;
+            keptFrame.aliasImageInStack(*firstFrames, k);
+            frame() = keptFrame;
+        } else {
+            this->loadFrame(movie, dark, igain, ids.at(k), frame);
+        }
+        if (keepFrames) {
+            if (0 == k) {
+                // first frame is read before the reader thread starts
+                movieRawData->resizeNoCopy(N, 1, YSIZE(frame()), XSIZE(frame()));
             }
+            memcpy(MULTIDIM_ARRAY(*movieRawData) + (k * movieRawData->yxdim),
+                    MULTIDIM_ARRAY(frame()), movieRawData->yxdim * sizeof(T));
+        }
+    };
 
-            // Reduce the size of the input frame
-            scaleToSizeFourier(1, newYdim, newXdim, croppedFrame(),
-                    reducedFrame());
+    // first frame determines the sizes of everything else
+    readFrame(0, ring.at(0));
+    newXdim = XSIZE(ring.at(0)()) * sizeFactor;
+    newYdim = YSIZE(ring.at(0)()) * sizeFactor;
+    MultidimArray<T> filter = this->createLPF(this->getTargetOccupancy(),
+            newXdim, newYdim);
+    loadedFrames.push(LoadedFrame(0, &ring.at(0)));
+    for (size_t i = 1; i < ring.size(); ++i) {
+        freeSlots.push(&ring.at(i));
+    }
 
-            // Now do the Fourier transform and filter
-            MultidimArray<std::complex<T> > *reducedFrameFourier =
-                    new MultidimArray<std::complex<T> >;
-            transformer.FourierTransform(reducedFrame(), *reducedFrameFourier,
-                    true);
-            for (size_t nn = 0; nn < filter.nzyxdim; ++nn) {
-                T wlpf = DIRECT_MULTIDIM_ELEM(filter, nn);
-                DIRECT_MULTIDIM_ELEM(*reducedFrameFourier,nn) *= wlpf;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto fail = [&]() {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if ( ! error)
+            error = std::current_exception();
+        freeSlots.close();
+        loadedFrames.close();
+    };
+
+    std::thread reader([&]() {
+        try {
+            for (size_t k = 1; k < N; ++k) {
+                Image<T> *slot;
+                if ( ! freeSlots.pop(slot))
+                    break;
+                readFrame(k, *slot);
+                if ( ! loadedFrames.push(LoadedFrame(k, slot)))
+                    break;
             }
-            frameFourier.push_back(reducedFrameFourier);
+        } catch (...) {
+            fail();
         }
-        if (this->verbose)
-            progress_bar(n);
+        loadedFrames.close();
+    });
+
+    // workers reduce, transform and filter the frames
+    frameFourier.clear();
+    frameFourier.resize(N);
+    std::atomic<size_t> processed(0);
+    auto worker = [&](int thread) {
+        try {
+            FourierTransformer &transformer = threadAux.at(thread)->frameTransformer;
+            MultidimArray<T> reducedFrame;
+            LoadedFrame f;
+            while (loadedFrames.pop(f)) {
+                // Reduce the size of the input frame
+                scaleToSizeFourier(1, newYdim, newXdim, (*f.second)(),
+                        reducedFrame);
+                // the slot can be reused by the reader
+                freeSlots.push(f.second);
+                // Now do the Fourier transform and filter
+                MultidimArray<std::complex<T> > &reducedFrameFourier =
+                        frameFourier.at(f.first);
+                transformer.FourierTransform(reducedFrame, reducedFrameFourier,
+                        true);
+                for (size_t nn = 0; nn < filter.nzyxdim; ++nn) {
+                    T wlpf = DIRECT_MULTIDIM_ELEM(filter, nn);
+                    DIRECT_MULTIDIM_ELEM(reducedFrameFourier,nn) *= wlpf;
+                }
+                size_t done = ++processed;
+                if ((0 == thread) && this->verbose)
+                    progress_bar(done);
+            }
+        } catch (...) {
+            fail();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < nThreads; ++t) {
+        workers.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto &t : workers) {
+        t.join();
     }
+    reader.join();
+    firstFrames->clear();
+    if (error)
+        std::rethrow_exception(error);
     if (this->verbose)
-        progress_bar(movie.size());
+        progress_bar(N);
+
+    if (this->verbose) {
+        const T MB = 1024 * 1024;
+        std::cout << "Frame buffer:        "
+                << ring.size() * ring.at(0)().yxdim * sizeof(T) / MB << " MB"
+                << std::endl
+                << "Fourier transforms:  "
+                << N * frameFourier.at(0).yxdim * sizeof(std::complex<T>) / MB
+                << " MB" << std::endl
+                << "Kept frames:         "
+                << movieRawData->nzyxdim * sizeof(T) / MB << " MB" << std::endl;
+        reportPeakMemory();
+    }
+}
+
+template<typename T>
+void ProgMovieAlignmentCorrelation<T>::reportPeakMemory() {
+    struct rusage usage;
+    if (0 != getrusage(RUSAGE_SELF, &usage))
+        return;
+#ifdef __APPLE__
+    size_t peakKB = usage.ru_maxrss / 1024; // reported in bytes
+#else
+    size_t peakKB = usage.ru_maxrss; // reported in kilobytes
+#endif
+    std::cout << "Peak memory:         " << peakKB / 1024 << " MB" << std::endl;
 }
 
 template<typename T>
 void ProgMovieAlignmentCorrelation<T>::computeShifts(size_t N,
         const Matrix1D<T>& bX, const Matrix1D<T>& bY, const Matrix2D<T>& A) {
-    int idx = 0;
     assert(frameFourier.size() > 0);
-    MultidimArray<T> Mcorr;
-    Mcorr.resizeNoCopy(newYdim, newXdim);
-    Mcorr.setXmippOrigin();
-    CorrelationAux aux;
+    // list all pairs, so that the result of each pair is stored
+    // at the same position regardless of the thread that computed it
+    std::vector<std::pair<size_t, size_t>> pairs;
+    pairs.reserve(N * (N - 1) / 2);
     for (size_t i = 0; i < N - 1; ++i) {
         for (size_t j = i + 1; j < N; ++j) {
-            bestShift(*frameFourier[i], *frameFourier[j], Mcorr, bX(idx),
+            pairs.emplace_back(i, j);
+        }
+    }
+    // pairs are assigned dynamically, each thread has its own
+    // correlation buffer and FFT plans (kept between movies)
+    std::atomic<size_t> nextPair(0);
+    auto worker = [&](int thread) {
+        MultidimArray<T> Mcorr;
+        Mcorr.resizeNoCopy(newYdim, newXdim);
+        Mcorr.setXmippOrigin();
+        CorrelationAux &aux = threadAux.at(thread)->frameCorrelation;
+        size_t idx;
+        while ((idx = nextPair++) < pairs.size()) {
+            size_t i = pairs[idx].first;
+            size_t j = pairs[idx].second;
+            bestShift(frameFourier[i], frameFourier[j], Mcorr, bX(idx),
                     bY(idx), aux, NULL, this->maxShift * sizeFactor);
             bX(idx) /= sizeFactor; // scale to expected size
             bY(idx) /= sizeFactor;
-            if (this->verbose)
-                std::cerr << "Frame " << i + this->nfirst << " to Frame "
-                        << j + this->nfirst << " -> ("
-                        << bX(idx) << ","
-                        << bY(idx) << ")\n";
-            for (int ij = i; ij < j; ij++)
-                A(idx, ij) = 1;
-
-            idx++;
         }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (size_t idx = 0; idx < pairs.size(); ++idx) {
+        size_t i = pairs[idx].first;
+        size_t j = pairs[idx].second;
+        if (this->verbose)
+            std::cerr << "Frame " << i + this->nfirst << " to Frame "
+                    << j + this->nfirst << " -> ("
+                    << bX(idx) << ","
+                    << bY(idx) << ")\n";
+        for (int ij = i; ij < j; ij++)
+            A(idx, ij) = 1;
     }
 }
 
@@ -170,7 +744,13 @@ void ProgMovieAlignmentCorrelation<T>::applyShiftsComputeAverage(
             YY(shift) = -globAlignment.shifts.at(frameOffset).y; // the shift
 
             // load frame
-            this->loadFrame(movie, dark, igain, __iter.objId, croppedFrame);
+            if (0 != movieRawData->nzyxdim) {
+                MultidimArray<T> keptFrame;
+                keptFrame.aliasImageInStack(*movieRawData, frameOffset);
+                croppedFrame() = keptFrame;
+            } else {
+                this->loadFrame(movie, dark, igain, __iter.objId, croppedFrame);
+            }
             if (this->bin > 0) {
                 scaleToSizeFourier(1, floor(YSIZE(croppedFrame()) / this->bin),
                         floor(XSIZE(croppedFrame()) / this->bin),
@@ -214,6 +794,8 @@ void ProgMovieAlignmentCorrelation<T>::applyShiftsComputeAverage(
             }
         }
     }
+    if (this->verbose)
+        reportPeakMemory();
 }
 
 template class ProgMovieAlignmentCorrelation<double> ;
@@ -27,20 +27,36 @@
 #ifndef _PROG_MOVIE_ALIGNMENT_CORRELATION
 #define _PROG_MOVIE_ALIGNMENT_CORRELATION
 
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <sys/resource.h>
 #include "data/filters.h"
 #include "core/xmipp_fftw.h"
 #include "reconstruction/movie_alignment_correlation_base.h"
+#include "data/bounded_queue.h"
 
 /** Movie alignment correlation Parameters. */
 template<typename T>
 class ProgMovieAlignmentCorrelation: public AProgMovieAlignmentCorrelation<T> {
 public:
+    /// Read argument from command line
+    void readParams();
+
+    /// Show
+    void show();
+
     /// Define parameters
     void defineParams();
 private:
     /**
      * After running this method, all relevant images from the movie are
-     * loaded in 'frameFourier' and ready for further processing
+     * loaded in 'frameFourier' and ready for further processing.
+     * Frames are read by a separate thread to a ring buffer of
+     * 'loadBufferSize' frames and processed by 'nThreads' workers.
+     * If requested, corrected frames are also kept in 'movieRawData'.
      * @param movie input
      * @param dark correction to be used
      * @param igain correction to be used
@@ -50,7 +66,8 @@ private:
 
     /**
      * Computes shifts of all images in the 'frameFourier'
-     * Method uses one thread to calculate correlations.
+     * Pairs of frames are distributed dynamically among 'nThreads' threads,
+     * result does not depend on the number of threads.
      * @param N number of images to process
      * @param bX pair-wise shifts in X dimension
      * @param bY pair-wise shifts in Y dimension
@@ -86,10 +103,9 @@ private:
      * Inherited, see parent
      */
     void releaseAll() {
-        for (auto f : frameFourier) {
-            delete f;
-        }
         frameFourier.clear();
+        movieRawData->clear();
+        firstFrames->clear();
     };
 
     /**
@@ -98,12 +114,104 @@ private:
     LocalAlignmentResult<T> computeLocalAlignment(const MetaData &movie,
             const Image<T> &dark, const Image<T> &igain,
             const AlignmentResult<T> &globAlignment);
+
+    /**
+     * Loads frames (after gain and dark correction) to memory
+     * @param movie to load
+     * @param first frame to load
+     * @param last frame to load (inclusive)
+     * @param dark pixel correction
+     * @param igain correction
+     * @param out where frames are stored, one frame per image
+     */
+    void loadMovie(const MetaData& movie, int first, int last,
+            const Image<T>& dark, const Image<T>& igain,
+            MultidimArray<T> &out);
+
+    /**
+     * Inherited, see parent
+     */
+    void prefetchMovie(const MetaData &movie, int first, int last,
+            const Image<T> &dark, const Image<T> &igain);
+
+    /**
+     * Inherited, see parent
+     */
+    void usePrefetchedMovie();
+
+    /**
+     * Returns size of the patches used for local alignment
+     * @param movie size
+     * @param borders that should be left intact
+     */
+    Dimensions getPatchDim(const Dimensions &movie,
+            const std::pair<T, T> &borders);
+
+    /**
+     * Method returns requested downscale (<=1) for the correlations used
+     * for local alignment
+     * @param patchDim size of the patch
+     */
+    T getLocalAlignmentCorrelationDownscale(const Dimensions &patchDim);
+
+    /**
+     * Method returns a 'window'/'view' of each and all frames, aligned (to int positions)
+     * using global alignment. Each frame is averaged with 'patchesAvg' near frames
+     * @param patch defining the portion of each frame to load
+     * @param globAlignment to compensate
+     * @param result where data are stored, one patch per image of the stack
+     */
+    void getPatchData(const Rectangle<Point2D<T>> &patch,
+            const AlignmentResult<T> &globAlignment,
+            MultidimArray<T> &result);
+
+    /**
+     * Method computes alignment of the single patch (all frames)
+     * @param patchData where data (in spacial domain) are stored, one frame per image
+     * @param filter to be applied to each correlation
+     * @param corrXdim size of the correlation
+     * @param corrYdim size of the correlation
+     * @param refFrame reference frame
+     * @param transformer to be used for FFT
+     * @param aux for the correlation
+     * @return alignment of the patch
+     */
+    AlignmentResult<T> alignPatch(MultidimArray<T> &patchData,
+            const MultidimArray<T> &filter, int corrXdim, int corrYdim,
+            const core::optional<size_t> &refFrame,
+            FourierTransformer &transformer, CorrelationAux &aux);
+
+    /**
+     * Method applies local shifts to the single frame, using BSpline
+     * representation of the shifts
+     * @param grid BSpline representation of the shifts
+     * @param movieDim size of the movie
+     * @param frameIndex index of the frame in the movie
+     * @param input frame
+     * @param output shifted frame
+     */
+    void applyLocalShifts(const BSplineGrid<T> &grid, const Dimensions &movieDim,
+            size_t frameIndex, const MultidimArray<T> &input,
+            MultidimArray<T> &output);
+
+    /**
+     * Prints peak resident memory of the process to standard output
+     */
+    void reportPeakMemory();
+
+    /**
+     * Seconds elapsed since given time
+     */
+    static double elapsed(const std::chrono::steady_clock::time_point &start) {
+        return std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+    }
 private:
     /**
      *  Fourier transforms of the input images, after cropping, gain and dark
      *  correction
      */
-    std::vector<MultidimArray<std::complex<T> > *> frameFourier;
+    std::vector<MultidimArray<std::complex<T> > > frameFourier;
 
     /** Sizes of the correlation */
     int newXdim;
@@ -111,6 +219,40 @@ private:
 
     /** Scale factor of the correlation and original frame size */
     T sizeFactor;
+
+    /** Number of threads */
+    int nThreads;
+
+    /** No of frames used for averaging a single patch */
+    int patchesAvg;
+
+    /** No of frames in the ring buffer used while loading the movie */
+    int loadBufferSize;
+
+    /** Keep corrected frames in memory after loading */
+    bool keepFrames;
+
+    /** Frames of the movie (after gain and dark correction), one per image */
+    std::unique_ptr<MultidimArray<T>> movieRawData =
+            std::unique_ptr<MultidimArray<T>>(new MultidimArray<T>());
+
+    /** First frames of the next movie (in batch mode), loaded in the
+     * background. At most 'loadBufferSize' frames, as the ring buffer */
+    std::unique_ptr<MultidimArray<T>> prefetchedFrames =
+            std::unique_ptr<MultidimArray<T>>(new MultidimArray<T>());
+
+    /** First frames of the current movie, taken from prefetchedFrames */
+    std::unique_ptr<MultidimArray<T>> firstFrames =
+            std::unique_ptr<MultidimArray<T>>(new MultidimArray<T>());
+
+    /** FFT plans and buffers of each thread, kept between movies */
+    struct ThreadAux {
+        FourierTransformer frameTransformer;
+        FourierTransformer patchTransformer;
+        CorrelationAux frameCorrelation;
+        CorrelationAux patchCorrelation;
+    };
+    std::vector<std::unique_ptr<ThreadAux>> threadAux;
 };
 
 #endif
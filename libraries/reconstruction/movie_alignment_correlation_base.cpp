@@ -51,6 +51,8 @@ void AProgMovieAlignmentCorrelation<T>::readParams() {
     bin = getDoubleParam("--bin");
     BsplineOrder = getIntParam("--Bspline");
     processLocalShifts = checkParam("--processLocalShifts");
+    if (checkParam("--batch"))
+        fnBatchDir = getParam("--batch");
 
     String outside = getParam("--outside");
     if (outside == "wrap")
@@ -118,6 +120,8 @@ void AProgMovieAlignmentCorrelation<T>::show() {
             << "Local shift correction: " << (processLocalShifts ? "yes" : "no") << std::endl
             << "Control points:      " << this->localAlignmentControlPoints << std::endl
             << "Patches:             " << this->localAlignPatches.first << " x " << this->localAlignPatches.second << std::endl;
+    if ( ! fnBatchDir.isEmpty())
+        std::cout << "Batch output dir:    " << fnBatchDir << std::endl;
 }
 
 template<typename T>
@@ -181,7 +185,19 @@ void AProgMovieAlignmentCorrelation<T>::defineParams() {
             "  [--controlPoints <x=6> <y=6> <t=5>]: Number of control points (including end points) used for defining the BSpline");
     addParamsLine(
             "  [--patches <x=10> <y=10>]    : Number of patches to use for local alignment estimation");
+    addParamsLine(
+            "  [--batch <odir=\".\">]      : Input metadata is a list of movies (label image), all of them are aligned");
+    addParamsLine(
+            "                               :+Gain and dark images, filters and FFT plans are kept in memory, and");
+    addParamsLine(
+            "                               :+the next movie is loaded while the current one is aligned.");
+    addParamsLine(
+            "                               :+Output filenames (-o, --oavg, ...) are appended to the name of each movie");
+    addParamsLine(
+            "                               :+and stored in odir.");
     addExampleLine("A typical example", false);
+    addExampleLine(
+            "xmipp_movie_alignment_correlation -i movies.xmd --batch alignedDir -o _shifts.xmd --oavg _aligned.mrc");
     addSeeAlsoLine("xmipp_movie_optical_alignment_cpu");
 }
 
@@ -241,6 +257,12 @@ template<typename T>
 MultidimArray<T> AProgMovieAlignmentCorrelation<T>::createLPF(T targetOccupancy,
         size_t xSize,
         size_t ySize) {
+    // movies of the batch usually share the sizes, so reuse the last filter
+    auto key = std::make_tuple(targetOccupancy, xSize, ySize);
+    auto it = lpfCache.find(key);
+    if (lpfCache.end() != it)
+        return it->second;
+
     // Construct 1D profile of the lowpass filter
     MultidimArray<T> lpf(xSize);
     constructLPF(targetOccupancy, lpf);
@@ -249,6 +271,7 @@ MultidimArray<T> AProgMovieAlignmentCorrelation<T>::createLPF(T targetOccupancy,
     result.initZeros(ySize, (xSize / 2) + 1);
 
     scaleLPF(lpf, xSize, ySize, targetOccupancy, result);
+    lpfCache[key] = result;
     return result;
 }
 
@@ -293,6 +316,59 @@ int AProgMovieAlignmentCorrelation<T>::findReferenceImage(size_t N,
     return bestIref;
 }
 
+template<typename T>
+std::vector<FramePatchMeta<T>> AProgMovieAlignmentCorrelation<T>::getPatchesLocation(
+        const std::pair<T, T> &borders,
+        const Dimensions &movie, const Dimensions &patch) {
+    size_t patchesX = this->localAlignPatches.first;
+    size_t patchesY = this->localAlignPatches.second;
+    T windowXSize = movie.x() - 2 * borders.first;
+    T windowYSize = movie.y() - 2 * borders.second;
+    T corrX = std::ceil(
+            ((patchesX * patch.x()) - windowXSize) / (T) (patchesX - 1));
+    T corrY = std::ceil(
+            ((patchesY * patch.y()) - windowYSize) / (T) (patchesY - 1));
+    T stepX = (T)patch.x() - corrX;
+    T stepY = (T)patch.y() - corrY;
+    std::vector<FramePatchMeta<T>> result;
+    for (size_t y = 0; y < patchesY; ++y) {
+        for (size_t x = 0; x < patchesX; ++x) {
+            T tlx = borders.first + x * stepX; // Top Left
+            T tly = borders.second + y * stepY;
+            T brx = tlx + patch.x() - 1; // Bottom Right
+            T bry = tly + patch.y() - 1; // -1 for indexing
+            Point2D<T> tl(tlx, tly);
+            Point2D<T> br(brx, bry);
+            Rectangle<Point2D<T>> r(tl, br);
+            result.emplace_back(
+                    FramePatchMeta<T> { .rec = r, .id_x = x, .id_y =
+                    y });
+        }
+    }
+    return result;
+}
+
+template<typename T>
+std::pair<T,T> AProgMovieAlignmentCorrelation<T>::getMovieBorders(
+        const AlignmentResult<T> &globAlignment, int verbose) {
+    T minX = std::numeric_limits<T>::max();
+    T maxX = std::numeric_limits<T>::min();
+    T minY = std::numeric_limits<T>::max();
+    T maxY = std::numeric_limits<T>::min();
+    for (const auto& s : globAlignment.shifts) {
+        minX = std::min(std::floor(s.x), minX);
+        maxX = std::max(std::ceil(s.x), maxX);
+        minY = std::min(std::floor(s.y), minY);
+        maxY = std::max(std::ceil(s.y), maxY);
+    }
+    auto res = std::make_pair(std::abs(maxX - minX), std::abs(maxY - minY));
+    if (verbose > 1) {
+        std::cout << "Movie borders: x=" << res.first << " y=" << res.second
+                << std::endl;
+    }
+    return res;
+}
+
 template<typename T>
 void AProgMovieAlignmentCorrelation<T>::loadDarkCorrection(Image<T>& dark) {
     if (fnDark.isEmpty())
@@ -364,7 +440,8 @@ T AProgMovieAlignmentCorrelation<T>::computeSizeFactor() {
 }
 
 template<typename T>
-void AProgMovieAlignmentCorrelation<T>::readMovie(MetaData& movie) {
+void AProgMovieAlignmentCorrelation<T>::readMovie(const FileName &fnMovie,
+        MetaData& movie) {
     //if input is an stack create a metadata.
     if (fnMovie.isMetaData())
         movie.read(fnMovie);
@@ -487,13 +564,18 @@ void AProgMovieAlignmentCorrelation<T>::storeResults(Image<T>& initialMic,
 template<typename T>
 void AProgMovieAlignmentCorrelation<T>::correctLoopIndices(
         const MetaData& movie) {
+    const int lastFrame = movie.size() - 1;
     nfirst = std::max(nfirst, 0);
     nfirstSum = std::max(nfirstSum, 0);
     if (nlast < 0)
-        nlast = movie.size() - 1;
+        nlast = lastFrame;
+    else
+        nlast = std::min(nlast, lastFrame);
 
     if (nlastSum < 0)
-        nlastSum = movie.size() - 1;
+        nlastSum = lastFrame;
+    else
+        nlastSum = std::min(nlastSum, lastFrame);
 }
 
 template<typename T>
@@ -563,18 +645,10 @@ void AProgMovieAlignmentCorrelation<T>::storeResults(
 }
 
 template<typename T>
-void AProgMovieAlignmentCorrelation<T>::run() {
-    show();
-    if ( ! checkSettings()) return;
-    // preprocess input data
-    MetaData movie;
-    readMovie(movie);
+void AProgMovieAlignmentCorrelation<T>::processMovie(MetaData &movie,
+        const Image<T> &dark, const Image<T> &igain) {
     correctLoopIndices(movie);
 
-    Image<T> dark, igain;
-    loadDarkCorrection(dark);
-    loadGainCorrection(igain);
-
     AlignmentResult<T> globalAlignment;
     if (useInputShifts) {
         if (!movie.containsLabel(MDL_SHIFT_X)) {
@@ -609,5 +683,144 @@ void AProgMovieAlignmentCorrelation<T>::run() {
     releaseAll();
 }
 
+template<typename T>
+void AProgMovieAlignmentCorrelation<T>::runBatch(const Image<T> &dark,
+        const Image<T> &igain) {
+    MetaData mdMovies;
+    mdMovies.read(fnMovie);
+    std::vector<FileName> fnMovies;
+    FileName fnTmp;
+    FOR_ALL_OBJECTS_IN_METADATA(mdMovies)
+    {
+        mdMovies.getValue(MDL_IMAGE, fnTmp, __iter.objId);
+        fnMovies.push_back(fnTmp);
+    }
+    if (fnMovies.empty())
+        return;
+    fnBatchDir.makePath();
+
+    // output names and frame ranges are given per movie, keep the original values
+    const FileName suffixOut = fnOut, suffixAvg = fnAvg,
+            suffixAligned = fnAligned, suffixInitialAvg = fnInitialAvg;
+    const int first = nfirst, last = nlast, firstSum = nfirstSum,
+            lastSum = nlastSum;
+    auto composeName = [&](const FileName &fnCurrent, const FileName &suffix) {
+        return suffix.isEmpty() ?
+                suffix : FileName(fnBatchDir + "/" + fnCurrent.getBaseName() + suffix);
+    };
+    // same frames as correctLoopIndices() will use for this movie
+    auto frameRange = [&](const MetaData &movie) {
+        const int lastFrame = movie.size() - 1;
+        return std::make_pair(std::max(first, 0),
+                (last < 0) ? lastFrame : std::min(last, lastFrame));
+    };
+    // a movie that cannot be read is reported and skipped
+    auto skipMovie = [&](size_t k, const XmippError &XE) {
+        std::cerr << "Movie " << fnMovies.at(k) << " skipped:" << std::endl
+                << XE << std::endl;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    MetaData current;
+    bool currentOk = true;
+    try {
+        readMovie(fnMovies.at(0), current);
+        auto range = frameRange(current);
+        prefetchMovie(current, range.first, range.second, dark, igain);
+    } catch (XmippError &XE) {
+        skipMovie(0, XE);
+        currentOk = false;
+    }
+    for (size_t k = 0; k < fnMovies.size(); ++k) {
+        auto movieStart = std::chrono::steady_clock::now();
+        usePrefetchedMovie();
+        // start loading the next movie while the current one is being aligned
+        MetaData next;
+        std::thread prefetcher;
+        std::exception_ptr prefetchError;
+        if ((k + 1) < fnMovies.size()) {
+            try {
+                readMovie(fnMovies.at(k + 1), next);
+                auto range = frameRange(next);
+                prefetcher = std::thread([&, range]() {
+                    try {
+                        prefetchMovie(next, range.first, range.second, dark, igain);
+                    } catch (...) {
+                        prefetchError = std::current_exception();
+                    }
+                });
+            } catch (...) {
+                prefetchError = std::current_exception();
+            }
+        }
+
+        fnOut = composeName(fnMovies.at(k), suffixOut);
+        fnAvg = composeName(fnMovies.at(k), suffixAvg);
+        fnAligned = composeName(fnMovies.at(k), suffixAligned);
+        fnInitialAvg = composeName(fnMovies.at(k), suffixInitialAvg);
+        nfirst = first;
+        nlast = last;
+        nfirstSum = firstSum;
+        nlastSum = lastSum;
+        try {
+            if (currentOk)
+                processMovie(current, dark, igain);
+        } catch (XmippError &XE) {
+            // one broken movie should not stop the whole batch
+            skipMovie(k, XE);
+            releaseAll();
+        } catch (...) {
+            if (prefetcher.joinable())
+                prefetcher.join();
+            throw;
+        }
+        if (prefetcher.joinable())
+            prefetcher.join();
+        // neither does a movie that could not be prefetched
+        currentOk = true;
+        if (prefetchError) {
+            currentOk = false;
+            try {
+                std::rethrow_exception(prefetchError);
+            } catch (XmippError &XE) {
+                skipMovie(k + 1, XE);
+            }
+        }
+        current = next;
+
+        if (verbose) {
+            double movieTime = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - movieStart).count();
+            double total = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+            std::cout << "Movie " << k + 1 << "/" << fnMovies.size() << " ("
+                    << fnMovies.at(k) << ") processed in " << movieTime
+                    << " s, " << 3600 * (k + 1) / total << " movies/hour"
+                    << std::endl;
+        }
+    }
+}
+
+template<typename T>
+void AProgMovieAlignmentCorrelation<T>::run() {
+    show();
+    if ( ! checkSettings()) return;
+
+    // gain and dark are shared by all movies
+    Image<T> dark, igain;
+    loadDarkCorrection(dark);
+    loadGainCorrection(igain);
+
+    if ( ! fnBatchDir.isEmpty()) {
+        runBatch(dark, igain);
+        return;
+    }
+
+    // preprocess input data
+    MetaData movie;
+    readMovie(fnMovie, movie);
+    processMovie(movie, dark, igain);
+}
+
 template class AProgMovieAlignmentCorrelation<float> ;
 template class AProgMovieAlignmentCorrelation<double> ;
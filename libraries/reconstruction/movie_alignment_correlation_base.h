@@ -47,6 +47,10 @@
 #include "eq_system_solver.h"
 #include "bspline_helper.h"
 #include "data/point2D.h"
+#include <map>
+#include <tuple>
+#include <thread>
+#include <chrono>
 
 template<typename T>
 class AProgMovieAlignmentCorrelation: public XmippProgram {
@@ -158,6 +162,28 @@ protected:
      */
     T getTargetOccupancy();
 
+    /**
+     * Returns position of all 'local alignment patches' within a single frame
+     * @param borders that should be left intact
+     * @param movie size
+     * @param patch size
+     */
+    std::vector<FramePatchMeta<T>> getPatchesLocation(const std::pair<T, T> &borders,
+            const Dimensions &movie,
+            const Dimensions &patch);
+
+    /**
+     * Imagine you align frames of the movie using global alignment
+     * Some frames edges will overlap, i.e. there will be an are shared
+     * by all frames, and edge area where at least one frame does not contribute.
+     * This method computes the size of that area.
+     * @param globAlignment to use
+     * @param verbose level
+     * @return no of pixels in X (Y) dimension where there might NOT be data from each frame
+     */
+    std::pair<T,T> getMovieBorders(const AlignmentResult<T> &globAlignment,
+            int verbose);
+
     /**
      * This method applies global shifts and can also produce 'average'
      * image (micrograph)
@@ -218,6 +244,28 @@ protected:
      */
     virtual void releaseAll() = 0;
 
+    /**
+     * This method can load the first frames of the movie to memory, so that
+     * its alignment does not have to wait for the disk. In batch mode, it is
+     * called from a separate thread while the previous movie is being
+     * processed, so it must not touch any data used by the processing. Only
+     * as many frames as the loading keeps in flight should be read, so that
+     * two whole movies are never in memory at the same time.
+     * @param movie to load
+     * @param first frame to load
+     * @param last frame to load (inclusive)
+     * @param dark pixel correction
+     * @param igain correction
+     */
+    virtual void prefetchMovie(const MetaData &movie, int first, int last,
+            const Image<T> &dark, const Image<T> &igain) {};
+
+    /**
+     * Makes the frames loaded by prefetchMovie() those of the movie to be
+     * processed.
+     */
+    virtual void usePrefetchedMovie() {};
+
     /**
      * Method to store all computed alignment to hard drive
      */
@@ -273,9 +321,27 @@ private:
 
     /**
      * Loads movie from the file
+     * @param fnMovie metadata or stack with the frames
      * @param movie where the input should be stored
      */
-    void readMovie(MetaData& movie);
+    void readMovie(const FileName &fnMovie, MetaData& movie);
+
+    /**
+     * Aligns a single movie and stores all results
+     * @param movie to process
+     * @param dark pixel correction
+     * @param igain correction
+     */
+    void processMovie(MetaData &movie, const Image<T> &dark,
+            const Image<T> &igain);
+
+    /**
+     * Aligns all movies of the input list, loading the next movie while
+     * the current one is being processed
+     * @param dark pixel correction
+     * @param igain correction
+     */
+    void runBatch(const Image<T> &dark, const Image<T> &igain);
 
     /**
      * Sets all shifts in the movie to zero (0)
@@ -368,6 +434,10 @@ private:
     T maxFreq;
     /** Do not calculate and use the input shifts */
     bool useInputShifts;
+    /** Output directory of the batch mode (empty if single movie is processed) */
+    FileName fnBatchDir;
+    /** Low-pass filters created so far, by occupancy and size */
+    std::map<std::tuple<T, size_t, size_t>, MultidimArray<T>> lpfCache;
 
 };
 #endif
@@ -28,7 +28,10 @@
 #include <condor/Solver.h>
 #include <condor/tools.h>
 
+#include <cstring>
+#include <sstream>
 #include <core/metadata_extension.h>
+#include <data/fourier_filter.h>
 #include "program_extension.h"
 #include "nma_alignment.h"
 
@@ -41,11 +44,17 @@ ProgNmaAlignment::ProgNmaAlignment() {
 	each_image_produces_an_output = false;
 	produces_an_output = true;
 	progVolumeFromPDB = new ProgPdbConverter();
+	progContinuousAssign = new ProgAngularContinuousAssign();
+	progDiscreteAssign = new ProgAngularDiscreteAssign();
+	projector = new FourierProjector(1, 0.25, BSPLINE3);
 	projMatch = false;
 }
 
 ProgNmaAlignment::~ProgNmaAlignment() {
 	delete progVolumeFromPDB;
+	delete progContinuousAssign;
+	delete progDiscreteAssign;
+	delete projector;
 }
 
 // Params definition ============================================================
@@ -162,37 +171,32 @@ void ProgNmaAlignment::preProcess() {
 	global_nma_prog = this;
 	//create some neededs files
 	createWorkFiles();
-}
 
-void ProgNmaAlignment::finishProcessing() {
-	XmippMetadataProgram::finishProcessing();
-	rename((fnOutDir+"/nmaDone.xmd").c_str(), fn_out.c_str());
-}
-
-// Create deformed PDB =====================================================
-FileName ProgNmaAlignment::createDeformedPDB(int pyramidLevel) const {
-	String program;
-	String arguments;
-	FileName fnRandom;
-	fnRandom.initUniqueName(nameTemplate,fnOutDir);
-	const char * randStr = fnRandom.c_str();
-
-	program = "xmipp_pdb_nma_deform";
-	arguments = formatString(
-			"--pdb %s -o %s_deformedPDB.pdb --nma %s --deformations ",
-			fnPDB.c_str(), randStr, fnModeList.c_str());
-	for (size_t i = 0; i < VEC_XSIZE(trial) - 5; ++i)
-		arguments += floatToString(trial(i)) + " ";
-	runSystem(program, arguments, false);
-
-	program = "xmipp_volume_from_pdb";
-	arguments = formatString(
-			"-i %s_deformedPDB.pdb --size %i --sampling %f -v 0", randStr,
-			imgSize, sampling_rate);
+	// Read the reference structure and the modes once, they are deformed
+	// in memory at every evaluation of the objective function
+	pdbReference.read(fnPDB);
+	modes.resize(numberOfModes);
+	FileName fnMode;
+	int m = 0;
+	FOR_ALL_OBJECTS_IN_METADATA(SF)
+	{
+		SF.getValue(MDL_NMA_MODEFILE, fnMode, __iter.objId);
+		MultidimArray<double> &mode = modes[m++];
+		mode.resizeNoCopy(pdbReference.getNumberOfAtoms(), 3);
+		std::ifstream fhMode;
+		fhMode.open(fnMode.c_str());
+		if (!fhMode)
+			REPORT_ERROR(ERR_IO_NOREAD, fnMode);
+		fhMode >> mode;
+		fhMode.close();
+	}
 
+	// Set up the conversion from PDB to volume. The atomic profiles are
+	// computed only once
+	String arguments = formatString("-i %s --size %i --sampling %f -v 0",
+			fnPDB.c_str(), imgSize, sampling_rate);
 	if (do_centerPDB)
 		arguments.append(" --centerPDB ");
-
 	if (useFixedGaussian) {
 		arguments.append(" --intensityColumn Bfactor --fixed_Gaussian ");
 		if (sigmaGaussian >= 0)
@@ -200,145 +204,223 @@ FileName ProgNmaAlignment::createDeformedPDB(int pyramidLevel) const {
 	}
 	//else
 		//arguments +=" --poor_Gaussian"; // Otherwise, a detailed conversion of the atoms takes too long in this context
-		
 	progVolumeFromPDB->read(arguments);
-	progVolumeFromPDB->tryRun();
+	progVolumeFromPDB->produceSideInfo();
 
+	// Low-pass filter of the deformed volumes
 	if (do_FilterPDBVol) {
-		program = "xmipp_transform_filter";
-		arguments = formatString(
-						"-i %s_deformedPDB.vol --sampling %f --fourier low_pass %f  -v 0",
-						randStr, sampling_rate, cutoff_LPfilter);
-		runSystem(program, arguments, false);
+		filterLP.FilterBand = LOWPASS;
+		filterLP.FilterShape = RAISED_COSINE;
+		filterLP.raised_w = 0.02;
+		filterLP.w1 = sampling_rate / cutoff_LPfilter;
+		filterLP.do_generate_3dmask = true;
+		MultidimArray<double> V(imgSize, imgSize, imgSize);
+		V.setXmippOrigin();
+		filterLP.generateMask(V);
 	}
 
-	if (pyramidLevel != 0) {
-		Image<double> I;
-		FileName fnDeformed = formatString("%s_deformedPDB.vol",randStr);
-		I.read(fnDeformed);
-		selfPyramidReduce(BSPLINE3, I(), pyramidLevel);
-		I.write(fnDeformed);
-	}
-	return fnRandom;
+	// Continuous assignment with the default limits of
+	// xmipp_angular_continuous_assign
+	progContinuousAssign->gaussian_DFT_sigma = gaussian_DFT_sigma;
+	progContinuousAssign->gaussian_Real_sigma = gaussian_Real_sigma;
+	progContinuousAssign->weight_zero_freq = weight_zero_freq;
+	progContinuousAssign->max_no_iter = 60;
+	progContinuousAssign->max_shift = -1;
+	progContinuousAssign->max_angular_change = -1;
 }
 
-// Perform complete search =================================================
-void ProgNmaAlignment::performCompleteSearch(const FileName &fnRandom,
-		int pyramidLevel) const {
-	String program;
-	String arguments;
-	const char * randStr = fnRandom.c_str();
-
-	// Reduce the image
-	FileName fnDown = formatString("%s_downimg.xmp", fnRandom.c_str());
-	if (pyramidLevel != 0) {
-		Image<double> I;
-		I.read(currentImgName);
-		selfPyramidReduce(BSPLINE3, I(), pyramidLevel);
-		I.write(fnDown);
-	} else
-		copyImage(currentImgName.c_str(), fnDown.c_str());
+void ProgNmaAlignment::finishProcessing() {
+	XmippMetadataProgram::finishProcessing();
+	rename((fnOutDir+"/nmaDone.xmd").c_str(), fn_out.c_str());
+}
 
-	mkdir((fnRandom+"_ref").c_str(), S_IRWXU);
+// Create deformed volume ==================================================
+void ProgNmaAlignment::createDeformedVolume(int pyramidLevel) {
+	// Deform the reference structure
+	PDBRichPhantom pdb = pdbReference;
+	for (size_t m = 0; m < modes.size(); ++m) {
+		double lambda = trial(m);
+		const MultidimArray<double> &mode = modes[m];
+		for (size_t i = 0; i < YSIZE(mode); ++i) {
+			RichAtom& atom_i = pdb.atomList[i];
+			atom_i.x += lambda * DIRECT_A2D_ELEM(mode,i,0);
+			atom_i.y += lambda * DIRECT_A2D_ELEM(mode,i,1);
+			atom_i.z += lambda * DIRECT_A2D_ELEM(mode,i,2);
+		}
+	}
 
-	double angSampling=2*RAD2DEG(atan(1.0/((double) imgSize / pow(2.0, (double) pyramidLevel+1))));
-	angSampling=std::max(angSampling,discrAngStep);
-	program = "xmipp_angular_project_library";
-	arguments = formatString(
-			"-i %s_deformedPDB.vol -o %s_ref/ref.stk --sampling_rate %f -v 0",
-			randStr, randStr, angSampling);
-	if (projMatch)
-		arguments +=formatString(
-						" --compute_neighbors --angular_distance -1 --experimental_images %s_downimg.xmp", randStr);
+	// Convert it into a volume
+	std::ostringstream pdbText;
+	pdb.write(pdbText);
+	progVolumeFromPDB->pdbText = pdbText.str();
+	progVolumeFromPDB->convertPDB();
+	Vdeformed() = progVolumeFromPDB->Vlow();
+
+	if (do_FilterPDBVol)
+		filterLP.applyMaskSpace(Vdeformed());
 
-	runSystem(program, arguments, false);
+	if (pyramidLevel != 0)
+		selfPyramidReduce(BSPLINE3, Vdeformed(), pyramidLevel);
+}
 
-	String refSelStr = formatString("%s_ref/ref.doc", randStr);
+// Prepare complete search =================================================
+void ProgNmaAlignment::prepareCompleteSearch(int pyramidLevel) {
+	// Same directions as angular_project_library
+	double angSampling=2*RAD2DEG(atan(1.0/((double) imgSize / pow(2.0, (double) pyramidLevel+1))));
+	angSampling=std::max(angSampling,discrAngStep);
+	int symmetry, sym_order;
+	gallerySampling.setSampling(angSampling);
+	gallerySampling.SL.isSymmetryGroup("c1", symmetry, sym_order);
+	gallerySampling.computeSamplingPoints(false, 180, 0);
+	gallerySampling.SL.readSymmetryFile("c1");
+	gallerySampling.fillLRRepository();
+	gallerySampling.removeRedundantPoints(symmetry, sym_order);
+
+	size_t Ndirs = gallerySampling.no_redundant_sampling_points_angles.size();
+	galleryEuler.resize(Ndirs);
+	progDiscreteAssign->rot.resize(Ndirs);
+	progDiscreteAssign->tilt.resize(Ndirs);
+	for (size_t k = 0; k < Ndirs; ++k) {
+		const Matrix1D<double> &angles = gallerySampling.no_redundant_sampling_points_angles[k];
+		Euler_angles2matrix(XX(angles), YY(angles), ZZ(angles), galleryEuler[k]);
+		progDiscreteAssign->rot[k] = XX(angles);
+		progDiscreteAssign->tilt[k] = YY(angles);
+	}
 
 	if (fnmask != "") {
-		program = "xmipp_transform_mask";
-		arguments = formatString("-i %s --mask binary_file %s", refSelStr.c_str(),
-				fnmask.c_str());
-		runSystem(program, arguments, false);
+		Image<double> mask;
+		mask.read(fnmask);
+		typeCast(mask(), galleryMask);
+	}
+
+	// Same parameters as the angular_discrete_assign call of the old
+	// stage 1, and its defaults for the rest
+	if (!projMatch) {
+		int size = (int)YSIZE(currentImgReduced());
+		progDiscreteAssign->fn_sym = "";
+		progDiscreteAssign->max_proj_change = -1;
+		progDiscreteAssign->max_psi_change = -1;
+		progDiscreteAssign->psi_step = 5;
+		progDiscreteAssign->max_shift_change = round((double) imgSize / (10.0 * pow(2.0, (double) pyramidLevel)));
+		progDiscreteAssign->shift_step = 1;
+		progDiscreteAssign->th_discard = 50;
+		progDiscreteAssign->smin = 1;
+		progDiscreteAssign->smax = -1;
+		progDiscreteAssign->pick = 1;
+		progDiscreteAssign->tell = 0;
+		progDiscreteAssign->checkMirrors = 1;
+		progDiscreteAssign->search5D = true;
+		progDiscreteAssign->verbose = 0;
+		progDiscreteAssign->produceSideInfo(size, size);
 	}
+}
+
+// Perform complete search =================================================
+void ProgNmaAlignment::performCompleteSearch(int pyramidLevel,
+		Matrix1D<double> &pose) {
+	if (galleryEuler.empty())
+		prepareCompleteSearch(pyramidLevel);
+
+	// Project the deformed volume. The projector keeps its scratch memory
+	// from one evaluation to the next, only the coefficients of the volume
+	// are recomputed
+	MultidimArray<double> V = Vdeformed();
+	V.setXmippOrigin();
+	projector->updateVolume(V);
+	projector->projectBatch(galleryEuler, gallery);
+	if (fnmask != "")
+		for (size_t k = 0; k < gallery.size(); ++k) {
+			MultidimArray<double> &P = gallery[k];
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(P)
+			if (DIRECT_MULTIDIM_ELEM(galleryMask,n) == 0)
+				DIRECT_MULTIDIM_ELEM(P,n) = 0;
+		}
 
-	// Perform alignment
-	String fnOut=formatString("%s_angledisc.xmd",randStr);
+	double rot, tilt, psi, shiftX, shiftY;
 	if (!projMatch) {
-		program = "xmipp_angular_discrete_assign";
-		arguments = formatString(
-						"-i %s_downimg.xmp --ref %s -o %s --psi_step 5 --max_shift_change %d --search5D -v 0",
-						randStr, refSelStr.c_str(), fnOut.c_str(), (int)round((double) imgSize / (10.0 * pow(2.0, (double) pyramidLevel))));
+		progDiscreteAssign->produce_library(gallery);
+
+		// The image as angular_discrete_assign reads it from disk
+		Image<double> I;
+		I() = currentImgReduced();
+		STARTINGX(I()) = STARTINGY(I()) = 0;
+		I.setEulerAngles(0, 0, 0);
+		I.setShifts(0, 0);
+		progDiscreteAssign->predictPose(I, rot, tilt, psi, shiftX, shiftY);
+		psi = -psi;
 	} else {
+		// angular_projection_matching reads the gallery from disk
+		const char * randStr = fnRandom.c_str();
+		size_t Ndirs = gallery.size(), Xdim = XSIZE(gallery[0]);
+		Image<double> G;
+		G().resizeNoCopy(Ndirs, 1, Xdim, Xdim);
+		for (size_t k = 0; k < Ndirs; ++k)
+			memcpy(&DIRECT_NZYX_ELEM(G(),k,0,0,0), MULTIDIM_ARRAY(gallery[k]), Xdim*Xdim*sizeof(double));
 		String refStkStr = formatString("%s_ref/ref.stk", randStr);
-		program = "xmipp_angular_projection_matching";
-		arguments =	formatString(
-				        "-i %s_downimg.xmp --ref %s -o %s --search5d_step 1 --max_shift %d -v 0",
-				        randStr, refStkStr.c_str(), fnOut.c_str(), (int)round((double) imgSize / (10.0 * pow(2.0, (double) pyramidLevel))));
-	}
-	runSystem(program, arguments, false);
-	if (projMatch)
-	{
+		G.write(refStkStr);
+
+		String fnOut = formatString("%s_angledisc.xmd", randStr);
+		String arguments = formatString(
+				"-i %s_downimg.xmp --ref %s -o %s --search5d_step 1 --max_shift %d -v 0",
+				randStr, refStkStr.c_str(), fnOut.c_str(), (int)round((double) imgSize / (10.0 * pow(2.0, (double) pyramidLevel))));
+		runSystem("xmipp_angular_projection_matching", arguments, false);
+
+		// Pick up results
 		MetaData MD;
 		MD.read(fnOut);
-		bool flip;
 		size_t id=MD.firstObject();
+		MD.getValue(MDL_ANGLE_ROT,rot,id);
+		MD.getValue(MDL_ANGLE_TILT,tilt,id);
+		MD.getValue(MDL_ANGLE_PSI,psi,id);
+		MD.getValue(MDL_SHIFT_X,shiftX,id);
+		MD.getValue(MDL_SHIFT_Y,shiftY,id);
+		bool flip;
 		MD.getValue(MDL_FLIP,flip,id);
 		if (flip)
 		{
 			// This is because continuous assignment does not understand flips
-
-			double shiftX, rot, tilt, psi, newrot, newtilt, newpsi;
-			// Change sign in shiftX
-			MD.getValue(MDL_SHIFT_X,shiftX,id);
-			MD.setValue(MDL_SHIFT_X,-shiftX,id);
-
-			// Change Euler angles
-			MD.getValue(MDL_ANGLE_ROT,rot,id);
-			MD.getValue(MDL_ANGLE_TILT,tilt,id);
-			MD.getValue(MDL_ANGLE_PSI,psi,id);
+			double newrot, newtilt, newpsi;
+			shiftX=-shiftX;
 			Euler_mirrorY(rot,tilt,psi,newrot,newtilt,newpsi);
-			MD.setValue(MDL_ANGLE_ROT,newrot,id);
-			MD.setValue(MDL_ANGLE_TILT,newtilt,id);
-			MD.setValue(MDL_ANGLE_PSI,newpsi,id);
-			MD.write(fnOut);
+			rot=newrot;
+			tilt=newtilt;
+			psi=newpsi;
 		}
 	}
+	pose.resizeNoCopy(5);
+	VEC_ELEM(pose,0)=rot;
+	VEC_ELEM(pose,1)=tilt;
+	VEC_ELEM(pose,2)=psi;
+	VEC_ELEM(pose,3)=shiftX;
+	VEC_ELEM(pose,4)=shiftY;
 }
 
 // Continuous assignment ===================================================
-double ProgNmaAlignment::performContinuousAssignment(const FileName &fnRandom,
-		int pyramidLevel) const {
-	// Perform alignment
-	const char * randStr = fnRandom.c_str();
-	String fnResults=formatString("%s_anglecont.xmd", randStr);
-	bool costSource=true;
-	String program = "xmipp_angular_continuous_assign";
-	String arguments =
-			formatString(
-					"-i %s_angledisc.xmd --ref %s_deformedPDB.vol -o %s --gaussian_Fourier %f --gaussian_Real %f --zerofreq_weight %f -v 0",
-					randStr, randStr, fnResults.c_str(), gaussian_DFT_sigma,
-					gaussian_Real_sigma, weight_zero_freq);
-	runSystem(program, arguments, false);
-
-	// Pick up results
-	MetaData DF(fnResults);
-	MDRow row;
-	DF.getRow(row, DF.firstObject());
-	row.getValue(MDL_ANGLE_ROT, trial(VEC_XSIZE(trial) - 5));
-	row.getValue(MDL_ANGLE_TILT, trial(VEC_XSIZE(trial) - 4));
-	row.getValue(MDL_ANGLE_PSI, trial(VEC_XSIZE(trial) - 3));
-	row.getValue(MDL_SHIFT_X, trial(VEC_XSIZE(trial) - 2));
-	trial(VEC_XSIZE(trial) - 2) *= pow(2.0, (double) pyramidLevel);
-	row.getValue(MDL_SHIFT_Y, trial(VEC_XSIZE(trial) - 1));
-	trial(VEC_XSIZE(trial) - 1) *= pow(2.0, (double) pyramidLevel);
-	double tempvar;
-	if (!costSource) {
-		row.getValue(MDL_MAXCC, tempvar);
-		tempvar = -tempvar;
-	} else
-		row.getValue(MDL_COST, tempvar);
-	return tempvar;
+double ProgNmaAlignment::performContinuousAssignment(const Matrix1D<double> &pose,
+		int pyramidLevel) {
+	progContinuousAssign->prepareVolume(Vdeformed());
+
+	// The image is modified by the assignment, so work on a copy
+	MultidimArray<double> I;
+	if (pyramidLevel == 0)
+		I = currentImg();
+	else if (pyramidLevel == 1)
+		I = currentImgReduced();
+	else {
+		I = currentImg();
+		selfPyramidReduce(BSPLINE3, I, pyramidLevel);
+	}
+
+	double rot=VEC_ELEM(pose,0), tilt=VEC_ELEM(pose,1), psi=VEC_ELEM(pose,2);
+	double shiftX=VEC_ELEM(pose,3), shiftY=VEC_ELEM(pose,4);
+	double cost=progContinuousAssign->refinePose(I, rot, tilt, psi, shiftX, shiftY);
+
+	trial(VEC_XSIZE(trial) - 5) = rot;
+	trial(VEC_XSIZE(trial) - 4) = tilt;
+	trial(VEC_XSIZE(trial) - 3) = psi;
+	trial(VEC_XSIZE(trial) - 2) = shiftX * pow(2.0, (double) pyramidLevel);
+	trial(VEC_XSIZE(trial) - 1) = shiftY * pow(2.0, (double) pyramidLevel);
+	return cost;
 }
 
 void ProgNmaAlignment::updateBestFit(double fitness, int dim) {
@@ -359,44 +441,19 @@ double ObjFunc_nma_alignment::eval(Vector X, int *nerror) {
 	int pyramidLevelDisc = 1;
 	int pyramidLevelCont = (global_nma_prog->currentStage == 1) ? 1 : 0;
 
-	FileName fnRandom = global_nma_prog->createDeformedPDB(pyramidLevelCont);
-	const char * randStr = fnRandom.c_str();
+	global_nma_prog->createDeformedVolume(pyramidLevelCont);
 
+	Matrix1D<double> pose(5);
 	if (global_nma_prog->currentStage == 1) {
-		global_nma_prog->performCompleteSearch(fnRandom, pyramidLevelDisc);
+		global_nma_prog->performCompleteSearch(pyramidLevelDisc, pose);
 	} else {
-		double rot, tilt, psi, xshift, yshift;
-		MetaData DF;
-
-		rot = global_nma_prog->bestStage1(
-				VEC_XSIZE(global_nma_prog->bestStage1) - 5);
-		tilt = global_nma_prog->bestStage1(
-				VEC_XSIZE(global_nma_prog->bestStage1) - 4);
-		psi = global_nma_prog->bestStage1(
-				VEC_XSIZE(global_nma_prog->bestStage1) - 3);
-		xshift = global_nma_prog->bestStage1(
-				VEC_XSIZE(global_nma_prog->bestStage1) - 2);
-		yshift = global_nma_prog->bestStage1(
-				VEC_XSIZE(global_nma_prog->bestStage1) - 1);
-
-		size_t objId = DF.addObject();
-		FileName fnDown = formatString("%s_downimg.xmp", randStr);
-		DF.setValue(MDL_IMAGE, fnDown, objId);
-		DF.setValue(MDL_ENABLED, 1, objId);
-		DF.setValue(MDL_ANGLE_ROT, rot, objId);
-		DF.setValue(MDL_ANGLE_TILT, tilt, objId);
-		DF.setValue(MDL_ANGLE_PSI, psi, objId);
-		DF.setValue(MDL_SHIFT_X, xshift, objId);
-		DF.setValue(MDL_SHIFT_Y, yshift, objId);
-
-		DF.write(formatString("%s_angledisc.xmd", randStr));
-		copyImage(global_nma_prog->currentImgName.c_str(), fnDown.c_str());
+		const Matrix1D<double> &bestStage1 = global_nma_prog->bestStage1;
+		for (int i = 0; i < 5; i++)
+			VEC_ELEM(pose,i) = VEC_ELEM(bestStage1,VEC_XSIZE(bestStage1) - 5 + i);
 	}
-	double fitness = global_nma_prog->performContinuousAssignment(fnRandom,
+	double fitness = global_nma_prog->performContinuousAssignment(pose,
 			pyramidLevelCont);
 
-	runSystem("rm", formatString("-rf %s* &", randStr));
-
 	global_nma_prog->updateBestFit(fitness, dim);
 	return fitness;
 }
@@ -420,7 +477,28 @@ void ProgNmaAlignment::processImage(const FileName &fnImg,
 
 	parameters.initZeros(dim + 5);
 	currentImgName = fnImg;
-	sprintf(nameTemplate, "_node%d_img%lu_XXXXXX", rangen, (long unsigned int)imageCounter);
+
+	// Read the image once
+	currentImg.read(fnImg);
+	currentImg().setXmippOrigin();
+	currentImgReduced() = currentImg();
+	selfPyramidReduce(BSPLINE3, currentImgReduced(), 1);
+
+	// Projection matching reads the reduced image, the gallery and its
+	// sampling from a scratch prefix of the image
+	if (projMatch) {
+		sprintf(nameTemplate, "_node%d_img%lu_XXXXXX", rangen, (long unsigned int)imageCounter);
+		fnRandom.initUniqueName(nameTemplate,fnOutDir);
+		currentImgReduced.write(fnRandom + "_downimg.xmp");
+		mkdir((fnRandom+"_ref").c_str(), S_IRWXU);
+		if (galleryEuler.empty())
+			prepareCompleteSearch(1);
+		gallerySampling.setNeighborhoodRadius(-1);
+		gallerySampling.fillExpDataProjectionDirectionByLR(fnRandom + "_downimg.xmp");
+		gallerySampling.computeNeighbors(false);
+		gallerySampling.saveSamplingFile(fnRandom + "_ref/ref", false);
+		gallerySampling.exp_data_projection_direction_by_L_R.clear();
+	}
 
 	trial.initZeros(dim + 5);
 	trial_best.initZeros(dim + 5);
@@ -508,6 +586,9 @@ void ProgNmaAlignment::processImage(const FileName &fnImg,
 
 	writeImageParameters(fnImg);
 	delete of;
+
+	if (projMatch)
+		runSystem("rm", formatString("-rf %s*", fnRandom.c_str()));
 }
 
 void ProgNmaAlignment::writeImageParameters(const FileName &fnImg) {
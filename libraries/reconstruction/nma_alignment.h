@@ -33,6 +33,11 @@
 #include <core/metadata.h>
 #include <core/xmipp_image.h>
 #include "volume_from_pdb.h"
+#include "angular_continuous_assign.h"
+#include "angular_discrete_assign.h"
+#include <data/fourier_filter.h>
+#include <data/fourier_projection.h>
+#include <data/sampling.h>
 
 /**@defgroup NMAAlignment Alignment with Normal modes
    @ingroup ReconsLibrary */
@@ -133,9 +138,48 @@ public:
     // Template for temporal filename generation
     char nameTemplate[256];
 
+    // Root name of the scratch files of the current image (projMatch)
+    FileName fnRandom;
+
     // Volume from PDB
     ProgPdbConverter* progVolumeFromPDB;
 
+    // Continuous assignment of the current image
+    ProgAngularContinuousAssign* progContinuousAssign;
+
+    // Discrete assignment of the first stage
+    ProgAngularDiscreteAssign* progDiscreteAssign;
+
+    // Projector of the deformed volumes, reused by all the evaluations
+    FourierProjector* projector;
+
+    // Directions of the gallery of the first stage, computed once
+    Sampling gallerySampling;
+
+    // Euler matrices of the gallery directions
+    std::vector< Matrix2D<double> > galleryEuler;
+
+    // Gallery of projections of the deformed volume
+    std::vector< MultidimArray<double> > gallery;
+
+    // Mask of the gallery projections
+    MultidimArray<int> galleryMask;
+
+    // Reference structure, read once
+    PDBRichPhantom pdbReference;
+
+    // Normal modes (one row per atom and one column per coordinate), read once
+    std::vector< MultidimArray<double> > modes;
+
+    // Deformed volume of the current evaluation
+    Image<double> Vdeformed;
+
+    // Low-pass filter of the deformed volume
+    FourierFilter filterLP;
+
+    // Current image at full size and reduced by one pyramid level
+    Image<double> currentImg, currentImgReduced;
+
 public:
     /// Empty constructor
     ProgNmaAlignment();
@@ -152,19 +196,31 @@ public:
     /// Show
     void show();
 
-   /** Create deformed PDB */
-    FileName createDeformedPDB(int pyramidLevel) const;
-
-    /** Perform a complete search with the given image and reference
-        volume at the given level of pyramid. Return the values
-    in the last five positions of trial. */
-    void performCompleteSearch(const FileName &fnRandom,
-        int pyramidLevel) const;
-
-    /** Perform a continuous search with the given image and reference
-        volume at the given pyramid level. Return the values
-    in the last five positions of trial. */
-    double performContinuousAssignment(const FileName &fnRandom, int pyramidLevel) const;
+    /** Create the deformed volume.
+        The reference structure is deformed with the amplitudes in trial,
+        converted into a volume, filtered and reduced to the given pyramid
+        level. The result is left in Vdeformed. */
+    void createDeformedVolume(int pyramidLevel);
+
+    /** Prepare the complete search at the given level of pyramid.
+        The directions of the gallery and the side info of the discrete
+        assignment do not depend on the deformation, so they are computed
+        at the first complete search of the program. */
+    void prepareCompleteSearch(int pyramidLevel);
+
+    /** Perform a complete search with the current image and the deformed
+        volume at the given level of pyramid. Return the pose (rot, tilt,
+        psi, shift X, shift Y) in the units of the reduced image.
+        The gallery is projected from the deformed volume in memory. With
+        projMatch it is matched by angular_projection_matching, which
+        reads it from the scratch files of the current image. */
+    void performCompleteSearch(int pyramidLevel, Matrix1D<double> &pose);
+
+    /** Perform a continuous search with the current image and the deformed
+        volume at the given pyramid level, starting from the given pose.
+        Return the values in the last five positions of trial and
+        the cost of the assignment. */
+    double performContinuousAssignment(const Matrix1D<double> &pose, int pyramidLevel);
 
     /** Computes the fitness of a set of trial parameters */
     double computeFitness(Matrix1D<double> &trial) const;
@@ -79,7 +79,7 @@ XmippProgram * getProgramByName(const String &programName)
     if (programName == "xmipp_angular_projection_matching")
         return new ProgAngularProjectionMatching();
 
-    if (programName == "xmipp_mask")
+    if (programName == "xmipp_mask" || programName == "xmipp_transform_mask")
         return new ProgMask();
 
     if (programName == "xmipp_angular_discrete_assign")
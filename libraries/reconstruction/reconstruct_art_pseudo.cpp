@@ -24,7 +24,9 @@
  *  e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <chrono>
 #include <fstream>
+#include <thread>
 
 #include <core/histogram.h>
 #include "reconstruct_art_pseudo.h"
@@ -40,15 +42,17 @@ void project_Pseudo(const std::vector< Matrix1D<double> > &atomPosition,
                     const std::vector<double> &lambda,
                     const std::vector< Matrix2D<double> > &NMA,
                     int direction, const Matrix1D<double> &gaussianProjectionTable,
-                    const Matrix1D<double> &gaussianProjectionTable2)
+                    const Matrix1D<double> &gaussianProjectionTable2,
+                    int thread_id, int numthreads)
 {
     // Project all pseudo atoms ............................................
+    // Each thread takes one of every numthreads atoms
     int nmax=atomPosition.size();
     Matrix1D<double> actprj(3);
     double sigma4=4*sigma;
     Matrix1D<double> actualAtomPosition;
     int lambdaSize=lambda.size();
-    for (int n=0; n<nmax; n++)
+    for (int n=thread_id; n<nmax; n+=numthreads)
     {
         actualAtomPosition=atomPosition[n];
         double weight=atomWeight[n];
@@ -166,6 +170,68 @@ void project_Pseudo(const std::vector< Matrix1D<double> > &atomPosition,
     }
 }
 
+/** Threaded projection of a pseudoatom volume.
+    When projecting forward, every thread but the first one accumulates onto
+    its own images, which are added at the end. When backprojecting, each
+    thread corrects a disjoint set of atoms. */
+void project_Pseudo(const std::vector< Matrix1D<double> > &atomPosition,
+                    std::vector<double> &atomWeight, double sigma,
+                    MultidimArray<double> &proj, MultidimArray<double> &norm_proj,
+                    Matrix2D<double> &Euler, double shiftX, double shiftY,
+                    const std::vector<double> &lambda,
+                    const std::vector< Matrix2D<double> > &NMA,
+                    int direction, const Matrix1D<double> &gaussianProjectionTable,
+                    const Matrix1D<double> &gaussianProjectionTable2,
+                    int numThreads)
+{
+    if (numThreads<=1)
+    {
+        project_Pseudo(atomPosition, atomWeight, sigma, proj, norm_proj,
+                       Euler, shiftX, shiftY, lambda, NMA, direction,
+                       gaussianProjectionTable, gaussianProjectionTable2, 0, 1);
+        return;
+    }
+
+    std::vector< MultidimArray<double> > thrProj, thrNormProj;
+    if (direction==FORWARD)
+    {
+        thrProj.resize(numThreads-1);
+        thrNormProj.resize(numThreads-1);
+        for (int t=0; t<numThreads-1; t++)
+        {
+            thrProj[t].initZeros(proj);
+            thrNormProj[t].initZeros(norm_proj);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    for (int t=1; t<numThreads; t++)
+    {
+        MultidimArray<double> *P=(direction==FORWARD) ? &thrProj[t-1] : &proj;
+        MultidimArray<double> *Pnorm=(direction==FORWARD) ? &thrNormProj[t-1] : &norm_proj;
+        workers.emplace_back([&, P, Pnorm, t]()
+                             {
+                                 project_Pseudo(atomPosition, atomWeight, sigma, *P, *Pnorm,
+                                                Euler, shiftX, shiftY, lambda, NMA, direction,
+                                                gaussianProjectionTable, gaussianProjectionTable2,
+                                                t, numThreads);
+                             });
+    }
+    project_Pseudo(atomPosition, atomWeight, sigma, proj, norm_proj,
+                   Euler, shiftX, shiftY, lambda, NMA, direction,
+                   gaussianProjectionTable, gaussianProjectionTable2,
+                   0, numThreads);
+    for (size_t t=0; t<workers.size(); t++)
+        workers[t].join();
+
+    if (direction==FORWARD)
+        for (int t=0; t<numThreads-1; t++)
+        {
+            proj+=thrProj[t];
+            norm_proj+=thrNormProj[t];
+        }
+}
+
 void ProgARTPseudo::show() const
 {
     if (verbose > 0)
@@ -182,6 +248,7 @@ void ProgARTPseudo::show() const
         std::cout << "Output rootname: " << fnRoot    << std::endl;
         std::cout << "Lambda ART:      " << lambdaART << std::endl;
         std::cout << "N. Iterations:   " << Nit       << std::endl;
+        std::cout << "Threads:         " << numThreads << std::endl;
         std::cout << "\n -----------------------------------------------------" << std::endl;
     }
 }
@@ -207,6 +274,7 @@ void ProgARTPseudo::defineParams()
     addParamsLine("  [-l <lambda=0.1>]      : Relaxation factor");
     addParamsLine("  [-n <N=1>]             : Number of iterations");
     addParamsLine("  [--nma <selfile=\"\">] : Selfile with NMA");
+    addParamsLine("  [--thr <N=1>]          : Number of threads used to project and backproject");
 
     addExampleLine("Reconstruct with NMA file and relaxation factor of 0.2:", false);
     addExampleLine("xmipp_reconstruct_art_pseudo -i projections.xmd -o art_rec --nma nmafile.xmd -l 0.2");
@@ -222,6 +290,7 @@ void ProgARTPseudo::readParams()
     sigma = getDoubleParam("--sigma");
     fnNMA = getParam("--nma");
     sampling = getDoubleParam("--sampling_rate");
+    numThreads = getIntParam("--thr");
 }
 
 void ProgARTPseudo::produceSideInfo()
@@ -289,6 +358,7 @@ void ProgARTPseudo::run()
     Image<double> Iexp;
     for (int it=0; it<Nit; it++)
     {
+        auto itStart = std::chrono::steady_clock::now();
         double itError=0;
         FOR_ALL_OBJECTS_IN_METADATA(DF)
         {
@@ -314,7 +384,9 @@ void ProgARTPseudo::run()
         }
         if (DF.size()>0)
             itError/=DF.size();
-        std::cerr << "Error at iteration " << it << " = " << itError << std::endl;
+        double itTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - itStart).count();
+        std::cerr << "Error at iteration " << it << " = " << itError
+                  << " (" << itTime << " s)" << std::endl;
     }
     writePseudo();
 }
@@ -373,7 +445,7 @@ double ProgARTPseudo::ART_single_step(const MultidimArray<double> &Iexp,
     Euler_angles2matrix(rot, tilt, psi, Euler);
     project_Pseudo(atomPosition, atomWeight, sigma, Itheo, Icorr,
                    Euler, shiftX, shiftY, lambda, NMA, FORWARD,
-                   gaussianProjectionTable, gaussianProjectionTable2);
+                   gaussianProjectionTable, gaussianProjectionTable2, numThreads);
     Idiff.initZeros(Iexp);
 
     double mean_error=0;
@@ -392,6 +464,6 @@ double ProgARTPseudo::ART_single_step(const MultidimArray<double> &Iexp,
 
     project_Pseudo(atomPosition, atomWeight, sigma, Itheo, Icorr,
                    Euler, shiftX, shiftY, lambda, NMA, BACKWARD,
-                   gaussianProjectionTable, gaussianProjectionTable2);
+                   gaussianProjectionTable, gaussianProjectionTable2, numThreads);
     return mean_error;
 }
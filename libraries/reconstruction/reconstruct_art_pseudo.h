@@ -58,6 +58,9 @@ public:
 
     /// Sampling rate
     double sampling;
+
+    /// Number of threads
+    int numThreads;
 public:
     /** Define parameters */
     void defineParams();
@@ -44,6 +44,12 @@ void ProgRecFourier::defineParams()
     addParamsLine("  [--max_resolution <p=0.5>]     : Max resolution (Nyquist=0.5)");
     addParamsLine("  [--weight]                     : Use weights stored in the image metadata");
     addParamsLine("  [--thr <threads=1> <rows=1>]   : Number of concurrent threads and rows processed at time by a thread");
+    addParamsLine("  [--insertion <mode=rows>]      : How the threads insert the images in the volume");
+    addParamsLine("         where <mode>");
+    addParamsLine("           rows                  : All threads share the rows of each image");
+    addParamsLine("           images <volumes=0>    : Each thread inserts whole images in one of the partial volumes");
+    addParamsLine("                                 : (0 means one per thread). Every partial volume needs the memory of");
+    addParamsLine("                                 : the Fourier volume and its weights, use fewer volumes for large boxes");
     addParamsLine("  [--blob <radius=1.9> <order=0> <alpha=15>] : Blob parameters");
     addParamsLine("                                 : radius in pixels, order of Bessel function in blob and parameter alpha");
     addParamsLine("  [--useCTF]                     : Use CTF information if present");
@@ -52,6 +58,9 @@ void ProgRecFourier::defineParams()
     addParamsLine("  [--phaseFlipped]               : Give this flag if images have been already phase flipped");
     addParamsLine("  [--minCTF <ctf=0.01>]          : Minimum value of the CTF that will be inverted");
     addParamsLine("                                 : CTF values (in absolute value) below this one will not be corrected");
+    addParamsLine("  [--ctfCache <MB=0> <step=1>]   : Memory for the cache of CTF images and its defocus quantization (A)");
+    addParamsLine("                                 : Particles with the same defocus (up to the step) share the CTF image.");
+    addParamsLine("                                 : By default, the exact CTF of each particle is used");
     addExampleLine("For reconstruct enforcing i3 symmetry and using stored weights:", false);
     addExampleLine("   xmipp_reconstruct_fourier  -i reconstruction.sel --sym i3 --weight");
 }
@@ -73,12 +82,22 @@ void ProgRecFourier::readParams()
     maxResolution = getDoubleParam("--max_resolution");
     numThreads = getIntParam("--thr");
     thrWidth = getIntParam("--thr", 1);
+    insertWholeImages = String(getParam("--insertion")) == "images";
+    numPartialVolumes = insertWholeImages ? getIntParam("--insertion", 1) : 1;
+    if (numPartialVolumes<=0 || numPartialVolumes>numThreads)
+        numPartialVolumes = numThreads;
     NiterWeight = getIntParam("--iter");
     useCTF = checkParam("--useCTF");
     phaseFlipped = checkParam("--phaseFlipped");
     minCTF = getDoubleParam("--minCTF");
+    ctfCacheMB = 0;
     if (useCTF)
+    {
         Ts=getDoubleParam("--sampling");
+        ctfCacheMB=getDoubleParam("--ctfCache", 0);
+        ctfCache.setMaxMemory(ctfCacheMB);
+        ctfCache.setDefocusStep(getDoubleParam("--ctfCache", 1), 0.01);
+    }
 }
 
 // Show ====================================================================
@@ -112,6 +131,7 @@ void ProgRecFourier::show()
         << "\n   blalpha               : "  << blob.alpha
         //<< "\n sampling_rate           : "  << sampling_rate
         << "\n max_resolution          : "  << maxResolution
+        << "\n insertion               : "  << (insertWholeImages ? "images" : "rows")
         << "\n -----------------------------------------------------------------" << std::endl;
     }
 }
@@ -174,6 +194,8 @@ void ProgRecFourier::run()
     }
     free(th_ids);
     free(th_args);
+    partialFourier.clear();
+    partialWeights.clear();
 }
 
 
@@ -282,6 +304,338 @@ void ProgRecFourier::produceSideinfo()
     }
 }
 
+void InsertionTables::initialize(int volPadSizeX, int volPadSizeY, int volPadSizeZ)
+{
+    zWrapped.resize(3*volPadSizeZ);
+    zWrapped.initConstant(-1);
+    yWrapped.resize(3*volPadSizeY);
+    yWrapped.initConstant(-1);
+    xWrapped.resize(3*volPadSizeX);
+    xWrapped.initConstant(-1);
+    zWrapped.setXmippOrigin();
+    yWrapped.setXmippOrigin();
+    xWrapped.setXmippOrigin();
+    zNegWrapped=zWrapped;
+    yNegWrapped=yWrapped;
+    xNegWrapped=xWrapped;
+
+    x2precalculated.resize(XSIZE(xWrapped));
+    x2precalculated.initConstant(-1);
+    y2precalculated.resize(XSIZE(yWrapped));
+    y2precalculated.initConstant(-1);
+    z2precalculated.resize(XSIZE(zWrapped));
+    z2precalculated.initConstant(-1);
+    x2precalculated.setXmippOrigin();
+    y2precalculated.setXmippOrigin();
+    z2precalculated.setXmippOrigin();
+}
+
+void ProgRecFourier::insertImageRow(int i, const MultidimArray< std::complex<double> > &paddedFourier,
+                                    const Matrix2D<double> &A_SL, const MultidimArray<double> *ctfImage,
+                                    double weight, bool reprocessFlag,
+                                    MultidimArray< std::complex<double> > &VoutFourier,
+                                    MultidimArray<double> &fourierWeights, InsertionTables &tables) const
+{
+    // Loop over all Fourier coefficients in the padded image
+    Matrix1D<double> freq(3), real_position(3);
+    Matrix1D<int> corner1(3), corner2(3);
+
+    // Some alias and calculations moved from heavy loops
+    double wCTF=1, wModulator=1.0;
+    double blobRadiusSquared = blob.radius * blob.radius;
+    int xsize_1 = XSIZE(VoutFourier) - 1;
+    int zsize_1 = ZSIZE(VoutFourier) - 1;
+    MultidimArray<int> &zWrapped=tables.zWrapped, &yWrapped=tables.yWrapped, &xWrapped=tables.xWrapped;
+    MultidimArray<int> &zNegWrapped=tables.zNegWrapped, &yNegWrapped=tables.yNegWrapped, &xNegWrapped=tables.xNegWrapped;
+    MultidimArray<double> &x2precalculated=tables.x2precalculated, &y2precalculated=tables.y2precalculated,
+                          &z2precalculated=tables.z2precalculated;
+    for (int j=STARTINGX(paddedFourier); j<=FINISHINGX(paddedFourier); j++)
+    {
+        // Compute the frequency of this coefficient in the
+        // universal coordinate system
+        FFT_IDX2DIGFREQ(j,XSIZE(paddedImg),XX(freq));
+        FFT_IDX2DIGFREQ(i,YSIZE(paddedImg),YY(freq));
+        ZZ(freq)=0;
+        if (XX(freq)*XX(freq)+YY(freq)*YY(freq)>maxResolution2)
+            continue;
+        wModulator=1.0;
+        if (ctfImage!=NULL && !reprocessFlag)
+        {
+            wCTF=DIRECT_A2D_ELEM(*ctfImage,i,j);
+
+            if (std::isnan(wCTF))
+            {
+                if (i==0 && j==0)
+                    wModulator=wCTF=1.0;
+                else
+                    wModulator=wCTF=0.0;
+            }
+            if (fabs(wCTF)<minCTF)
+            {
+                wModulator=fabs(wCTF);
+                wCTF=SGN(wCTF);
+            }
+            else
+                wCTF=1.0/wCTF;
+            if (phaseFlipped)
+                wCTF=fabs(wCTF);
+        }
+
+        SPEED_UP_temps012;
+        M3x3_BY_V3x1(freq,A_SL,freq);
+
+        // Look for the corresponding index in the volume Fourier transform
+        DIGFREQ2FFT_IDX_DOUBLE(XX(freq),volPadSizeX,XX(real_position));
+        DIGFREQ2FFT_IDX_DOUBLE(YY(freq),volPadSizeY,YY(real_position));
+        DIGFREQ2FFT_IDX_DOUBLE(ZZ(freq),volPadSizeZ,ZZ(real_position));
+
+        // Put a box around that coefficient
+        XX(corner1)=CEIL (XX(real_position)-blob.radius);
+        YY(corner1)=CEIL (YY(real_position)-blob.radius);
+        ZZ(corner1)=CEIL (ZZ(real_position)-blob.radius);
+        XX(corner2)=FLOOR(XX(real_position)+blob.radius);
+        YY(corner2)=FLOOR(YY(real_position)+blob.radius);
+        ZZ(corner2)=FLOOR(ZZ(real_position)+blob.radius);
+
+#ifdef DEBUG
+
+        std::cout << "Idx Img=(0," << i << "," << j << ") -> Freq Img=("
+        << freq.transpose() << ") ->\n    Idx Vol=("
+        << real_position.transpose() << ")\n"
+        << "   Corner1=" << corner1.transpose() << std::endl
+        << "   Corner2=" << corner2.transpose() << std::endl;
+#endif
+        // Loop within the box
+        const double *ptrIn=(const double *)&(A2D_ELEM(paddedFourier, i,j));
+
+        // Some precalculations
+        for (int intz = ZZ(corner1); intz <= ZZ(corner2); ++intz)
+        {
+            double z = intz - ZZ(real_position);
+            A1D_ELEM(z2precalculated,intz)=z*z;
+            if (A1D_ELEM(zWrapped,intz)<0)
+            {
+                int iz, izneg;
+                fastIntWRAP(iz, intz, 0, zsize_1);
+                A1D_ELEM(zWrapped,intz)=iz;
+                int miz=-iz;
+                fastIntWRAP(izneg, miz,0,zsize_1);
+                A1D_ELEM(zNegWrapped,intz)=izneg;
+            }
+        }
+        for (int inty = YY(corner1); inty <= YY(corner2); ++inty)
+        {
+            double y = inty - YY(real_position);
+            A1D_ELEM(y2precalculated,inty)=y*y;
+            if (A1D_ELEM(yWrapped,inty)<0)
+            {
+                int iy, iyneg;
+                fastIntWRAP(iy, inty, 0, zsize_1);
+                A1D_ELEM(yWrapped,inty)=iy;
+                int miy=-iy;
+                fastIntWRAP(iyneg, miy,0,zsize_1);
+                A1D_ELEM(yNegWrapped,inty)=iyneg;
+            }
+        }
+        for (int intx = XX(corner1); intx <= XX(corner2); ++intx)
+        {
+            double x = intx - XX(real_position);
+            A1D_ELEM(x2precalculated,intx)=x*x;
+            if (A1D_ELEM(xWrapped,intx)<0)
+            {
+                int ix, ixneg;
+                fastIntWRAP(ix, intx, 0, zsize_1);
+                A1D_ELEM(xWrapped,intx)=ix;
+                int mix=-ix;
+                fastIntWRAP(ixneg, mix,0,zsize_1);
+                A1D_ELEM(xNegWrapped,intx)=ixneg;
+            }
+        }
+
+        // Actually compute
+        for (int intz = ZZ(corner1); intz <= ZZ(corner2); ++intz)
+        {
+            double z2 = A1D_ELEM(z2precalculated,intz);
+            int iz=A1D_ELEM(zWrapped,intz);
+            int izneg=A1D_ELEM(zNegWrapped,intz);
+
+            for (int inty = YY(corner1); inty <= YY(corner2); ++inty)
+            {
+                double y2z2 = A1D_ELEM(y2precalculated,inty) + z2;
+                if (y2z2 > blobRadiusSquared)
+                    continue;
+                int iy=A1D_ELEM(yWrapped,inty);
+                int iyneg=A1D_ELEM(yNegWrapped,inty);
+
+                int	size1=YXSIZE(VoutFourier)*(izneg)+((iyneg)*XSIZE(VoutFourier));
+                int	size2=YXSIZE(VoutFourier)*(iz)+((iy)*XSIZE(VoutFourier));
+                int	fixSize=0;
+
+                for (int intx = XX(corner1); intx <= XX(corner2); ++intx)
+                {
+                    // Compute distance to the center of the blob
+                    // Compute blob value at that distance
+                    double d2 = A1D_ELEM(x2precalculated,intx) + y2z2;
+
+                    if (d2 > blobRadiusSquared)
+                        continue;
+                    int aux = (int)(d2 * iDeltaSqrt + 0.5);//Same as ROUND but avoid comparison
+                    double w = VEC_ELEM(blobTableSqrt, aux)*weight *wModulator;
+
+                    // Look for the location of this logical index
+                    // in the physical layout
+                    int ix=A1D_ELEM(xWrapped,intx);
+
+                    bool conjugate=false;
+                    int izp, iyp, ixp;
+                    if (ix > xsize_1)
+                    {
+                        izp = izneg;
+                        iyp = iyneg;
+                        ixp = A1D_ELEM(xNegWrapped,intx);
+                        conjugate=true;
+                        fixSize = size1;
+                    }
+                    else
+                    {
+                        izp=iz;
+                        iyp=iy;
+                        ixp=ix;
+                        fixSize = size2;
+                    }
+#ifdef DEBUG
+                    std::cout << "   3: ix=" << ix << " iy=" << iy
+                    << " iz=" << iz << " conj="
+                    << conjugate << std::endl;
+#endif
+
+                    // Add the weighted coefficient
+                    if (reprocessFlag)
+                    {
+                        // Use VoutFourier as temporary to save the memory
+                        double *ptrOut=(double *)&(DIRECT_A3D_ELEM(VoutFourier, izp,iyp,ixp));
+                        DIRECT_A3D_ELEM(fourierWeights, izp,iyp,ixp) += (w * ptrOut[0]);
+                    }
+                    else
+                    {
+                        double wEffective=w*wCTF;
+                        size_t memIdx=fixSize + ixp;//YXSIZE(VoutFourier)*(izp)+((iyp)*XSIZE(VoutFourier))+(ixp);
+                        double *ptrOut=(double *)&(DIRECT_A1D_ELEM(VoutFourier, memIdx));
+                        ptrOut[0] += wEffective * ptrIn[0];
+                        DIRECT_A1D_ELEM(fourierWeights, memIdx) += w;
+
+                        if (conjugate)
+                            ptrOut[1]-=wEffective*ptrIn[1];
+                        else
+                            ptrOut[1]+=wEffective*ptrIn[1];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ProgRecFourier::insertWholeImage(ImageThreadParams *threadParams, InsertionTables &tables)
+{
+    const MultidimArray< std::complex<double> > &paddedFourier=*(threadParams->localPaddedFourier);
+    double weight=threadParams->localweight;
+    if (weight==0.0)
+        return;
+    bool reprocessFlag=threadParams->reprocessFlag;
+
+    // Take a free partial volume, starting by the one of this thread
+    int v0=threadParams->myThreadID % numPartialVolumes;
+    int v=-1;
+    for (int n=0; n<numPartialVolumes && v<0; n++)
+    {
+        int candidate=(v0+n) % numPartialVolumes;
+        if (partialMutex[candidate].try_lock())
+            v=candidate;
+    }
+    if (v<0)
+    {
+        v=v0;
+        partialMutex[v].lock();
+    }
+    // When reprocessing, VoutFourier is only read and the weights are accumulated
+    MultidimArray< std::complex<double> > &fourier=(v==0 || reprocessFlag) ? VoutFourier : partialFourier[v];
+    MultidimArray<double> &weights=(v==0) ? FourierWeights : partialWeights[v];
+
+    // Rows above the maximum resolution are not inserted
+    int ydim=YSIZE(paddedFourier);
+    int conserveRows=(int)ceil((double)ydim * maxResolution * 2.0);
+    conserveRows=(int)ceil((double)conserveRows/2.0);
+    for (size_t isym = 0; isym < R_repository.size(); isym++)
+    {
+        Matrix2D<double> A_SL=R_repository[isym]*(*(threadParams->localAInv));
+        for (int i=0; i<ydim; i++)
+            if (i < conserveRows || i >= ydim-conserveRows)
+                insertImageRow(i, paddedFourier, A_SL, threadParams->localCtfImage, weight, reprocessFlag,
+                               fourier, weights, tables);
+    }
+    partialMutex[v].unlock();
+}
+
+void ProgRecFourier::preparePartialVolumes(bool reprocessFlag)
+{
+    if (!partialMutex || (int)partialWeights.size()!=numPartialVolumes)
+    {
+        partialMutex.reset(new std::mutex[numPartialVolumes]);
+        partialFourier.resize(numPartialVolumes);
+        partialWeights.resize(numPartialVolumes);
+    }
+    // The first partial volume is VoutFourier itself
+    for (int v=1; v<numPartialVolumes; v++)
+    {
+        if (reprocessFlag)
+            partialFourier[v].clear();
+        else if (!partialFourier[v].sameShape(VoutFourier))
+            partialFourier[v].initZeros(VoutFourier);
+        if (!partialWeights[v].sameShape(FourierWeights))
+            partialWeights[v].initZeros(FourierWeights);
+    }
+}
+
+void ProgRecFourier::reducePartialVolumes()
+{
+    if (numPartialVolumes<=1)
+        return;
+    threadOpCode = REDUCE_PARTIAL_VOLUMES;
+    // Awake threads
+    barrier_wait( &barrier );
+    // Threads are working now, wait for them to finish
+    barrier_wait( &barrier );
+}
+
+void ProgRecFourier::reducePartialSlices(int firstSlice, int step)
+{
+    size_t sliceSize=YXSIZE(FourierWeights);
+    for (size_t k=firstSlice; k<ZSIZE(FourierWeights); k+=step)
+    {
+        size_t offset=k*sliceSize;
+        for (int v=1; v<numPartialVolumes; v++)
+        {
+            double *ptrWeights=MULTIDIM_ARRAY(FourierWeights)+offset;
+            double *ptrPartialWeights=MULTIDIM_ARRAY(partialWeights[v])+offset;
+            for (size_t n=0; n<sliceSize; n++)
+            {
+                ptrWeights[n]+=ptrPartialWeights[n];
+                ptrPartialWeights[n]=0;
+            }
+            if (partialFourier[v].nzyxdim>0)
+            {
+                std::complex<double> *ptrFourier=MULTIDIM_ARRAY(VoutFourier)+offset;
+                std::complex<double> *ptrPartialFourier=MULTIDIM_ARRAY(partialFourier[v])+offset;
+                for (size_t n=0; n<sliceSize; n++)
+                {
+                    ptrFourier[n]+=ptrPartialFourier[n];
+                    ptrPartialFourier[n]=0;
+                }
+            }
+        }
+    }
+}
+
 void * ProgRecFourier::processImageThread( void * threadArgs )
 {
 
@@ -300,6 +654,8 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
 
     Matrix2D<double>  localA(3, 3), localAinv(3, 3);
     MultidimArray< std::complex<double> > localPaddedFourier;
+    CTFImageCache::ImagePtr localCtfImage;
+    MultidimArray<double> localExactCtfImage;
     MultidimArray<double> localPaddedImg;
     FourierTransformer localTransformerImg;
 
@@ -308,25 +664,8 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
     threadParams->selFile->findObjects(objId);
     ApplyGeoParams params;
     params.only_apply_shifts = true;
-    MultidimArray<int> zWrapped(3*parent->volPadSizeZ),yWrapped(3*parent->volPadSizeY),xWrapped(3*parent->volPadSizeX),
-    zNegWrapped, yNegWrapped, xNegWrapped;
-    zWrapped.initConstant(-1);
-    yWrapped.initConstant(-1);
-    xWrapped.initConstant(-1);
-    zWrapped.setXmippOrigin();
-    yWrapped.setXmippOrigin();
-    xWrapped.setXmippOrigin();
-    zNegWrapped=zWrapped;
-    yNegWrapped=yWrapped;
-    xNegWrapped=xWrapped;
-
-    MultidimArray<double> x2precalculated(XSIZE(xWrapped)), y2precalculated(XSIZE(yWrapped)), z2precalculated(XSIZE(zWrapped));
-    x2precalculated.initConstant(-1);
-    y2precalculated.initConstant(-1);
-    z2precalculated.initConstant(-1);
-    x2precalculated.setXmippOrigin();
-    y2precalculated.setXmippOrigin();
-    z2precalculated.setXmippOrigin();
+    InsertionTables tables;
+    tables.initialize(parent->volPadSizeX, parent->volPadSizeY, parent->volPadSizeZ);
 
     bool hasCTF=(threadParams->selFile->containsLabel(MDL_CTF_MODEL) || threadParams->selFile->containsLabel(MDL_CTF_DEFOCUSU)) &&
                 parent->useCTF;
@@ -360,11 +699,26 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                     tilt = proj.tilt();
                     psi  = proj.psi();
                     weight = proj.weight();
-                    if (hasCTF)
+                    threadParams->localCtfImage = NULL;
+                    if (hasCTF && !threadParams->reprocessFlag)
                     {
                         threadParams->ctf.readFromMetadataRow(*(threadParams->selFile),objId[threadParams->imageIndex]);
                         // threadParams->ctf.Tm=threadParams->parent->Ts;
+                        threadParams->ctf.K=1; // Pure CTF without gain
                         threadParams->ctf.produceSideInfo();
+                        if (parent->ctfCacheMB>0)
+                        {
+                            localCtfImage=parent->ctfCache.getImage(threadParams->ctf,
+                                          YSIZE(parent->paddedImg), XSIZE(parent->paddedImg), parent->Ts);
+                            threadParams->localCtfImage = localCtfImage.get();
+                        }
+                        else
+                        {
+                            // The image is in use until the next image is preloaded
+                            threadParams->ctf.generateCTFFast(YSIZE(parent->paddedImg), XSIZE(parent->paddedImg),
+                                                              localExactCtfImage, parent->Ts);
+                            threadParams->localCtfImage = &localExactCtfImage;
+                        }
                     }
 
                     threadParams->weight = 1.;
@@ -486,10 +840,6 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                 bool breakCase;
                 bool assigned;
 
-                // Get the inverse of the sampling rate
-                // double iTs=parent->padding_factor_proj/parent->Ts;
-                double iTs=1.0/parent->Ts; // The padding factor is not considered here, but later when the indexes
-                //                         // are converted to digital frequencies
                 do
                 {
                     minAssignedRow = -1;
@@ -562,230 +912,15 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                         break;
                     }
 
-                    Matrix2D<double> * A_SL = threadParams->symmetry;
-
-                    // Loop over all Fourier coefficients in the padded image
-                    Matrix1D<double> freq(3), gcurrent(3), real_position(3), contFreq(3);
-                    Matrix1D<int> corner1(3), corner2(3);
-
-                    // Some alias and calculations moved from heavy loops
-                    double wCTF=1, wModulator=1.0;
-                    double blobRadiusSquared = parent->blob.radius * parent->blob.radius;
-                    double iDeltaSqrt = parent->iDeltaSqrt;
-                    Matrix1D<double> & blobTableSqrt = parent->blobTableSqrt;
-                    int xsize_1 = XSIZE(parent->VoutFourier) - 1;
-                    int zsize_1 = ZSIZE(parent->VoutFourier) - 1;
-                    MultidimArray< std::complex<double> > &VoutFourier=parent->VoutFourier;
-                    MultidimArray<double> &fourierWeights = parent->FourierWeights;
-                    //                    MultidimArray<double> &prefourierWeights = parent->preFourierWeights;
-                    // Get i value for the thread
+                    // Insert the rows assigned to this thread
+                    const MultidimArray<double> *ctfImage = hasCTF ? threadParams->ctfImage : NULL;
                     for (int i = minAssignedRow; i <= maxAssignedRow ; i ++ )
                     {
                         // Discarded rows can be between minAssignedRow and maxAssignedRow, check
                         if ( statusArray[i] == -1 )
-                            for (int j=STARTINGX(*paddedFourier); j<=FINISHINGX(*paddedFourier); j++)
-                            {
-                                // Compute the frequency of this coefficient in the
-                                // universal coordinate system
-                                FFT_IDX2DIGFREQ(j,XSIZE(parent->paddedImg),XX(freq));
-                                FFT_IDX2DIGFREQ(i,YSIZE(parent->paddedImg),YY(freq));
-                                ZZ(freq)=0;
-                                if (XX(freq)*XX(freq)+YY(freq)*YY(freq)>parent->maxResolution2)
-                                    continue;
-                                wModulator=1.0;
-                                if (hasCTF && !reprocessFlag)
-                                {
-                                    XX(contFreq)=XX(freq)*iTs;
-                                    YY(contFreq)=YY(freq)*iTs;
-                                    threadParams->ctf.precomputeValues(XX(contFreq),YY(contFreq));
-                                    //wCTF=threadParams->ctf.getValueAt();
-                                    wCTF=threadParams->ctf.getValuePureNoKAt();
-                                    //wCTF=threadParams->ctf.getValuePureWithoutDampingAt();
-
-                                    if (std::isnan(wCTF))
-                                    {
-                                    	if (i==0 && j==0)
-                                    		wModulator=wCTF=1.0;
-                                    	else
-                                    		wModulator=wCTF=0.0;
-                                    }
-                                    if (fabs(wCTF)<parent->minCTF)
-                                    {
-                                        wModulator=fabs(wCTF);
-                                        wCTF=SGN(wCTF);
-                                    }
-                                    else
-                                        wCTF=1.0/wCTF;
-                                    if (parent->phaseFlipped)
-                                        wCTF=fabs(wCTF);
-                                }
-
-                                SPEED_UP_temps012;
-                                M3x3_BY_V3x1(freq,*A_SL,freq);
-
-                                // Look for the corresponding index in the volume Fourier transform
-                                DIGFREQ2FFT_IDX_DOUBLE(XX(freq),parent->volPadSizeX,XX(real_position));
-                                DIGFREQ2FFT_IDX_DOUBLE(YY(freq),parent->volPadSizeY,YY(real_position));
-                                DIGFREQ2FFT_IDX_DOUBLE(ZZ(freq),parent->volPadSizeZ,ZZ(real_position));
-
-                                // Put a box around that coefficient
-                                XX(corner1)=CEIL (XX(real_position)-parent->blob.radius);
-                                YY(corner1)=CEIL (YY(real_position)-parent->blob.radius);
-                                ZZ(corner1)=CEIL (ZZ(real_position)-parent->blob.radius);
-                                XX(corner2)=FLOOR(XX(real_position)+parent->blob.radius);
-                                YY(corner2)=FLOOR(YY(real_position)+parent->blob.radius);
-                                ZZ(corner2)=FLOOR(ZZ(real_position)+parent->blob.radius);
-
-#ifdef DEBUG
-
-                                std::cout << "Idx Img=(0," << i << "," << j << ") -> Freq Img=("
-                                << freq.transpose() << ") ->\n    Idx Vol=("
-                                << real_position.transpose() << ")\n"
-                                << "   Corner1=" << corner1.transpose() << std::endl
-                                << "   Corner2=" << corner2.transpose() << std::endl;
-#endif
-                                // Loop within the box
-                                double *ptrIn=(double *)&(A2D_ELEM(*paddedFourier, i,j));
-
-                                // Some precalculations
-                                for (int intz = ZZ(corner1); intz <= ZZ(corner2); ++intz)
-                                {
-                                    double z = intz - ZZ(real_position);
-                                    A1D_ELEM(z2precalculated,intz)=z*z;
-                                    if (A1D_ELEM(zWrapped,intz)<0)
-                                    {
-                                        int iz, izneg;
-                                        fastIntWRAP(iz, intz, 0, zsize_1);
-                                        A1D_ELEM(zWrapped,intz)=iz;
-                                        int miz=-iz;
-                                        fastIntWRAP(izneg, miz,0,zsize_1);
-                                        A1D_ELEM(zNegWrapped,intz)=izneg;
-                                    }
-                                }
-                                for (int inty = YY(corner1); inty <= YY(corner2); ++inty)
-                                {
-                                    double y = inty - YY(real_position);
-                                    A1D_ELEM(y2precalculated,inty)=y*y;
-                                    if (A1D_ELEM(yWrapped,inty)<0)
-                                    {
-                                        int iy, iyneg;
-                                        fastIntWRAP(iy, inty, 0, zsize_1);
-                                        A1D_ELEM(yWrapped,inty)=iy;
-                                        int miy=-iy;
-                                        fastIntWRAP(iyneg, miy,0,zsize_1);
-                                        A1D_ELEM(yNegWrapped,inty)=iyneg;
-                                    }
-                                }
-                                for (int intx = XX(corner1); intx <= XX(corner2); ++intx)
-                                {
-                                    double x = intx - XX(real_position);
-                                    A1D_ELEM(x2precalculated,intx)=x*x;
-                                    if (A1D_ELEM(xWrapped,intx)<0)
-                                    {
-                                        int ix, ixneg;
-                                        fastIntWRAP(ix, intx, 0, zsize_1);
-                                        A1D_ELEM(xWrapped,intx)=ix;
-                                        int mix=-ix;
-                                        fastIntWRAP(ixneg, mix,0,zsize_1);
-                                        A1D_ELEM(xNegWrapped,intx)=ixneg;
-                                    }
-                                }
-
-                                // Actually compute
-                                for (int intz = ZZ(corner1); intz <= ZZ(corner2); ++intz)
-                                {
-                                    double z2 = A1D_ELEM(z2precalculated,intz);
-                                    int iz=A1D_ELEM(zWrapped,intz);
-                                    int izneg=A1D_ELEM(zNegWrapped,intz);
-
-                                    for (int inty = YY(corner1); inty <= YY(corner2); ++inty)
-                                    {
-                                        double y2z2 = A1D_ELEM(y2precalculated,inty) + z2;
-                                        if (y2z2 > blobRadiusSquared)
-                                            continue;
-                                        int iy=A1D_ELEM(yWrapped,inty);
-                                        int iyneg=A1D_ELEM(yNegWrapped,inty);
-
-                                        int	size1=YXSIZE(VoutFourier)*(izneg)+((iyneg)*XSIZE(VoutFourier));
-                                        int	size2=YXSIZE(VoutFourier)*(iz)+((iy)*XSIZE(VoutFourier));
-                                        int	fixSize=0;
-
-                                        for (int intx = XX(corner1); intx <= XX(corner2); ++intx)
-                                        {
-                                            // Compute distance to the center of the blob
-                                            // Compute blob value at that distance
-                                            double d2 = A1D_ELEM(x2precalculated,intx) + y2z2;
-
-                                            if (d2 > blobRadiusSquared)
-                                                continue;
-                                            int aux = (int)(d2 * iDeltaSqrt + 0.5);//Same as ROUND but avoid comparison
-                                            double w = VEC_ELEM(blobTableSqrt, aux)*threadParams->weight *wModulator;
-
-                                            // Look for the location of this logical index
-                                            // in the physical layout
-#ifdef DEBUG
-
-                                            std::cout << "   gcurrent=" << gcurrent.transpose()
-                                            << " d=" << d << std::endl;
-                                            std::cout << "   1: intx=" << intx
-                                            << " inty=" << inty
-                                            << " intz=" << intz << std::endl;
-#endif
-
-                                            int ix=A1D_ELEM(xWrapped,intx);
-#ifdef DEBUG
-
-                                            std::cout << "   2: ix=" << ix << " iy=" << iy
-                                            << " iz=" << iz << std::endl;
-#endif
-
-                                            bool conjugate=false;
-                                            int izp, iyp, ixp;
-                                            if (ix > xsize_1)
-                                            {
-                                                izp = izneg;
-                                                iyp = iyneg;
-                                                ixp = A1D_ELEM(xNegWrapped,intx);
-                                                conjugate=true;
-                                                fixSize = size1;
-                                            }
-                                            else
-                                            {
-                                                izp=iz;
-                                                iyp=iy;
-                                                ixp=ix;
-                                                fixSize = size2;
-                                            }
-#ifdef DEBUG
-                                            std::cout << "   3: ix=" << ix << " iy=" << iy
-                                            << " iz=" << iz << " conj="
-                                            << conjugate << std::endl;
-#endif
-
-                                            // Add the weighted coefficient
-                                            if (reprocessFlag)
-                                            {
-                                                // Use VoutFourier as temporary to save the memory
-                                                double *ptrOut=(double *)&(DIRECT_A3D_ELEM(VoutFourier, izp,iyp,ixp));
-                                                DIRECT_A3D_ELEM(fourierWeights, izp,iyp,ixp) += (w * ptrOut[0]);
-                                            }
-                                            else
-                                            {
-                                                double wEffective=w*wCTF;
-                                                size_t memIdx=fixSize + ixp;//YXSIZE(VoutFourier)*(izp)+((iyp)*XSIZE(VoutFourier))+(ixp);
-                                                double *ptrOut=(double *)&(DIRECT_A1D_ELEM(VoutFourier, memIdx));
-                                                ptrOut[0] += wEffective * ptrIn[0];
-                                                DIRECT_A1D_ELEM(fourierWeights, memIdx) += w;
-
-                                                if (conjugate)
-                                                    ptrOut[1]-=wEffective*ptrIn[1];
-                                                else
-                                                    ptrOut[1]+=wEffective*ptrIn[1];
-                                            }
-                                        }
-                                    }
-                                }
-                            }
+                            parent->insertImageRow(i, *paddedFourier, *(threadParams->symmetry), ctfImage,
+                                                   threadParams->weight, reprocessFlag,
+                                                   parent->VoutFourier, parent->FourierWeights, tables);
                     }
 
                     pthread_mutex_lock( &(parent->workLoadMutex) );
@@ -818,6 +953,17 @@ void * ProgRecFourier::processImageThread( void * threadArgs )
                 while (!breakCase);
                 break;
             }
+        case PROCESS_OWN_IMAGE:
+            {
+                if ( threadParams->read == 1 )
+                    parent->insertWholeImage(threadParams, tables);
+                break;
+            }
+        case REDUCE_PARTIAL_VOLUMES:
+            {
+                parent->reducePartialSlices(threadParams->myThreadID, parent->numThreads);
+                break;
+            }
         default:
             break;
         }
@@ -845,13 +991,21 @@ void ProgRecFourier::processImages( int firstImageIndex, int lastImageIndex, boo
     // FSC purposes
     int current_index;
 
+    if (insertWholeImages)
+        preparePartialVolumes(reprocessFlag);
+
     do
     {
         threadOpCode = PRELOAD_IMAGE;
 
+        // Do not mix images of both FSC halves in the same round
+        int roundLastIndex = lastImageIndex;
+        if ( saveFSC && imgIndex <= FSCIndex )
+            roundLastIndex = FSCIndex;
+
         for ( int nt = 0 ; nt < numThreads ; nt ++ )
         {
-            if ( imgIndex <= lastImageIndex )
+            if ( imgIndex <= roundLastIndex )
             {
                 th_args[nt].imageIndex = imgIndex;
                 th_args[nt].reprocessFlag = reprocessFlag;
@@ -870,6 +1024,14 @@ void ProgRecFourier::processImages( int firstImageIndex, int lastImageIndex, boo
         // processing current projection
         barrier_wait( &barrier );
 
+        if (insertWholeImages)
+        {
+            // each thread inserts its own image in a partial volume
+            threadOpCode = PROCESS_OWN_IMAGE;
+            barrier_wait( &barrier );
+            barrier_wait( &barrier );
+        }
+
         // each threads have read a different image and now
         // all the thread will work in a different part of a single image.
         threadOpCode = PROCESS_IMAGE;
@@ -911,81 +1073,88 @@ void ProgRecFourier::processImages( int firstImageIndex, int lastImageIndex, boo
 #endif
                 #undef DEBUG22
 
-                // Initialized just once
-                if ( statusArray == NULL )
-                {
-                    statusArray = (int *) malloc ( sizeof(int) * paddedFourier->ydim );
-                }
-
-                // Determine how many rows of the fourier
-                // transform are of interest for us. This is because
-                // the user can avoid to explore at certain resolutions
-                size_t conserveRows=(size_t)ceil((double)paddedFourier->ydim * maxResolution * 2.0);
-                conserveRows=(size_t)ceil((double)conserveRows/2.0);
-
-                // Loop over all symmetries
-                for (size_t isym = 0; isym < R_repository.size(); isym++)
+                if (!insertWholeImages)
                 {
-                    rowsProcessed = 0;
-
-                    // Compute the coordinate axes of the symmetrized projection
-                    Matrix2D<double> A_SL=R_repository[isym]*(*Ainv);
-
-                    // Fill the thread arguments for each thread
-                    for ( int th = 0 ; th < numThreads ; th ++ )
+                    // Initialized just once
+                    if ( statusArray == NULL )
                     {
-                        // Passing parameters to each thread
-                        th_args[th].symmetry = &A_SL;
-                        th_args[th].paddedFourier = paddedFourier;
-                        th_args[th].weight = weight;
-                        th_args[th].reprocessFlag = reprocessFlag;
+                        statusArray = (int *) malloc ( sizeof(int) * paddedFourier->ydim );
                     }
 
-                    // Init status array
-                    for (size_t i = 0 ; i < paddedFourier->ydim ; i ++ )
+                    // Determine how many rows of the fourier
+                    // transform are of interest for us. This is because
+                    // the user can avoid to explore at certain resolutions
+                    size_t conserveRows=(size_t)ceil((double)paddedFourier->ydim * maxResolution * 2.0);
+                    conserveRows=(size_t)ceil((double)conserveRows/2.0);
+
+                    // Loop over all symmetries
+                    for (size_t isym = 0; isym < R_repository.size(); isym++)
                     {
-                        if ( i >= conserveRows && i < (paddedFourier->ydim-conserveRows))
+                        rowsProcessed = 0;
+
+                        // Compute the coordinate axes of the symmetrized projection
+                        Matrix2D<double> A_SL=R_repository[isym]*(*Ainv);
+
+                        // Fill the thread arguments for each thread
+                        for ( int th = 0 ; th < numThreads ; th ++ )
                         {
-                            // -2 means "discarded"
-                            statusArray[i] = -2;
-                            rowsProcessed++;
+                            // Passing parameters to each thread
+                            th_args[th].symmetry = &A_SL;
+                            th_args[th].paddedFourier = paddedFourier;
+                            th_args[th].ctfImage = th_args[nt].localCtfImage;
+                            th_args[th].weight = weight;
+                            th_args[th].reprocessFlag = reprocessFlag;
                         }
-                        else
+
+                        // Init status array
+                        for (size_t i = 0 ; i < paddedFourier->ydim ; i ++ )
                         {
-                            statusArray[i] = 0;
+                            if ( i >= conserveRows && i < (paddedFourier->ydim-conserveRows))
+                            {
+                                // -2 means "discarded"
+                                statusArray[i] = -2;
+                                rowsProcessed++;
+                            }
+                            else
+                            {
+                                statusArray[i] = 0;
+                            }
                         }
-                    }
 
-                    // Awaking sleeping threads
-                    barrier_wait( &barrier );
-                    // Threads are working now, wait for them to finish
-                    // processing current projection
-                    barrier_wait( &barrier );
+                        // Awaking sleeping threads
+                        barrier_wait( &barrier );
+                        // Threads are working now, wait for them to finish
+                        // processing current projection
+                        barrier_wait( &barrier );
 
-                    //#define DEBUG2
+                        //#define DEBUG2
 #ifdef DEBUG2
 
-                    {
-                        static int ii=0;
-                        if(ii%1==0)
                         {
-                            Image<double> save;
-                            save().alias( FourierWeights );
-                            save.write((std::string) integerToString(ii)  + "_1_Weights.vol");
+                            static int ii=0;
+                            if(ii%1==0)
+                            {
+                                Image<double> save;
+                                save().alias( FourierWeights );
+                                save.write((std::string) integerToString(ii)  + "_1_Weights.vol");
 
-                            Image< std::complex<double> > save2;
-                            save2().alias( VoutFourier );
-                            save2.write((std::string) integerToString(ii)  + "_1_Fourier.vol");
+                                Image< std::complex<double> > save2;
+                                save2().alias( VoutFourier );
+                                save2.write((std::string) integerToString(ii)  + "_1_Fourier.vol");
+                            }
+                            ii++;
                         }
-                        ii++;
-                    }
 #endif
-                    #undef DEBUG2
+                        #undef DEBUG2
 
+                    }
                 }
 
                 if ( current_index == FSCIndex && saveFSC )
                 {
+                    if (insertWholeImages)
+                        reducePartialVolumes();
+
                     // Save Current Fourier, Reconstruction and Weights
                     Image<double> save;
                     save().alias( FourierWeights );
@@ -1008,6 +1177,9 @@ void ProgRecFourier::processImages( int firstImageIndex, int lastImageIndex, boo
     }
     while ( processed );
 
+    if (insertWholeImages)
+        reducePartialVolumes();
+
     if( saveFSC )
     {
         // Save Current Fourier, Reconstruction and Weights
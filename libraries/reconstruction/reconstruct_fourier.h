@@ -30,6 +30,9 @@
 #define __RECONSTRUCT_FOURIER_H
 
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <core/xmipp_fftw.h>
 #include <core/xmipp_funcs.h>
 #include <core/xmipp_image.h>
@@ -38,6 +41,7 @@
 #include <data/blobs.h>
 #include <core/metadata.h>
 #include <data/ctf.h>
+#include <data/ctf_image_cache.h>
 
 #include <core/args.h>
 #include <core/xmipp_fft.h>
@@ -58,6 +62,8 @@
 #define PROCESS_IMAGE 1
 #define PROCESS_WEIGHTS 2
 #define PRELOAD_IMAGE 3
+#define PROCESS_OWN_IMAGE 4
+#define REDUCE_PARTIAL_VOLUMES 5
 
 /**@defgroup FourierReconstruction Fourier reconstruction
    @ingroup ReconsLibrary */
@@ -73,6 +79,8 @@ struct ImageThreadParams
     MultidimArray< std::complex<double> > *paddedFourier;
     MultidimArray< std::complex<double> > *localPaddedFourier;
     CTFDescription ctf;
+    const MultidimArray<double> *ctfImage;
+    const MultidimArray<double> *localCtfImage;
     Matrix2D<double> * symmetry;
     int read;
     Matrix2D<double> * localAInv;
@@ -83,6 +91,16 @@ struct ImageThreadParams
     MetaData * selFile;
 };
 
+/** Lookup tables used by a thread while inserting image rows in the volume */
+struct InsertionTables
+{
+    MultidimArray<int> zWrapped, yWrapped, xWrapped, zNegWrapped, yNegWrapped, xNegWrapped;
+    MultidimArray<double> x2precalculated, y2precalculated, z2precalculated;
+
+    /// Allocate the tables for a padded volume of this size
+    void initialize(int volPadSizeX, int volPadSizeY, int volPadSizeZ);
+};
+
 /** Fourier reconstruction parameters. */
 class ProgRecFourier : public ProgReconsBase
 {
@@ -107,6 +125,12 @@ public:
     /** Minimum CTF value to invert */
     double minCTF;
 
+    /** Memory of the CTF image cache (MB), 0 for no cache */
+    double ctfCacheMB;
+
+    /** CTF images shared by the particles with the same defocus */
+    CTFImageCache ctfCache;
+
     /** Sampling rate */
     double Ts;
 
@@ -155,6 +179,22 @@ public:
     /// How many image rows are processed at a time by a single thread.
     int thrWidth;
 
+    /** Each thread inserts whole images instead of sharing the rows of each image.
+     * The images are accumulated in partial volumes that are added to VoutFourier
+     * and FourierWeights at the end of processImages.
+     */
+    bool insertWholeImages;
+
+    /// Number of partial volumes, the first one is VoutFourier/FourierWeights itself
+    int numPartialVolumes;
+
+    /// Partial Fourier volumes and weights (the first element is not used)
+    std::vector< MultidimArray< std::complex<double> > > partialFourier;
+    std::vector< MultidimArray<double> > partialWeights;
+
+    /// A thread owns a partial volume while it inserts an image in it
+    std::unique_ptr<std::mutex[]> partialMutex;
+
 public: // Internal members
     // Size of the original images
     int imgSize;
@@ -222,6 +262,28 @@ public:
     /// Process one image
     void processImages( int firstImageIndex, int lastImageIndex, bool saveFSC=false, bool reprocessFlag=false);
 
+    /** Insert the row i of a Fourier image with orientation A_SL.
+     * When reprocessing, the weights are accumulated in fourierWeights using
+     * the real part of VoutFourier.
+     */
+    void insertImageRow(int i, const MultidimArray< std::complex<double> > &paddedFourier,
+                        const Matrix2D<double> &A_SL, const MultidimArray<double> *ctfImage,
+                        double weight, bool reprocessFlag,
+                        MultidimArray< std::complex<double> > &VoutFourier,
+                        MultidimArray<double> &fourierWeights, InsertionTables &tables) const;
+
+    /// Insert the image preloaded by a thread (all symmetries) in a free partial volume
+    void insertWholeImage(ImageThreadParams *threadParams, InsertionTables &tables);
+
+    /// Allocate the partial volumes for the whole image insertion
+    void preparePartialVolumes(bool reprocessFlag);
+
+    /// Add the partial volumes to VoutFourier and FourierWeights using all threads
+    void reducePartialVolumes();
+
+    /// Add and reset the slices firstSlice, firstSlice+step, ... of the partial volumes
+    void reducePartialSlices(int firstSlice, int step);
+
     /// Method for the correction of the fourier coefficients
     void correctWeight();
 
@@ -25,6 +25,12 @@
 
 #include "reconstruct_significant.h"
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <data/mask.h>
+#include "reconstruct_fourier.h"
+#include "symmetrize.h"
 
 // Define params
 ProgReconstructSignificant::ProgReconstructSignificant()
@@ -62,6 +68,15 @@ void ProgReconstructSignificant::defineParams()
     addParamsLine("  [--dontReconstruct]          : Do not reconstruct");
     addParamsLine("  [--useForValidation <numOrientationsPerParticle=10>] : Use the program for validation. This number defines the number of possible orientations per particle");
     addParamsLine("  [--dontCheckMirrors]         : Don't check mirrors in the alignment process");
+    addParamsLine("  [--thr <N=1>]                : Number of threads to align each image with the gallery");
+    addParamsLine("  [--coarseSearch <K=0>]       : Align each image only with the K gallery images with the highest");
+    addParamsLine("                               : rotational correlation. The rotational correlation does not search for shifts");
+    addParamsLine("                               : and is much cheaper than the alignment. By default, all gallery images are aligned");
+    addParamsLine("  [--checkCoarseSearch <n=0>]  : Compare the coarse search with the full search every n images of each process,");
+    addParamsLine("                               : and report how often they agree");
+    addParamsLine("  [--cacheImages <MB=2048>]    : Read the images only once and keep them in memory between iterations");
+    addParamsLine("                               : Each process keeps its share of the images. If they take more than MB,");
+    addParamsLine("                               : they are kept in a memory mapped file");
 
 }
 
@@ -90,6 +105,12 @@ void ProgReconstructSignificant::readParams()
     useForValidation=checkParam("--useForValidation");
     numOrientationsPerParticle = getIntParam("--useForValidation");
     dontCheckMirrors = checkParam("--dontCheckMirrors");
+    Nthreads = getIntParam("--thr");
+    coarseCandidates = getIntParam("--coarseSearch");
+    coarseValidation = getIntParam("--checkCoarseSearch");
+    cacheImages = checkParam("--cacheImages");
+    if (cacheImages)
+        cacheMB = getDoubleParam("--cacheImages");
 
     if (!doReconstruct)
     {
@@ -120,6 +141,11 @@ void ProgReconstructSignificant::show()
         std::cout << "Reconstruct                 : "  << doReconstruct << std::endl;
         std::cout << "useForValidation            : "  << useForValidation << std::endl;
         std::cout << "dontCheckMirrors            : "  << dontCheckMirrors << std::endl;
+        std::cout << "Threads                     : "  << Nthreads << std::endl;
+        if (coarseCandidates>0)
+            std::cout << "Coarse search candidates    : "  << coarseCandidates << std::endl;
+        if (cacheImages)
+            std::cout << "Image cache (MB)            : "  << cacheMB << std::endl;
 
 
         if (fnSym != "")
@@ -139,19 +165,32 @@ void ProgReconstructSignificant::show()
     }
 }
 
+// Threads ================================================================
+void ProgReconstructSignificant::runInThreads(size_t N, const std::function<void(size_t,int)> &f)
+{
+	std::atomic<size_t> next(0);
+	auto worker=[&](int thread)
+	{
+		size_t i;
+		while ((i=next++)<N)
+			f(i,thread);
+	};
+	std::vector<std::thread> threads;
+	for (int thread=1; thread<Nthreads; ++thread)
+		threads.push_back(std::thread(worker,thread));
+	worker(0);
+	for (auto &t: threads)
+		t.join();
+}
+
 // Image alignment ========================================================
 //#define DEBUG
 void ProgReconstructSignificant::alignImagesToGallery()
 {
-    AlignmentAux aux;
-    CorrelationAux aux2;
-    RotationalCorrelationAux aux3;
-
-	Matrix2D<double> M;
-	std::vector< Matrix2D<double> > allM;
-
 	size_t Nvols=YSIZE(cc);
 	size_t Ndirs=XSIZE(cc);
+	size_t Ncandidates=Nvols*Ndirs;
+	bool coarse=coarseCandidates>0 && (size_t)coarseCandidates<Ncandidates;
 
 	// Clear the previous assignment
 	for (size_t nvol=0; nvol<Nvols; ++nvol)
@@ -160,14 +199,27 @@ void ProgReconstructSignificant::alignImagesToGallery()
 		mdReconstructionProjectionMatching[nvol].clear();
 	}
 
-	MultidimArray<double> imgcc(Nvols*Ndirs), imgimed(Nvols*Ndirs);
+	MultidimArray<double> imgcc(Ncandidates), imgimed(Ncandidates), imgccFull;
 	MultidimArray<double> cdfcc, cdfimed;
+	std::vector< Matrix2D<double> > allM(Ncandidates);
+	std::vector<double> coarseScore(Ncandidates);
+	std::vector<size_t> candidates(Ncandidates);
+	std::vector<bool> aligned(Ncandidates);
 	double one_alpha=1-currentAlpha-deltaAlpha2;
 
+	// Auxiliary variables of each thread
+	std::vector<AlignmentAux> aux(Nthreads);
+	std::vector<CorrelationAux> aux2(Nthreads);
+	std::vector<RotationalCorrelationAux> aux3(Nthreads);
+	std::vector< MultidimArray<double> > mCurrentImageAligned(Nthreads);
+	Polar_fftw_plans *plans=NULL;
+	Polar< std::complex<double> > polarFourierI, polarFourierIMirror;
+	MultidimArray<double> mCurrentImageMirror;
+
 	FileName fnImg;
-	size_t nImg=0;
+	size_t nImg=0, nLocal=0;
+	size_t Nvalidated=0, NbestAgree=0, NsignificantFull=0, NsignificantKept=0;
 	Image<double> I;
-	MultidimArray<double> mCurrentImageAligned, mGalleryProjection;
 	if (rank==0)
 	{
 		std::cout << "Current significance: " << one_alpha << std::endl;
@@ -186,83 +238,169 @@ void ProgReconstructSignificant::alignImagesToGallery()
 #ifdef DEBUG
 			std::cout << "Processing: " << fnImg << std::endl;
 #endif
-			I.read(fnImg);
-			MultidimArray<double> &mCurrentImage=I();
-			mCurrentImage.setXmippOrigin();
-			allM.clear();
+			if (!particles.get(__iter.objId,I()))
+			{
+				I.read(fnImg);
+				I().setXmippOrigin();
+				particles.put(__iter.objId,I());
+			}
+			const MultidimArray<double> &mCurrentImage=I();
 
-			double bestCorr=-2, bestRot, bestTilt, bestImed=1e38, worstImed=-1e38;
-			Matrix2D<double> bestM;
-			int bestVolume=-1;
+			// Full alignment with one of the gallery images
+			auto alignToGallery=[&](size_t idx, int thread)
+			{
+				size_t nVolume=idx/Ndirs;
+				size_t nDir=idx%Ndirs;
+				MultidimArray<double> &mAligned=mCurrentImageAligned[thread];
+				MultidimArray<double> mGalleryProjection;
+				Matrix2D<double> &M=allM[idx];
+				mAligned=mCurrentImage;
+				mGalleryProjection.aliasImageInStack(gallery[nVolume](),nDir);
+				mGalleryProjection.setXmippOrigin();
+				double corr;
+				if (! dontCheckMirrors)
+					corr=alignImagesConsideringMirrors(mGalleryProjection,galleryTransforms[nVolume][nDir],
+							mAligned,M,aux[thread],aux2[thread],aux3[thread],DONT_WRAP);
+				else
+					corr = alignImages(mGalleryProjection, mAligned, M, DONT_WRAP);
+				M=M.inv();
+				double scale, shiftX, shiftY, anglePsi;
+				bool flip;
+				transformationMatrix2Parameters2D(M,flip,scale,shiftX,shiftY,anglePsi);
+
+				double imed=imedDistance(mGalleryProjection, mAligned);
+				if (maxShift>0 && (fabs(shiftX)>maxShift || fabs(shiftY)>maxShift))
+				{
+					corr/=3;
+					imed*=3;
+				}
+				DIRECT_A1D_ELEM(imgcc,idx)=corr;
+				DIRECT_A1D_ELEM(imgimed,idx)=imed;
+			};
 
-			// Compute all correlations
-	    	for (size_t nVolume=0; nVolume<Nvols; ++nVolume)
-	    	{
-	    		AlignmentTransforms *transforms=galleryTransforms[nVolume];
-		    	for (size_t nDir=0; nDir<Ndirs; ++nDir)
+			// Choose the gallery images to align
+			if (coarse)
+			{
+				// Rotational correlation of the polar Fourier transforms, it
+				// does not search for shifts so it is much cheaper
+				normalizedPolarFourierTransform(mCurrentImage, polarFourierI, true,
+				                                XSIZE(mCurrentImage) / 5, XSIZE(mCurrentImage) / 2, plans, 1);
+				if (!dontCheckMirrors)
+				{
+					mCurrentImageMirror=mCurrentImage;
+					mCurrentImageMirror.selfReverseX();
+					mCurrentImageMirror.setXmippOrigin();
+					normalizedPolarFourierTransform(mCurrentImageMirror, polarFourierIMirror, true,
+					                                XSIZE(mCurrentImage) / 5, XSIZE(mCurrentImage) / 2, plans, 1);
+				}
+				// best_rotation leaves the correlation in the real array of
+				// local_transformer, size it as alignImages does
+				for (int thread=0; thread<Nthreads; ++thread)
 				{
-					mCurrentImageAligned=mCurrentImage;
-					mGalleryProjection.aliasImageInStack(gallery[nVolume](),nDir);
-					mGalleryProjection.setXmippOrigin();
-					double corr;
-					if (! dontCheckMirrors)
-						corr=alignImagesConsideringMirrors(mGalleryProjection,transforms[nDir],
-								mCurrentImageAligned,M,aux,aux2,aux3,DONT_WRAP);
-					else
-						corr = alignImages(mGalleryProjection, mCurrentImageAligned,
-						                   M, DONT_WRAP);
-
-//					double corr=alignImagesConsideringMirrors(mGalleryProjection,
-//							mCurrentImageAligned,M,aux,aux2,aux3,DONT_WRAP);
-					M=M.inv();
-					double scale, shiftX, shiftY, anglePsi;
-					bool flip;
-					transformationMatrix2Parameters2D(M,flip,scale,shiftX,shiftY,anglePsi);
-
-					double imed=imedDistance(mGalleryProjection, mCurrentImageAligned);
-					if (maxShift>0 && (fabs(shiftX)>maxShift || fabs(shiftY)>maxShift))
+					aux[thread].rotationalCorr.resize(2*polarFourierI.getSampleNoOuterRing()-1);
+					aux3[thread].local_transformer.setReal(aux[thread].rotationalCorr);
+				}
+				runInThreads(Ncandidates, [&](size_t idx, int thread)
+				{
+					const Polar< std::complex<double> > &polarGallery=galleryTransforms[idx/Ndirs][idx%Ndirs].polarFourierI;
+					best_rotation(polarGallery, polarFourierI, aux3[thread]);
+					double score=aux3[thread].local_transformer.getReal().computeMax();
+					if (!dontCheckMirrors)
 					{
-						corr/=3;
-						imed*=3;
+						best_rotation(polarGallery, polarFourierIMirror, aux3[thread]);
+						score=std::max(score,aux3[thread].local_transformer.getReal().computeMax());
 					}
+					coarseScore[idx]=score;
+				});
+				candidates.resize(Ncandidates);
+				for (size_t idx=0; idx<Ncandidates; ++idx)
+					candidates[idx]=idx;
+				std::partial_sort(candidates.begin(), candidates.begin()+coarseCandidates, candidates.end(),
+				                  [&](size_t i1, size_t i2) { return coarseScore[i1]>coarseScore[i2]; });
+				candidates.resize(coarseCandidates);
+				std::sort(candidates.begin(), candidates.end());
+			}
+			else
+			{
+				candidates.resize(Ncandidates);
+				for (size_t idx=0; idx<Ncandidates; ++idx)
+					candidates[idx]=idx;
+			}
 
-//					//if (corr>0.99)
-//					//{
-//					//std::cout << prm.mdGallery[nVolume][nDir].fnImg << " corr= " << corr << " imed= " << imed << std::endl;
-//					//std::cout << "Matrix=" << M << std::endl;
-//					//Image<double> save;
-//					//save()=mGalleryProjection;
-//					//save.write("PPPgallery.xmp");
-//					//save()=mCurrentImage;
-//					//save.write("PPPcurrentImage.xmp");
-//					//save()=mCurrentImageAligned;
-//					//save.write("PPPcurrentImageAligned.xmp");
-//					//char c; std::cin >> c;
-//					//}
-
-					DIRECT_A3D_ELEM(cc,nImg,nVolume,nDir)=corr;
-					// For the paper plot: std::cout << corr << " " << imed << std::endl;
-					size_t idx=nVolume*Ndirs+nDir;
-					DIRECT_A1D_ELEM(imgcc,idx)=corr;
-					DIRECT_A1D_ELEM(imgimed,idx)=imed;
-					allM.push_back(M);
+			// Compute all correlations
+			runInThreads(candidates.size(), [&](size_t i, int thread) { alignToGallery(candidates[i],thread); });
 
-					if (corr>bestCorr)
-					{
-						bestM=M;
-						bestCorr=corr;
-						bestVolume=(int)nVolume;
-						bestRot=mdGallery[nVolume][nDir].rot;
-						bestTilt=mdGallery[nVolume][nDir].tilt;
-						// std::cout << "nDir=" << nDir << " bestCorr=" << bestCorr << " imed=" << imed << " (bestImed=" << bestImed << ") M=" << M << std::endl;
-                    }
-
-					if (imed<bestImed)
-						bestImed=imed;
-					else if (imed>worstImed)
-						worstImed=imed;
+			double bestCorr=-2, bestRot, bestTilt, bestImed=1e38, worstImed=-1e38;
+			Matrix2D<double> bestM;
+			int bestVolume=-1;
+			size_t bestIdx=0;
+			aligned.assign(Ncandidates,false);
+			for (size_t idx: candidates)
+			{
+				size_t nVolume=idx/Ndirs;
+				size_t nDir=idx%Ndirs;
+				double corr=DIRECT_A1D_ELEM(imgcc,idx);
+				double imed=DIRECT_A1D_ELEM(imgimed,idx);
+				aligned[idx]=true;
+				DIRECT_A3D_ELEM(cc,nImg,nVolume,nDir)=corr;
+				// For the paper plot: std::cout << corr << " " << imed << std::endl;
+
+				if (corr>bestCorr)
+				{
+					bestM=allM[idx];
+					bestCorr=corr;
+					bestIdx=idx;
+					bestVolume=(int)nVolume;
+					bestRot=mdGallery[nVolume][nDir].rot;
+					bestTilt=mdGallery[nVolume][nDir].tilt;
+					// std::cout << "nDir=" << nDir << " bestCorr=" << bestCorr << " imed=" << imed << " (bestImed=" << bestImed << ") M=" << M << std::endl;
+				}
+
+				if (imed<bestImed)
+					bestImed=imed;
+				else if (imed>worstImed)
+					worstImed=imed;
+			}
+
+			if (coarse)
+			{
+				// Check the coarse search against the full search
+				if (coarseValidation>0 && nLocal%coarseValidation==0)
+				{
+					std::vector<size_t> rest;
+					for (size_t idx=0; idx<Ncandidates; ++idx)
+						if (!aligned[idx])
+							rest.push_back(idx);
+					runInThreads(rest.size(), [&](size_t i, int thread) { alignToGallery(rest[i],thread); });
+					imgccFull=imgcc;
+					MultidimArray<double> cdfccFull;
+					imgccFull.cumlativeDensityFunction(cdfccFull);
+					Nvalidated++;
+					size_t bestIdxFull=bestIdx;
+					for (size_t idx=0; idx<Ncandidates; ++idx)
+						if (DIRECT_A1D_ELEM(imgccFull,idx)>DIRECT_A1D_ELEM(imgccFull,bestIdxFull))
+							bestIdxFull=idx;
+					if (bestIdxFull==bestIdx)
+						NbestAgree++;
+					for (size_t idx=0; idx<Ncandidates; ++idx)
+						if (DIRECT_A1D_ELEM(cdfccFull,idx)>=one_alpha)
+						{
+							NsignificantFull++;
+							if (aligned[idx])
+								NsignificantKept++;
+						}
 				}
-	    	}
+
+				// The gallery images not aligned are ranked below all the others
+				double maxImed=std::max(bestImed,worstImed);
+				for (size_t idx=0; idx<Ncandidates; ++idx)
+					if (!aligned[idx])
+					{
+						DIRECT_A1D_ELEM(imgcc,idx)=-2;
+						DIRECT_A1D_ELEM(imgimed,idx)=maxImed;
+					}
+			}
+			nLocal++;
 
 	    	// Keep the best assignment for the projection matching
 	    	// Each process keeps a list of the images for each volume
@@ -307,6 +445,8 @@ void ProgReconstructSignificant::alignImagesToGallery()
 				for (size_t nDir=0; nDir<Ndirs; ++nDir)
 				{
 					size_t idx=nVolume*Ndirs+nDir;
+					if (!aligned[idx])
+						continue;
 					double cdfccthis=DIRECT_A1D_ELEM(cdfcc,idx);
 					double cdfimedthis=DIRECT_A1D_ELEM(cdfimed,idx);
 					double cc=DIRECT_A1D_ELEM(imgcc,idx);
@@ -378,8 +518,26 @@ void ProgReconstructSignificant::alignImagesToGallery()
 			progress_bar(nImg+1);
 		nImg++;
 	}
+	if (coarseValidation>0)
+	{
+		// Every process checked its own images
+		size_t counters[4]={Nvalidated, NbestAgree, NsignificantFull, NsignificantKept};
+		gatherCoarseSearchCheck(counters, 4);
+		Nvalidated=counters[0];
+		NbestAgree=counters[1];
+		NsignificantFull=counters[2];
+		NsignificantKept=counters[3];
+	}
 	if (rank==0)
+	{
 		progress_bar(mdIn.size());
+		if (Nvalidated>0)
+			std::cout << "Coarse search: the best gallery image is the one of the full search in "
+			          << 100.0*NbestAgree/Nvalidated << "% of " << Nvalidated << " checked images, and "
+			          << (NsignificantFull>0 ? 100.0*NsignificantKept/NsignificantFull : 100.0)
+			          << "% of the significant gallery images are kept" << std::endl;
+	}
+	delete plans;
 }
 #undef DEBUG
 
@@ -534,21 +692,11 @@ void ProgReconstructSignificant::run()
 					mdPM.write(fnImages);
 
 					// Remove from mdPM those images that do not participate in angles
-					String fnAux=formatString("%s/aux_iter%03d_%02d.xmd",fnDir.c_str(),iter,nVolume);
-					// Take only the image name from angles.xmd
-					String cmd=(String)"xmipp_metadata_utilities -i "+fnAngles+" --operate keep_column image -o "+fnAux;
-					if (system(cmd.c_str())!=0)
-						REPORT_ERROR(ERR_MD,(String)"Cannot execute "+cmd);
-					// Remove duplicated images
-					cmd=(String)"xmipp_metadata_utilities -i "+fnAux+" --operate remove_duplicates image";
-					if (system(cmd.c_str())!=0)
-						REPORT_ERROR(ERR_MD,(String)"Cannot execute "+cmd);
-					// Intersect with images.xmd
+					MetaData mdAngleImages, mdImagesSignificant(mdPM);
+					mdAngleImages.removeDuplicates(mdAux,MDL_IMAGE);
+					mdImagesSignificant.intersection(mdAngleImages,MDL_IMAGE);
 					String fnImagesSignificant=formatString("%s/images_significant_iter%03d_%02d.xmd",fnDir.c_str(),iter,nVolume);
-					cmd=(String)"xmipp_metadata_utilities -i "+fnImages+" --set intersection "+fnAux+" image image -o "+fnImagesSignificant;
-					if (system(cmd.c_str())!=0)
-						REPORT_ERROR(ERR_MD,(String)"Cannot execute "+cmd);
-					deleteFile(fnAux);
+					mdImagesSignificant.write(fnImagesSignificant);
 				}
 				else
 					std::cout << formatString("%s/images_iter%03d_%02d.xmd empty. Not written.",fnDir.c_str(),iter,nVolume) << std::endl;
@@ -587,72 +735,130 @@ void ProgReconstructSignificant::run()
     }
 }
 
+void ProgReconstructSignificant::reconstructVolume(const FileName &fnAngles, const FileName &fnVolume,
+		bool useWeights, MultidimArray<double> &V)
+{
+	ProgRecFourier program;
+	program.read(formatString("-i %s -o %s --sym %s --thr %d -v 0%s",fnAngles.c_str(),fnVolume.c_str(),
+	                          fnSym.c_str(),Nthreads,useWeights ? " --weight":""));
+	program.run();
+	V=program.Vout();
+	V.setXmippOrigin();
+}
+
 void ProgReconstructSignificant::reconstructCurrent()
 {
 	if (rank==0)
 		std::cerr << "Reconstructing volumes ..." << std::endl;
 	MetaData MD;
+	SymList SL;
+	if (fnSym!="c1")
+		SL.readSymmetryFile(fnSym);
+	MultidimArray<int> mask;
+	MultidimArray<double> Vsym;
 	for (size_t nVolume=0; nVolume<(size_t)Nvolumes; ++nVolume)
 	{
 		if ((nVolume+1)%Nprocessors!=rank)
 			continue;
 
+		volumes[nVolume].clear();
 		FileName fnAngles=formatString("%s/angles_iter%03d_%02d.xmd",fnDir.c_str(),iter,nVolume);
 		if (!fnAngles.exists())
 			continue;
 		MD.read(fnAngles);
 		std::cout << "Volume " << nVolume << ": number of images=" << MD.size() << std::endl;
 		FileName fnVolume=formatString("%s/volume_iter%03d_%02d.vol",fnDir.c_str(),iter,nVolume);
-		String args=formatString("-i %s -o %s --sym %s --weight -v 0",fnAngles.c_str(),fnVolume.c_str(),fnSym.c_str());
-		String cmd=(String)"xmipp_reconstruct_fourier "+args;
-		std::cout << cmd << std::endl;
-		if (system(cmd.c_str())==-1)
-			REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
+		Image<double> &V=volumes[nVolume];
+		reconstructVolume(fnAngles,fnVolume,true,V());
 
 		if (fnSym!="c1")
 		{
-			args=formatString("-i %s --sym %s -v 0",fnVolume.c_str(),fnSym.c_str());
-			cmd=(String)"xmipp_transform_symmetrize "+args;
-			std::cout << cmd << std::endl;
-			if (system(cmd.c_str())==-1)
-				REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
+			symmetrizeVolume(SL,V(),Vsym);
+			V()=Vsym;
 		}
 
-		args=formatString("-i %s --mask circular %d -v 0",fnVolume.c_str(),-Xdim/2);
-		cmd=(String)"xmipp_transform_mask "+args;
-		std::cout << cmd << std::endl;
-		if (system(cmd.c_str())==-1)
-			REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
+		mask.resizeNoCopy(V());
+		mask.setXmippOrigin();
+		BinaryCircularMask(mask,Xdim/2,INNER_MASK);
+		apply_binary_mask(mask,V(),V());
+		// The volume is kept in memory for the projections of the next iteration
+		V.write(fnVolume);
+	}
+}
+
+void ProgReconstructSignificant::computeGalleryDirections()
+{
+	Sampling sampling;
+	int symmetry, sym_order;
+	sampling.setSampling(angularSampling);
+	if (!sampling.SL.isSymmetryGroup(fnSym, symmetry, sym_order))
+		REPORT_ERROR(ERR_VALUE_INCORRECT, (String)"Invalid symmetry " + fnSym);
+	sampling.computeSamplingPoints(false,tiltF,tilt0);
+	sampling.SL.readSymmetryFile(fnSym);
+	sampling.fillLRRepository();
+	sampling.removeRedundantPoints(symmetry, sym_order);
+
+	galleryDirections.clear();
+	GalleryImage I;
+	for (const Matrix1D<double> &angles: sampling.no_redundant_sampling_points_angles)
+	{
+		I.rot=XX(angles);
+		I.tilt=YY(angles);
+		galleryDirections.push_back(I);
 	}
 }
 
+void ProgReconstructSignificant::projectGallery(const MultidimArray<double> &V, MultidimArray<double> &G)
+{
+	// Same projector as the default of angular_project_library
+	MultidimArray<double> Vaux=V;
+	FourierProjector projector(Vaux, 1, 0.25, BSPLINE3);
+	std::vector< std::unique_ptr<FourierProjector> > projectors;
+	for (int thread=0; thread<Nthreads; ++thread)
+		projectors.emplace_back(new FourierProjector(projector.getSharedVolume()));
+	std::vector<Projection> P(Nthreads);
+
+	size_t Ndirs=galleryDirections.size();
+	G.resizeNoCopy(Ndirs,1,Xdim,Xdim);
+	runInThreads(Ndirs, [&](size_t k, int thread)
+	{
+		const GalleryImage &direction=galleryDirections[k];
+		projectVolume(*projectors[thread],P[thread],(int)Xdim,(int)Xdim,direction.rot,direction.tilt,0.0);
+		memcpy(&DIRECT_NZYX_ELEM(G,k,0,0,0),MULTIDIM_ARRAY(P[thread]()),Xdim*Xdim*sizeof(double));
+	});
+}
+
 void ProgReconstructSignificant::generateProjections()
 {
 	FileName fnGallery, fnGalleryMetaData;
-	if (iter>1 || fnFirstGallery=="")
+	bool fromVolumes=iter>1 || fnFirstGallery=="";
+	if (fromVolumes)
 	{
-		FileName fnVol, fnAngles;
-		// Generate projections
+		// Project the volumes of the previous iteration
+		FileName fnVol;
 		for (int n=0; n<Nvolumes; n++)
 		{
 			if ((n+1)%Nprocessors!=rank)
 				continue;
-			fnVol=formatString("%s/volume_iter%03d_%02d.vol",fnDir.c_str(),iter-1,n);
-			fnGallery=formatString("%s/gallery_iter%03d_%02d.stk",fnDir.c_str(),iter,n);
-			fnAngles=formatString("%s/angles_iter%03d_%02d.xmd",fnDir.c_str(),iter-1,n);
-			fnGalleryMetaData=formatString("%s/gallery_iter%03d_%02d.doc",fnDir.c_str(),iter,n);
-			String args=formatString("-i %s -o %s --sampling_rate %f --sym %s --compute_neighbors --angular_distance -1 --experimental_images %s --min_tilt_angle %f --max_tilt_angle %f -v 0",
-					fnVol.c_str(),fnGallery.c_str(),angularSampling,fnSym.c_str(),fnAngles.c_str(),tilt0,tiltF);
-
-			String cmd=(String)"xmipp_angular_project_library "+args;
-			if (system(cmd.c_str())==-1)
-				REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
+			if (XSIZE(volumes[n]())==0)
+			{
+				fnVol=formatString("%s/volume_iter%03d_%02d.vol",fnDir.c_str(),iter-1,n);
+				volumes[n].read(fnVol);
+				volumes[n]().setXmippOrigin();
+			}
+			projectGallery(volumes[n](),gallery[n]());
+
+			// The rest of processes read it from disk
+			if (Nprocessors>1)
+			{
+				fnGallery=formatString("%s/gallery_iter%03d_%02d.stk",fnDir.c_str(),iter,n);
+				gallery[n].write(fnGallery);
+			}
 		}
 		synchronize();
 	}
 
 	// Read projection galleries
-	std::vector<GalleryImage> galleryNames;
 	mdGallery.clear();
 
 	CorrelationAux aux;
@@ -660,28 +866,32 @@ void ProgReconstructSignificant::generateProjections()
 	MultidimArray<double> mGalleryProjection;
 	for (int n=0; n<Nvolumes; n++)
 	{
-		mdGallery.push_back(galleryNames);
-		if (iter>1 || fnFirstGallery=="")
+		if (fromVolumes)
 		{
-			fnGalleryMetaData=formatString("%s/gallery_iter%03d_%02d.doc",fnDir.c_str(),iter,n);
 			fnGallery=formatString("%s/gallery_iter%03d_%02d.stk",fnDir.c_str(),iter,n);
+			mdGallery.push_back(galleryDirections);
+			for (size_t k=0; k<galleryDirections.size(); ++k)
+				mdGallery[n][k].fnImg.compose(k+1,fnGallery);
+			if ((n+1)%Nprocessors!=rank)
+				gallery[n].read(fnGallery);
 		}
 		else
 		{
 			fnGalleryMetaData=fnFirstGallery;
 			fnGallery=fnFirstGallery.replaceExtension("stk");
+			MetaData mdAux(fnGalleryMetaData);
+			std::vector<GalleryImage> galleryNames;
+			FOR_ALL_OBJECTS_IN_METADATA(mdAux)
+			{
+				GalleryImage I;
+				mdAux.getValue(MDL_IMAGE,I.fnImg,__iter.objId);
+				mdAux.getValue(MDL_ANGLE_ROT,I.rot,__iter.objId);
+				mdAux.getValue(MDL_ANGLE_TILT,I.tilt,__iter.objId);
+				galleryNames.push_back(I);
+			}
+			mdGallery.push_back(galleryNames);
+			gallery[n].read(fnGallery);
 		}
-		MetaData mdAux(fnGalleryMetaData);
-		galleryNames.clear();
-		FOR_ALL_OBJECTS_IN_METADATA(mdAux)
-		{
-			GalleryImage I;
-			mdAux.getValue(MDL_IMAGE,I.fnImg,__iter.objId);
-			mdAux.getValue(MDL_ANGLE_ROT,I.rot,__iter.objId);
-			mdAux.getValue(MDL_ANGLE_TILT,I.tilt,__iter.objId);
-			mdGallery[n].push_back(I);
-		}
-		gallery[n].read(fnGallery);
 
 		// Calculate transforms of this gallery
 		size_t kmax=NSIZE(gallery[n]());
@@ -755,6 +965,10 @@ void ProgReconstructSignificant::produceSideinfo()
 	size_t Ydim,Zdim,Ndim;
 	getImageSize(mdIn,Xdim,Ydim,Zdim,Ndim);
 
+	// Room for the share of images of this process
+	if (cacheImages)
+		particles.initialize((mdIn.size()+Nprocessors-1)/Nprocessors,Ydim,Xdim,cacheMB);
+
 	// Adjust alpha
 	if ( (fnSym!="c1") && !useForValidation )
 	{
@@ -791,26 +1005,22 @@ void ProgReconstructSignificant::produceSideinfo()
 					FileName fnAngles=fnDir+formatString("/angles_random_%02d.xmd",n);
 					FileName fnVolume=fnDir+formatString("/volume_random_%02d.vol",n);
 					mdRandom.write(fnAngles);
-					String args=formatString("-i %s -o %s --sym %s -v 0",fnAngles.c_str(),fnVolume.c_str(),fnSym.c_str());
-					String cmd=(String)"xmipp_reconstruct_fourier "+args;
-					if (system(cmd.c_str())==-1)
-						REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
+					Image<double> V;
+					reconstructVolume(fnAngles,fnVolume,false,V());
 					if (!keepIntermediateVolumes)
 						deleteFile(fnAngles);
 
 					// Symmetrize with many different possibilities to have a spherical volume
-					args=formatString("-i %s --sym i1 --spline 1 -v 0",fnVolume.c_str());
-					cmd=(String)"xmipp_transform_symmetrize "+args;
-					if (system(cmd.c_str())==-1)
-						REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
-
-					args=formatString("-i %s --sym i3 --spline 1 -v 0",fnVolume.c_str());
-					if (system(cmd.c_str())==-1)
-						REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
-
-					args=formatString("-i %s --sym i2 --spline 1 -v 0",fnVolume.c_str());
-					if (system(cmd.c_str())==-1)
-						REPORT_ERROR(ERR_UNCLASSIFIED,"Cannot open shell");
+					MultidimArray<double> Vsym;
+					const char *spherical[]={"i1","i3","i2"};
+					for (const char *sym: spherical)
+					{
+						SymList SLsphere;
+						SLsphere.readSymmetryFile(sym);
+						symmetrizeVolume(SLsphere,V(),Vsym,LINEAR);
+						V()=Vsym;
+					}
+					V.write(fnVolume);
 					deleteFile(fnAngles);
 					mdAux.setValue(MDL_IMAGE,fnVolume,mdAux.addObject());
 				}
@@ -849,6 +1059,9 @@ void ProgReconstructSignificant::produceSideinfo()
 		Nvolumes=1;
 	synchronize();
 
+	// The gallery directions are the same at every iteration
+	computeGalleryDirections();
+
 	// Copy all input values as iteration 0 volumes
 	FileName fnAngles;
 	Image<double> galleryDummy;
@@ -861,6 +1074,7 @@ void ProgReconstructSignificant::produceSideinfo()
 			mdIn.write(fnAngles);
 		}
 		gallery.push_back(galleryDummy);
+		volumes.push_back(galleryDummy);
 		galleryTransforms.push_back(NULL);
 		mdReconstructionPartial.push_back(mdPartial);
 		mdReconstructionProjectionMatching.push_back(mdProjMatch);
@@ -26,8 +26,10 @@
 #ifndef __RECONSTRUCT_SIGNIFICANT_H
 #define __RECONSTRUCT_SIGNIFICANT_H
 
+#include <functional>
 #include <core/xmipp_program.h>
 #include <data/filters.h>
+#include <data/particle_cache.h>
 #include "angular_project_library.h"
 #include "volume_initial_simulated_annealing.h"
 
@@ -94,6 +96,21 @@ public:
 
     bool dontCheckMirrors;
 
+    /** Number of threads */
+    int Nthreads;
+
+    /** Number of gallery images fully aligned after the coarse search, 0 for all */
+    int coarseCandidates;
+
+    /** Compare the coarse search with the full search every this number of images, 0 for never */
+    int coarseValidation;
+
+    /** Keep the images in memory between iterations */
+    bool cacheImages;
+
+    /** Memory for the image cache (in MB), beyond it the cache is memory mapped */
+    double cacheMB;
+
 
 public: // Internal members
     size_t rank, Nprocessors;
@@ -104,6 +121,9 @@ public: // Internal members
     // Size of the images
     size_t Xdim;
 
+    // Images of this process
+    ParticleCache particles;
+
     // Partial reconstruction metadatas
     std::vector<MetaData> mdReconstructionPartial;
 
@@ -125,6 +145,12 @@ public: // Internal members
     // Images
     // COSS Image<double> inputImages;
     std::vector< Image<double> > gallery;
+
+    // Projection directions of the gallery, they are the same at every iteration
+    std::vector<GalleryImage> galleryDirections;
+
+    // Volumes reconstructed by this process, they are projected in the next iteration
+    std::vector< Image<double> > volumes;
     std::vector< AlignmentTransforms* > galleryTransforms;
 
 	// Current iteration
@@ -154,6 +180,16 @@ public:
     /// Reconstruct current volume
     void reconstructCurrent();
 
+    /** Reconstruct a volume from the angles in a metadata.
+        The volume is also written in fnVolume. */
+    void reconstructVolume(const FileName &fnAngles, const FileName &fnVolume, bool useWeights, MultidimArray<double> &V);
+
+    /// Compute the projection directions of the gallery from the angular sampling and symmetry
+    void computeGalleryDirections();
+
+    /// Project a volume in all gallery directions, the projections are stored in the stack G
+    void projectGallery(const MultidimArray<double> &V, MultidimArray<double> &G);
+
     /// Generate projections from the current volume
     void generateProjections();
 
@@ -163,9 +199,15 @@ public:
     /// Align images to gallery projections
     void alignImagesToGallery();
 
+    /// Run f(i,thread) for i=0...N-1 in Nthreads threads
+    void runInThreads(size_t N, const std::function<void(size_t,int)> &f);
+
     /// Gather alignment
     virtual void gatherAlignment() {}
 
+    /// Sum the n counters of the coarse search check over all processors
+    virtual void gatherCoarseSearchCheck(size_t *counters, int n) {}
+
     /// Synchronize with other processors
     virtual void synchronize() {}
 };
@@ -76,10 +76,9 @@ void ProgPdbConverter::produceSideInfo()
     if (useFixedGaussian && sigmaGaussian<0)
     {
         // Check if it is a pseudodensity volume
-        std::ifstream fh_pdb;
-        fh_pdb.open(fn_pdb.c_str());
-        if (!fh_pdb)
-            REPORT_ERROR(ERR_IO_NOTEXIST, fn_pdb);
+        std::ifstream fh_file;
+        std::istringstream fh_text;
+        std::istream &fh_pdb=openPDB(fh_file, fh_text);
         while (!fh_pdb.eof())
         {
             // Read an ATOM line
@@ -99,7 +98,6 @@ void ProgPdbConverter::produceSideInfo()
             if (useFixedGaussian && results[1]=="intensityColumn")
                 intensityColumn=results[2];
         }
-        fh_pdb.close();
     }
 
     if (!useBlobs && !usePoorGaussian && !useFixedGaussian)
@@ -211,7 +209,10 @@ void ProgPdbConverter::show()
 void ProgPdbConverter::computeProteinGeometry()
 {
     Matrix1D<double> limit0(3), limitF(3);
-    computePDBgeometry(fn_pdb, centerOfMass, limit0, limitF, intensityColumn);
+    std::ifstream fh_file;
+    std::istringstream fh_text;
+    computePDBgeometry(openPDB(fh_file, fh_text), centerOfMass, limit0, limitF,
+                       intensityColumn);
     if (doCenter)
     {
         limit0-=centerOfMass;
@@ -250,10 +251,9 @@ void ProgPdbConverter::createProteinAtHighSamplingRate()
     	<< std::endl;
 
     // Fill the volume with the different atoms
-    std::ifstream fh_pdb;
-    fh_pdb.open(fn_pdb.c_str());
-    if (!fh_pdb)
-        REPORT_ERROR(ERR_IO_NOTEXIST, fn_pdb);
+    std::ifstream fh_file;
+    std::istringstream fh_text;
+    std::istream &fh_pdb=openPDB(fh_file, fh_text);
 
     // Process all lines of the file
     int col=1;
@@ -334,9 +334,6 @@ void ProgPdbConverter::createProteinAtHighSamplingRate()
                                           GaussianNormalization;
                 }
     }
-
-    // Close file
-    fh_pdb.close();
 }
 
 /* Create protein at a low sampling rate ----------------------------------- */
@@ -390,10 +387,9 @@ void ProgPdbConverter::createProteinUsingScatteringProfiles()
     Vlow().setXmippOrigin();
 
     // Fill the volume with the different atoms
-    std::ifstream fh_pdb;
-    fh_pdb.open(fn_pdb.c_str());
-    if (!fh_pdb)
-        REPORT_ERROR(ERR_IO_NOTEXIST, fn_pdb);
+    std::ifstream fh_file;
+    std::istringstream fh_text;
+    std::istream &fh_pdb=openPDB(fh_file, fh_text);
 
     // Process all lines of the file
     std::string line, kind, atom_type;
@@ -468,16 +464,26 @@ void ProgPdbConverter::createProteinUsingScatteringProfiles()
         		std::cerr << "Ignoring atom of type *" << atom_type << "*" << std::endl;
         }
     }
+}
 
-    // Close file
-    fh_pdb.close();
+/* Open the PDB ------------------------------------------------------------ */
+std::istream &ProgPdbConverter::openPDB(std::ifstream &fh_file,
+                                        std::istringstream &fh_text) const
+{
+    if (!pdbText.empty())
+    {
+        fh_text.str(pdbText);
+        return fh_text;
+    }
+    fh_file.open(fn_pdb.c_str());
+    if (!fh_file)
+        REPORT_ERROR(ERR_IO_NOTEXIST, fn_pdb);
+    return fh_file;
 }
 
-/* Run --------------------------------------------------------------------- */
-void ProgPdbConverter::run()
+/* Convert ----------------------------------------------------------------- */
+void ProgPdbConverter::convertPDB()
 {
-    produceSideInfo();
-    show();
     computeProteinGeometry();
     if (useBlobs)
     {
@@ -496,6 +502,14 @@ void ProgPdbConverter::run()
     {
         createProteinUsingScatteringProfiles();
     }
+}
+
+/* Run --------------------------------------------------------------------- */
+void ProgPdbConverter::run()
+{
+    produceSideInfo();
+    show();
+    convertPDB();
     if (fn_out!="")
         Vlow.write(fn_out + ".vol");
 }
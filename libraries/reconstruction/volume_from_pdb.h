@@ -25,6 +25,8 @@
 #ifndef _PROG_VOLUME_FROM_PDB_HH
 #  define _PROG_VOLUME_FROM_PDB_HH
 
+#include <fstream>
+#include <sstream>
 #include <data/blobs.h>
 #include <data/pdb.h>
 #include <core/xmipp_program.h>
@@ -43,6 +45,10 @@ public:
     /** PDB file */
     FileName fn_pdb;
 
+    /** PDB lines kept in memory.
+        If not empty, they are used instead of the file fn_pdb. */
+    String pdbText;
+
     /** Output fileroot */
     FileName fn_out;
 
@@ -88,6 +94,12 @@ public:
     /** Show parameters. */
     void show();
 
+    /** Convert the PDB into the volume Vlow.
+        produceSideInfo must have been called before. It can be called
+        several times (e.g., after changing pdbText) reusing the atomic
+        profiles. */
+    void convertPDB();
+
     /** Run. */
     void run();
 public:
@@ -120,6 +132,9 @@ public:
     void atomBlobDescription(const std::string &_element,
         double &weight, double &radius) const;
 
+    /* Open the PDB, either from pdbText or from fn_pdb */
+    std::istream &openPDB(std::ifstream &fh_file, std::istringstream &fh_text) const;
+
     /* Protein geometry */
     void computeProteinGeometry();
 
@@ -221,28 +221,6 @@ private:
     FFTSettings<T> runBenchmark(const Dimensions &d, size_t extraMem,
             bool crop);
 
-    /**
-     * Returns position of all 'local alignment patches' within a single frame
-     * @param borders that should be left intact
-     * @param movie size
-     * @param patch size
-     */
-    std::vector<FramePatchMeta<T>> getPatchesLocation(const std::pair<T, T> &borders,
-            const Dimensions &movie,
-            const Dimensions &patch);
-
-    /**
-     * Imagine you align frames of the movie using global alignment
-     * Some frames edges will overlap, i.e. there will be an are shared
-     * by all frames, and edge area where at least one frame does not contribute.
-     * This method computes the size of that area.
-     * @param globAlignment to use
-     * @param verbose level
-     * @return no of pixels in X (Y) dimension where there might NOT be data from each frame
-     */
-    std::pair<T,T> getMovieBorders(const AlignmentResult<T> &globAlignment,
-            int verbose);
-
     /**
      * Method returns a 'window'/'view' of each and all frames, aligned (to int positions)
      * using global alignment